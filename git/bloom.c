@@ -12,6 +12,11 @@
 #include "tree-walk.h"
 #include "config.h"
 #include "repository.h"
+#include "gettext.h"
+#include "hex.h"
+#include "object-store-ll.h"
+#include "progress.h"
+#include "thread-utils.h"
 
 define_commit_slab(bloom_filter_slab, struct bloom_filter);
 
@@ -248,6 +253,41 @@ void clear_bloom_key(struct bloom_key *key)
 	FREE_AND_NULL(key->hashes);
 }
 
+struct bloom_keyvec *bloom_keyvec_new(const char *path, size_t len,
+				      const struct bloom_filter_settings *settings)
+{
+	struct bloom_keyvec *vec;
+	size_t count = 1, i;
+
+	for (i = 0; i < len; i++)
+		if (path[i] == '/')
+			count++;
+
+	vec = xcalloc(1, st_add(sizeof(*vec),
+				st_mult(sizeof(vec->key[0]), count)));
+	vec->count = count;
+
+	/*
+	 * The key for the full path goes first, as it is the one most
+	 * likely to be missing from a filter.
+	 */
+	fill_bloom_key(path, len, &vec->key[0], settings);
+	for (i = len - 1, count = 1; i > 0; i--)
+		if (path[i] == '/')
+			fill_bloom_key(path, i, &vec->key[count++], settings);
+
+	return vec;
+}
+
+void bloom_keyvec_free(struct bloom_keyvec *vec)
+{
+	if (!vec)
+		return;
+	for (size_t i = 0; i < vec->count; i++)
+		clear_bloom_key(&vec->key[i]);
+	free(vec);
+}
+
 void add_key_to_filter(const struct bloom_key *key,
 		       struct bloom_filter *filter,
 		       const struct bloom_filter_settings *settings)
@@ -386,21 +426,13 @@ struct bloom_filter *get_bloom_filter(struct repository *r, struct commit *c)
 	return filter;
 }
 
-struct bloom_filter *get_or_compute_bloom_filter(struct repository *r,
-						 struct commit *c,
-						 int compute_if_not_present,
-						 const struct bloom_filter_settings *settings,
-						 enum bloom_filter_computed *computed)
+static struct bloom_filter *get_or_upgrade_filter(struct repository *r,
+						  struct commit *c,
+						  int upgrade,
+						  const struct bloom_filter_settings *settings,
+						  enum bloom_filter_computed *computed)
 {
 	struct bloom_filter *filter;
-	int i;
-	struct diff_options diffopt;
-
-	if (computed)
-		*computed = BLOOM_NOT_COMPUTED;
-
-	if (!bloom_filters.slab_size)
-		return NULL;
 
 	filter = bloom_filter_slab_at(&bloom_filters, c);
 
@@ -412,24 +444,95 @@ struct bloom_filter *get_or_compute_bloom_filter(struct repository *r,
 	}
 
 	if (filter->data && filter->len) {
-		struct bloom_filter *upgrade;
+		struct bloom_filter *upgraded;
 		if (!settings || settings->hash_version == filter->version)
 			return filter;
 
 		/* version mismatch, see if we can upgrade */
-		if (compute_if_not_present &&
+		if (upgrade &&
 		    git_env_bool("GIT_TEST_UPGRADE_BLOOM_FILTERS", 1)) {
-			upgrade = upgrade_filter(r, c, filter,
-						 settings->hash_version);
-			if (upgrade) {
+			upgraded = upgrade_filter(r, c, filter,
+						  settings->hash_version);
+			if (upgraded) {
 				if (computed)
 					*computed |= BLOOM_UPGRADED;
-				return upgrade;
+				return upgraded;
 			}
 		}
 	}
-	if (!compute_if_not_present)
-		return NULL;
+	return NULL;
+}
+
+/*
+ * Add "path" and each of its leading directories to "pathmap", i.e. for
+ * 'dir/subdir/file' add 'dir' and 'dir/subdir' as well, so the Bloom
+ * filter could be used to speed up commands like 'git log dir/subdir',
+ * too. "path" is clobbered in the process.
+ *
+ * Note that directories are added without the trailing '/'.
+ */
+static void add_path_to_pathmap(struct hashmap *pathmap, char *path)
+{
+	do {
+		struct pathmap_hash_entry *e;
+		char *last_slash = strrchr(path, '/');
+
+		FLEX_ALLOC_STR(e, path, path);
+		hashmap_entry_init(&e->entry, strhash(path));
+
+		if (!hashmap_get(pathmap, &e->entry, NULL))
+			hashmap_add(pathmap, &e->entry);
+		else
+			free(e);
+
+		if (!last_slash)
+			last_slash = path;
+		*last_slash = '\0';
+
+	} while (*path);
+}
+
+static void fill_filter_from_pathmap(struct bloom_filter *filter,
+				     struct hashmap *pathmap,
+				     const struct bloom_filter_settings *settings,
+				     enum bloom_filter_computed *computed)
+{
+	struct pathmap_hash_entry *e;
+	struct hashmap_iter iter;
+
+	if (hashmap_get_size(pathmap) > settings->max_changed_paths) {
+		init_truncated_large_filter(filter, settings->hash_version);
+		if (computed)
+			*computed |= BLOOM_TRUNC_LARGE;
+		return;
+	}
+
+	filter->len = (hashmap_get_size(pathmap) * settings->bits_per_entry + BITS_PER_WORD - 1) / BITS_PER_WORD;
+	filter->version = settings->hash_version;
+	if (!filter->len) {
+		if (computed)
+			*computed |= BLOOM_TRUNC_EMPTY;
+		filter->len = 1;
+	}
+	CALLOC_ARRAY(filter->data, filter->len);
+	filter->to_free = filter->data;
+
+	hashmap_for_each_entry(pathmap, &iter, e, entry) {
+		struct bloom_key key;
+		fill_bloom_key(e->path, strlen(e->path), &key, settings);
+		add_key_to_filter(&key, filter, settings);
+		clear_bloom_key(&key);
+	}
+}
+
+static void compute_filter_from_diff(struct repository *r,
+				     struct commit *c,
+				     struct bloom_filter *filter,
+				     const struct bloom_filter_settings *settings,
+				     enum bloom_filter_computed *computed)
+{
+	struct diff_options diffopt;
+	int i;
 
 	repo_diff_setup(r, &diffopt);
 	diffopt.flags.recursive = 1;
@@ -448,64 +551,12 @@ struct bloom_filter *get_or_compute_bloom_filter(struct repository *r,
 
 	if (diff_queued_diff.nr <= settings->max_changed_paths) {
 		struct hashmap pathmap = HASHMAP_INIT(pathmap_cmp, NULL);
-		struct pathmap_hash_entry *e;
-		struct hashmap_iter iter;
-
-		for (i = 0; i < diff_queued_diff.nr; i++) {
-			const char *path = diff_queued_diff.queue[i]->two->path;
-
-			/*
-			 * Add each leading directory of the changed file, i.e. for
-			 * 'dir/subdir/file' add 'dir' and 'dir/subdir' as well, so
-			 * the Bloom filter could be used to speed up commands like
-			 * 'git log dir/subdir', too.
-			 *
-			 * Note that directories are added without the trailing '/'.
-			 */
-			do {
-				char *last_slash = strrchr(path, '/');
-
-				FLEX_ALLOC_STR(e, path, path);
-				hashmap_entry_init(&e->entry, strhash(path));
-
-				if (!hashmap_get(&pathmap, &e->entry, NULL))
-					hashmap_add(&pathmap, &e->entry);
-				else
-					free(e);
-
-				if (!last_slash)
-					last_slash = (char*)path;
-				*last_slash = '\0';
-
-			} while (*path);
-		}
 
-		if (hashmap_get_size(&pathmap) > settings->max_changed_paths) {
-			init_truncated_large_filter(filter,
-						    settings->hash_version);
-			if (computed)
-				*computed |= BLOOM_TRUNC_LARGE;
-			goto cleanup;
-		}
-
-		filter->len = (hashmap_get_size(&pathmap) * settings->bits_per_entry + BITS_PER_WORD - 1) / BITS_PER_WORD;
-		filter->version = settings->hash_version;
-		if (!filter->len) {
-			if (computed)
-				*computed |= BLOOM_TRUNC_EMPTY;
-			filter->len = 1;
-		}
-		CALLOC_ARRAY(filter->data, filter->len);
-		filter->to_free = filter->data;
-
-		hashmap_for_each_entry(&pathmap, &iter, e, entry) {
-			struct bloom_key key;
-			fill_bloom_key(e->path, strlen(e->path), &key, settings);
-			add_key_to_filter(&key, filter, settings);
-			clear_bloom_key(&key);
-		}
+		for (i = 0; i < diff_queued_diff.nr; i++)
+			add_path_to_pathmap(&pathmap,
+					    diff_queued_diff.queue[i]->two->path);
 
-	cleanup:
+		fill_filter_from_pathmap(filter, &pathmap, settings, computed);
 		hashmap_clear_and_free(&pathmap, struct pathmap_hash_entry, entry);
 	} else {
 		init_truncated_large_filter(filter, settings->hash_version);
@@ -518,9 +569,321 @@ struct bloom_filter *get_or_compute_bloom_filter(struct repository *r,
 		*computed |= BLOOM_COMPUTED;
 
 	diff_queue_clear(&diff_queued_diff);
+}
+
+struct bloom_filter *get_or_compute_bloom_filter(struct repository *r,
+						 struct commit *c,
+						 int compute_if_not_present,
+						 const struct bloom_filter_settings *settings,
+						 enum bloom_filter_computed *computed)
+{
+	struct bloom_filter *filter;
+
+	if (computed)
+		*computed = BLOOM_NOT_COMPUTED;
+
+	if (!bloom_filters.slab_size)
+		return NULL;
+
+	filter = get_or_upgrade_filter(r, c, compute_if_not_present,
+				       settings, computed);
+	if (filter || !compute_if_not_present)
+		return filter;
+
+	filter = bloom_filter_slab_at(&bloom_filters, c);
+	compute_filter_from_diff(r, c, filter, settings, computed);
 	return filter;
 }
 
+struct bloom_filter *get_or_upgrade_bloom_filter(struct repository *r,
+						 struct commit *c,
+						 int upgrade,
+						 const struct bloom_filter_settings *settings,
+						 enum bloom_filter_computed *computed)
+{
+	if (computed)
+		*computed = BLOOM_NOT_COMPUTED;
+
+	if (!bloom_filters.slab_size)
+		return NULL;
+
+	return get_or_upgrade_filter(r, c, upgrade, settings, computed);
+}
+
+/*
+ * Collects the paths that differ between two trees, like diff_tree_oid()
+ * does for get_or_compute_bloom_filter(), but without going through the
+ * diff queue, so that several threads can do so at the same time.
+ */
+struct bloom_tree_diff {
+	struct repository *r;
+	struct strbuf base;
+	struct strbuf path;
+	struct hashmap pathmap;
+	size_t nr_changes;
+	size_t max_changes;
+
+	/*
+	 * Whether the diff involves a submodule. Whether diff_tree_oid()
+	 * reports those depends on the submodule configuration, which we
+	 * cannot look at from a thread, so these commits are left to
+	 * compute_filter_from_diff().
+	 */
+	unsigned needs_diff:1;
+};
+
+struct bloom_batch_item {
+	struct commit *commit;
+	struct bloom_filter *filter;
+	struct object_id old_tree, new_tree;
+	enum bloom_filter_computed *computed;
+	unsigned root:1,
+		 needs_diff:1;
+};
+
+struct bloom_batch {
+	struct repository *r;
+	const struct bloom_filter_settings *settings;
+	struct bloom_batch_item *items;
+	size_t nr, next;
+	struct progress *progress;
+	uint64_t done;
+	pthread_mutex_t mutex;
+};
+
+static void bloom_diff_trees(struct bloom_tree_diff *d,
+			     const struct object_id *old_oid,
+			     const struct object_id *new_oid);
+
+static void bloom_diff_entry(struct bloom_tree_diff *d,
+			     const struct name_entry *old_entry,
+			     const struct name_entry *new_entry)
+{
+	const struct name_entry *e = new_entry ? new_entry : old_entry;
+	size_t baselen = d->base.len;
+
+	if ((old_entry && S_ISGITLINK(old_entry->mode)) ||
+	    (new_entry && S_ISGITLINK(new_entry->mode))) {
+		d->needs_diff = 1;
+		return;
+	}
+
+	strbuf_add(&d->base, e->path, tree_entry_len(e));
+	if (S_ISDIR(e->mode)) {
+		strbuf_addch(&d->base, '/');
+		bloom_diff_trees(d, old_entry ? &old_entry->oid : NULL,
+				 new_entry ? &new_entry->oid : NULL);
+	} else {
+		d->nr_changes++;
+		strbuf_reset(&d->path);
+		strbuf_addbuf(&d->path, &d->base);
+		add_path_to_pathmap(&d->pathmap, d->path.buf);
+	}
+	strbuf_setlen(&d->base, baselen);
+}
+
+static void *read_tree_for_diff(struct bloom_tree_diff *d,
+				const struct object_id *oid,
+				unsigned long *size)
+{
+	enum object_type type;
+	void *buf;
+
+	if (!oid) {
+		*size = 0;
+		return NULL;
+	}
+
+	buf = repo_read_object_file(d->r, oid, &type, size);
+	if (!buf || type != OBJ_TREE)
+		die(_("unable to read tree (%s)"), oid_to_hex(oid));
+	return buf;
+}
+
+static void bloom_diff_trees(struct bloom_tree_diff *d,
+			     const struct object_id *old_oid,
+			     const struct object_id *new_oid)
+{
+	struct tree_desc o, n;
+	unsigned long old_size, new_size;
+	void *old_buf = read_tree_for_diff(d, old_oid, &old_size);
+	void *new_buf = read_tree_for_diff(d, new_oid, &new_size);
+
+	init_tree_desc(&o, old_oid, old_buf, old_size);
+	init_tree_desc(&n, new_oid, new_buf, new_size);
+
+	while ((o.size || n.size) &&
+	       !d->needs_diff && d->nr_changes <= d->max_changes) {
+		int cmp;
+
+		if (!o.size)
+			cmp = 1;
+		else if (!n.size)
+			cmp = -1;
+		else
+			cmp = base_name_compare(o.entry.path, tree_entry_len(&o.entry),
+						o.entry.mode,
+						n.entry.path, tree_entry_len(&n.entry),
+						n.entry.mode);
+
+		if (cmp < 0) {
+			bloom_diff_entry(d, &o.entry, NULL);
+			update_tree_entry(&o);
+		} else if (cmp > 0) {
+			bloom_diff_entry(d, NULL, &n.entry);
+			update_tree_entry(&n);
+		} else {
+			if (!oideq(&o.entry.oid, &n.entry.oid) ||
+			    o.entry.mode != n.entry.mode)
+				bloom_diff_entry(d, &o.entry, &n.entry);
+			update_tree_entry(&o);
+			update_tree_entry(&n);
+		}
+	}
+
+	free(old_buf);
+	free(new_buf);
+}
+
+static void compute_filter_from_trees(struct bloom_tree_diff *d,
+				      struct bloom_batch_item *item,
+				      const struct bloom_filter_settings *settings)
+{
+	hashmap_init(&d->pathmap, pathmap_cmp, NULL, 0);
+	d->nr_changes = 0;
+	d->needs_diff = 0;
+
+	bloom_diff_trees(d, item->root ? NULL : &item->old_tree,
+			 &item->new_tree);
+
+	if (d->needs_diff) {
+		item->needs_diff = 1;
+	} else {
+		if (d->nr_changes <= settings->max_changed_paths)
+			fill_filter_from_pathmap(item->filter, &d->pathmap,
+						 settings, item->computed);
+		else {
+			init_truncated_large_filter(item->filter,
+						    settings->hash_version);
+			*item->computed |= BLOOM_TRUNC_LARGE;
+		}
+		*item->computed |= BLOOM_COMPUTED;
+	}
+
+	hashmap_clear_and_free(&d->pathmap, struct pathmap_hash_entry, entry);
+}
+
+static void *bloom_batch_worker(void *data)
+{
+	struct bloom_batch *b = data;
+	struct bloom_tree_diff d = {
+		.r = b->r,
+		.base = STRBUF_INIT,
+		.path = STRBUF_INIT,
+		.max_changes = b->settings->max_changed_paths,
+	};
+	int finished_one = 0;
+
+	for (;;) {
+		size_t i;
+
+		pthread_mutex_lock(&b->mutex);
+		if (finished_one)
+			display_progress(b->progress, ++b->done);
+		i = b->next++;
+		pthread_mutex_unlock(&b->mutex);
+
+		if (i >= b->nr)
+			break;
+		compute_filter_from_trees(&d, &b->items[i], b->settings);
+		finished_one = 1;
+	}
+
+	strbuf_release(&d.base);
+	strbuf_release(&d.path);
+	return NULL;
+}
+
+void compute_bloom_filters_threaded(struct repository *r,
+				    struct commit **commits, size_t nr,
+				    const struct bloom_filter_settings *settings,
+				    enum bloom_filter_computed *computed,
+				    int nr_threads,
+				    struct progress *progress,
+				    uint64_t progress_start)
+{
+	struct bloom_batch b = {
+		.r = r,
+		.settings = settings,
+		.nr = nr,
+		.progress = progress,
+		.done = progress_start,
+	};
+	pthread_t *threads = NULL;
+	size_t i;
+
+	if (!bloom_filters.slab_size || !nr)
+		return;
+
+	/*
+	 * Parse the commits and grow the filter slab up front; neither
+	 * can be done from the threads.
+	 */
+	CALLOC_ARRAY(b.items, nr);
+	for (i = 0; i < nr; i++) {
+		struct bloom_batch_item *item = &b.items[i];
+		struct commit *c = commits[i];
+
+		repo_parse_commit(r, c);
+		item->commit = c;
+		item->filter = bloom_filter_slab_at(&bloom_filters, c);
+		item->computed = &computed[i];
+		*item->computed = BLOOM_NOT_COMPUTED;
+		oidcpy(&item->new_tree, get_commit_tree_oid(c));
+		if (c->parents) {
+			repo_parse_commit(r, c->parents->item);
+			oidcpy(&item->old_tree,
+			       get_commit_tree_oid(c->parents->item));
+		} else {
+			item->root = 1;
+		}
+	}
+
+	if (!HAVE_THREADS || nr_threads < 1)
+		nr_threads = 1;
+	if (nr_threads > nr)
+		nr_threads = nr;
+
+	pthread_mutex_init(&b.mutex, NULL);
+	if (nr_threads > 1) {
+		enable_obj_read_lock();
+		CALLOC_ARRAY(threads, nr_threads);
+		for (i = 0; i < nr_threads; i++) {
+			int err = pthread_create(&threads[i], NULL,
+						 bloom_batch_worker, &b);
+			if (err)
+				die(_("unable to create thread: %s"), strerror(err));
+		}
+		for (i = 0; i < nr_threads; i++)
+			pthread_join(threads[i], NULL);
+		free(threads);
+		disable_obj_read_lock();
+	} else {
+		bloom_batch_worker(&b);
+	}
+	pthread_mutex_destroy(&b.mutex);
+
+	for (i = 0; i < nr; i++) {
+		struct bloom_batch_item *item = &b.items[i];
+
+		if (item->needs_diff)
+			compute_filter_from_diff(r, item->commit, item->filter,
+						 settings, item->computed);
+	}
+
+	free(b.items);
+}
+
 int bloom_filter_contains(const struct bloom_filter *filter,
 			  const struct bloom_key *key,
 			  const struct bloom_filter_settings *settings)
@@ -540,3 +903,15 @@ int bloom_filter_contains(const struct bloom_filter *filter,
 
 	return 1;
 }
+
+int bloom_filter_contains_vec(const struct bloom_filter *filter,
+			      const struct bloom_keyvec *vec,
+			      const struct bloom_filter_settings *settings)
+{
+	int ret = 1;
+
+	for (size_t i = 0; ret && i < vec->count; i++)
+		ret = bloom_filter_contains(filter, &vec->key[i], settings);
+
+	return ret;
+}
@@ -4,6 +4,7 @@
 struct commit;
 struct repository;
 struct commit_graph;
+struct progress;
 
 struct bloom_filter_settings {
 	/*
@@ -74,6 +75,15 @@ struct bloom_key {
 	uint32_t *hashes;
 };
 
+/*
+ * The keys for a path and each of its leading directories, all of which
+ * a Bloom filter contains if the path was changed.
+ */
+struct bloom_keyvec {
+	size_t count;
+	struct bloom_key key[FLEX_ARRAY];
+};
+
 int load_bloom_filter_from_graph(struct commit_graph *g,
 				 struct bloom_filter *filter,
 				 uint32_t graph_pos);
@@ -93,6 +103,14 @@ void fill_bloom_key(const char *data,
 		    const struct bloom_filter_settings *settings);
 void clear_bloom_key(struct bloom_key *key);
 
+/*
+ * Compute the keys for the "len" bytes of "path", which must neither be
+ * empty nor end in a slash.
+ */
+struct bloom_keyvec *bloom_keyvec_new(const char *path, size_t len,
+				      const struct bloom_filter_settings *settings);
+void bloom_keyvec_free(struct bloom_keyvec *vec);
+
 void add_key_to_filter(const struct bloom_key *key,
 		       struct bloom_filter *filter,
 		       const struct bloom_filter_settings *settings);
@@ -114,6 +132,33 @@ struct bloom_filter *get_or_compute_bloom_filter(struct repository *r,
 						 const struct bloom_filter_settings *settings,
 						 enum bloom_filter_computed *computed);
 
+/*
+ * Like get_or_compute_bloom_filter(), but never computes a missing
+ * filter. A filter with a different hash version is upgraded if
+ * "upgrade" is set and that can be done without a diff.
+ */
+struct bloom_filter *get_or_upgrade_bloom_filter(struct repository *r,
+						 struct commit *c,
+						 int upgrade,
+						 const struct bloom_filter_settings *settings,
+						 enum bloom_filter_computed *computed);
+
+/*
+ * Compute the Bloom filters of the "nr" commits in "commits" using up to
+ * "nr_threads" threads, storing how each was computed in the matching
+ * entry of "computed". The filters are the same as the ones computed by
+ * get_or_compute_bloom_filter() and can be retrieved with it afterwards.
+ *
+ * Progress is shown on "progress", counting up from "progress_start".
+ */
+void compute_bloom_filters_threaded(struct repository *r,
+				    struct commit **commits, size_t nr,
+				    const struct bloom_filter_settings *settings,
+				    enum bloom_filter_computed *computed,
+				    int nr_threads,
+				    struct progress *progress,
+				    uint64_t progress_start);
+
 /*
  * Find the Bloom filter associated with the given commit "c".
  *
@@ -137,4 +182,12 @@ int bloom_filter_contains(const struct bloom_filter *filter,
 			  const struct bloom_key *key,
 			  const struct bloom_filter_settings *settings);
 
+/*
+ * Like bloom_filter_contains(), but for all keys of "vec": returns 0 if
+ * the path of "vec" was definitely not changed.
+ */
+int bloom_filter_contains_vec(const struct bloom_filter *filter,
+			      const struct bloom_keyvec *vec,
+			      const struct bloom_filter_settings *settings);
+
 #endif
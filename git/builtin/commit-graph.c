@@ -19,8 +19,9 @@
 #define BUILTIN_COMMIT_GRAPH_WRITE_USAGE \
 	N_("git commit-graph write [--object-dir <dir>] [--append]\n" \
 	   "                       [--split[=<strategy>]] [--reachable | --stdin-packs | --stdin-commits]\n" \
-	   "                       [--changed-paths] [--[no-]max-new-filters <n>] [--[no-]progress]\n" \
-	   "                       <split-options>")
+	   "                       [--changed-paths] [--identities] [--reach-index]\n" \
+	   "                       [--[no-]max-new-filters <n>]\n" \
+	   "                       [--[no-]progress] <split-options>")
 
 static const char * builtin_commit_graph_verify_usage[] = {
 	BUILTIN_COMMIT_GRAPH_VERIFY_USAGE,
@@ -48,6 +49,8 @@ static struct opts_commit_graph {
 	int shallow;
 	int progress;
 	int enable_changed_paths;
+	int enable_identities;
+	int enable_reach_index;
 } opts;
 
 static struct option common_opts[] = {
@@ -237,6 +240,10 @@ static int graph_write(int argc, const char **argv, const char *prefix,
 			N_("include all commits already in the commit-graph file")),
 		OPT_BOOL(0, "changed-paths", &opts.enable_changed_paths,
 			N_("enable computation for changed paths")),
+		OPT_BOOL(0, "identities", &opts.enable_identities,
+			N_("store author and committer identities and subjects")),
+		OPT_BOOL(0, "reach-index", &opts.enable_reach_index,
+			N_("store labels to answer reachability queries")),
 		OPT_CALLBACK_F(0, "split", &write_opts.split_flags, NULL,
 			N_("allow writing an incremental commit-graph file"),
 			PARSE_OPT_OPTARG | PARSE_OPT_NONEG,
@@ -258,6 +265,8 @@ static int graph_write(int argc, const char **argv, const char *prefix,
 
 	opts.progress = isatty(2);
 	opts.enable_changed_paths = -1;
+	opts.enable_identities = -1;
+	opts.enable_reach_index = -1;
 	write_opts.size_multiple = 2;
 	write_opts.max_commits = 0;
 	write_opts.expire_time = 0;
@@ -288,6 +297,14 @@ static int graph_write(int argc, const char **argv, const char *prefix,
 	if (opts.enable_changed_paths == 1 ||
 	    git_env_bool(GIT_TEST_COMMIT_GRAPH_CHANGED_PATHS, 0))
 		flags |= COMMIT_GRAPH_WRITE_BLOOM_FILTERS;
+	if (!opts.enable_identities)
+		flags |= COMMIT_GRAPH_NO_WRITE_IDENTITIES;
+	if (opts.enable_identities == 1)
+		flags |= COMMIT_GRAPH_WRITE_IDENTITIES;
+	if (!opts.enable_reach_index)
+		flags |= COMMIT_GRAPH_NO_WRITE_REACH_INDEX;
+	if (opts.enable_reach_index == 1)
+		flags |= COMMIT_GRAPH_WRITE_REACH_INDEX;
 
 	odb = find_odb(the_repository, opts.obj_dir);
 
@@ -10,6 +10,7 @@
 
 #include "builtin.h"
 #include "advice.h"
+#include "attr.h"
 #include "config.h"
 #include "lockfile.h"
 #include "cache-tree.h"
@@ -29,19 +30,27 @@
 #include "path.h"
 #include "preload-index.h"
 #include "read-cache.h"
+#include "refs.h"
 #include "repository.h"
 #include "string-list.h"
 #include "rerere.h"
 #include "unpack-trees.h"
 #include "column.h"
+#include "fsmonitor-ipc.h"
+#include "fsmonitor-settings.h"
+#include "remote.h"
 #include "sequencer.h"
 #include "sparse-index.h"
 #include "mailmap.h"
 #include "help.h"
+#include "hex.h"
 #include "commit-reach.h"
 #include "commit-graph.h"
 #include "pretty.h"
 #include "trailer.h"
+#include "tempfile.h"
+#include "trace2.h"
+#include "write-or-die.h"
 
 static const char * const builtin_commit_usage[] = {
 	N_("git commit [-a | --interactive | --patch] [-s] [-v] [-u[<mode>]] [--amend]\n"
@@ -146,6 +155,7 @@ static int have_option_m;
 static struct strbuf message = STRBUF_INIT;
 
 static enum wt_status_format status_format = STATUS_FORMAT_UNSPECIFIED;
+static int status_fsmonitor_cache;
 
 static int opt_parse_porcelain(const struct option *opt, const char *arg, int unset)
 {
@@ -1462,6 +1472,10 @@ static int git_status_config(const char *k, const char *v,
 		s->show_stash = git_config_bool(k, v);
 		return 0;
 	}
+	if (!strcmp(k, "status.fsmonitorcache")) {
+		status_fsmonitor_cache = git_config_bool(k, v);
+		return 0;
+	}
 	if (!strcmp(k, "status.color") || !strcmp(k, "color.status")) {
 		s->use_color = git_config_colorbool(k, v);
 		return 0;
@@ -1513,6 +1527,286 @@ static int git_status_config(const char *k, const char *v,
 	return git_diff_ui_config(k, v, ctx, NULL);
 }
 
+/*
+ * With status.fsmonitorCache, the fsmonitor daemon keeps the output of
+ * recent `git status` commands, so that running one again when nothing
+ * changed only has to print it.  The daemon can tell whether anything
+ * in the working directory changed; the key covers everything else the
+ * output depends on.
+ */
+#define STATUS_CACHE_MAX_OUTPUT (1024 * 1024)
+
+struct status_cache {
+	struct strbuf state;
+	struct strbuf token;
+	struct tempfile *output;
+};
+
+#define STATUS_CACHE_INIT { \
+	.state = STRBUF_INIT, \
+	.token = STRBUF_INIT, \
+}
+
+static int status_cache_add_config(const char *var, const char *value,
+				   const struct config_context *ctx UNUSED,
+				   void *cb)
+{
+	struct strbuf *sb = cb;
+
+	strbuf_addstr(sb, var);
+	if (value)
+		strbuf_addf(sb, "=%s", value);
+	strbuf_addch(sb, '\0');
+	return 0;
+}
+
+static void status_cache_add_stat(struct strbuf *sb, const char *path)
+{
+	struct stat st;
+
+	if (!path)
+		return;
+	strbuf_addf(sb, "%s:", path);
+	if (!stat(path, &st))
+		strbuf_addf(sb, "%"PRIuMAX".%u:%"PRIuMAX".%u:%"PRIuMAX":%"PRIuMAX,
+			    (uintmax_t)st.st_mtime, ST_MTIME_NSEC(st),
+			    (uintmax_t)st.st_ctime, ST_CTIME_NSEC(st),
+			    (uintmax_t)st.st_size, (uintmax_t)st.st_ino);
+	strbuf_addch(sb, '\0');
+}
+
+/*
+ * Add what identifies the contents of the index or its journal at
+ * `path`: the hash each of them ends with, or its stat data if it ends
+ * with none, as an index written with index.skipHash does.
+ */
+static void status_cache_add_checksum(struct strbuf *sb, const char *path)
+{
+	const unsigned hashsz = the_hash_algo->rawsz;
+	unsigned char hash[GIT_MAX_RAWSZ];
+	struct object_id oid;
+	struct stat st;
+	int fd;
+
+	oidclr(&oid, the_repository->hash_algo);
+	strbuf_addf(sb, "%s:", path);
+	fd = open(path, O_RDONLY);
+	if (fd >= 0) {
+		if (!fstat(fd, &st) && st.st_size >= hashsz &&
+		    pread_in_full(fd, hash, hashsz, st.st_size - hashsz) == hashsz) {
+			oidread(&oid, hash, the_repository->hash_algo);
+			strbuf_addf(sb, "%"PRIuMAX":%s", (uintmax_t)st.st_size,
+				    oid_to_hex(&oid));
+		}
+		close(fd);
+	}
+	strbuf_addch(sb, '\0');
+	if (is_null_oid(&oid))
+		status_cache_add_stat(sb, path);
+}
+
+static void status_cache_add_ref(struct strbuf *sb, const char *refname)
+{
+	struct object_id oid;
+
+	if (refs_read_ref(get_main_ref_store(the_repository), refname, &oid))
+		oidclr(&oid, the_repository->hash_algo);
+	strbuf_addf(sb, "%s:%s", refname, oid_to_hex(&oid));
+	strbuf_addch(sb, '\0');
+}
+
+/*
+ * Describe what the output of `git status` depends on, other than the
+ * working directory and the index, in `sb`.  Returns -1 if the output
+ * should not be cached at all, as when HEAD is detached or an operation
+ * is in progress, which status describes from files we do not track.
+ */
+static int status_cache_get_state(struct strbuf *sb, const char **argv,
+				  const char *prefix)
+{
+	extern char **environ;
+	struct wt_status_state state = { 0 };
+	struct branch *branch;
+	const char *head, *upstream;
+	char *path;
+	int flags, ret = -1;
+
+	wt_status_get_state(the_repository, &state, 0);
+	if (state.merge_in_progress || state.am_in_progress ||
+	    state.rebase_in_progress || state.rebase_interactive_in_progress ||
+	    state.cherry_pick_in_progress || state.bisect_in_progress ||
+	    state.revert_in_progress)
+		goto out;
+
+	head = refs_resolve_ref_unsafe(get_main_ref_store(the_repository),
+				       "HEAD", 0, NULL, &flags);
+	if (!head || !(flags & REF_ISSYMREF))
+		goto out;
+	status_cache_add_ref(sb, head);
+	branch = branch_get(NULL);
+	upstream = branch_get_upstream(branch, NULL);
+	if (upstream)
+		status_cache_add_ref(sb, upstream);
+
+	for (; *argv; argv++)
+		strbuf_add(sb, *argv, strlen(*argv) + 1);
+	strbuf_addf(sb, "%s%c%d%c", prefix ? prefix : "", '\0',
+		    isatty(1), '\0');
+	for (char **env = environ; *env; env++) {
+		/* These change from one process to the next while tracing. */
+		if (starts_with(*env, "GIT_TRACE"))
+			continue;
+		strbuf_add(sb, *env, strlen(*env) + 1);
+	}
+	repo_config(the_repository, status_cache_add_config, sb);
+
+	path = repo_git_path(the_repository, "info/exclude");
+	status_cache_add_stat(sb, path);
+	free(path);
+	path = repo_git_path(the_repository, "info/attributes");
+	status_cache_add_stat(sb, path);
+	free(path);
+	path = repo_git_path(the_repository, "info/sparse-checkout");
+	status_cache_add_stat(sb, path);
+	free(path);
+	if (excludes_file) {
+		status_cache_add_stat(sb, excludes_file);
+	} else {
+		path = xdg_config_home("ignore");
+		status_cache_add_stat(sb, path);
+		free(path);
+	}
+	status_cache_add_stat(sb, git_attr_global_file());
+	status_cache_add_stat(sb, git_attr_system_file());
+
+	ret = 0;
+out:
+	wt_status_state_free_buffers(&state);
+	return ret;
+}
+
+/* Hash the state and the current index into the key for the daemon. */
+static void status_cache_key(struct strbuf *key, const struct strbuf *state)
+{
+	struct git_hash_ctx ctx;
+	struct strbuf sb = STRBUF_INIT;
+	unsigned char hash[GIT_MAX_RAWSZ];
+	const char *index_file = repo_get_index_file(the_repository);
+	char *journal = xstrfmt("%s.journal", index_file);
+
+	status_cache_add_checksum(&sb, index_file);
+	status_cache_add_checksum(&sb, journal);
+
+	the_hash_algo->init_fn(&ctx);
+	git_hash_update(&ctx, state->buf, state->len);
+	git_hash_update(&ctx, sb.buf, sb.len);
+	git_hash_final(hash, &ctx);
+
+	strbuf_addstr(key, hash_to_hex(hash));
+
+	strbuf_release(&sb);
+	free(journal);
+}
+
+/*
+ * Print the output of an earlier `git status` that the daemon has for
+ * us and return 1, or return 0 after setting up `s` to write the output
+ * to a temporary file, which status_cache_finish() prints and passes on
+ * to the daemon.
+ */
+static int status_cache_start(struct status_cache *sc, struct wt_status *s,
+			      const char **argv, const char *prefix)
+{
+	struct strbuf request = STRBUF_INIT;
+	struct strbuf answer = STRBUF_INIT;
+	const char *p;
+	int ret = 0;
+
+	if (s->show_stash || column_active(s->colopts) ||
+	    status_cache_get_state(&sc->state, argv, prefix))
+		goto out;
+
+	strbuf_addstr(&request, "status-cache get ");
+	status_cache_key(&request, &sc->state);
+	if (fsmonitor_ipc__send_request(request.buf, request.len, &answer))
+		goto out;
+
+	if (skip_prefix(answer.buf, "hit\n", &p)) {
+		trace2_data_string("status", the_repository, "fsmonitor-cache", "hit");
+		write_or_die(1, p, answer.len - (p - answer.buf));
+		ret = 1;
+		goto out;
+	}
+	trace2_data_string("status", the_repository, "fsmonitor-cache", "miss");
+	if (!skip_prefix(answer.buf, "miss ", &p))
+		goto out;
+	strbuf_addstr(&sc->token, p);
+
+	sc->output = mks_tempfile_t("git-status-XXXXXX");
+	if (sc->output)
+		s->fp = fdopen_tempfile(sc->output, "w+");
+	if (!s->fp) {
+		delete_tempfile(&sc->output);
+		s->fp = stdout;
+	}
+
+out:
+	strbuf_release(&request);
+	strbuf_release(&answer);
+	return ret;
+}
+
+static void status_cache_finish(struct status_cache *sc, struct wt_status *s,
+				const char **argv, const char *prefix)
+{
+	struct strbuf output = STRBUF_INIT;
+	struct strbuf state = STRBUF_INIT;
+	struct strbuf request = STRBUF_INIT;
+	struct strbuf answer = STRBUF_INIT;
+	struct index_state *istate = the_repository->index;
+
+	if (!sc->output)
+		goto out;
+
+	if (fflush(s->fp) ||
+	    strbuf_read_file(&output, get_tempfile_path(sc->output), 0) < 0)
+		die_errno(_("could not read '%s'"), get_tempfile_path(sc->output));
+	delete_tempfile(&sc->output);
+	s->fp = stdout;
+	write_or_die(1, output.buf, output.len);
+
+	/*
+	 * Submodules have working directories of their own, which the
+	 * daemon does not watch.
+	 */
+	for (unsigned int i = 0; i < istate->cache_nr; i++)
+		if (S_ISGITLINK(istate->cache[i]->ce_mode))
+			goto out;
+
+	/*
+	 * We may have written the index; the key is that of the index as
+	 * it is now, as long as nothing else changed while we ran.
+	 */
+	if (output.len > STATUS_CACHE_MAX_OUTPUT ||
+	    status_cache_get_state(&state, argv, prefix) ||
+	    strbuf_cmp(&state, &sc->state))
+		goto out;
+
+	strbuf_addstr(&request, "status-cache put ");
+	status_cache_key(&request, &state);
+	strbuf_addf(&request, " %s\n", sc->token.buf);
+	strbuf_addbuf(&request, &output);
+	fsmonitor_ipc__send_request(request.buf, request.len, &answer);
+
+out:
+	strbuf_release(&output);
+	strbuf_release(&state);
+	strbuf_release(&request);
+	strbuf_release(&answer);
+	strbuf_release(&sc->state);
+	strbuf_release(&sc->token);
+}
+
 int cmd_status(int argc,
 const char **argv,
 const char *prefix,
@@ -1524,6 +1818,8 @@ struct repository *repo UNUSED)
 	unsigned int progress_flag = 0;
 	int fd;
 	struct object_id oid;
+	struct strvec args = STRVEC_INIT;
+	struct status_cache sc = STATUS_CACHE_INIT;
 	static struct option builtin_status_options[] = {
 		OPT__VERBOSE(&verbose, N_("be verbose")),
 		OPT_SET_INT('s', "short", &status_format,
@@ -1568,6 +1864,7 @@ struct repository *repo UNUSED)
 	the_repository->settings.command_requires_full_index = 0;
 
 	status_init_config(&s, git_status_config);
+	strvec_pushv(&args, argv);
 	argc = parse_options(argc, argv, prefix,
 			     builtin_status_options,
 			     builtin_status_usage, 0);
@@ -1585,6 +1882,13 @@ struct repository *repo UNUSED)
 		       PATHSPEC_PREFER_FULL,
 		       prefix, argv);
 
+	if (status_fsmonitor_cache && !verbose &&
+	    fsm_settings__get_mode(the_repository) == FSMONITOR_MODE_IPC &&
+	    status_cache_start(&sc, &s, args.v, prefix)) {
+		strvec_clear(&args);
+		return 0;
+	}
+
 	enable_fscache(0);
 	if (status_format != STATUS_FORMAT_PORCELAIN &&
 	    status_format != STATUS_FORMAT_PORCELAIN_V2)
@@ -1624,7 +1928,9 @@ struct repository *repo UNUSED)
 		s.prefix = prefix;
 
 	wt_status_print(&s);
+	status_cache_finish(&sc, &s, args.v, prefix);
 	wt_status_collect_free_buffers(&s);
+	strvec_clear(&args);
 
 	disable_fscache();
 	return 0;
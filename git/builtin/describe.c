@@ -22,6 +22,9 @@
 #include "object-store-ll.h"
 #include "list-objects.h"
 #include "commit-slab.h"
+#include "commit-graph.h"
+#include "oidset.h"
+#include "prio-queue.h"
 #include "wildmatch.h"
 
 #define MAX_TAGS	(FLAG_BITS - 1)
@@ -69,6 +72,7 @@ struct commit_name {
 	unsigned misnamed:1;
 	struct object_id oid;
 	char *path;
+	timestamp_t generation; /* of the peeled commit, once looked up */
 };
 
 static const char *prio_names[] = {
@@ -250,35 +254,47 @@ static int compare_pt(const void *a_, const void *b_)
 }
 
 static unsigned long finish_depth_computation(
-	struct commit_list **list,
+	struct prio_queue *queue,
 	struct possible_tag *best)
 {
 	unsigned long seen_commits = 0;
-	while (*list) {
-		struct commit *c = pop_commit(list);
+	/* queued commits that are not known to be within "best" yet */
+	struct oidset unflagged = OIDSET_INIT;
+
+	for (size_t i = 0; i < queue->nr; i++) {
+		struct commit *c = queue->array[i].data;
+		if (!(c->object.flags & best->flag_within))
+			oidset_insert(&unflagged, &c->object.oid);
+	}
+
+	while (queue->nr) {
+		struct commit *c = prio_queue_get(queue);
 		struct commit_list *parents = c->parents;
 		seen_commits++;
 		if (c->object.flags & best->flag_within) {
-			struct commit_list *a = *list;
-			while (a) {
-				struct commit *i = a->item;
-				if (!(i->object.flags & best->flag_within))
-					break;
-				a = a->next;
-			}
-			if (!a)
+			if (!oidset_size(&unflagged))
 				break;
-		} else
+		} else {
+			oidset_remove(&unflagged, &c->object.oid);
 			best->depth++;
+		}
 		while (parents) {
 			struct commit *p = parents->item;
+			int queued = 0;
 			repo_parse_commit(the_repository, p);
-			if (!(p->object.flags & SEEN))
-				commit_list_insert_by_date(p, list);
+			if (!(p->object.flags & SEEN)) {
+				prio_queue_put(queue, p);
+				queued = 1;
+			}
 			p->object.flags |= c->object.flags;
+			if (p->object.flags & best->flag_within)
+				oidset_remove(&unflagged, &p->object.oid);
+			else if (queued)
+				oidset_insert(&unflagged, &p->object.oid);
 			parents = parents->next;
 		}
 	}
+	oidset_clear(&unflagged);
 	return seen_commits;
 }
 
@@ -316,12 +332,17 @@ static void append_suffix(int depth, const struct object_id *oid, struct strbuf
 static void describe_commit(struct object_id *oid, struct strbuf *dst)
 {
 	struct commit *cmit, *gave_up_on = NULL;
-	struct commit_list *list;
+	struct prio_queue queue = {
+		.compare = compare_commits_by_commit_date,
+		.get_key = commit_date_queue_key,
+	};
 	struct commit_name *n;
 	struct possible_tag all_matches[MAX_TAGS];
 	unsigned int match_cnt = 0, annotated_cnt = 0, cur_match;
 	unsigned long seen_commits = 0;
 	unsigned int unannotated_cnt = 0;
+	unsigned int reachable_cnt = 0;
+	timestamp_t generation = GENERATION_NUMBER_INFINITY;
 
 	cmit = lookup_commit_reference(the_repository, oid);
 
@@ -353,24 +374,48 @@ static void describe_commit(struct object_id *oid, struct strbuf *dst)
 					entry /* member name */) {
 			c = lookup_commit_reference_gently(the_repository,
 							   &n->peeled, 1);
-			if (c)
+			n->generation = GENERATION_NUMBER_INFINITY;
+			if (c) {
 				*commit_names_at(&commit_names, c) = n;
+				n->generation = commit_graph_generation(c);
+			}
 		}
 		have_util = 1;
 	}
 
-	list = NULL;
+	/*
+	 * A name whose commit has a larger generation number than ours
+	 * cannot be reached by the walk below, so there is no point in
+	 * walking on in the hope of finding it.
+	 *
+	 * Names further down are not ruled out by how far below us they
+	 * are: with corrected commit dates a single parent can be many
+	 * generations away, so the difference says nothing about the
+	 * depth a name would get.
+	 */
+	if (generation_numbers_enabled(the_repository))
+		generation = commit_graph_generation(cmit);
+	if (generation == GENERATION_NUMBER_INFINITY) {
+		reachable_cnt = hashmap_get_size(&names);
+	} else {
+		struct hashmap_iter iter;
+
+		hashmap_for_each_entry(&names, &iter, n, entry /* member name */)
+			if (n->generation <= generation)
+				reachable_cnt++;
+	}
+
 	cmit->object.flags = SEEN;
-	commit_list_insert(cmit, &list);
-	while (list) {
-		struct commit *c = pop_commit(&list);
+	prio_queue_put(&queue, cmit);
+	while (queue.nr) {
+		struct commit *c = prio_queue_get(&queue);
 		struct commit_list *parents = c->parents;
 		struct commit_name **slot;
 
 		seen_commits++;
 
 		if (match_cnt == max_candidates ||
-		    match_cnt == hashmap_get_size(&names)) {
+		    match_cnt == reachable_cnt) {
 			gave_up_on = c;
 			break;
 		}
@@ -397,7 +442,7 @@ static void describe_commit(struct object_id *oid, struct strbuf *dst)
 				t->depth++;
 		}
 		/* Stop if last remaining path already covered by best candidate(s) */
-		if (annotated_cnt && !list) {
+		if (annotated_cnt && !queue.nr) {
 			int best_depth = INT_MAX;
 			unsigned best_within = 0;
 			for (cur_match = 0; cur_match < match_cnt; cur_match++) {
@@ -420,7 +465,7 @@ static void describe_commit(struct object_id *oid, struct strbuf *dst)
 			struct commit *p = parents->item;
 			repo_parse_commit(the_repository, p);
 			if (!(p->object.flags & SEEN))
-				commit_list_insert_by_date(p, &list);
+				prio_queue_put(&queue, p);
 			p->object.flags |= c->object.flags;
 			parents = parents->next;
 
@@ -431,6 +476,7 @@ static void describe_commit(struct object_id *oid, struct strbuf *dst)
 
 	if (!match_cnt) {
 		struct object_id *cmit_oid = &cmit->object.oid;
+		clear_prio_queue(&queue);
 		if (always) {
 			strbuf_add_unique_abbrev(dst, cmit_oid, abbrev);
 			if (suffix)
@@ -450,11 +496,11 @@ static void describe_commit(struct object_id *oid, struct strbuf *dst)
 	QSORT(all_matches, match_cnt, compare_pt);
 
 	if (gave_up_on) {
-		commit_list_insert_by_date(gave_up_on, &list);
+		prio_queue_put(&queue, gave_up_on);
 		seen_commits--;
 	}
-	seen_commits += finish_depth_computation(&list, &all_matches[0]);
-	free_commit_list(list);
+	seen_commits += finish_depth_computation(&queue, &all_matches[0]);
+	clear_prio_queue(&queue);
 
 	if (debug) {
 		static int label_width = -1;
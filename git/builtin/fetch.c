@@ -41,6 +41,8 @@
 #include "trace.h"
 #include "trace2.h"
 #include "bundle-uri.h"
+#include "strmap.h"
+#include "tempfile.h"
 
 #define FORCED_UPDATES_DELAY_WARNING_IN_MS (10 * 1000)
 
@@ -101,9 +103,19 @@ static struct list_objects_filter_options filter_options = LIST_OBJECTS_FILTER_I
 static struct string_list server_options = STRING_LIST_INIT_DUP;
 static struct string_list negotiation_tip = STRING_LIST_INIT_NODUP;
 
+/*
+ * When fetching from multiple remotes with fetch.batchRefUpdates, the
+ * per-remote children neither check connectivity nor touch refs or
+ * FETCH_HEAD; they record what they would have done in this file and
+ * leave it to the parent to verify and apply everything at once.
+ */
+static const char *deferred_updates_file;
+static struct strbuf deferred_updates = STRBUF_INIT;
+
 struct fetch_config {
 	enum display_format display_format;
 	int all;
+	int batch_ref_updates;
 	int prune;
 	int prune_tags;
 	int show_forced_updates;
@@ -122,6 +134,11 @@ static int git_fetch_config(const char *k, const char *v,
 		return 0;
 	}
 
+	if (!strcmp(k, "fetch.batchrefupdates")) {
+		fetch_config->batch_ref_updates = git_config_bool(k, v);
+		return 0;
+	}
+
 	if (!strcmp(k, "fetch.prune")) {
 		fetch_config->prune = git_config_bool(k, v);
 		return 0;
@@ -661,6 +678,18 @@ static int s_update_ref(const char *action,
 		rla = default_rla.buf;
 	msg = xstrfmt("%s: %s", rla, action);
 
+	if (deferred_updates_file) {
+		strbuf_addf(&deferred_updates, "update %s %s %s ",
+			    oid_to_hex(&ref->new_oid),
+			    check_old ? oid_to_hex(&ref->old_oid) : "-",
+			    ref->name);
+		for (const char *p = msg; *p; p++)
+			strbuf_addch(&deferred_updates, *p == '\n' ? ' ' : *p);
+		strbuf_addch(&deferred_updates, '\n');
+		ret = 0;
+		goto out;
+	}
+
 	/*
 	 * If no transaction was passed to us, we manage the transaction
 	 * ourselves. Otherwise, we trust the caller to handle the transaction
@@ -1107,7 +1136,7 @@ static void append_fetch_head(struct fetch_head *fetch_head,
 	 * updates to a buffer first and only commit it as soon as all
 	 * references have been successfully updated.
 	 */
-	if (!atomic_fetch) {
+	if (!atomic_fetch && !deferred_updates_file) {
 		strbuf_write(&fetch_head->buf, fetch_head->fp);
 		strbuf_reset(&fetch_head->buf);
 	}
@@ -1115,7 +1144,20 @@ static void append_fetch_head(struct fetch_head *fetch_head,
 
 static void commit_fetch_head(struct fetch_head *fetch_head)
 {
-	if (!fetch_head->fp || !atomic_fetch)
+	if (!fetch_head->fp)
+		return;
+	if (deferred_updates_file) {
+		struct string_list lines = STRING_LIST_INIT_NODUP;
+
+		string_list_split_in_place(&lines, fetch_head->buf.buf, "\n", -1);
+		for (size_t i = 0; i < lines.nr; i++)
+			if (*lines.items[i].string)
+				strbuf_addf(&deferred_updates, "fetch-head %s\n",
+					    lines.items[i].string);
+		string_list_clear(&lines, 0);
+		return;
+	}
+	if (!atomic_fetch)
 		return;
 	strbuf_write(&fetch_head->buf, fetch_head->fp);
 }
@@ -1155,7 +1197,14 @@ static int store_updated_refs(struct display_state *display_state,
 	if (verbosity >= 0)
 		summary_width = transport_summary_width(ref_map);
 
-	if (!connectivity_checked) {
+	if (!connectivity_checked && deferred_updates_file) {
+		const struct object_id *oid;
+
+		rm = ref_map;
+		while ((oid = iterate_ref_map(&rm)))
+			strbuf_addf(&deferred_updates, "check %s\n",
+				    oid_to_hex(oid));
+	} else if (!connectivity_checked) {
 		struct check_connected_options opt = CHECK_CONNECTED_INIT;
 
 		opt.exclude_hidden_refs_section = "fetch";
@@ -1663,6 +1712,12 @@ static int set_head(const struct ref *remote_refs, struct remote *remote)
 	} else {
 		strbuf_addf(&b_head, "refs/remotes/%s/HEAD", remote->name);
 		strbuf_addf(&b_remote_head, "refs/remotes/%s/%s", remote->name, head_name);
+	}
+	if (deferred_updates_file) {
+		/* the target may only be created by our parent */
+		strbuf_addf(&deferred_updates, "symref %d %s %s\n", create_only,
+			    b_head.buf, b_remote_head.buf);
+		goto cleanup;
 	}
 		/* make sure it's valid */
 	if (!baremirror && !refs_ref_exists(refs, b_remote_head.buf)) {
@@ -1933,6 +1988,10 @@ static int do_fetch(struct transport *transport,
 		 * so let's just fail silently for now.
 		 */
 
+	if (deferred_updates_file)
+		write_file_buf(deferred_updates_file, deferred_updates.buf,
+			       deferred_updates.len);
+
 cleanup:
 	if (retcode) {
 		if (err.len) {
@@ -2045,30 +2104,347 @@ static void add_options_to_argv(struct strvec *argv,
 		strvec_pushf(argv, "--porcelain");
 }
 
+/*
+ * The ref updates and FETCH_HEAD lines a child recorded with
+ * --deferred-updates, to be checked and applied by the parent.
+ */
+struct deferred_update {
+	struct object_id new_oid;
+	struct object_id old_oid;
+	unsigned check_old : 1;
+	char *refname;
+	char *msg;
+};
+
+struct deferred_remote {
+	const char *name;
+	struct tempfile *file;
+	struct deferred_update *updates;
+	size_t updates_nr, updates_alloc;
+	struct oid_array tips;
+	struct strbuf symrefs;
+	struct strbuf fetch_head;
+	unsigned fetched : 1;
+};
+
+static void deferred_remotes_release(struct deferred_remote *remotes, size_t nr)
+{
+	for (size_t i = 0; remotes && i < nr; i++) {
+		struct deferred_remote *r = &remotes[i];
+
+		for (size_t j = 0; j < r->updates_nr; j++) {
+			free(r->updates[j].refname);
+			free(r->updates[j].msg);
+		}
+		free(r->updates);
+		oid_array_clear(&r->tips);
+		strbuf_release(&r->symrefs);
+		strbuf_release(&r->fetch_head);
+		delete_tempfile(&r->file);
+	}
+	free(remotes);
+}
+
+static int parse_deferred_updates(struct deferred_remote *r)
+{
+	struct strbuf buf = STRBUF_INIT;
+	const char *line, *next;
+	int ret = 0;
+
+	if (strbuf_read_file(&buf, get_tempfile_path(r->file), 0) < 0)
+		return error_errno(_("could not read '%s'"),
+				   get_tempfile_path(r->file));
+
+	for (line = buf.buf; *line; line = next) {
+		const char *arg, *end = strchrnul(line, '\n');
+		struct deferred_update *u;
+		struct object_id oid;
+
+		next = *end ? end + 1 : end;
+		if (skip_prefix(line, "check ", &arg)) {
+			if (parse_oid_hex(arg, &oid, &arg) || arg != end)
+				goto bad;
+			oid_array_append(&r->tips, &oid);
+			continue;
+		}
+		if (skip_prefix(line, "symref ", &arg)) {
+			strbuf_add(&r->symrefs, arg, end - arg);
+			strbuf_addch(&r->symrefs, '\n');
+			continue;
+		}
+		if (skip_prefix(line, "fetch-head ", &arg)) {
+			strbuf_add(&r->fetch_head, arg, end - arg);
+			strbuf_addch(&r->fetch_head, '\n');
+			continue;
+		}
+
+		ALLOC_GROW(r->updates, r->updates_nr + 1, r->updates_alloc);
+		u = &r->updates[r->updates_nr];
+		memset(u, 0, sizeof(*u));
+		if (!skip_prefix(line, "update ", &arg) ||
+		    parse_oid_hex(arg, &u->new_oid, &arg) || *arg++ != ' ')
+			goto bad;
+		if (skip_prefix(arg, "- ", &arg))
+			u->check_old = 0;
+		else if (!parse_oid_hex(arg, &u->old_oid, &arg) && *arg++ == ' ')
+			u->check_old = 1;
+		else
+			goto bad;
+		next = strchr(arg, ' ');
+		if (!next || next > end)
+			goto bad;
+		u->refname = xmemdupz(arg, next - arg);
+		u->msg = xmemdupz(next + 1, end - next - 1);
+		r->updates_nr++;
+		next = *end ? end + 1 : end;
+	}
+	goto out;
+
+bad:
+	ret = error(_("malformed deferred update for '%s': %.*s"),
+		    r->name, (int)(strchrnul(line, '\n') - line), line);
+out:
+	strbuf_release(&buf);
+	return ret;
+}
+
+struct deferred_oid_iter {
+	struct deferred_remote *remotes;
+	size_t nr, remote, tip;
+};
+
+static const struct object_id *iterate_deferred_tips(void *cb_data)
+{
+	struct deferred_oid_iter *it = cb_data;
+
+	for (; it->remote < it->nr; it->remote++, it->tip = 0) {
+		struct deferred_remote *r = &it->remotes[it->remote];
+
+		if (r->fetched && it->tip < r->tips.nr)
+			return &r->tips.oid[it->tip++];
+	}
+	return NULL;
+}
+
+static int check_deferred_connected(struct deferred_remote *remotes, size_t nr)
+{
+	struct check_connected_options opt = CHECK_CONNECTED_INIT;
+	struct deferred_oid_iter it = { remotes, nr };
+
+	opt.exclude_hidden_refs_section = "fetch";
+	opt.quiet = 1;
+	return check_connected(iterate_deferred_tips, &it, &opt);
+}
+
+static int update_deferred_ref(struct ref_transaction *transaction,
+			       const struct deferred_update *u,
+			       struct strbuf *err)
+{
+	return ref_transaction_update(transaction, u->refname, &u->new_oid,
+				      u->check_old ? &u->old_oid : NULL,
+				      NULL, NULL, 0, u->msg, err);
+}
+
+/*
+ * Point remote HEADs at their targets, like set_head() would have done
+ * had the targets already existed in the child.
+ */
+static void update_deferred_symrefs(struct deferred_remote *r)
+{
+	struct ref_store *refs = get_main_ref_store(the_repository);
+	struct string_list lines = STRING_LIST_INIT_NODUP;
+
+	string_list_split_in_place(&lines, r->symrefs.buf, "\n", -1);
+	for (size_t i = 0; i < lines.nr; i++) {
+		char *head, *target;
+		int create_only;
+
+		if (!*lines.items[i].string)
+			continue;
+		create_only = *lines.items[i].string == '1';
+		head = strchr(lines.items[i].string, ' ');
+		target = head ? strchr(++head, ' ') : NULL;
+		if (!target)
+			continue;
+		*target++ = '\0';
+		if (!strcmp(head, "HEAD") || refs_ref_exists(refs, target))
+			refs_update_symref_extended(refs, head, target, "fetch",
+						    NULL, create_only);
+	}
+	string_list_clear(&lines, 0);
+}
+
+/*
+ * Apply the updates of all remotes whose children succeeded: verify
+ * connectivity of everything they fetched in a single walk, then update
+ * refs in a single transaction and append to FETCH_HEAD.
+ */
+static int apply_deferred_updates(struct deferred_remote *remotes, size_t nr)
+{
+	struct ref_store *refs = get_main_ref_store(the_repository);
+	struct ref_transaction *transaction;
+	struct strmap seen = STRMAP_INIT;
+	struct strbuf err = STRBUF_INIT;
+	struct fetch_head fetch_head = { 0 };
+	int result = 0;
+
+	for (size_t i = 0; i < nr; i++)
+		if (remotes[i].fetched && parse_deferred_updates(&remotes[i])) {
+			remotes[i].fetched = 0;
+			result = 1;
+		}
+
+	trace2_region_enter("fetch", "deferred-connectivity", the_repository);
+	if (check_deferred_connected(remotes, nr)) {
+		/*
+		 * Find out which of the remotes is to blame, so that the
+		 * others can still be updated.
+		 */
+		for (size_t i = 0; i < nr; i++) {
+			if (!remotes[i].fetched ||
+			    !check_deferred_connected(&remotes[i], 1))
+				continue;
+			error(_("%s did not send all necessary objects"),
+			      remotes[i].name);
+			remotes[i].fetched = 0;
+			result = 1;
+		}
+	}
+	trace2_region_leave("fetch", "deferred-connectivity", the_repository);
+
+	if (atomic_fetch && result)
+		goto out;
+
+	trace2_region_enter("fetch", "deferred-ref-updates", the_repository);
+	transaction = ref_store_transaction_begin(refs, 0, &err);
+	if (!transaction) {
+		result = error("%s", err.buf);
+		trace2_region_leave("fetch", "deferred-ref-updates", the_repository);
+		goto out;
+	}
+	for (size_t i = 0; i < nr; i++) {
+		struct deferred_remote *r = &remotes[i];
+
+		if (!r->fetched)
+			continue;
+		for (size_t j = 0; j < r->updates_nr; j++) {
+			const struct object_id *prev =
+				strmap_get(&seen, r->updates[j].refname);
+
+			/*
+			 * The same ref may legitimately be recorded more
+			 * than once, e.g. a tag that is both fetched and
+			 * followed, or offered by several remotes.
+			 */
+			if (prev && oideq(prev, &r->updates[j].new_oid)) {
+				r->updates[j].refname[0] = '\0';
+				continue;
+			} else if (prev) {
+				result = error(_("'%s' is updated by more than one remote; "
+						 "ignoring the update from '%s'"),
+					       r->updates[j].refname, r->name);
+				r->updates[j].refname[0] = '\0';
+				continue;
+			}
+			strmap_put(&seen, r->updates[j].refname,
+				   &r->updates[j].new_oid);
+			if (update_deferred_ref(transaction, &r->updates[j], &err)) {
+				result = error("%s", err.buf);
+				strbuf_reset(&err);
+				r->updates[j].refname[0] = '\0';
+			}
+		}
+	}
+
+	if (atomic_fetch && result) {
+		ref_transaction_abort(transaction, &err);
+	} else if (ref_transaction_commit(transaction, &err)) {
+		error("%s", err.buf);
+		strbuf_reset(&err);
+		result = 1;
+		ref_transaction_free(transaction);
+
+		/*
+		 * Without --atomic, a single bad update must not hold up
+		 * all the others; retry them one by one.
+		 */
+		for (size_t i = 0; !atomic_fetch && i < nr; i++) {
+			struct deferred_remote *r = &remotes[i];
+
+			for (size_t j = 0; r->fetched && j < r->updates_nr; j++) {
+				if (!*r->updates[j].refname)
+					continue;
+				transaction = ref_store_transaction_begin(refs, 0, &err);
+				if (!transaction ||
+				    update_deferred_ref(transaction, &r->updates[j], &err) ||
+				    ref_transaction_commit(transaction, &err)) {
+					error("%s", err.buf);
+					strbuf_reset(&err);
+				}
+				ref_transaction_free(transaction);
+			}
+		}
+	} else {
+		ref_transaction_free(transaction);
+	}
+	trace2_region_leave("fetch", "deferred-ref-updates", the_repository);
+
+	if (atomic_fetch && result)
+		goto out;
+	for (size_t i = 0; i < nr; i++)
+		if (remotes[i].fetched)
+			update_deferred_symrefs(&remotes[i]);
+	if (open_fetch_head(&fetch_head)) {
+		result = 1;
+		goto out;
+	}
+	for (size_t i = 0; fetch_head.fp && i < nr; i++)
+		if (remotes[i].fetched)
+			strbuf_write(&remotes[i].fetch_head, fetch_head.fp);
+	close_fetch_head(&fetch_head);
+
+out:
+	strmap_clear(&seen, 0);
+	strbuf_release(&err);
+	return result;
+}
+
 /* Fetch multiple remotes in parallel */
 
 struct parallel_fetch_state {
 	const char **argv;
 	struct string_list *remotes;
+	struct deferred_remote *deferred;
 	int next, result;
 	const struct fetch_config *config;
 };
 
+static void push_deferred_updates_arg(struct strvec *args,
+				      struct deferred_remote *deferred)
+{
+	if (deferred)
+		strvec_pushf(args, "--deferred-updates=%s",
+			     get_tempfile_path(deferred->file));
+}
+
 static int fetch_next_remote(struct child_process *cp,
 			     struct strbuf *out UNUSED,
 			     void *cb, void **task_cb)
 {
 	struct parallel_fetch_state *state = cb;
+	int i = state->next;
 	char *remote;
 
 	if (state->next < 0 || state->next >= state->remotes->nr)
 		return 0;
 
 	remote = state->remotes->items[state->next++].string;
-	*task_cb = remote;
+	*task_cb = (void *)(intptr_t)i;
 
 	strvec_pushv(&cp->args, state->argv);
-	strvec_push(&cp->args, remote);
+	push_deferred_updates_arg(&cp->args,
+				  state->deferred ? &state->deferred[i] : NULL);
+	strvec_pushl(&cp->args, "--end-of-options", remote, NULL);
 	cp->git_cmd = 1;
 
 	if (verbosity >= 0 && state->config->display_format != DISPLAY_FORMAT_PORCELAIN)
@@ -2081,7 +2457,7 @@ static int fetch_failed_to_start(struct strbuf *out UNUSED,
 				 void *cb, void *task_cb)
 {
 	struct parallel_fetch_state *state = cb;
-	const char *remote = task_cb;
+	const char *remote = state->remotes->items[(intptr_t)task_cb].string;
 
 	state->result = error(_("could not fetch %s"), remote);
 
@@ -2092,12 +2468,15 @@ static int fetch_finished(int result, struct strbuf *out,
 			  void *cb, void *task_cb)
 {
 	struct parallel_fetch_state *state = cb;
-	const char *remote = task_cb;
+	int i = (intptr_t)task_cb;
+	const char *remote = state->remotes->items[i].string;
 
 	if (result) {
 		strbuf_addf(out, _("could not fetch '%s' (exit code: %d)\n"),
 			    remote, result);
 		state->result = -1;
+	} else if (state->deferred) {
+		state->deferred[i].fetched = 1;
 	}
 
 	return 0;
@@ -2108,6 +2487,7 @@ static int fetch_multiple(struct string_list *list, int max_children,
 {
 	int i, result = 0;
 	struct strvec argv = STRVEC_INIT;
+	struct deferred_remote *deferred = NULL;
 
 	if (!append && write_fetch_head) {
 		int errcode = truncate_fetch_head();
@@ -2115,6 +2495,24 @@ static int fetch_multiple(struct string_list *list, int max_children,
 			return errcode;
 	}
 
+	if (config->batch_ref_updates && !dry_run) {
+		CALLOC_ARRAY(deferred, list->nr);
+		for (i = 0; i < list->nr; i++) {
+			char *path = repo_git_path(the_repository, "fetch-updates-XXXXXX");
+
+			deferred[i].name = list->items[i].string;
+			strbuf_init(&deferred[i].symrefs, 0);
+			strbuf_init(&deferred[i].fetch_head, 0);
+			deferred[i].file = mks_tempfile(path);
+			free(path);
+			if (!deferred[i].file) {
+				result = error_errno(_("unable to create temporary file"));
+				goto out;
+			}
+			close_tempfile_gently(deferred[i].file);
+		}
+	}
+
 	/*
 	 * Cancel out the fetch.bundleURI config when running subprocesses,
 	 * to avoid fetching from the same bundle list multiple times.
@@ -2127,7 +2525,9 @@ static int fetch_multiple(struct string_list *list, int max_children,
 	add_options_to_argv(&argv, config);
 
 	if (max_children != 1 && list->nr != 1) {
-		struct parallel_fetch_state state = { argv.v, list, 0, 0, config };
+		struct parallel_fetch_state state = {
+			argv.v, list, deferred, 0, 0, config
+		};
 		const struct run_process_parallel_opts opts = {
 			.tr2_category = "fetch",
 			.tr2_label = "parallel/fetch",
@@ -2140,8 +2540,6 @@ static int fetch_multiple(struct string_list *list, int max_children,
 			.data = &state,
 		};
 
-		strvec_push(&argv, "--end-of-options");
-
 		run_processes_parallel(&opts);
 		result = state.result;
 	} else
@@ -2150,6 +2548,8 @@ static int fetch_multiple(struct string_list *list, int max_children,
 			struct child_process cmd = CHILD_PROCESS_INIT;
 
 			strvec_pushv(&cmd.args, argv.v);
+			push_deferred_updates_arg(&cmd.args,
+						  deferred ? &deferred[i] : NULL);
 			strvec_push(&cmd.args, name);
 			if (verbosity >= 0 && config->display_format != DISPLAY_FORMAT_PORCELAIN)
 				printf(_("Fetching %s\n"), name);
@@ -2157,9 +2557,17 @@ static int fetch_multiple(struct string_list *list, int max_children,
 			if (run_command(&cmd)) {
 				error(_("could not fetch %s"), name);
 				result = 1;
+			} else if (deferred) {
+				deferred[i].fetched = 1;
 			}
 		}
 
+	if (deferred && !(atomic_fetch && result) &&
+	    apply_deferred_updates(deferred, list->nr))
+		result = 1;
+
+out:
+	deferred_remotes_release(deferred, list->nr);
 	strvec_clear(&argv);
 	return !!result;
 }
@@ -2369,6 +2777,9 @@ int cmd_fetch(int argc,
 			      1, PARSE_OPT_NONEG),
 		{ OPTION_STRING, 0, "submodule-prefix", &submodule_prefix, N_("dir"),
 			   N_("prepend this to submodule path output"), PARSE_OPT_HIDDEN },
+		{ OPTION_STRING, 0, "deferred-updates", &deferred_updates_file, N_("file"),
+			   N_("record ref updates in <file> instead of applying them"),
+			   PARSE_OPT_HIDDEN },
 		OPT_CALLBACK_F(0, "recurse-submodules-default",
 			   &recurse_submodules_default, N_("on-demand"),
 			   N_("default for recursive fetching of submodules "
@@ -2593,7 +3004,7 @@ int cmd_fetch(int argc,
 			die(_("--filter can only be used with the remote "
 			      "configured in extensions.partialclone"));
 
-		if (atomic_fetch)
+		if (atomic_fetch && !config.batch_ref_updates)
 			die(_("--atomic can only be used when fetching "
 			      "from one remote"));
 
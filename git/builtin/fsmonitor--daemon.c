@@ -960,6 +960,177 @@ static int do_handle_client(struct fsmonitor_daemon_state *state,
 	return 0;
 }
 
+/*
+ * The daemon keeps the output of a few recent `git status` commands,
+ * so that a client can print it again instead of scanning the working
+ * directory, as long as nothing in it changed since.  The client hashes
+ * everything else the output depends on (its arguments, config, index,
+ * HEAD, ...) into the key; the daemon only vouches for the working
+ * directory, by tying each entry to the response token of the batch it
+ * was computed after.  Any new event starts a new batch (since that one
+ * is pinned) and a resync starts a new token id, either of which makes
+ * the entry stale.
+ */
+#define STATUS_CACHE_MAX_ENTRIES 16
+
+struct status_cache_entry {
+	char *token;
+	size_t len;
+	char *output;
+};
+
+static void status_cache_entry_free(struct status_cache_entry *entry)
+{
+	if (!entry)
+		return;
+	free(entry->token);
+	free(entry->output);
+	free(entry);
+}
+
+static void with_lock__status_cache_clear(struct fsmonitor_daemon_state *state)
+{
+	/* assert current thread holding state->main_lock */
+
+	struct hashmap_iter iter;
+	struct strmap_entry *e;
+
+	strmap_for_each_entry(&state->status_cache, &iter, e)
+		status_cache_entry_free(e->value);
+	/* keep the map usable, so that the next entry can be put in */
+	strmap_partial_clear(&state->status_cache, 0);
+}
+
+/*
+ * Answer "status-cache get <key>" with "hit" LF <output> if the entry
+ * for <key> is still valid, or with "miss <token>", where <token> is
+ * what the client should "put" its output with.
+ */
+static int do_handle_status_cache_get(struct fsmonitor_daemon_state *state,
+				      const char *key,
+				      ipc_server_reply_cb *reply,
+				      struct ipc_server_reply_data *reply_data)
+{
+	struct fsmonitor_token_data *token_data;
+	struct fsmonitor_batch *batch_head;
+	struct status_cache_entry *entry;
+	struct strbuf token = STRBUF_INIT;
+	struct strbuf response = STRBUF_INIT;
+
+	pthread_mutex_lock(&state->main_lock);
+
+	if (with_lock__wait_for_cookie(state) != FCIR_SEEN) {
+		pthread_mutex_unlock(&state->main_lock);
+		strbuf_addstr(&response, "miss");
+		goto reply;
+	}
+
+	/* See do_handle_client() for why the head is pinned. */
+	token_data = state->current_token_data;
+	batch_head = token_data->batch_head;
+	batch_head->pinned_time = time(NULL);
+	with_lock__format_response_token(&token, &token_data->token_id,
+					 batch_head);
+
+	entry = strmap_get(&state->status_cache, key);
+	if (entry && !strcmp(entry->token, token.buf)) {
+		strbuf_addstr(&response, "hit\n");
+		strbuf_add(&response, entry->output, entry->len);
+	} else {
+		strbuf_addf(&response, "miss %s", token.buf);
+	}
+
+	pthread_mutex_unlock(&state->main_lock);
+
+reply:
+	trace2_data_string("fsmonitor", the_repository, "status-cache",
+			   starts_with(response.buf, "hit") ? "hit" : "miss");
+	reply(reply_data, response.buf, response.len);
+
+	strbuf_release(&token);
+	strbuf_release(&response);
+	return 0;
+}
+
+/*
+ * Handle "status-cache put <key> <token>" LF <output> by remembering
+ * <output> for <key>, unless the working directory changed since the
+ * client got <token>.
+ */
+static int do_handle_status_cache_put(struct fsmonitor_daemon_state *state,
+				      const char *args, size_t args_len,
+				      ipc_server_reply_cb *reply,
+				      struct ipc_server_reply_data *reply_data)
+{
+	struct fsmonitor_token_data *token_data;
+	struct strbuf token = STRBUF_INIT;
+	const char *lf = memchr(args, '\n', args_len);
+	const char *sp;
+	char *key;
+	int stored = 0;
+
+	if (!lf || !(sp = memchr(args, ' ', lf - args))) {
+		trace_printf_key(&trace_fsmonitor,
+				 "fsmonitor: invalid status-cache request");
+		return 0;
+	}
+	key = xmemdupz(args, sp - args);
+	sp++;
+
+	pthread_mutex_lock(&state->main_lock);
+
+	token_data = state->current_token_data;
+	with_lock__format_response_token(&token, &token_data->token_id,
+					 token_data->batch_head);
+
+	if (token.len == lf - sp && !memcmp(token.buf, sp, token.len)) {
+		struct status_cache_entry *entry;
+
+		if (!strmap_contains(&state->status_cache, key) &&
+		    strmap_get_size(&state->status_cache) >= STATUS_CACHE_MAX_ENTRIES)
+			with_lock__status_cache_clear(state);
+
+		CALLOC_ARRAY(entry, 1);
+		entry->token = strbuf_detach(&token, NULL);
+		entry->len = args + args_len - (lf + 1);
+		entry->output = xmemdupz(lf + 1, entry->len);
+		status_cache_entry_free(strmap_put(&state->status_cache,
+						   key, entry));
+		stored = 1;
+	}
+
+	pthread_mutex_unlock(&state->main_lock);
+
+	reply(reply_data, stored ? "ok" : "stale", stored ? 2 : 5);
+
+	strbuf_release(&token);
+	free(key);
+	return 0;
+}
+
+static int do_handle_status_cache(struct fsmonitor_daemon_state *state,
+				  const char *command, size_t command_len,
+				  ipc_server_reply_cb *reply,
+				  struct ipc_server_reply_data *reply_data)
+{
+	const char *end = command + command_len;
+	const char *p;
+
+	/*
+	 * <command> := status-cache get <key> NUL
+	 *            | status-cache put <key> <token> LF <output>
+	 */
+	if (skip_prefix(command, "status-cache get ", &p) && !memchr(p, '\n', end - p))
+		return do_handle_status_cache_get(state, p, reply, reply_data);
+	if (skip_prefix(command, "status-cache put ", &p))
+		return do_handle_status_cache_put(state, p, end - p,
+						  reply, reply_data);
+
+	trace_printf_key(&trace_fsmonitor,
+			 "fsmonitor: invalid status-cache request");
+	return 0;
+}
+
 static ipc_server_application_cb handle_client;
 
 static int handle_client(void *data,
@@ -970,6 +1141,18 @@ static int handle_client(void *data,
 	struct fsmonitor_daemon_state *state = data;
 	int result;
 
+	/*
+	 * The status cache requests carry the output of `git status`,
+	 * which may not be text.
+	 */
+	if (starts_with(command, "status-cache ")) {
+		trace2_region_enter("fsmonitor", "status_cache", the_repository);
+		result = do_handle_status_cache(state, command, command_len,
+						reply, reply_data);
+		trace2_region_leave("fsmonitor", "status_cache", the_repository);
+		return result;
+	}
+
 	/*
 	 * The Simple IPC API now supports {char*, len} arguments, but
 	 * FSMonitor always uses proper null-terminated strings, so
@@ -1285,6 +1468,7 @@ static int fsmonitor_run_daemon(void)
 	memset(&state, 0, sizeof(state));
 
 	hashmap_init(&state.cookies, cookies_cmp, NULL, 0);
+	strmap_init(&state.status_cache);
 	pthread_mutex_init(&state.main_lock, NULL);
 	pthread_cond_init(&state.cookies_cond, NULL);
 	state.listen_error_code = 0;
@@ -1402,6 +1586,8 @@ static int fsmonitor_run_daemon(void)
 	err = fsmonitor_run_daemon_1(&state);
 
 done:
+	with_lock__status_cache_clear(&state);
+	strmap_clear(&state.status_cache, 0);
 	pthread_cond_destroy(&state.cookies_cond);
 	pthread_mutex_destroy(&state.main_lock);
 	fsm_listen__dtor(&state);
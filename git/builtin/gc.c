@@ -882,6 +882,9 @@ struct repository *repo UNUSED)
 	if (run_command(&rerere_cmd))
 		die(FAILED_RUN, rerere.v[0]);
 
+	if (!is_bare_repository())
+		repo_compact_index_journal(the_repository);
+
 	report_garbage = report_pack_garbage;
 	reprepare_packed_git(the_repository);
 	if (pack_garbage.nr > 0) {
@@ -31,6 +31,7 @@
 #include "run-command.h"
 #include "setup.h"
 #include "strvec.h"
+#include "trace2.h"
 
 static const char index_pack_usage[] =
 "git index-pack [-v] [-o <index-file>] [--keep | --keep=<msg>] [--[no-]rev-index] [--verify] [--strict[=<msg-id>=<severity>...]] [--fsck-objects[=<msg-id>=<severity>...]] (<pack-file> | --stdin [--fix-thin] [<pack-file>])";
@@ -142,6 +143,8 @@ static const char *progress_title;
 static int show_resolving_progress;
 static int show_stat;
 static int check_self_contained_and_connected;
+static const char *foreign_links_file;
+static struct oid_array foreign_links = OID_ARRAY_INIT;
 
 static struct progress *progress;
 
@@ -286,7 +289,13 @@ static unsigned check_objects(void)
 						  _("Checking objects"), max);
 
 	for (i = 0; i < max; i++) {
-		foreign_nr += check_object(get_indexed_object(i));
+		struct object *obj = get_indexed_object(i);
+
+		if (check_object(obj)) {
+			foreign_nr++;
+			if (foreign_links_file)
+				oid_array_append(&foreign_links, &obj->oid);
+		}
 		display_progress(progress, i + 1);
 	}
 
@@ -1932,6 +1941,8 @@ int cmd_index_pack(int argc,
 			} else if (!strcmp(arg, "--check-self-contained-and-connected")) {
 				strict = 1;
 				check_self_contained_and_connected = 1;
+			} else if (skip_prefix(arg, "--foreign-links=", &foreign_links_file)) {
+				strict = 1;
 			} else if (skip_to_optional_arg(arg, "--fsck-objects", &arg)) {
 				do_fsck_object = 1;
 				fsck_set_msg_types(&fsck_options, arg);
@@ -2072,15 +2083,31 @@ int cmd_index_pack(int argc,
 	if (show_stat)
 		CALLOC_ARRAY(obj_stat, st_add(nr_objects, 1));
 	CALLOC_ARRAY(ofs_deltas, nr_objects);
+	trace2_region_enter("index-pack", "parse-pack-objects", the_repository);
 	parse_pack_objects(pack_hash);
+	trace2_region_leave("index-pack", "parse-pack-objects", the_repository);
 	if (report_end_of_input)
 		write_in_full(2, "\0", 1);
+	trace2_region_enter("index-pack", "resolve-deltas", the_repository);
 	resolve_deltas(&opts);
 	conclude_pack(fix_thin_pack, curr_pack, pack_hash);
+	trace2_region_leave("index-pack", "resolve-deltas", the_repository);
 	free(ofs_deltas);
 	free(ref_deltas);
-	if (strict)
+	if (strict) {
+		trace2_region_enter("index-pack", "check-objects", the_repository);
 		foreign_nr = check_objects();
+		trace2_region_leave("index-pack", "check-objects", the_repository);
+	}
+	if (foreign_links_file) {
+		struct strbuf buf = STRBUF_INIT;
+
+		for (i = 0; i < foreign_links.nr; i++)
+			strbuf_addf(&buf, "%s\n", oid_to_hex(&foreign_links.oid[i]));
+		write_file_buf(foreign_links_file, buf.buf, buf.len);
+		strbuf_release(&buf);
+		oid_array_clear(&foreign_links);
+	}
 
 	if (show_stat)
 		show_pack_info(stat_only);
@@ -16,6 +16,7 @@
 #include "cache-tree.h"
 #include "unpack-trees.h"
 #include "parse-options.h"
+#include "preload-index.h"
 #include "resolve-undo.h"
 #include "setup.h"
 #include "sparse-index.h"
@@ -198,6 +199,9 @@ int cmd_read_tree(int argc,
 			die(_("You need to resolve your current index first"));
 		stage = opts.merge = 1;
 	}
+	/* Check whether the files to update are up to date on threads. */
+	if (opts.update)
+		preload_index(the_repository->index, NULL, 0);
 	resolve_undo_clear_index(the_repository->index);
 
 	for (i = 0; i < argc; i++) {
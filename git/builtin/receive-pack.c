@@ -61,6 +61,7 @@ static int deny_non_fast_forwards;
 static enum deny_action deny_current_branch = DENY_UNCONFIGURED;
 static enum deny_action deny_delete_current = DENY_UNCONFIGURED;
 static int receive_fsck_objects = -1;
+static int connectivity_via_index_pack;
 static int transfer_fsck_objects = -1;
 static struct strbuf fsck_msg_types = STRBUF_INIT;
 static int receive_unpack_limit = -1;
@@ -192,6 +193,11 @@ static int receive_pack_config(const char *var, const char *value,
 		return 0;
 	}
 
+	if (strcmp(var, "receive.connectivityviaindexpack") == 0) {
+		connectivity_via_index_pack = git_config_bool(var, value);
+		return 0;
+	}
+
 	if (strcmp(var, "receive.fsckobjects") == 0) {
 		receive_fsck_objects = git_config_bool(var, value);
 		return 0;
@@ -1777,6 +1783,7 @@ static void set_connectivity_errors(struct command *commands,
 struct iterate_data {
 	struct command *cmds;
 	struct shallow_info *si;
+	size_t boundary_pos;
 };
 
 static const struct object_id *iterate_receive_command_list(void *cb_data)
@@ -1917,6 +1924,29 @@ static void execute_commands_atomic(struct command *commands,
 	strbuf_release(&err);
 }
 
+/*
+ * With receive.connectivityViaIndexPack, index-pack has verified that
+ * everything objects in the received pack link to is either in the pack
+ * or already present, and told us about the latter.  The new history is
+ * then connected if those objects and any updated ref outside the pack
+ * are, which spares rev-list from walking all of the new objects again.
+ */
+static struct packed_git *received_pack;
+static struct oid_array pack_boundary = OID_ARRAY_INIT;
+
+static const struct object_id *iterate_pack_boundary(void *cb_data)
+{
+	struct iterate_data *data = cb_data;
+	const struct object_id *oid;
+
+	if (data->boundary_pos < pack_boundary.nr)
+		return &pack_boundary.oid[data->boundary_pos++];
+	while ((oid = iterate_receive_command_list(data)))
+		if (!find_pack_entry_one(oid, received_pack))
+			return oid;
+	return NULL;
+}
+
 static void execute_commands(struct command *commands,
 			     const char *unpacker_error,
 			     struct shallow_info *si,
@@ -1946,13 +1976,20 @@ static void execute_commands(struct command *commands,
 
 	data.cmds = commands;
 	data.si = si;
+	data.boundary_pos = 0;
 	opt.err_fd = err_fd;
 	opt.progress = err_fd && !quiet;
 	opt.env = tmp_objdir_env(tmp_objdir);
 	opt.exclude_hidden_refs_section = "receive";
 
-	if (check_connected(iterate_receive_command_list, &data, &opt))
+	trace2_region_enter("receive-pack", "check-connectivity", the_repository);
+	if (received_pack)
+		trace2_data_intmax("receive-pack", the_repository,
+				   "connectivity/boundary", pack_boundary.nr);
+	if (check_connected(received_pack ? iterate_pack_boundary :
+			    iterate_receive_command_list, &data, &opt))
 		set_connectivity_errors(commands, si);
+	trace2_region_leave("receive-pack", "check-connectivity", the_repository);
 
 	if (use_sideband)
 		finish_async(&muxer);
@@ -2020,10 +2057,12 @@ static void execute_commands(struct command *commands,
 			    (cmd->run_proc_receive || use_atomic))
 				cmd->error_string = "fail to run proc-receive hook";
 
+	trace2_region_enter("receive-pack", "update-refs", the_repository);
 	if (use_atomic)
 		execute_commands_atomic(commands, si);
 	else
 		execute_commands_non_atomic(commands, si);
+	trace2_region_leave("receive-pack", "update-refs", the_repository);
 
 	if (shallow_update)
 		BUG_if_skipped_connectivity_check(commands, si);
@@ -2216,12 +2255,48 @@ static void push_header_arg(struct strvec *args, struct pack_header *hdr)
 		     ntohl(hdr->hdr_version), ntohl(hdr->hdr_entries));
 }
 
+static void read_pack_boundary(struct tempfile *boundary)
+{
+	struct strbuf buf = STRBUF_INIT, pack_name = STRBUF_INIT;
+	const char *p, *end, *name;
+	size_t name_len;
+
+	if (!pack_lockfile ||
+	    strbuf_read_file(&buf, get_tempfile_path(boundary), 0) < 0)
+		goto out;
+	for (p = buf.buf; *p; p = end + 1) {
+		struct object_id oid;
+
+		if (parse_oid_hex(p, &oid, &end) || *end != '\n') {
+			oid_array_clear(&pack_boundary);
+			goto out;
+		}
+		oid_array_append(&pack_boundary, &oid);
+	}
+
+	/* the pack sits in the quarantine directory, added as an alternate */
+	name = find_last_dir_sep(get_tempfile_path(pack_lockfile));
+	name = name ? name : get_tempfile_path(pack_lockfile);
+	if (!strip_suffix(name, ".keep", &name_len))
+		goto out;
+	strbuf_addf(&pack_name, "%.*s.pack", (int)name_len, name);
+	for (received_pack = get_all_packs(the_repository);
+	     received_pack; received_pack = received_pack->next)
+		if (ends_with(received_pack->pack_name, pack_name.buf))
+			break;
+
+out:
+	strbuf_release(&buf);
+	strbuf_release(&pack_name);
+}
+
 static const char *unpack(int err_fd, struct shallow_info *si)
 {
 	struct pack_header hdr;
 	const char *hdr_err;
 	int status;
 	struct child_process child = CHILD_PROCESS_INIT;
+	struct tempfile *boundary = NULL;
 	int fsck_objects = (receive_fsck_objects >= 0
 			    ? receive_fsck_objects
 			    : transfer_fsck_objects >= 0
@@ -2299,6 +2374,18 @@ static const char *unpack(int err_fd, struct shallow_info *si)
 		if (max_input_size)
 			strvec_pushf(&child.args, "--max-input-size=%"PRIuMAX,
 				     (uintmax_t)max_input_size);
+		if (connectivity_via_index_pack && !si->nr_ours && !si->nr_theirs) {
+			char *path = repo_git_path(the_repository,
+						   "receive-boundary-XXXXXX");
+
+			boundary = mks_tempfile(path);
+			free(path);
+			if (boundary) {
+				close_tempfile_gently(boundary);
+				strvec_pushf(&child.args, "--foreign-links=%s",
+					     get_tempfile_path(boundary));
+			}
+		}
 		child.out = -1;
 		child.err = err_fd;
 		child.git_cmd = 1;
@@ -2314,9 +2401,14 @@ static const char *unpack(int err_fd, struct shallow_info *si)
 		close(child.out);
 
 		status = finish_command(&child);
-		if (status)
+		if (status) {
+			delete_tempfile(&boundary);
 			return "index-pack abnormal exit";
+		}
 		reprepare_packed_git(the_repository);
+		if (boundary)
+			read_pack_boundary(boundary);
+		delete_tempfile(&boundary);
 	}
 	return NULL;
 }
@@ -2596,12 +2688,16 @@ int cmd_receive_pack(int argc,
 		if (!si.nr_ours && !si.nr_theirs)
 			shallow_update = 0;
 		if (!delete_only(commands)) {
+			trace2_region_enter("receive-pack", "unpack", the_repository);
 			unpack_status = unpack_with_sideband(&si);
+			trace2_region_leave("receive-pack", "unpack", the_repository);
 			update_shallow_info(commands, &si, &ref);
 		}
 		use_keepalive = KEEPALIVE_ALWAYS;
 		execute_commands(commands, unpack_status, &si,
 				 &push_options);
+		received_pack = NULL;
+		oid_array_clear(&pack_boundary);
 		delete_tempfile(&pack_lockfile);
 		sigchain_push(SIGPIPE, SIG_IGN);
 		if (report_status_v2)
@@ -28,6 +28,7 @@
 #include "object-name.h"
 #include "parse-options.h"
 #include "path.h"
+#include "preload-index.h"
 #include "repository.h"
 #include "unpack-trees.h"
 #include "cache-tree.h"
@@ -100,6 +101,9 @@ static int reset_index(const char *ref, const struct object_id *oid, int reset_t
 	}
 
 	repo_read_index_unmerged(the_repository);
+	/* Check whether the files to update are up to date on threads. */
+	if (opts.update)
+		preload_index(the_repository->index, NULL, 0);
 
 	if (reset_type == KEEP) {
 		struct object_id head_oid;
@@ -4,6 +4,7 @@
 #include "builtin.h"
 #include "config.h"
 #include "commit.h"
+#include "commit-graph.h"
 #include "diff.h"
 #include "environment.h"
 #include "gettext.h"
@@ -26,6 +27,7 @@
 #include "packfile.h"
 #include "quote.h"
 #include "strbuf.h"
+#include "tag.h"
 
 static const char rev_list_usage[] =
 "git rev-list [<options>] <commit>... [--] [<path>...]\n"
@@ -532,6 +534,67 @@ static int try_bitmap_count(struct rev_info *revs,
 	return 0;
 }
 
+/*
+ * Count the commits with commit_graph_count_reachable(), which does not
+ * need a "struct commit" for each of them.  It only knows about plain
+ * reachability, so anything that limits or marks the commits we count
+ * has to go through the revision walk.
+ */
+static int try_commit_graph_count(struct rev_info *revs)
+{
+	struct commit **tips = NULL, **bases = NULL;
+	size_t tips_nr = 0, tips_alloc = 0, bases_nr = 0, bases_alloc = 0;
+	uint64_t count;
+	int ret = -1;
+
+	if (!revs->count || revs->commits || !revs->pending.nr)
+		return -1;
+	if (revs->left_right || revs->left_only || revs->right_only ||
+	    revs->cherry_mark || revs->cherry_pick ||
+	    revs->tag_objects || revs->tree_objects || revs->blob_objects)
+		return -1;
+	if (revs->prune || revs->max_count >= 0 || revs->skip_count >= 0 ||
+	    revs->max_age != -1 || revs->max_age_as_filter != -1 ||
+	    revs->min_age != -1 || revs->min_parents || revs->max_parents >= 0 ||
+	    revs->first_parent_only || revs->exclude_first_parent_only ||
+	    revs->ancestry_path || revs->boundary || revs->bisect ||
+	    revs->no_walk || revs->reflog_info || revs->line_level_traverse ||
+	    revs->simplify_by_decoration || revs->include_check ||
+	    revs->grep_filter.pattern_list || revs->grep_filter.header_list ||
+	    revs->unpacked || revs->no_kept_objects || revs->filter.choice ||
+	    revs->exclude_promisor_objects || revs->ignore_missing_links ||
+	    revs->do_not_die_on_missing_objects)
+		return -1;
+
+	for (size_t i = 0; i < revs->pending.nr; i++) {
+		struct object *obj = revs->pending.objects[i].item;
+		unsigned flags = obj->flags;
+
+		obj = deref_tag(the_repository, obj, NULL, 0);
+		if (!obj || obj->type != OBJ_COMMIT)
+			goto out;
+		if (flags & UNINTERESTING) {
+			ALLOC_GROW(bases, bases_nr + 1, bases_alloc);
+			bases[bases_nr++] = (struct commit *)obj;
+		} else {
+			ALLOC_GROW(tips, tips_nr + 1, tips_alloc);
+			tips[tips_nr++] = (struct commit *)obj;
+		}
+	}
+
+	if (commit_graph_count_reachable(the_repository, tips, tips_nr,
+					 bases, bases_nr, &count))
+		goto out;
+
+	printf("%"PRIu64"\n", count);
+	ret = 0;
+
+out:
+	free(tips);
+	free(bases);
+	return ret;
+}
+
 static int try_bitmap_traversal(struct rev_info *revs,
 				int filter_provided_objects)
 {
@@ -803,6 +866,10 @@ int cmd_rev_list(int argc,
 			goto cleanup;
 	}
 
+	if (!bisect_list && !show_disk_usage && !show_progress &&
+	    !try_commit_graph_count(&revs))
+		goto cleanup;
+
 	if (prepare_revision_walk(&revs))
 		die("revision walk setup failed");
 	if (revs.tree_objects)
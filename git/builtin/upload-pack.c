@@ -11,14 +11,77 @@
 #include "upload-pack.h"
 #include "serve.h"
 #include "commit.h"
+#include "config.h"
 #include "environment.h"
+#include "strvec.h"
+#include "upload-pack-worker.h"
 
 static const char * const upload_pack_usage[] = {
 	N_("git-upload-pack [--[no-]strict] [--timeout=<n>] [--stateless-rpc]\n"
-	   "                [--advertise-refs] <directory>"),
+	   "                [--advertise-refs] [--worker=<socket>] <directory>"),
 	NULL
 };
 
+static void serve_upload_pack(int advertise_refs, int stateless_rpc, int timeout)
+{
+	switch (determine_protocol_version_server()) {
+	case protocol_v2:
+		if (advertise_refs)
+			protocol_v2_advertise_capabilities(the_repository);
+		else
+			protocol_v2_serve_loop(the_repository, stateless_rpc);
+		break;
+	case protocol_v1:
+		/*
+		 * v1 is just the original protocol with a version string,
+		 * so just fall through after writing the version string.
+		 */
+		if (advertise_refs || !stateless_rpc)
+			packet_write_fmt(1, "version 1\n");
+
+		/* fallthrough */
+	case protocol_v0:
+		upload_pack(advertise_refs, stateless_rpc, timeout);
+		break;
+	case protocol_unknown_version:
+		BUG("unknown protocol version");
+	}
+}
+
+#ifndef NO_UNIX_SOCKETS
+static int serve_worker_request(const struct strvec *args)
+{
+	int advertise_refs = 0;
+	int stateless_rpc = 0;
+	int timeout = 0;
+	struct option options[] = {
+		OPT_BOOL(0, "stateless-rpc", &stateless_rpc, NULL),
+		OPT_BOOL(0, "http-backend-info-refs", &advertise_refs, NULL),
+		OPT_INTEGER(0, "timeout", &timeout, NULL),
+		OPT_END()
+	};
+	struct strvec argv = STRVEC_INIT;
+	const char **parsed;
+	int argc, ret = 0;
+
+	strvec_push(&argv, "upload-pack");
+	strvec_pushv(&argv, args->v);
+	/* parse_options() reshuffles its argv, so give it a copy */
+	DUP_ARRAY(parsed, argv.v, argv.nr + 1);
+	argc = parse_options(argv.nr, parsed, NULL, options, upload_pack_usage,
+			     PARSE_OPT_NO_INTERNAL_HELP);
+	if (argc)
+		ret = error(_("unexpected argument in worker request: %s"),
+			    parsed[0]);
+	else
+		serve_upload_pack(advertise_refs, stateless_rpc, timeout);
+
+	free(parsed);
+	strvec_clear(&argv);
+	return ret;
+}
+#endif
+
 int cmd_upload_pack(int argc,
 		    const char **argv,
 		    const char *prefix,
@@ -29,6 +92,7 @@ int cmd_upload_pack(int argc,
 	int advertise_refs = 0;
 	int stateless_rpc = 0;
 	int timeout = 0;
+	const char *worker = NULL;
 	struct option options[] = {
 		OPT_BOOL(0, "stateless-rpc", &stateless_rpc,
 			 N_("quit after a single request/response exchange")),
@@ -39,6 +103,8 @@ int cmd_upload_pack(int argc,
 			 N_("do not try <directory>/.git/ if <directory> is no Git directory")),
 		OPT_INTEGER(0, "timeout", &timeout,
 			    N_("interrupt transfer after <n> seconds of inactivity")),
+		OPT_STRING(0, "worker", &worker, N_("socket"),
+			   N_("keep serving requests handed over on <socket>")),
 		OPT_END()
 	};
 	unsigned enter_repo_flags = ENTER_REPO_ANY_OWNER_OK;
@@ -62,28 +128,22 @@ int cmd_upload_pack(int argc,
 	if (!enter_repo(dir, enter_repo_flags))
 		die("'%s' does not appear to be a git repository", dir);
 
-	switch (determine_protocol_version_server()) {
-	case protocol_v2:
-		if (advertise_refs)
-			protocol_v2_advertise_capabilities(the_repository);
-		else
-			protocol_v2_serve_loop(the_repository, stateless_rpc);
-		break;
-	case protocol_v1:
-		/*
-		 * v1 is just the original protocol with a version string,
-		 * so just fall through after writing the version string.
-		 */
-		if (advertise_refs || !stateless_rpc)
-			packet_write_fmt(1, "version 1\n");
+	if (worker) {
+#ifndef NO_UNIX_SOCKETS
+		unsigned long idle_timeout = 300;
 
-		/* fallthrough */
-	case protocol_v0:
-		upload_pack(advertise_refs, stateless_rpc, timeout);
-		break;
-	case protocol_unknown_version:
-		BUG("unknown protocol version");
+		repo_config_get_ulong(the_repository,
+				      "uploadpack.workeridletimeout",
+				      &idle_timeout);
+		if (upload_pack_worker_run(worker, idle_timeout,
+					   serve_worker_request) < 0)
+			return 1;
+		return 0;
+#else
+		die(_("--worker requires Unix domain socket support"));
+#endif
 	}
 
+	serve_upload_pack(advertise_refs, stateless_rpc, timeout);
 	return 0;
 }
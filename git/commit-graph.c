@@ -21,6 +21,7 @@
 #include "hashmap.h"
 #include "replace-object.h"
 #include "progress.h"
+#include "prio-queue.h"
 #include "bloom.h"
 #include "commit-slab.h"
 #include "shallow.h"
@@ -28,6 +29,9 @@
 #include "trace2.h"
 #include "tree.h"
 #include "chunk-format.h"
+#include "ident.h"
+#include "pretty.h"
+#include "strmap.h"
 
 void git_test_write_commit_graph_or_die(void)
 {
@@ -53,6 +57,11 @@ void git_test_write_commit_graph_or_die(void)
 #define GRAPH_CHUNKID_BLOOMINDEXES 0x42494458 /* "BIDX" */
 #define GRAPH_CHUNKID_BLOOMDATA 0x42444154 /* "BDAT" */
 #define GRAPH_CHUNKID_BASE 0x42415345 /* "BASE" */
+#define GRAPH_CHUNKID_IDENTITYINDEX 0x49494458 /* "IIDX" */
+#define GRAPH_CHUNKID_IDENTITYDATA 0x49444154 /* "IDAT" */
+#define GRAPH_CHUNKID_SUBJECTINDEX 0x53494458 /* "SIDX" */
+#define GRAPH_CHUNKID_SUBJECTDATA 0x53444154 /* "SDAT" */
+#define GRAPH_CHUNKID_REACHINDEX 0x52454348 /* "RECH" */
 
 #define GRAPH_DATA_WIDTH (the_hash_algo->rawsz + 16)
 
@@ -65,6 +74,12 @@ void git_test_write_commit_graph_or_die(void)
 
 #define GRAPH_LAST_EDGE 0x80000000
 
+#define GRAPH_IDENTITY_WIDTH 32
+#define GRAPH_IDENTITY_NONE 0xffffffff
+
+#define GRAPH_REACH_INDEX_WIDTH 20
+#define GRAPH_REACH_NUMBER_NONE 0xffffffff
+
 #define GRAPH_HEADER_SIZE 8
 #define GRAPH_FANOUT_SIZE (4 * 256)
 #define GRAPH_MIN_SIZE (GRAPH_HEADER_SIZE + 4 * CHUNK_TOC_ENTRY_SIZE \
@@ -368,6 +383,55 @@ static int graph_read_bloom_data(const unsigned char *chunk_start,
 	return 0;
 }
 
+static int graph_read_identity_index(const unsigned char *chunk_start,
+				     size_t chunk_size, void *data)
+{
+	struct commit_graph *g = data;
+	if (chunk_size / GRAPH_IDENTITY_WIDTH != g->num_commits) {
+		warning(_("commit-graph identity index chunk is wrong size"));
+		return -1;
+	}
+	g->chunk_identity_index = chunk_start;
+	return 0;
+}
+
+static int graph_read_identity_data(const unsigned char *chunk_start,
+				    size_t chunk_size, void *data)
+{
+	struct commit_graph *g = data;
+	if (chunk_size && chunk_start[chunk_size - 1]) {
+		warning(_("commit-graph identity data chunk is not NUL-terminated"));
+		return -1;
+	}
+	g->chunk_identity_data = chunk_start;
+	g->chunk_identity_data_size = chunk_size;
+	return 0;
+}
+
+static int graph_read_subject_index(const unsigned char *chunk_start,
+				    size_t chunk_size, void *data)
+{
+	struct commit_graph *g = data;
+	if (chunk_size / sizeof(uint32_t) != g->num_commits) {
+		warning(_("commit-graph subject index chunk is wrong size"));
+		return -1;
+	}
+	g->chunk_subject_index = chunk_start;
+	return 0;
+}
+
+static int graph_read_reach_index(const unsigned char *chunk_start,
+				  size_t chunk_size, void *data)
+{
+	struct commit_graph *g = data;
+	if (chunk_size / GRAPH_REACH_INDEX_WIDTH != g->num_commits) {
+		warning(_("commit-graph reachability index chunk is wrong size"));
+		return -1;
+	}
+	g->chunk_reach_index = chunk_start;
+	return 0;
+}
+
 struct commit_graph *parse_commit_graph(struct repo_settings *s,
 					void *graph_map, size_t graph_size)
 {
@@ -473,6 +537,26 @@ struct commit_graph *parse_commit_graph(struct repo_settings *s,
 		FREE_AND_NULL(graph->bloom_filter_settings);
 	}
 
+	read_chunk(cf, GRAPH_CHUNKID_IDENTITYINDEX,
+		   graph_read_identity_index, graph);
+	read_chunk(cf, GRAPH_CHUNKID_IDENTITYDATA,
+		   graph_read_identity_data, graph);
+	read_chunk(cf, GRAPH_CHUNKID_SUBJECTINDEX,
+		   graph_read_subject_index, graph);
+	pair_chunk(cf, GRAPH_CHUNKID_SUBJECTDATA, &graph->chunk_subject_data,
+		   &graph->chunk_subject_data_size);
+
+	if (!graph->chunk_identity_index || !graph->chunk_identity_data ||
+	    !graph->chunk_subject_index || !graph->chunk_subject_data) {
+		/* The identity and subject chunks are only useful together. */
+		graph->chunk_identity_index = NULL;
+		graph->chunk_identity_data = NULL;
+		graph->chunk_subject_index = NULL;
+		graph->chunk_subject_data = NULL;
+	}
+
+	read_chunk(cf, GRAPH_CHUNKID_REACHINDEX, graph_read_reach_index, graph);
+
 	oidread(&graph->oid, graph->data + graph->data_len - graph->hash_len,
 		the_repository->hash_algo);
 
@@ -887,12 +971,42 @@ static struct commit_list **insert_parent_or_die(struct repository *r,
 	return &commit_list_insert(c, pptr)->next;
 }
 
+/*
+ * Read the generation number of the commit at "lex_index" of "g", whose
+ * commit data is at "commit_data" and whose commit date is "date".
+ */
+static timestamp_t read_graph_generation(struct commit_graph *g,
+					 uint32_t lex_index,
+					 const unsigned char *commit_data,
+					 timestamp_t date)
+{
+	uint32_t offset_pos;
+	uint64_t offset;
+
+	if (!g->read_generation_data)
+		return get_be32(commit_data + g->hash_len + 8) >> 2;
+
+	offset = (timestamp_t)get_be32(g->chunk_generation_data + st_mult(sizeof(uint32_t), lex_index));
+
+	if (offset & CORRECTED_COMMIT_DATE_OFFSET_OVERFLOW) {
+		if (!g->chunk_generation_data_overflow)
+			die(_("commit-graph requires overflow generation data but has none"));
+
+		offset_pos = offset ^ CORRECTED_COMMIT_DATE_OFFSET_OVERFLOW;
+		if (g->chunk_generation_data_overflow_size / sizeof(uint64_t) <= offset_pos)
+			die(_("commit-graph overflow generation data is too small"));
+		return date +
+			get_be64(g->chunk_generation_data_overflow + sizeof(uint64_t) * offset_pos);
+	}
+	return date + offset;
+}
+
 static void fill_commit_graph_info(struct commit *item, struct commit_graph *g, uint32_t pos)
 {
 	const unsigned char *commit_data;
 	struct commit_graph_data *graph_data;
-	uint32_t lex_index, offset_pos;
-	uint64_t date_high, date_low, offset;
+	uint32_t lex_index;
+	uint64_t date_high, date_low;
 
 	while (pos < g->num_commits_in_base)
 		g = g->base_graph;
@@ -910,22 +1024,8 @@ static void fill_commit_graph_info(struct commit *item, struct commit_graph *g,
 	date_low = get_be32(commit_data + g->hash_len + 12);
 	item->date = (timestamp_t)((date_high << 32) | date_low);
 
-	if (g->read_generation_data) {
-		offset = (timestamp_t)get_be32(g->chunk_generation_data + st_mult(sizeof(uint32_t), lex_index));
-
-		if (offset & CORRECTED_COMMIT_DATE_OFFSET_OVERFLOW) {
-			if (!g->chunk_generation_data_overflow)
-				die(_("commit-graph requires overflow generation data but has none"));
-
-			offset_pos = offset ^ CORRECTED_COMMIT_DATE_OFFSET_OVERFLOW;
-			if (g->chunk_generation_data_overflow_size / sizeof(uint64_t) <= offset_pos)
-				die(_("commit-graph overflow generation data is too small"));
-			graph_data->generation = item->date +
-				get_be64(g->chunk_generation_data_overflow + sizeof(uint64_t) * offset_pos);
-		} else
-			graph_data->generation = item->date + offset;
-	} else
-		graph_data->generation = get_be32(commit_data + g->hash_len + 8) >> 2;
+	graph_data->generation = read_graph_generation(g, lex_index,
+						       commit_data, item->date);
 
 	if (g->topo_levels)
 		*topo_level_slab_at(g->topo_levels, item) = get_be32(commit_data + g->hash_len + 8) >> 2;
@@ -1130,6 +1230,449 @@ struct tree *get_commit_tree_in_graph(struct repository *r, const struct commit
 	return get_commit_tree_in_graph_one(r, r->objects->commit_graph, c);
 }
 
+/*
+ * The parts of a commit stored in the identity and subject chunks: enough
+ * to reproduce its "author" and "committer" headers and the first
+ * paragraph of its message.
+ */
+struct commit_summary {
+	const char *author, *committer;
+	size_t author_len, committer_len;
+	timestamp_t author_date, committer_date;
+	int32_t author_tz, committer_tz;
+	const char *subject;
+	size_t subject_len;
+};
+
+static void add_summary_ident(struct strbuf *out,
+			      const char *ident, size_t ident_len,
+			      timestamp_t date, int32_t tz)
+{
+	strbuf_add(out, ident, ident_len);
+	strbuf_addf(out, " %"PRItime" %+05d", date, (int)tz);
+}
+
+static void format_commit_summary(struct strbuf *out,
+				  const struct commit_summary *s)
+{
+	strbuf_addstr(out, "author ");
+	add_summary_ident(out, s->author, s->author_len,
+			  s->author_date, s->author_tz);
+	strbuf_addstr(out, "\ncommitter ");
+	add_summary_ident(out, s->committer, s->committer_len,
+			  s->committer_date, s->committer_tz);
+	strbuf_addstr(out, "\n\n");
+	strbuf_add(out, s->subject, s->subject_len);
+}
+
+/*
+ * Split the value of an "author" or "committer" header into identity,
+ * date and timezone, and make sure that add_summary_ident() gives back
+ * the very same bytes.
+ */
+static int parse_summary_ident(const char *line, const char *eol,
+			       const char **ident, size_t *ident_len,
+			       timestamp_t *date, int32_t *tz)
+{
+	struct ident_split split;
+	struct strbuf check = STRBUF_INIT;
+	int ret = 0;
+
+	if (split_ident_line(&split, line, eol - line) ||
+	    !split.date_begin || !split.tz_begin ||
+	    split.date_begin == line)
+		return -1;
+
+	*ident = line;
+	*ident_len = split.date_begin - line - 1;
+	*date = parse_timestamp(split.date_begin, NULL, 10);
+	*tz = strtol(split.tz_begin, NULL, 10);
+
+	add_summary_ident(&check, *ident, *ident_len, *date, *tz);
+	if (check.len != eol - line || memcmp(check.buf, line, check.len))
+		ret = -1;
+	strbuf_release(&check);
+	return ret;
+}
+
+/*
+ * Fill `s` from the commit buffer `buf`. Returns -1 if the commit cannot
+ * be summarized faithfully, e.g. because its message is not in UTF-8.
+ */
+static int parse_commit_summary(const char *buf, struct commit_summary *s)
+{
+	const char *line = buf, *msg;
+	int seen_author = 0, seen_committer = 0;
+
+	memset(s, 0, sizeof(*s));
+	while (*line && *line != '\n') {
+		const char *eol = strchrnul(line, '\n');
+		const char *v;
+
+		if (skip_prefix(line, "author ", &v)) {
+			if (seen_author++ ||
+			    parse_summary_ident(v, eol, &s->author, &s->author_len,
+						&s->author_date, &s->author_tz))
+				return -1;
+		} else if (skip_prefix(line, "committer ", &v)) {
+			if (seen_committer++ ||
+			    parse_summary_ident(v, eol, &s->committer, &s->committer_len,
+						&s->committer_date, &s->committer_tz))
+				return -1;
+		} else if (starts_with(line, "encoding ")) {
+			return -1;
+		}
+		line = *eol ? eol + 1 : eol;
+	}
+	if (!seen_author || !seen_committer)
+		return -1;
+
+	msg = skip_blank_lines(line);
+	s->subject = msg;
+	s->subject_len = format_subject(NULL, msg, NULL) - msg;
+	return 0;
+}
+
+static int fill_summary_from_graph(struct commit_graph *g, uint32_t lex_index,
+				   struct commit_summary *s)
+{
+	const unsigned char *entry = g->chunk_identity_index +
+		st_mult(GRAPH_IDENTITY_WIDTH, lex_index);
+	uint32_t author = get_be32(entry);
+	uint32_t committer = get_be32(entry + 4);
+	uint32_t start = 0, end;
+
+	if (author == GRAPH_IDENTITY_NONE)
+		return 0;
+
+	if (lex_index)
+		start = get_be32(g->chunk_subject_index +
+				 st_mult(sizeof(uint32_t), lex_index - 1));
+	end = get_be32(g->chunk_subject_index +
+		       st_mult(sizeof(uint32_t), lex_index));
+
+	if (author >= g->chunk_identity_data_size ||
+	    committer >= g->chunk_identity_data_size ||
+	    start > end || end > g->chunk_subject_data_size) {
+		warning(_("commit-graph identity or subject data is out of bounds"));
+		return 0;
+	}
+
+	s->author = (const char *)g->chunk_identity_data + author;
+	s->author_len = strlen(s->author);
+	s->committer = (const char *)g->chunk_identity_data + committer;
+	s->committer_len = strlen(s->committer);
+	s->author_date = get_be64(entry + 8);
+	s->committer_date = get_be64(entry + 16);
+	s->author_tz = (int32_t)get_be32(entry + 24);
+	s->committer_tz = (int32_t)get_be32(entry + 28);
+	s->subject = (const char *)g->chunk_subject_data + start;
+	s->subject_len = end - start;
+	return 1;
+}
+
+int get_commit_summary_in_graph(struct repository *r,
+				const struct commit *c,
+				struct strbuf *out)
+{
+	uint32_t pos = commit_graph_position(c);
+	struct commit_graph *g;
+	struct commit_summary s;
+
+	if (pos == COMMIT_NOT_FROM_GRAPH || !prepare_commit_graph(r))
+		return 0;
+
+	g = r->objects->commit_graph;
+	while (g && pos < g->num_commits_in_base)
+		g = g->base_graph;
+	if (!g || pos >= g->num_commits + g->num_commits_in_base ||
+	    !g->chunk_identity_index ||
+	    !fill_summary_from_graph(g, pos - g->num_commits_in_base, &s))
+		return 0;
+
+	format_commit_summary(out, &s);
+	return 1;
+}
+
+struct commit_reach_label {
+	uint32_t post[2];
+	uint32_t low[2];
+	uint32_t tree_low;
+};
+
+static int get_commit_reach_label_one(struct commit_graph *g, uint32_t pos,
+				      struct commit_reach_label *label)
+{
+	const unsigned char *entry;
+
+	while (g && pos < g->num_commits_in_base)
+		g = g->base_graph;
+	if (!g || pos >= g->num_commits + g->num_commits_in_base ||
+	    !g->chunk_reach_index)
+		return 0;
+
+	entry = g->chunk_reach_index +
+		st_mult(GRAPH_REACH_INDEX_WIDTH, pos - g->num_commits_in_base);
+	label->post[0] = get_be32(entry);
+	label->low[0] = get_be32(entry + 4);
+	label->post[1] = get_be32(entry + 8);
+	label->low[1] = get_be32(entry + 12);
+	label->tree_low = get_be32(entry + 16);
+	return 1;
+}
+
+static int get_commit_reach_label(struct repository *r,
+				  const struct commit *c,
+				  struct commit_reach_label *label)
+{
+	uint32_t pos = commit_graph_position(c);
+
+	if (pos == COMMIT_NOT_FROM_GRAPH || !prepare_commit_graph(r))
+		return 0;
+
+	return get_commit_reach_label_one(r->objects->commit_graph, pos, label);
+}
+
+int commit_graph_can_reach(struct repository *r,
+			   const struct commit *from,
+			   const struct commit *to)
+{
+	struct commit_reach_label f, t;
+	int i;
+
+	if (from == to)
+		return 1;
+	if (!get_commit_reach_label(r, from, &f) ||
+	    !get_commit_reach_label(r, to, &t))
+		return -1;
+
+	if (f.tree_low <= t.post[0] && t.post[0] <= f.post[0])
+		return 1;
+	for (i = 0; i < 2; i++)
+		if (t.post[i] >= f.post[i] || t.low[i] < f.low[i])
+			return 0;
+	return -1;
+}
+
+int commit_graph_has_reach_index(struct repository *r)
+{
+	struct commit_graph *g;
+
+	if (!prepare_commit_graph(r))
+		return 0;
+
+	for (g = r->objects->commit_graph; g; g = g->base_graph)
+		if (g->chunk_reach_index)
+			return 1;
+	return 0;
+}
+
+/*
+ * Walks over positions in the commit-graph, without a "struct commit"
+ * for each commit visited: flags live in an array indexed by position,
+ * and parents are read from the commit data and extra edges chunks as
+ * they are needed.
+ */
+#define GRAPH_WALK_TIP    (1u<<0)
+#define GRAPH_WALK_BASE   (1u<<1)
+#define GRAPH_WALK_QUEUED (1u<<2)
+#define GRAPH_WALK_DONE   (1u<<3)
+
+struct graph_walk {
+	struct commit_graph *g;
+	uint8_t *flags;
+	struct prio_queue queue;
+	size_t nonstale;
+	uint64_t visited;
+	uint32_t *parents;
+	size_t parents_nr, parents_alloc;
+};
+
+static struct commit_graph *graph_for_pos(struct commit_graph *g, uint32_t pos)
+{
+	while (g && pos < g->num_commits_in_base)
+		g = g->base_graph;
+	return g;
+}
+
+static timestamp_t graph_walk_generation(struct graph_walk *walk, uint32_t pos)
+{
+	struct commit_graph *g = graph_for_pos(walk->g, pos);
+	uint32_t lex_index = pos - g->num_commits_in_base;
+	const unsigned char *commit_data =
+		g->chunk_commit_data + st_mult(g->hash_len + 16, lex_index);
+	timestamp_t date = ((timestamp_t)(get_be32(commit_data + g->hash_len + 8) & 0x3) << 32) |
+			   get_be32(commit_data + g->hash_len + 12);
+
+	return read_graph_generation(g, lex_index, commit_data, date);
+}
+
+/* Queue entries are positions plus one, so that none of them is NULL. */
+static int graph_walk_generation_compare(const void *one, const void *two,
+					 void *cb_data)
+{
+	timestamp_t a = graph_walk_generation(cb_data, (uintptr_t)one - 1);
+	timestamp_t b = graph_walk_generation(cb_data, (uintptr_t)two - 1);
+
+	/* larger generations come out of the queue first */
+	return (a < b) - (a > b);
+}
+
+static void graph_walk_generation_key(const void *thing, uint64_t key[2],
+				      void *cb_data)
+{
+	key[0] = graph_walk_generation(cb_data, (uintptr_t)thing - 1);
+	key[1] = 0;
+}
+
+/*
+ * Read the positions of the parents of the commit at "pos" into
+ * walk->parents.  Returns -1 if the commit-graph is corrupt.
+ */
+static int graph_walk_read_parents(struct graph_walk *walk, uint32_t pos)
+{
+	struct commit_graph *g = graph_for_pos(walk->g, pos);
+	const unsigned char *commit_data;
+	uint32_t edge_value, parent_data_pos;
+
+	walk->parents_nr = 0;
+	commit_data = g->chunk_commit_data +
+		st_mult(g->hash_len + 16, pos - g->num_commits_in_base);
+
+	edge_value = get_be32(commit_data + g->hash_len);
+	if (edge_value == GRAPH_PARENT_NONE)
+		return 0;
+	ALLOC_GROW(walk->parents, walk->parents_nr + 1, walk->parents_alloc);
+	walk->parents[walk->parents_nr++] = edge_value;
+
+	edge_value = get_be32(commit_data + g->hash_len + 4);
+	if (edge_value == GRAPH_PARENT_NONE)
+		return 0;
+	if (!(edge_value & GRAPH_EXTRA_EDGES_NEEDED)) {
+		ALLOC_GROW(walk->parents, walk->parents_nr + 1, walk->parents_alloc);
+		walk->parents[walk->parents_nr++] = edge_value;
+		return 0;
+	}
+
+	parent_data_pos = edge_value & GRAPH_EDGE_LAST_MASK;
+	do {
+		if (g->chunk_extra_edges_size / sizeof(uint32_t) <= parent_data_pos)
+			return error(_("commit-graph extra-edges pointer out of bounds"));
+		edge_value = get_be32(g->chunk_extra_edges +
+				      sizeof(uint32_t) * parent_data_pos);
+		ALLOC_GROW(walk->parents, walk->parents_nr + 1, walk->parents_alloc);
+		walk->parents[walk->parents_nr++] = edge_value & GRAPH_EDGE_LAST_MASK;
+		parent_data_pos++;
+	} while (!(edge_value & GRAPH_LAST_EDGE));
+
+	return 0;
+}
+
+/*
+ * Paint the commit at "pos" with "flags" and queue it.  Returns -1 if
+ * the commit already came out of the queue without them, which means
+ * that the generation numbers do not put it after all of its children.
+ */
+static int graph_walk_paint(struct graph_walk *walk, uint32_t pos,
+			    uint8_t flags)
+{
+	uint8_t old = walk->flags[pos];
+
+	if ((old & flags) == flags)
+		return 0;
+	if (old & GRAPH_WALK_DONE)
+		return error(_("commit-graph generation numbers are out of order"));
+	walk->flags[pos] |= flags;
+
+	if (!(old & GRAPH_WALK_QUEUED)) {
+		walk->flags[pos] |= GRAPH_WALK_QUEUED;
+		prio_queue_put(&walk->queue, (void *)((uintptr_t)pos + 1));
+		if (!(walk->flags[pos] & GRAPH_WALK_BASE))
+			walk->nonstale++;
+	} else if (!(old & GRAPH_WALK_BASE) && (flags & GRAPH_WALK_BASE)) {
+		walk->nonstale--;
+	}
+	return 0;
+}
+
+static int graph_walk_add(struct repository *r, struct graph_walk *walk,
+			  struct commit **commits, size_t nr, uint8_t flags)
+{
+	for (size_t i = 0; i < nr; i++) {
+		uint32_t pos;
+
+		if (!repo_find_commit_pos_in_graph(r, commits[i], &pos) ||
+		    graph_walk_paint(walk, pos, flags))
+			return -1;
+	}
+	return 0;
+}
+
+int commit_graph_count_reachable(struct repository *r,
+				 struct commit **tips, size_t tips_nr,
+				 struct commit **bases, size_t bases_nr,
+				 uint64_t *count)
+{
+	struct graph_walk walk = {
+		.queue.compare = graph_walk_generation_compare,
+		.queue.get_key = graph_walk_generation_key,
+	};
+	size_t nr_commits;
+	int ret = -1;
+
+	/* Without generation numbers we cannot tell when to stop. */
+	if (!generation_numbers_enabled(r))
+		return -1;
+	walk.g = r->objects->commit_graph;
+	walk.queue.cb_data = &walk;
+	nr_commits = walk.g->num_commits + walk.g->num_commits_in_base;
+	walk.flags = xcalloc(nr_commits, sizeof(*walk.flags));
+
+	if (graph_walk_add(r, &walk, tips, tips_nr, GRAPH_WALK_TIP) ||
+	    graph_walk_add(r, &walk, bases, bases_nr, GRAPH_WALK_BASE))
+		goto out;
+
+	/*
+	 * Parents have lower generation numbers than their children, so
+	 * a commit has been painted by all of its children by the time it
+	 * comes out of the queue.  Once everything left in the queue can
+	 * be reached from a base, nothing more can be counted.
+	 */
+	*count = 0;
+	while (walk.nonstale) {
+		uint32_t pos = (uint32_t)((uintptr_t)prio_queue_get(&walk.queue) - 1);
+		uint8_t flags = walk.flags[pos] & (GRAPH_WALK_TIP | GRAPH_WALK_BASE);
+
+		walk.flags[pos] |= GRAPH_WALK_DONE;
+		walk.visited++;
+		if (!(flags & GRAPH_WALK_BASE)) {
+			walk.nonstale--;
+			(*count)++;
+		}
+
+		if (graph_walk_read_parents(&walk, pos))
+			goto out;
+		for (size_t i = 0; i < walk.parents_nr; i++) {
+			if (walk.parents[i] >= nr_commits) {
+				error(_("invalid parent position %"PRIu32),
+				      walk.parents[i]);
+				goto out;
+			}
+			if (graph_walk_paint(&walk, walk.parents[i], flags))
+				goto out;
+		}
+	}
+	ret = 0;
+	trace2_data_intmax("commit-graph", r, "count-reachable/visited",
+			   walk.visited);
+
+out:
+	clear_prio_queue(&walk.queue);
+	free(walk.flags);
+	free(walk.parents);
+	return ret;
+}
+
 struct packed_commit_list {
 	struct commit **list;
 	size_t nr;
@@ -1162,6 +1705,8 @@ struct write_commit_graph_context {
 		 report_progress:1,
 		 split:1,
 		 changed_paths:1,
+		 identities:1,
+		 reach_index:1,
 		 order_by_pack:1,
 		 write_generation_data:1,
 		 trust_generation_numbers:1;
@@ -1176,6 +1721,13 @@ struct write_commit_graph_context {
 	int count_bloom_filter_trunc_empty;
 	int count_bloom_filter_trunc_large;
 	int count_bloom_filter_upgraded;
+
+	unsigned char *identity_index;
+	struct strbuf identity_data;
+	uint32_t *subject_index;
+	struct strbuf subject_data;
+
+	uint32_t *reach_index_data;
 };
 
 static int write_graph_chunk_fanout(struct hashfile *f,
@@ -1488,6 +2040,70 @@ static int write_graph_chunk_bloom_data(struct hashfile *f,
 	return 0;
 }
 
+static int write_graph_chunk_identity_index(struct hashfile *f,
+					    void *data)
+{
+	struct write_commit_graph_context *ctx = data;
+	size_t i;
+
+	for (i = 0; i < ctx->commits.nr; i++) {
+		display_progress(ctx->progress, ++ctx->progress_cnt);
+		hashwrite(f, ctx->identity_index + st_mult(GRAPH_IDENTITY_WIDTH, i),
+			  GRAPH_IDENTITY_WIDTH);
+	}
+
+	return 0;
+}
+
+static int write_graph_chunk_identity_data(struct hashfile *f,
+					   void *data)
+{
+	struct write_commit_graph_context *ctx = data;
+
+	hashwrite(f, ctx->identity_data.buf, ctx->identity_data.len);
+
+	return 0;
+}
+
+static int write_graph_chunk_subject_index(struct hashfile *f,
+					   void *data)
+{
+	struct write_commit_graph_context *ctx = data;
+	size_t i;
+
+	for (i = 0; i < ctx->commits.nr; i++) {
+		display_progress(ctx->progress, ++ctx->progress_cnt);
+		hashwrite_be32(f, ctx->subject_index[i]);
+	}
+
+	return 0;
+}
+
+static int write_graph_chunk_subject_data(struct hashfile *f,
+					  void *data)
+{
+	struct write_commit_graph_context *ctx = data;
+
+	hashwrite(f, ctx->subject_data.buf, ctx->subject_data.len);
+
+	return 0;
+}
+
+static int write_graph_chunk_reach_index(struct hashfile *f,
+					 void *data)
+{
+	struct write_commit_graph_context *ctx = data;
+	size_t i, nr = st_mult(GRAPH_REACH_INDEX_WIDTH / 4, ctx->commits.nr);
+
+	for (i = 0; i < nr; i++) {
+		if (!(i % (GRAPH_REACH_INDEX_WIDTH / 4)))
+			display_progress(ctx->progress, ++ctx->progress_cnt);
+		hashwrite_be32(f, ctx->reach_index_data[i]);
+	}
+
+	return 0;
+}
+
 static int add_packed_commits(const struct object_id *oid,
 			      struct packed_git *pack,
 			      uint32_t pos,
@@ -1792,11 +2408,42 @@ static void trace2_bloom_filter_write_statistics(struct write_commit_graph_conte
 			   ctx->count_bloom_filter_upgraded);
 }
 
+static void count_bloom_filter(struct write_commit_graph_context *ctx,
+			       struct bloom_filter *filter,
+			       enum bloom_filter_computed computed)
+{
+	if (computed & BLOOM_COMPUTED) {
+		ctx->count_bloom_filter_computed++;
+		if (computed & BLOOM_TRUNC_EMPTY)
+			ctx->count_bloom_filter_trunc_empty++;
+		if (computed & BLOOM_TRUNC_LARGE)
+			ctx->count_bloom_filter_trunc_large++;
+	} else if (computed & BLOOM_UPGRADED) {
+		ctx->count_bloom_filter_upgraded++;
+	} else if (computed & BLOOM_NOT_COMPUTED)
+		ctx->count_bloom_filter_not_computed++;
+	ctx->total_bloom_filter_data_size += filter
+		? sizeof(unsigned char) * filter->len : 0;
+}
+
+static int commit_graph_threads(struct repository *r)
+{
+	int nr_threads;
+
+	if (repo_config_get_int(r, "commitgraph.threads", &nr_threads) ||
+	    nr_threads <= 0)
+		nr_threads = online_cpus();
+	return nr_threads;
+}
+
 static void compute_bloom_filters(struct write_commit_graph_context *ctx)
 {
 	int i;
 	struct progress *progress = NULL;
 	struct commit **sorted_commits;
+	struct commit **pending;
+	enum bloom_filter_computed *pending_computed;
+	int nr_pending = 0, done = 0;
 	int max_new_filters;
 
 	init_bloom_filters();
@@ -1817,33 +2464,54 @@ static void compute_bloom_filters(struct write_commit_graph_context *ctx)
 	max_new_filters = ctx->opts && ctx->opts->max_new_filters >= 0 ?
 		ctx->opts->max_new_filters : ctx->commits.nr;
 
+	/*
+	 * Pick up the filters we already have first, and decide which of
+	 * the others to compute in the same order as if we computed them
+	 * one by one, so that --max-new-filters selects the same commits
+	 * no matter how many threads we use.
+	 */
+	ALLOC_ARRAY(pending, ctx->commits.nr);
 	for (i = 0; i < ctx->commits.nr; i++) {
 		enum bloom_filter_computed computed = 0;
 		struct commit *c = sorted_commits[i];
-		struct bloom_filter *filter = get_or_compute_bloom_filter(
+		int compute = ctx->count_bloom_filter_computed + nr_pending <
+			max_new_filters;
+		struct bloom_filter *filter = get_or_upgrade_bloom_filter(
 			ctx->r,
 			c,
-			ctx->count_bloom_filter_computed < max_new_filters,
+			compute,
 			ctx->bloom_settings,
 			&computed);
-		if (computed & BLOOM_COMPUTED) {
-			ctx->count_bloom_filter_computed++;
-			if (computed & BLOOM_TRUNC_EMPTY)
-				ctx->count_bloom_filter_trunc_empty++;
-			if (computed & BLOOM_TRUNC_LARGE)
-				ctx->count_bloom_filter_trunc_large++;
-		} else if (computed & BLOOM_UPGRADED) {
-			ctx->count_bloom_filter_upgraded++;
-		} else if (computed & BLOOM_NOT_COMPUTED)
-			ctx->count_bloom_filter_not_computed++;
-		ctx->total_bloom_filter_data_size += filter
-			? sizeof(unsigned char) * filter->len : 0;
-		display_progress(progress, i + 1);
+
+		if (!filter && compute) {
+			pending[nr_pending++] = c;
+			continue;
+		}
+
+		count_bloom_filter(ctx, filter, computed);
+		display_progress(progress, ++done);
+	}
+
+	CALLOC_ARRAY(pending_computed, nr_pending);
+	compute_bloom_filters_threaded(ctx->r, pending, nr_pending,
+				       ctx->bloom_settings, pending_computed,
+				       commit_graph_threads(ctx->r),
+				       progress, done);
+	for (i = 0; i < nr_pending; i++) {
+		struct bloom_filter *filter = get_or_compute_bloom_filter(
+			ctx->r,
+			pending[i],
+			0,
+			ctx->bloom_settings,
+			NULL);
+		count_bloom_filter(ctx, filter, pending_computed[i]);
 	}
 
 	if (trace2_is_enabled())
 		trace2_bloom_filter_write_statistics(ctx);
 
+	free(pending_computed);
+	free(pending);
 	free(sorted_commits);
 	stop_progress(&progress);
 }
@@ -2043,6 +2711,339 @@ static int write_graph_chunk_base(struct hashfile *f,
 	return 0;
 }
 
+/*
+ * Return the offset of `ident` in the identity data, appending it if it
+ * is not there yet, or -1 if the identity data would grow too large.
+ */
+static int intern_identity(struct write_commit_graph_context *ctx,
+			   struct strintmap *offsets, struct strbuf *key,
+			   const char *ident, size_t ident_len)
+{
+	int offset;
+
+	strbuf_reset(key);
+	strbuf_add(key, ident, ident_len);
+
+	offset = strintmap_get(offsets, key->buf);
+	if (offset >= 0)
+		return offset;
+
+	if (ctx->identity_data.len + key->len >= INT_MAX)
+		return -1;
+	offset = ctx->identity_data.len;
+	strbuf_add(&ctx->identity_data, key->buf, key->len + 1);
+	strintmap_set(offsets, key->buf, offset);
+	return offset;
+}
+
+static void compute_commit_summaries(struct write_commit_graph_context *ctx)
+{
+	struct strintmap offsets;
+	struct strbuf key = STRBUF_INIT;
+	struct progress *progress = NULL;
+	size_t i;
+
+	strintmap_init_with_options(&offsets, -1, NULL, 1);
+
+	if (ctx->report_progress)
+		progress = start_delayed_progress(
+			the_repository,
+			_("Collecting commit identities and subjects"),
+			ctx->commits.nr);
+
+	CALLOC_ARRAY(ctx->identity_index,
+		     st_mult(GRAPH_IDENTITY_WIDTH, ctx->commits.nr));
+	ALLOC_ARRAY(ctx->subject_index, ctx->commits.nr);
+
+	for (i = 0; i < ctx->commits.nr; i++) {
+		struct commit *c = ctx->commits.list[i];
+		unsigned char *entry = ctx->identity_index +
+			st_mult(GRAPH_IDENTITY_WIDTH, i);
+		const char *buf = repo_get_commit_buffer(ctx->r, c, NULL);
+		struct commit_summary s;
+		int author, committer;
+
+		if (parse_commit_summary(buf, &s) < 0 ||
+		    ctx->subject_data.len + s.subject_len > UINT32_MAX ||
+		    (author = intern_identity(ctx, &offsets, &key,
+					      s.author, s.author_len)) < 0 ||
+		    (committer = intern_identity(ctx, &offsets, &key,
+						 s.committer, s.committer_len)) < 0) {
+			put_be32(entry, GRAPH_IDENTITY_NONE);
+		} else {
+			put_be32(entry, author);
+			put_be32(entry + 4, committer);
+			put_be64(entry + 8, s.author_date);
+			put_be64(entry + 16, s.committer_date);
+			put_be32(entry + 24, (uint32_t)s.author_tz);
+			put_be32(entry + 28, (uint32_t)s.committer_tz);
+			strbuf_add(&ctx->subject_data, s.subject, s.subject_len);
+		}
+		repo_unuse_commit_buffer(ctx->r, c, buf);
+
+		ctx->subject_index[i] = ctx->subject_data.len;
+		display_progress(progress, i + 1);
+	}
+
+	trace2_data_intmax("commit-graph", ctx->r, "identities/count",
+			   strintmap_get_size(&offsets));
+	trace2_data_intmax("commit-graph", ctx->r, "identities/subject-bytes",
+			   ctx->subject_data.len);
+
+	strintmap_clear(&offsets);
+	strbuf_release(&key);
+	stop_progress(&progress);
+}
+
+static int commit_date_then_lex_cmp(const void *va, const void *vb,
+				    void *data)
+{
+	struct commit **list = data;
+	uint32_t a = *(const uint32_t *)va, b = *(const uint32_t *)vb;
+
+	if (list[a]->date != list[b]->date)
+		return list[a]->date < list[b]->date ? -1 : 1;
+	return a < b ? -1 : a > b;
+}
+
+/*
+ * The parents of the commits we are about to write, as positions in
+ * ctx->commits.list, or -1 for parents in the base graphs. The parents
+ * of the ith commit are parents[offsets[i]] to parents[offsets[i + 1] - 1].
+ */
+struct commit_graph_edges {
+	size_t *offsets;
+	int *parents;
+};
+
+static void collect_commit_graph_edges(struct write_commit_graph_context *ctx,
+				       struct commit_graph_edges *edges)
+{
+	struct commit **list = ctx->commits.list;
+	size_t i, nr = 0;
+
+	ALLOC_ARRAY(edges->offsets, st_add(ctx->commits.nr, 1));
+	for (i = 0; i < ctx->commits.nr; i++) {
+		edges->offsets[i] = nr;
+		nr = st_add(nr, commit_list_count(list[i]->parents));
+	}
+	edges->offsets[ctx->commits.nr] = nr;
+
+	ALLOC_ARRAY(edges->parents, nr);
+	for (i = 0, nr = 0; i < ctx->commits.nr; i++) {
+		struct commit_list *parent;
+
+		for (parent = list[i]->parents; parent; parent = parent->next)
+			edges->parents[nr++] = oid_pos(&parent->item->object.oid,
+						       list, ctx->commits.nr,
+						       commit_to_oid);
+	}
+}
+
+static void clear_commit_graph_edges(struct commit_graph_edges *edges)
+{
+	FREE_AND_NULL(edges->offsets);
+	FREE_AND_NULL(edges->parents);
+}
+
+/*
+ * Return the commits we are about to write that have no children, oldest
+ * first.
+ */
+static uint32_t *find_graph_tips(struct write_commit_graph_context *ctx,
+				 const struct commit_graph_edges *edges,
+				 size_t *nr)
+{
+	unsigned char *has_children;
+	uint32_t *tips;
+	size_t i;
+
+	CALLOC_ARRAY(has_children, ctx->commits.nr);
+	for (i = 0; i < edges->offsets[ctx->commits.nr]; i++)
+		if (edges->parents[i] >= 0)
+			has_children[edges->parents[i]] = 1;
+
+	ALLOC_ARRAY(tips, ctx->commits.nr);
+	*nr = 0;
+	for (i = 0; i < ctx->commits.nr; i++)
+		if (!has_children[i])
+			tips[(*nr)++] = i;
+	QSORT_S(tips, *nr, commit_date_then_lex_cmp, ctx->commits.list);
+
+	free(has_children);
+	return tips;
+}
+
+struct depth_first_frame {
+	uint32_t lex_index;
+	size_t next_parent;
+};
+
+/*
+ * Number the commits we are about to write for one walk of
+ * compute_reach_index(), after all commits of the base graphs, and store
+ * the number of the ith commit in post[i].
+ *
+ * We walk depth-first from "tips", visiting parents in order, and number
+ * each commit once all of its parents are numbered; with "reverse" we go
+ * through both the tips and the parents backwards. If "tree_low" is not
+ * NULL, tree_low[i] is set to the first number handed out while we are
+ * below the ith commit, so that all commits numbered from tree_low[i] to
+ * post[i] are reachable from it.
+ */
+static void number_depth_first(struct write_commit_graph_context *ctx,
+			       const struct commit_graph_edges *edges,
+			       const uint32_t *tips, size_t tips_nr,
+			       int reverse, uint32_t *post, uint32_t *tree_low)
+{
+	struct depth_first_frame *stack = NULL;
+	size_t stack_nr = 0, stack_alloc = 0;
+	uint32_t next_pos = ctx->new_num_commits_in_base;
+	size_t i;
+
+	for (i = 0; i < ctx->commits.nr; i++)
+		post[i] = GRAPH_REACH_NUMBER_NONE;
+
+	for (i = 0; i < tips_nr; i++) {
+		uint32_t tip = tips[reverse ? tips_nr - 1 - i : i];
+
+		ALLOC_GROW(stack, stack_nr + 1, stack_alloc);
+		stack[stack_nr].lex_index = tip;
+		stack[stack_nr].next_parent = 0;
+		stack_nr++;
+		if (tree_low)
+			tree_low[tip] = next_pos;
+
+		while (stack_nr) {
+			struct depth_first_frame *top = &stack[stack_nr - 1];
+			size_t first = edges->offsets[top->lex_index];
+			size_t nr = edges->offsets[top->lex_index + 1] - first;
+
+			if (top->next_parent < nr) {
+				size_t k = top->next_parent++;
+				int parent = edges->parents[first +
+							    (reverse ? nr - 1 - k : k)];
+
+				if (parent >= 0 && post[parent] == GRAPH_REACH_NUMBER_NONE) {
+					ALLOC_GROW(stack, stack_nr + 1, stack_alloc);
+					stack[stack_nr].lex_index = parent;
+					stack[stack_nr].next_parent = 0;
+					stack_nr++;
+					if (tree_low)
+						tree_low[parent] = next_pos;
+				}
+				continue;
+			}
+
+			post[top->lex_index] = next_pos++;
+			stack_nr--;
+			display_progress(ctx->progress, ++ctx->progress_cnt);
+		}
+	}
+
+	free(stack);
+}
+
+/*
+ * Return the positions in ctx->commits.list of the commits in the order
+ * given by number_depth_first(), parents first.
+ */
+static uint32_t *order_by_number(struct write_commit_graph_context *ctx,
+				 const uint32_t *post)
+{
+	uint32_t *order;
+	size_t i;
+
+	ALLOC_ARRAY(order, ctx->commits.nr);
+	for (i = 0; i < ctx->commits.nr; i++)
+		order[post[i] - ctx->new_num_commits_in_base] = i;
+	return order;
+}
+
+/*
+ * Label the commits we are about to write for commit_graph_can_reach().
+ *
+ * We number the commits in two depth-first walks, the second one going
+ * through tips and parents in the opposite order of the first, and
+ * give each commit the lowest number among its ancestors in both. A
+ * commit can only reach another one if its range of numbers contains
+ * the other's in both walks, which settles most negative queries. For
+ * the first walk we also remember where the subtree the walk took
+ * below each commit starts, which settles positive queries between
+ * commits it found that way.
+ *
+ * Parents in base graphs without labels count as reaching everything.
+ */
+static void compute_reach_index(struct write_commit_graph_context *ctx)
+{
+	struct commit_graph_edges edges;
+	uint32_t *tips, *post[2], *low, *tree_low, *order;
+	size_t tips_nr, i;
+	int t;
+
+	if (ctx->report_progress)
+		ctx->progress = start_delayed_progress(
+					the_repository,
+					_("Computing commit graph reachability index"),
+					st_mult(2, ctx->commits.nr));
+	ctx->progress_cnt = 0;
+
+	collect_commit_graph_edges(ctx, &edges);
+	tips = find_graph_tips(ctx, &edges, &tips_nr);
+	ALLOC_ARRAY(post[0], ctx->commits.nr);
+	ALLOC_ARRAY(post[1], ctx->commits.nr);
+	ALLOC_ARRAY(low, ctx->commits.nr);
+	ALLOC_ARRAY(tree_low, ctx->commits.nr);
+	ALLOC_ARRAY(ctx->reach_index_data,
+		    st_mult(GRAPH_REACH_INDEX_WIDTH / 4, ctx->commits.nr));
+
+	for (t = 0; t < 2; t++) {
+		number_depth_first(ctx, &edges, tips, tips_nr, t, post[t],
+				   t ? NULL : tree_low);
+		order = order_by_number(ctx, post[t]);
+
+		for (i = 0; i < ctx->commits.nr; i++) {
+			uint32_t lex_index = order[i];
+			size_t j = edges.offsets[lex_index];
+			struct commit_list *p;
+
+			low[lex_index] = post[t][lex_index];
+			for (p = ctx->commits.list[lex_index]->parents; p; p = p->next, j++) {
+				struct commit_reach_label label;
+				int parent = edges.parents[j];
+				uint32_t parent_low = 0;
+
+				if (parent >= 0)
+					parent_low = low[parent];
+				else if (get_commit_reach_label(ctx->r, p->item, &label))
+					parent_low = label.low[t];
+
+				if (parent_low < low[lex_index])
+					low[lex_index] = parent_low;
+			}
+		}
+
+		for (i = 0; i < ctx->commits.nr; i++) {
+			uint32_t *entry = ctx->reach_index_data +
+				GRAPH_REACH_INDEX_WIDTH / 4 * i;
+			entry[2 * t] = post[t][i];
+			entry[2 * t + 1] = low[i];
+		}
+		free(order);
+	}
+
+	for (i = 0; i < ctx->commits.nr; i++)
+		ctx->reach_index_data[GRAPH_REACH_INDEX_WIDTH / 4 * i + 4] = tree_low[i];
+
+	free(tree_low);
+	free(low);
+	free(post[1]);
+	free(post[0]);
+	free(tips);
+	clear_commit_graph_edges(&edges);
+	stop_progress(&ctx->progress);
+}
+
 static int write_commit_graph_file(struct write_commit_graph_context *ctx)
 {
 	uint32_t i;
@@ -2127,6 +3128,24 @@ static int write_commit_graph_file(struct write_commit_graph_context *ctx)
 				 ctx->total_bloom_filter_data_size),
 			  write_graph_chunk_bloom_data);
 	}
+	if (ctx->identities) {
+		add_chunk(cf, GRAPH_CHUNKID_IDENTITYINDEX,
+			  st_mult(GRAPH_IDENTITY_WIDTH, ctx->commits.nr),
+			  write_graph_chunk_identity_index);
+		add_chunk(cf, GRAPH_CHUNKID_IDENTITYDATA,
+			  ctx->identity_data.len,
+			  write_graph_chunk_identity_data);
+		add_chunk(cf, GRAPH_CHUNKID_SUBJECTINDEX,
+			  st_mult(sizeof(uint32_t), ctx->commits.nr),
+			  write_graph_chunk_subject_index);
+		add_chunk(cf, GRAPH_CHUNKID_SUBJECTDATA,
+			  ctx->subject_data.len,
+			  write_graph_chunk_subject_data);
+	}
+	if (ctx->reach_index)
+		add_chunk(cf, GRAPH_CHUNKID_REACHINDEX,
+			  st_mult(GRAPH_REACH_INDEX_WIDTH, ctx->commits.nr),
+			  write_graph_chunk_reach_index);
 	if (ctx->num_commit_graphs_after > 1)
 		add_chunk(cf, GRAPH_CHUNKID_BASE,
 			  st_mult(hashsz, ctx->num_commit_graphs_after - 1),
@@ -2540,6 +3559,8 @@ int write_commit_graph(struct object_directory *odb,
 	ctx->total_bloom_filter_data_size = 0;
 	ctx->write_generation_data = (get_configured_generation_version(r) == 2);
 	ctx->num_generation_data_overflows = 0;
+	strbuf_init(&ctx->identity_data, 0);
+	strbuf_init(&ctx->subject_data, 0);
 
 	bloom_settings.hash_version = r->settings.commit_graph_changed_paths_version;
 	bloom_settings.bits_per_entry = git_env_ulong("GIT_TEST_BLOOM_SETTINGS_BITS_PER_ENTRY",
@@ -2585,6 +3606,26 @@ int write_commit_graph(struct object_directory *odb,
 
 	bloom_settings.hash_version = bloom_settings.hash_version == 2 ? 2 : 1;
 
+	if (flags & COMMIT_GRAPH_WRITE_IDENTITIES)
+		ctx->identities = 1;
+	else if (!(flags & COMMIT_GRAPH_NO_WRITE_IDENTITIES)) {
+		struct commit_graph *g = ctx->r->objects->commit_graph;
+
+		/* We have identities already. Keep them in the next graph */
+		if (g && g->chunk_identity_index)
+			ctx->identities = 1;
+	}
+
+	if (flags & COMMIT_GRAPH_WRITE_REACH_INDEX)
+		ctx->reach_index = 1;
+	else if (!(flags & COMMIT_GRAPH_NO_WRITE_REACH_INDEX)) {
+		struct commit_graph *g = ctx->r->objects->commit_graph;
+
+		/* We have a reachability index already. Keep it in the next graph */
+		if (g && g->chunk_reach_index)
+			ctx->reach_index = 1;
+	}
+
 	if (ctx->split) {
 		struct commit_graph *g = ctx->r->objects->commit_graph;
 
@@ -2666,6 +3707,12 @@ int write_commit_graph(struct object_directory *odb,
 	if (ctx->changed_paths)
 		compute_bloom_filters(ctx);
 
+	if (ctx->identities)
+		compute_commit_summaries(ctx);
+
+	if (ctx->reach_index)
+		compute_reach_index(ctx);
+
 	res = write_commit_graph_file(ctx);
 
 	if (ctx->changed_paths)
@@ -2682,6 +3729,11 @@ int write_commit_graph(struct object_directory *odb,
 	free(ctx->commits.list);
 	oid_array_clear(&ctx->oids);
 	clear_topo_level_slab(&topo_levels);
+	free(ctx->identity_index);
+	strbuf_release(&ctx->identity_data);
+	free(ctx->subject_index);
+	strbuf_release(&ctx->subject_data);
+	free(ctx->reach_index_data);
 
 	for (i = 0; i < ctx->num_commit_graphs_before; i++)
 		free(ctx->commit_graph_filenames_before[i]);
@@ -2719,6 +3771,83 @@ static int commit_graph_checksum_valid(struct commit_graph *g)
 	return hashfile_checksum_valid(g->data, g->data_len);
 }
 
+static void verify_commit_summary(struct repository *r,
+				  struct commit_graph *g,
+				  uint32_t lex_index,
+				  struct commit *odb_commit)
+{
+	struct commit_summary summary;
+	struct strbuf graph_buf = STRBUF_INIT, odb_buf = STRBUF_INIT;
+	const char *buf;
+
+	if (!fill_summary_from_graph(g, lex_index, &summary))
+		return;
+	format_commit_summary(&graph_buf, &summary);
+
+	buf = repo_get_commit_buffer(r, odb_commit, NULL);
+	if (parse_commit_summary(buf, &summary) < 0)
+		graph_report(_("commit-graph has identities and subject for commit %s, which cannot be summarized"),
+			     oid_to_hex(&odb_commit->object.oid));
+	else {
+		format_commit_summary(&odb_buf, &summary);
+		if (strbuf_cmp(&graph_buf, &odb_buf))
+			graph_report(_("commit-graph identities and subject for commit %s do not match the commit"),
+				     oid_to_hex(&odb_commit->object.oid));
+	}
+	repo_unuse_commit_buffer(r, odb_commit, buf);
+
+	strbuf_release(&graph_buf);
+	strbuf_release(&odb_buf);
+}
+
+static void verify_reach_index(struct commit_graph *g,
+			       uint32_t lex_index,
+			       struct commit *graph_commit)
+{
+	struct commit_reach_label label, parent_label;
+	uint32_t expect_low[2];
+	struct commit_list *p;
+	int t;
+
+	get_commit_reach_label_one(g, g->num_commits_in_base + lex_index, &label);
+
+	for (t = 0; t < 2; t++) {
+		if (label.post[t] < g->num_commits_in_base ||
+		    label.post[t] - g->num_commits_in_base >= g->num_commits)
+			graph_report(_("commit-graph reachability position for commit %s is out of range"),
+				     oid_to_hex(&graph_commit->object.oid));
+		expect_low[t] = label.post[t];
+	}
+	if (label.tree_low < g->num_commits_in_base ||
+	    label.tree_low > label.post[0])
+		graph_report(_("commit-graph reachability subtree for commit %s is out of range"),
+			     oid_to_hex(&graph_commit->object.oid));
+
+	for (p = graph_commit->parents; p; p = p->next) {
+		if (!get_commit_reach_label_one(g, commit_graph_position(p->item),
+						&parent_label)) {
+			/* a base graph without a reachability index */
+			expect_low[0] = expect_low[1] = 0;
+			continue;
+		}
+
+		for (t = 0; t < 2; t++) {
+			if (parent_label.post[t] >= label.post[t])
+				graph_report(_("commit-graph reachability position for commit %s is not after its parent %s"),
+					     oid_to_hex(&graph_commit->object.oid),
+					     oid_to_hex(&p->item->object.oid));
+			if (parent_label.low[t] < expect_low[t])
+				expect_low[t] = parent_label.low[t];
+		}
+	}
+
+	for (t = 0; t < 2; t++)
+		if (label.low[t] != expect_low[t])
+			graph_report(_("commit-graph reachability low position for commit %s is %"PRIu32" != %"PRIu32),
+				     oid_to_hex(&graph_commit->object.oid),
+				     label.low[t], expect_low[t]);
+}
+
 static int verify_one_commit_graph(struct repository *r,
 				   struct commit_graph *g,
 				   struct progress *progress,
@@ -2831,6 +3960,12 @@ static int verify_one_commit_graph(struct repository *r,
 			graph_report(_("commit-graph parent list for commit %s terminates early"),
 				     oid_to_hex(&cur_oid));
 
+		if (g->chunk_identity_index)
+			verify_commit_summary(r, g, i, odb_commit);
+
+		if (g->chunk_reach_index)
+			verify_reach_index(g, i, graph_commit);
+
 		if (commit_graph_generation_from_graph(graph_commit))
 			seen_gen_non_zero = graph_commit;
 		else
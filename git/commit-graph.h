@@ -28,6 +28,7 @@ struct bloom_filter_settings;
 struct repository;
 struct raw_object_store;
 struct string_list;
+struct strbuf;
 
 char *get_commit_graph_filename(struct object_directory *odb);
 char *get_commit_graph_chain_filename(struct object_directory *odb);
@@ -80,6 +81,49 @@ void load_commit_graph_info(struct repository *r, struct commit *item);
 struct tree *get_commit_tree_in_graph(struct repository *r,
 				      const struct commit *c);
 
+/*
+ * If the commit-graph stores the identities and the subject of `c`,
+ * append to `out` a commit buffer that holds only its "author" and
+ * "committer" headers followed by the first paragraph of its message,
+ * and return 1. This is enough to expand most placeholders of a pretty
+ * format without reading the commit object.
+ *
+ * Returns 0 if `c` was not parsed from the commit-graph, or if the
+ * commit-graph does not have this information for it.
+ */
+int get_commit_summary_in_graph(struct repository *r,
+				const struct commit *c,
+				struct strbuf *out);
+
+/*
+ * Use the reachability index of the commit-graph to tell whether `to`
+ * can be reached from `from`. Return 1 if it can, 0 if it cannot, and
+ * -1 if the index does not know, in which case the caller has to walk.
+ */
+int commit_graph_can_reach(struct repository *r,
+			   const struct commit *from,
+			   const struct commit *to);
+
+/*
+ * Return 1 if the repository has a commit-graph and some layer of it has
+ * a reachability index.
+ */
+int commit_graph_has_reach_index(struct repository *r);
+
+/*
+ * Count the commits that can be reached from `tips` but not from
+ * `bases`, like "git rev-list --count", by walking the commit-graph
+ * directly instead of parsing a "struct commit" for each of them.
+ *
+ * Return 0 on success, and -1 if the commit-graph has no generation
+ * numbers or any of the given commits is not in it, in which case the
+ * caller has to walk.
+ */
+int commit_graph_count_reachable(struct repository *r,
+				 struct commit **tips, size_t tips_nr,
+				 struct commit **bases, size_t bases_nr,
+				 uint64_t *count);
+
 struct commit_graph {
 	const unsigned char *data;
 	size_t data_len;
@@ -108,6 +152,13 @@ struct commit_graph {
 	const unsigned char *chunk_bloom_indexes;
 	const unsigned char *chunk_bloom_data;
 	size_t chunk_bloom_data_size;
+	const unsigned char *chunk_identity_index;
+	const unsigned char *chunk_identity_data;
+	size_t chunk_identity_data_size;
+	const unsigned char *chunk_subject_index;
+	const unsigned char *chunk_subject_data;
+	size_t chunk_subject_data_size;
+	const unsigned char *chunk_reach_index;
 
 	struct topo_level_slab *topo_levels;
 	struct bloom_filter_settings *bloom_filter_settings;
@@ -151,6 +202,10 @@ enum commit_graph_write_flags {
 	COMMIT_GRAPH_WRITE_SPLIT      = (1 << 2),
 	COMMIT_GRAPH_WRITE_BLOOM_FILTERS = (1 << 3),
 	COMMIT_GRAPH_NO_WRITE_BLOOM_FILTERS = (1 << 4),
+	COMMIT_GRAPH_WRITE_IDENTITIES = (1 << 5),
+	COMMIT_GRAPH_NO_WRITE_IDENTITIES = (1 << 6),
+	COMMIT_GRAPH_WRITE_REACH_INDEX = (1 << 7),
+	COMMIT_GRAPH_NO_WRITE_REACH_INDEX = (1 << 8),
 };
 
 enum commit_graph_split_flags {
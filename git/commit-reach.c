@@ -5,6 +5,7 @@
 #include "commit-graph.h"
 #include "decorate.h"
 #include "hex.h"
+#include "pack-bitmap.h"
 #include "prio-queue.h"
 #include "ref-filter.h"
 #include "revision.h"
@@ -57,12 +58,17 @@ static int paint_down_to_common(struct repository *r,
 				int ignore_missing_commits,
 				struct commit_list **result)
 {
-	struct prio_queue queue = { compare_commits_by_gen_then_commit_date };
+	struct prio_queue queue = {
+		.compare = compare_commits_by_gen_then_commit_date,
+		.get_key = commit_gen_then_date_queue_key,
+	};
 	int i;
 	timestamp_t last_gen = GENERATION_NUMBER_INFINITY;
 
-	if (!min_generation && !corrected_commit_dates_enabled(r))
+	if (!min_generation && !corrected_commit_dates_enabled(r)) {
 		queue.compare = compare_commits_by_commit_date;
+		queue.get_key = commit_date_queue_key;
+	}
 
 	one->object.flags |= PARENT1;
 	if (!n) {
@@ -77,9 +83,10 @@ static int paint_down_to_common(struct repository *r,
 	}
 
 	while (queue_has_nonstale(&queue)) {
-		struct commit *commit = prio_queue_get(&queue);
+		/* Keep it in the queue until we can replace it by a parent. */
+		struct commit *commit = prio_queue_peek(&queue);
 		struct commit_list *parents;
-		int flags;
+		int flags, popped = 0;
 		timestamp_t generation = commit_graph_generation(commit);
 
 		if (min_generation && generation > last_gen)
@@ -123,8 +130,14 @@ static int paint_down_to_common(struct repository *r,
 					     oid_to_hex(&p->object.oid));
 			}
 			p->object.flags |= flags;
-			prio_queue_put(&queue, p);
+			if (popped)
+				prio_queue_put(&queue, p);
+			else
+				prio_queue_replace(&queue, p);
+			popped = 1;
 		}
+		if (!popped)
+			prio_queue_get(&queue);
 	}
 
 	clear_prio_queue(&queue);
@@ -532,15 +545,40 @@ int repo_in_merge_bases_many(struct repository *r, struct commit *commit,
 			     int ignore_missing_commits)
 {
 	struct commit_list *bases = NULL;
+	struct commit **unsettled = NULL;
 	int ret = 0, i;
 	timestamp_t generation, max_generation = GENERATION_NUMBER_ZERO;
 
 	if (repo_parse_commit(r, commit))
 		return ignore_missing_commits ? 0 : -1;
-	for (i = 0; i < nr_reference; i++) {
+	for (i = 0; i < nr_reference; i++)
 		if (repo_parse_commit(r, reference[i]))
 			return ignore_missing_commits ? 0 : -1;
 
+	/*
+	 * Only walk from the references for which the reachability index
+	 * of the commit-graph does not know the answer.
+	 */
+	if (commit_graph_has_reach_index(r)) {
+		int nr_unsettled = 0;
+
+		ALLOC_ARRAY(unsettled, nr_reference);
+		for (i = 0; i < nr_reference; i++) {
+			int reach = commit_graph_can_reach(r, reference[i], commit);
+			if (reach > 0) {
+				ret = 1;
+				goto done;
+			}
+			if (reach < 0)
+				unsettled[nr_unsettled++] = reference[i];
+		}
+		reference = unsettled;
+		nr_reference = nr_unsettled;
+		if (!nr_reference)
+			goto done;
+	}
+
+	for (i = 0; i < nr_reference; i++) {
 		generation = commit_graph_generation(reference[i]);
 		if (generation > max_generation)
 			max_generation = generation;
@@ -548,7 +586,7 @@ int repo_in_merge_bases_many(struct repository *r, struct commit *commit,
 
 	generation = commit_graph_generation(commit);
 	if (generation > max_generation)
-		return ret;
+		goto done;
 
 	if (paint_down_to_common(r, commit,
 				 nr_reference, reference,
@@ -559,6 +597,8 @@ int repo_in_merge_bases_many(struct repository *r, struct commit *commit,
 	clear_commit_marks(commit, all_flags);
 	clear_commit_marks_many(nr_reference, reference, all_flags);
 	free_commit_list(bases);
+done:
+	free(unsettled);
 	return ret;
 }
 
@@ -689,6 +729,28 @@ static int in_commit_list(const struct commit_list *want, struct commit *c)
  * Test whether the candidate is contained in the list.
  * Do not recurse to find out, though, but return -1 if inconclusive.
  */
+static enum contains_result contains_test_reach_index(struct commit *candidate,
+						      const struct commit_list *want,
+						      enum contains_result *cached)
+{
+	enum contains_result result = CONTAINS_NO;
+
+	for (; want; want = want->next) {
+		int reach = commit_graph_can_reach(the_repository, candidate,
+						   want->item);
+		if (reach > 0) {
+			result = CONTAINS_YES;
+			break;
+		}
+		if (reach < 0)
+			result = CONTAINS_UNKNOWN;
+	}
+
+	if (result != CONTAINS_UNKNOWN)
+		*cached = result;
+	return result;
+}
+
 static enum contains_result contains_test(struct commit *candidate,
 					  const struct commit_list *want,
 					  struct contains_cache *cache,
@@ -712,7 +774,8 @@ static enum contains_result contains_test(struct commit *candidate,
 	if (commit_graph_generation(candidate) < cutoff)
 		return CONTAINS_NO;
 
-	return CONTAINS_UNKNOWN;
+	/* The reachability index of the commit-graph may know the answer. */
+	return contains_test_reach_index(candidate, want, cached);
 }
 
 static void push_to_contains_stack(struct commit *candidate, struct contains_stack *contains_stack)
@@ -926,9 +989,47 @@ int can_all_from_reach(struct commit_list *from, struct commit_list *to,
 		to_iter = to_iter->next;
 	}
 
+	/*
+	 * Drop the commits the reachability index of the commit-graph
+	 * knows to reach one of "to", and stop early if it knows one
+	 * that does not.
+	 */
+	if (commit_graph_has_reach_index(the_repository)) {
+		struct object_array unsettled = OBJECT_ARRAY_INIT;
+		size_t i;
+
+		for (i = 0; i < from_objs.nr; i++) {
+			struct commit *c = (struct commit *)from_objs.objects[i].item;
+			int reach = 0;
+
+			for (to_iter = to; to_iter; to_iter = to_iter->next) {
+				int one = commit_graph_can_reach(the_repository, c,
+								 to_iter->item);
+				if (one > 0) {
+					reach = 1;
+					break;
+				}
+				if (one < 0)
+					reach = -1;
+			}
+
+			if (!reach) {
+				object_array_clear(&unsettled);
+				result = 0;
+				goto cleanup;
+			}
+			if (reach < 0)
+				add_object_array(&c->object, NULL, &unsettled);
+		}
+
+		object_array_clear(&from_objs);
+		from_objs = unsettled;
+	}
+
 	result = can_all_from_reach_with_flag(&from_objs, PARENT2, PARENT1,
 					      min_commit_date, min_generation);
 
+cleanup:
 	while (from) {
 		clear_commit_marks(from->item, PARENT1);
 		from = from->next;
@@ -955,7 +1056,10 @@ struct commit_list *get_reachable_subset(struct commit **from, size_t nr_from,
 	timestamp_t min_generation = GENERATION_NUMBER_INFINITY;
 	int num_to_find = 0;
 
-	struct prio_queue queue = { compare_commits_by_gen_then_commit_date };
+	struct prio_queue queue = {
+		.compare = compare_commits_by_gen_then_commit_date,
+		.get_key = commit_gen_then_date_queue_key,
+	};
 
 	for (item = to; item < to_last; item++) {
 		timestamp_t generation;
@@ -1048,12 +1152,19 @@ void ahead_behind(struct repository *r,
 		  struct commit **commits, size_t commits_nr,
 		  struct ahead_behind_count *counts, size_t counts_nr)
 {
-	struct prio_queue queue = { .compare = compare_commits_by_gen_then_commit_date };
+	struct prio_queue queue = {
+		.compare = compare_commits_by_gen_then_commit_date,
+		.get_key = commit_gen_then_date_queue_key,
+	};
 	size_t width = DIV_ROUND_UP(commits_nr, BITS_IN_EWORD);
 
 	if (!commits_nr || !counts_nr)
 		return;
 
+	/* Reachability bitmaps answer without walking at all. */
+	if (!bitmap_ahead_behind(r, commits, commits_nr, counts, counts_nr))
+		return;
+
 	for (size_t i = 0; i < counts_nr; i++) {
 		counts[i].ahead = 0;
 		counts[i].behind = 0;
@@ -1252,7 +1363,10 @@ int get_branch_base_for_tip(struct repository *r,
 {
 	int best_index = -1;
 	struct commit *branch_point = NULL;
-	struct prio_queue queue = { compare_commits_by_gen_then_commit_date };
+	struct prio_queue queue = {
+		.compare = compare_commits_by_gen_then_commit_date,
+		.get_key = commit_gen_then_date_queue_key,
+	};
 	int found_missing_gen = 0;
 
 	if (!bases_nr)
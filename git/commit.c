@@ -892,6 +892,33 @@ int compare_commits_by_commit_date(const void *a_, const void *b_,
 	return 0;
 }
 
+void commit_author_date_queue_key(const void *commit, uint64_t key[2],
+				  void *cb_data)
+{
+	struct author_date_slab *author_date = cb_data;
+
+	key[0] = *(author_date_slab_at(author_date, commit));
+	key[1] = 0;
+}
+
+void commit_date_queue_key(const void *commit, uint64_t key[2],
+			   void *unused UNUSED)
+{
+	const struct commit *c = commit;
+
+	key[0] = c->date;
+	key[1] = 0;
+}
+
+void commit_gen_then_date_queue_key(const void *commit, uint64_t key[2],
+				    void *unused UNUSED)
+{
+	const struct commit *c = commit;
+
+	key[0] = commit_graph_generation(c);
+	key[1] = c->date;
+}
+
 /*
  * Performs an in-place topological sort on the list supplied.
  */
@@ -917,10 +944,12 @@ void sort_in_topological_order(struct commit_list **list, enum rev_sort_order so
 		break;
 	case REV_SORT_BY_COMMIT_DATE:
 		queue.compare = compare_commits_by_commit_date;
+		queue.get_key = commit_date_queue_key;
 		break;
 	case REV_SORT_BY_AUTHOR_DATE:
 		init_author_date_slab(&author_date);
 		queue.compare = compare_commits_by_author_date;
+		queue.get_key = commit_author_date_queue_key;
 		queue.cb_data = &author_date;
 		break;
 	}
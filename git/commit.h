@@ -359,6 +359,14 @@ void verify_merge_signature(struct commit *commit, int verbose,
 int compare_commits_by_commit_date(const void *a_, const void *b_, void *unused);
 int compare_commits_by_gen_then_commit_date(const void *a_, const void *b_, void *unused);
 
+/*
+ * Keys for a prio_queue that order commits like the comparison
+ * functions of the same name, without looking at the commits again.
+ */
+void commit_author_date_queue_key(const void *commit, uint64_t key[2], void *author_date);
+void commit_date_queue_key(const void *commit, uint64_t key[2], void *unused);
+void commit_gen_then_date_queue_key(const void *commit, uint64_t key[2], void *unused);
+
 LAST_ARG_MUST_BE_NULL
 int run_commit_hook(int editor_is_used, const char *index_file,
 		    int *invoked_hook, const char *name, ...);
@@ -0,0 +1,682 @@
+#include "git-compat-util.h"
+#include "dir.h"
+#include "fsmonitor-ll.h"
+#include "fsm-listen.h"
+#include "fsmonitor--daemon.h"
+#include "gettext.h"
+#include "hashmap.h"
+#include "list.h"
+#include "simple-ipc.h"
+#include "string-list.h"
+#include "trace.h"
+
+#include <poll.h>
+#include <sys/inotify.h>
+
+/*
+ * inotify only reports changes to the direct children of a watched
+ * directory, so we have to put a watch on every directory of the
+ * worktree ourselves, and keep up with directories that are created,
+ * deleted or renamed while we are running.
+ *
+ * We do not look inside ".git" (or any nested ".git" of a submodule or
+ * an embedded repository) except for the cookie directory, as clients
+ * do not care about changes in there, and the object store alone could
+ * use up a good part of the watch descriptors a user gets.
+ */
+#define WATCH_MASK (IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MODIFY | \
+		    IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | \
+		    IN_MOVE_SELF | IN_ONLYDIR | IN_DONT_FOLLOW | \
+		    IN_EXCL_UNLINK)
+
+struct watch_entry {
+	struct hashmap_entry wd_entry;
+	struct hashmap_entry path_entry;
+	int wd;
+	/* the worktree root or the external <gitdir> */
+	unsigned int is_root:1;
+	/* the rescan that last saw this directory */
+	unsigned int scan_seq;
+	char *path; /* absolute, without a trailing slash */
+
+	/*
+	 * The watches of the directories right below this one, so that
+	 * a subtree can be dropped without looking at every watch.
+	 */
+	struct watch_entry *parent;
+	struct list_head children;
+	struct list_head sibling;
+};
+
+struct fsm_listen_data
+{
+	int fd_inotify;
+	int fd_stop[2];
+
+	/* All watches, by watch descriptor and by path */
+	struct hashmap watches_by_wd;
+	struct hashmap watches_by_path;
+	unsigned int scan_seq;
+
+	enum shutdown_style {
+		SHUTDOWN_EVENT = 0,
+		FORCE_SHUTDOWN,
+		FORCE_ERROR_STOP,
+	} shutdown_style;
+};
+
+static int watch_wd_cmp(const void *cmp_data UNUSED,
+			const struct hashmap_entry *eptr,
+			const struct hashmap_entry *entry_or_key,
+			const void *keydata UNUSED)
+{
+	const struct watch_entry *a, *b;
+
+	a = container_of(eptr, const struct watch_entry, wd_entry);
+	b = container_of(entry_or_key, const struct watch_entry, wd_entry);
+	return a->wd != b->wd;
+}
+
+static int watch_path_cmp(const void *cmp_data UNUSED,
+			  const struct hashmap_entry *eptr,
+			  const struct hashmap_entry *entry_or_key,
+			  const void *keydata)
+{
+	const struct watch_entry *a, *b;
+
+	a = container_of(eptr, const struct watch_entry, path_entry);
+	b = container_of(entry_or_key, const struct watch_entry, path_entry);
+	return strcmp(a->path, keydata ? keydata : b->path);
+}
+
+static struct watch_entry *find_watch_by_wd(struct fsm_listen_data *data,
+					    int wd)
+{
+	struct watch_entry key;
+
+	hashmap_entry_init(&key.wd_entry, memhash(&wd, sizeof(wd)));
+	key.wd = wd;
+	return hashmap_get_entry(&data->watches_by_wd, &key, wd_entry, NULL);
+}
+
+static struct watch_entry *find_watch_by_path(struct fsm_listen_data *data,
+					      const char *path)
+{
+	return hashmap_get_entry_from_hash(&data->watches_by_path,
+					   strhash(path), path,
+					   struct watch_entry, path_entry);
+}
+
+/*
+ * Hang `w` below the watch of its parent directory, if we have one;
+ * the roots and the cookie directory inside ".git" have none.
+ */
+static void link_watch_to_parent(struct fsm_listen_data *data,
+				 struct watch_entry *w)
+{
+	const char *slash = strrchr(w->path, '/');
+	char *dirname;
+
+	if (w->parent) {
+		list_del_init(&w->sibling);
+		w->parent = NULL;
+	}
+	if (w->is_root || !slash)
+		return;
+
+	dirname = xmemdupz(w->path, slash - w->path);
+	w->parent = find_watch_by_path(data, dirname);
+	if (w->parent)
+		list_add_tail(&w->sibling, &w->parent->children);
+	free(dirname);
+}
+
+static void forget_watch(struct fsm_listen_data *data, struct watch_entry *w)
+{
+	struct list_head *pos, *tmp;
+
+	if (w->parent)
+		list_del(&w->sibling);
+	list_for_each_safe(pos, tmp, &w->children) {
+		struct watch_entry *child =
+			list_entry(pos, struct watch_entry, sibling);
+
+		list_del_init(&child->sibling);
+		child->parent = NULL;
+	}
+
+	hashmap_remove(&data->watches_by_wd, &w->wd_entry, NULL);
+	hashmap_remove(&data->watches_by_path, &w->path_entry, w->path);
+	free(w->path);
+	free(w);
+}
+
+/*
+ * Watch the directory `path`.  Directories that vanish or that we may
+ * not read before we get to them are skipped, as there is nothing in
+ * there for a client to see either.
+ *
+ * Returns -1 if the directory should be watched but cannot be, most
+ * likely because we ran out of watch descriptors.
+ */
+static int add_watch(struct fsm_listen_data *data, const char *path,
+		     int is_root)
+{
+	struct watch_entry *w;
+	int wd;
+
+	wd = inotify_add_watch(data->fd_inotify, path, WATCH_MASK);
+	if (wd < 0) {
+		if (!is_root &&
+		    (errno == ENOENT || errno == ENOTDIR || errno == EACCES)) {
+			trace_printf_key(&trace_fsmonitor,
+					 "skipping '%s': %s",
+					 path, strerror(errno));
+			return 0;
+		}
+		if (errno == ENOSPC)
+			return error(_("inotify watch limit reached while watching '%s'; "
+				       "consider raising fs.inotify.max_user_watches"),
+				     path);
+		return error_errno(_("could not watch '%s'"), path);
+	}
+
+	w = find_watch_by_wd(data, wd);
+	if (w && strcmp(w->path, path)) {
+		/* A directory we already watch was renamed. */
+		hashmap_remove(&data->watches_by_path, &w->path_entry, w->path);
+		free(w->path);
+		w->path = xstrdup(path);
+		hashmap_entry_init(&w->path_entry, strhash(w->path));
+		hashmap_add(&data->watches_by_path, &w->path_entry);
+	} else if (!w) {
+		CALLOC_ARRAY(w, 1);
+		w->wd = wd;
+		w->path = xstrdup(path);
+		INIT_LIST_HEAD(&w->children);
+		INIT_LIST_HEAD(&w->sibling);
+		hashmap_entry_init(&w->wd_entry, memhash(&wd, sizeof(wd)));
+		hashmap_entry_init(&w->path_entry, strhash(w->path));
+		hashmap_add(&data->watches_by_wd, &w->wd_entry);
+		hashmap_add(&data->watches_by_path, &w->path_entry);
+	}
+	w->is_root = !!is_root;
+	w->scan_seq = data->scan_seq;
+	link_watch_to_parent(data, w);
+	return 0;
+}
+
+/*
+ * Watch `path` and all directories below it, leaving out ".git".
+ */
+static int add_watches_recursive(struct fsm_listen_data *data,
+				 struct strbuf *path, int is_root)
+{
+	DIR *dir;
+	struct dirent *de;
+	size_t len = path->len;
+	int ret = 0;
+
+	if (add_watch(data, path->buf, is_root))
+		return -1;
+
+	dir = opendir(path->buf);
+	if (!dir)
+		return 0; /* vanished in the meantime */
+
+	while (!ret && (de = readdir_skip_dot_and_dotdot(dir))) {
+		int dtype = DTYPE(de);
+
+		if (!fspathcmp(de->d_name, ".git"))
+			continue;
+
+		strbuf_setlen(path, len);
+		strbuf_addch(path, '/');
+		strbuf_addstr(path, de->d_name);
+
+		if (dtype == DT_UNKNOWN) {
+			struct stat st;
+
+			if (lstat(path->buf, &st))
+				continue;
+			dtype = S_ISDIR(st.st_mode) ? DT_DIR : DT_REG;
+		}
+		if (dtype == DT_DIR)
+			ret = add_watches_recursive(data, path, 0);
+	}
+
+	closedir(dir);
+	strbuf_setlen(path, len);
+	return ret;
+}
+
+/*
+ * Stop watching `path` and the directories below it, because it was
+ * renamed or deleted.  If it was renamed within the worktree, the
+ * watches are set up again under the new name.
+ */
+static void remove_watches_recursive(struct fsm_listen_data *data,
+				     const char *path)
+{
+	struct watch_entry *w = find_watch_by_path(data, path);
+	struct watch_entry **doomed = NULL;
+	size_t doomed_nr = 0, doomed_alloc = 0;
+
+	if (!w)
+		return;
+
+	/* Collect the whole subtree before we take it apart. */
+	ALLOC_GROW(doomed, doomed_nr + 1, doomed_alloc);
+	doomed[doomed_nr++] = w;
+	for (size_t i = 0; i < doomed_nr; i++) {
+		struct list_head *pos;
+
+		list_for_each(pos, &doomed[i]->children) {
+			ALLOC_GROW(doomed, doomed_nr + 1, doomed_alloc);
+			doomed[doomed_nr++] = list_entry(pos, struct watch_entry,
+							 sibling);
+		}
+	}
+
+	for (size_t i = 0; i < doomed_nr; i++) {
+		/* the kernel sends IN_IGNORED, which we no longer care about */
+		inotify_rm_watch(data->fd_inotify, doomed[i]->wd);
+		forget_watch(data, doomed[i]);
+	}
+	free(doomed);
+}
+
+/*
+ * (Re-)watch every directory we care about, and forget the watches of
+ * directories that are no longer there.  This is how we start, and
+ * how we recover after the kernel dropped events and we could have
+ * missed directories being created or renamed.
+ */
+static int add_all_watches(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_listen_data *data = state->listen_data;
+	struct strbuf path = STRBUF_INIT;
+	struct hashmap_iter iter;
+	struct watch_entry *w;
+	struct watch_entry **stale = NULL;
+	size_t stale_nr = 0, stale_alloc = 0;
+	int ret;
+
+	data->scan_seq++;
+
+	strbuf_addbuf(&path, &state->path_worktree_watch);
+	ret = add_watches_recursive(data, &path, 1);
+
+	if (!ret && state->nr_paths_watching > 1)
+		ret = add_watch(data, state->path_gitdir_watch.buf, 1);
+
+	if (!ret) {
+		/* The cookie directory is inside ".git", so add it by hand. */
+		strbuf_reset(&path);
+		strbuf_addbuf(&path, &state->path_cookie_prefix);
+		strbuf_strip_suffix(&path, "/");
+		ret = add_watch(data, path.buf, 0);
+	}
+	strbuf_release(&path);
+
+	hashmap_for_each_entry(&data->watches_by_wd, &iter, w, wd_entry) {
+		if (w->scan_seq == data->scan_seq)
+			continue;
+		ALLOC_GROW(stale, stale_nr + 1, stale_alloc);
+		stale[stale_nr++] = w;
+	}
+	for (size_t i = 0; i < stale_nr; i++) {
+		inotify_rm_watch(data->fd_inotify, stale[i]->wd);
+		forget_watch(data, stale[i]);
+	}
+	free(stale);
+
+	trace_printf_key(&trace_fsmonitor, "watching %u directories",
+			 hashmap_get_size(&data->watches_by_wd));
+	return ret;
+}
+
+static void log_mask_set(const char *path, uint32_t mask)
+{
+	struct strbuf msg = STRBUF_INIT;
+
+	if (mask & IN_ACCESS)
+		strbuf_addstr(&msg, "IN_ACCESS|");
+	if (mask & IN_MODIFY)
+		strbuf_addstr(&msg, "IN_MODIFY|");
+	if (mask & IN_ATTRIB)
+		strbuf_addstr(&msg, "IN_ATTRIB|");
+	if (mask & IN_CLOSE_WRITE)
+		strbuf_addstr(&msg, "IN_CLOSE_WRITE|");
+	if (mask & IN_MOVED_FROM)
+		strbuf_addstr(&msg, "IN_MOVED_FROM|");
+	if (mask & IN_MOVED_TO)
+		strbuf_addstr(&msg, "IN_MOVED_TO|");
+	if (mask & IN_CREATE)
+		strbuf_addstr(&msg, "IN_CREATE|");
+	if (mask & IN_DELETE)
+		strbuf_addstr(&msg, "IN_DELETE|");
+	if (mask & IN_DELETE_SELF)
+		strbuf_addstr(&msg, "IN_DELETE_SELF|");
+	if (mask & IN_MOVE_SELF)
+		strbuf_addstr(&msg, "IN_MOVE_SELF|");
+	if (mask & IN_UNMOUNT)
+		strbuf_addstr(&msg, "IN_UNMOUNT|");
+	if (mask & IN_Q_OVERFLOW)
+		strbuf_addstr(&msg, "IN_Q_OVERFLOW|");
+	if (mask & IN_IGNORED)
+		strbuf_addstr(&msg, "IN_IGNORED|");
+	if (mask & IN_ISDIR)
+		strbuf_addstr(&msg, "IN_ISDIR|");
+
+	trace_printf_key(&trace_fsmonitor, "inotify: '%s', mask=0x%x %s",
+			 path, mask, msg.buf);
+
+	strbuf_release(&msg);
+}
+
+/*
+ * Handle the events in `buf`, which holds everything a single read()
+ * on the inotify descriptor returned, and publish the changes they
+ * describe as one batch.
+ *
+ * Returns -1 if the listener must stop; `data->shutdown_style` then
+ * tells how.
+ */
+static int handle_events(struct fsmonitor_daemon_state *state,
+			 const char *buf, size_t len)
+{
+	struct fsm_listen_data *data = state->listen_data;
+	struct fsmonitor_batch *batch = NULL;
+	struct string_list cookie_list = STRING_LIST_INIT_DUP;
+	struct strbuf path = STRBUF_INIT;
+	struct strbuf tmp = STRBUF_INIT;
+	const char *p;
+
+	for (p = buf; p < buf + len; ) {
+		const struct inotify_event *event = (const void *)p;
+		struct watch_entry *w;
+		const char *rel;
+
+		p += sizeof(*event) + event->len;
+
+		/*
+		 * The kernel dropped events, so we have lost sync with
+		 * the filesystem.  Flush the cached state (which wakes any
+		 * client waiting for a cookie) and the batch we were
+		 * building, which is relative to the flushed token, and
+		 * look for directories we do not know about yet.
+		 */
+		if (event->mask & IN_Q_OVERFLOW) {
+			trace_printf_key(&trace_fsmonitor, "inotify: overflow");
+
+			fsmonitor_force_resync(state);
+			fsmonitor_batch__free_list(batch);
+			string_list_clear(&cookie_list, 0);
+			batch = NULL;
+
+			if (add_all_watches(state))
+				goto force_error_stop;
+			continue;
+		}
+
+		w = find_watch_by_wd(data, event->wd);
+		if (!w)
+			continue; /* a watch we removed ourselves */
+
+		if (event->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF |
+				   IN_UNMOUNT)) {
+			if (trace_pass_fl(&trace_fsmonitor))
+				log_mask_set(w->path, event->mask);
+
+			/*
+			 * The worktree root or the external <gitdir> went
+			 * away or got a new name; the Unix domain socket is
+			 * in there, so clients could no longer find us.
+			 * Other directories are taken care of by the event
+			 * their parent directory gets.
+			 */
+			if (w->is_root) {
+				trace_printf_key(&trace_fsmonitor,
+						 "event: root removed");
+				goto force_shutdown;
+			}
+			if (event->mask & IN_IGNORED)
+				forget_watch(data, w);
+			continue;
+		}
+
+		if (!event->len)
+			continue; /* e.g. IN_ATTRIB on the directory itself */
+
+		strbuf_reset(&path);
+		strbuf_addf(&path, "%s/%s", w->path, event->name);
+
+		/*
+		 * If you want to debug inotify, log the events to
+		 * GIT_TRACE_FSMONITOR.  Please don't log them to Trace2.
+		 */
+		switch (fsmonitor_classify_path_absolute(state, path.buf)) {
+
+		case IS_INSIDE_DOT_GIT_WITH_COOKIE_PREFIX:
+		case IS_INSIDE_GITDIR_WITH_COOKIE_PREFIX:
+			/* special case cookie files within .git or gitdir */
+			if (event->mask & IN_CREATE)
+				string_list_append(&cookie_list, event->name);
+			break;
+
+		case IS_INSIDE_DOT_GIT:
+		case IS_INSIDE_GITDIR:
+			/* ignore all other paths inside of .git or gitdir */
+			break;
+
+		case IS_DOT_GIT:
+		case IS_GITDIR:
+			/*
+			 * If .git directory is deleted or renamed away,
+			 * we have to quit.
+			 */
+			if ((event->mask & IN_ISDIR) &&
+			    (event->mask & (IN_DELETE | IN_MOVED_FROM))) {
+				trace_printf_key(&trace_fsmonitor,
+						 "event: gitdir removed");
+				goto force_shutdown;
+			}
+			break;
+
+		case IS_WORKDIR_PATH:
+			/* try to queue normal pathnames */
+
+			if (trace_pass_fl(&trace_fsmonitor))
+				log_mask_set(path.buf, event->mask);
+
+			rel = path.buf + state->path_worktree_watch.len + 1;
+
+			if (!batch)
+				batch = fsmonitor_batch__new();
+
+			if (!(event->mask & IN_ISDIR)) {
+				fsmonitor_batch__add_path(batch, rel);
+				break;
+			}
+
+			/*
+			 * Tell the client about the directory, so that it
+			 * invalidates everything below it: files that were
+			 * created in a new directory before we got to watch
+			 * it produced no events of their own.
+			 */
+			strbuf_reset(&tmp);
+			strbuf_addstr(&tmp, rel);
+			strbuf_addch(&tmp, '/');
+			fsmonitor_batch__add_path(batch, tmp.buf);
+
+			if (event->mask & (IN_DELETE | IN_MOVED_FROM))
+				remove_watches_recursive(data, path.buf);
+			if ((event->mask & (IN_CREATE | IN_MOVED_TO)) &&
+			    fspathcmp(event->name, ".git") &&
+			    add_watches_recursive(data, &path, 0))
+				goto force_error_stop;
+			break;
+
+		case IS_OUTSIDE_CONE:
+		default:
+			trace_printf_key(&trace_fsmonitor,
+					 "ignoring '%s'", path.buf);
+			break;
+		}
+	}
+
+	fsmonitor_publish(state, batch, &cookie_list);
+	string_list_clear(&cookie_list, 0);
+	strbuf_release(&path);
+	strbuf_release(&tmp);
+	return 0;
+
+force_error_stop:
+	/*
+	 * A directory we cannot watch is a directory whose changes we
+	 * would miss, so we cannot continue to answer queries.
+	 */
+	data->shutdown_style = FORCE_ERROR_STOP;
+	goto stop;
+
+force_shutdown:
+	data->shutdown_style = FORCE_SHUTDOWN;
+
+stop:
+	fsmonitor_batch__free_list(batch);
+	string_list_clear(&cookie_list, 0);
+	strbuf_release(&path);
+	strbuf_release(&tmp);
+	return -1;
+}
+
+int fsm_listen__ctor(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_listen_data *data;
+
+	CALLOC_ARRAY(data, 1);
+	state->listen_data = data;
+
+	data->fd_stop[0] = data->fd_stop[1] = -1;
+	hashmap_init(&data->watches_by_wd, watch_wd_cmp, NULL, 0);
+	hashmap_init(&data->watches_by_path, watch_path_cmp, NULL, 0);
+
+	data->fd_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (data->fd_inotify < 0) {
+		error_errno(_("could not initialize inotify"));
+		goto failed;
+	}
+
+	if (pipe(data->fd_stop) < 0) {
+		error_errno(_("could not create pipe"));
+		goto failed;
+	}
+
+	if (add_all_watches(state))
+		goto failed;
+
+	return 0;
+
+failed:
+	fsm_listen__dtor(state);
+	return -1;
+}
+
+void fsm_listen__dtor(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_listen_data *data;
+
+	if (!state || !state->listen_data)
+		return;
+
+	data = state->listen_data;
+
+	/* closing the descriptor removes all of its watches */
+	if (data->fd_inotify >= 0)
+		close(data->fd_inotify);
+	if (data->fd_stop[0] >= 0)
+		close(data->fd_stop[0]);
+	if (data->fd_stop[1] >= 0)
+		close(data->fd_stop[1]);
+
+	hashmap_clear(&data->watches_by_path);
+	hashmap_clear_and_free(&data->watches_by_wd, struct watch_entry,
+			       wd_entry);
+
+	FREE_AND_NULL(state->listen_data);
+}
+
+void fsm_listen__stop_async(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_listen_data *data = state->listen_data;
+
+	data->shutdown_style = SHUTDOWN_EVENT;
+	if (write(data->fd_stop[1], "x", 1) < 0)
+		error_errno(_("could not stop the fsmonitor listener"));
+}
+
+void fsm_listen__loop(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_listen_data *data = state->listen_data;
+	/* large enough for a burst of events, aligned like the events */
+	union {
+		struct inotify_event event;
+		char buf[64 * 1024];
+	} u;
+
+	/*
+	 * Our fs event listener is now running, so it's safe to start
+	 * serving client requests.
+	 */
+	ipc_server_start_async(state->ipc_server_data);
+
+	for (;;) {
+		struct pollfd pfd[2];
+		ssize_t len;
+
+		pfd[0].fd = data->fd_inotify;
+		pfd[0].events = POLLIN;
+		pfd[1].fd = data->fd_stop[0];
+		pfd[1].events = POLLIN;
+
+		if (poll(pfd, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			error_errno(_("poll() failed"));
+			data->shutdown_style = FORCE_ERROR_STOP;
+			break;
+		}
+
+		if (pfd[1].revents)
+			break; /* fsm_listen__stop_async() */
+
+		if (!(pfd[0].revents & POLLIN))
+			continue;
+
+		len = read(data->fd_inotify, u.buf, sizeof(u.buf));
+		if (len < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			error_errno(_("could not read inotify events"));
+			data->shutdown_style = FORCE_ERROR_STOP;
+			break;
+		}
+
+		if (handle_events(state, u.buf, len))
+			break;
+	}
+
+	switch (data->shutdown_style) {
+	case FORCE_ERROR_STOP:
+		state->listen_error_code = -1;
+		/* fall thru */
+	case FORCE_SHUTDOWN:
+		ipc_server_stop_async(state->ipc_server_data);
+		/* fall thru */
+	case SHUTDOWN_EVENT:
+	default:
+		break;
+	}
+}
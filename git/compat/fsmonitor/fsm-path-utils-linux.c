@@ -0,0 +1,97 @@
+#include "git-compat-util.h"
+#include "fsmonitor-ll.h"
+#include "fsmonitor-path-utils.h"
+#include "gettext.h"
+#include "trace.h"
+
+#include <sys/vfs.h>
+
+/*
+ * statfs(2) only tells us the magic number of the file system, so map
+ * the ones we care about to a name, and remember which of them are
+ * network file systems.  The numbers come from <linux/magic.h> and
+ * the statfs(2) manual page.
+ */
+static const struct {
+	unsigned long magic;
+	const char *name;
+	int is_remote;
+} fs_types[] = {
+	{ 0x00006969, "nfs", 1 },
+	{ 0x0000517b, "smb", 1 },
+	{ 0xff534d42, "cifs", 1 },
+	{ 0xfe534d42, "smb2", 1 },
+	{ 0x6b414653, "afs", 1 },
+	{ 0x5346414f, "afs", 1 },
+	{ 0x73757245, "coda", 1 },
+	{ 0x01021997, "9p", 1 },
+	{ 0x0000564c, "ncp", 1 },
+	{ 0x00c36400, "ceph", 1 },
+	{ 0x0bd00bd0, "lustre", 1 },
+	{ 0x47504653, "gpfs", 1 },
+	{ 0x00004d44, "msdos", 0 },
+	{ 0x5346544e, "ntfs", 0 },
+	{ 0x2011bab0, "exfat", 0 },
+};
+
+int fsmonitor__get_fs_info(const char *path, struct fs_info *fs_info)
+{
+	struct statfs fs;
+	const char *name = NULL;
+
+	if (statfs(path, &fs) == -1) {
+		int saved_errno = errno;
+		trace_printf_key(&trace_fsmonitor, "statfs('%s') failed: %s",
+				 path, strerror(saved_errno));
+		errno = saved_errno;
+		return -1;
+	}
+
+	fs_info->is_remote = 0;
+	for (size_t i = 0; i < ARRAY_SIZE(fs_types); i++) {
+		if ((unsigned long)fs.f_type == fs_types[i].magic) {
+			name = fs_types[i].name;
+			fs_info->is_remote = fs_types[i].is_remote;
+			break;
+		}
+	}
+
+	trace_printf_key(&trace_fsmonitor,
+			 "statfs('%s') [type 0x%08lx] '%s'",
+			 path, (unsigned long)fs.f_type, name ? name : "");
+
+	fs_info->typename = name ? xstrdup(name) :
+		xstrfmt("0x%08lx", (unsigned long)fs.f_type);
+
+	trace_printf_key(&trace_fsmonitor,
+				"'%s' is_remote: %d",
+				path, fs_info->is_remote);
+	return 0;
+}
+
+int fsmonitor__is_fs_remote(const char *path)
+{
+	struct fs_info fs;
+	if (fsmonitor__get_fs_info(path, &fs))
+		return -1;
+
+	free(fs.typename);
+
+	return fs.is_remote;
+}
+
+/*
+ * Linux does not have the synthetic firmlinks of macOS, so the paths
+ * we are given are the paths inotify reports.
+ */
+int fsmonitor__get_alias(const char *path UNUSED,
+			 struct alias_info *info UNUSED)
+{
+	return 0;
+}
+
+char *fsmonitor__resolve_alias(const char *path UNUSED,
+			       const struct alias_info *info UNUSED)
+{
+	return NULL;
+}
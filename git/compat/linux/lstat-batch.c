@@ -0,0 +1,208 @@
+#include "git-compat-util.h"
+
+#include "compat/lstat-batch.h"
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+
+/*
+ * The paths are lstat()'ed by submitting one IORING_OP_STATX request per
+ * path to an io_uring, and waiting for all of them at once.  This talks
+ * to the kernel directly, so as not to depend on liburing for the small
+ * part of it we need.
+ */
+struct lstat_batch {
+	int fd;
+	unsigned int depth;
+	int broken;
+
+	void *sq_ring, *cq_ring;
+	size_t sq_ring_size, cq_ring_size;
+	unsigned int *sq_tail, *sq_mask, *sq_array;
+	unsigned int *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe *cqes;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+
+	struct statx *stx;
+};
+
+static int io_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, unsigned int to_submit,
+			  unsigned int min_complete, unsigned int flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+		       flags, NULL, 0);
+}
+
+void lstat_batch_release(struct lstat_batch *batch)
+{
+	if (!batch)
+		return;
+	if (batch->sqes)
+		munmap(batch->sqes, batch->sqes_size);
+	if (batch->cq_ring && batch->cq_ring != batch->sq_ring)
+		munmap(batch->cq_ring, batch->cq_ring_size);
+	if (batch->sq_ring)
+		munmap(batch->sq_ring, batch->sq_ring_size);
+	if (batch->fd >= 0)
+		close(batch->fd);
+	free(batch->stx);
+	free(batch);
+}
+
+static void *map_ring(int fd, size_t size, off_t offset)
+{
+	void *map = xmmap_gently(NULL, size, PROT_READ | PROT_WRITE,
+				 MAP_SHARED | MAP_POPULATE, fd, offset);
+	return map == MAP_FAILED ? NULL : map;
+}
+
+struct lstat_batch *lstat_batch_init(unsigned int depth)
+{
+	struct io_uring_params p = { 0 };
+	struct lstat_batch *batch;
+
+	if (!depth)
+		return NULL;
+
+	CALLOC_ARRAY(batch, 1);
+	batch->fd = io_uring_setup(depth, &p);
+	if (batch->fd < 0)
+		goto fail;
+	batch->depth = depth;
+
+	batch->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	batch->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (batch->cq_ring_size > batch->sq_ring_size)
+			batch->sq_ring_size = batch->cq_ring_size;
+		batch->cq_ring_size = batch->sq_ring_size;
+	}
+
+	batch->sq_ring = map_ring(batch->fd, batch->sq_ring_size, IORING_OFF_SQ_RING);
+	if (!batch->sq_ring)
+		goto fail;
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		batch->cq_ring = batch->sq_ring;
+	else
+		batch->cq_ring = map_ring(batch->fd, batch->cq_ring_size,
+					  IORING_OFF_CQ_RING);
+	if (!batch->cq_ring)
+		goto fail;
+	batch->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	batch->sqes = map_ring(batch->fd, batch->sqes_size, IORING_OFF_SQES);
+	if (!batch->sqes)
+		goto fail;
+
+	batch->sq_tail = (unsigned int *)((char *)batch->sq_ring + p.sq_off.tail);
+	batch->sq_mask = (unsigned int *)((char *)batch->sq_ring + p.sq_off.ring_mask);
+	batch->sq_array = (unsigned int *)((char *)batch->sq_ring + p.sq_off.array);
+	batch->cq_head = (unsigned int *)((char *)batch->cq_ring + p.cq_off.head);
+	batch->cq_tail = (unsigned int *)((char *)batch->cq_ring + p.cq_off.tail);
+	batch->cq_mask = (unsigned int *)((char *)batch->cq_ring + p.cq_off.ring_mask);
+	batch->cqes = (struct io_uring_cqe *)((char *)batch->cq_ring + p.cq_off.cqes);
+
+	ALLOC_ARRAY(batch->stx, depth);
+	return batch;
+
+fail:
+	lstat_batch_release(batch);
+	return NULL;
+}
+
+static void statx_to_stat(const struct statx *stx, struct stat *st)
+{
+	memset(st, 0, sizeof(*st));
+	st->st_dev = makedev(stx->stx_dev_major, stx->stx_dev_minor);
+	st->st_ino = stx->stx_ino;
+	st->st_mode = stx->stx_mode;
+	st->st_nlink = stx->stx_nlink;
+	st->st_uid = stx->stx_uid;
+	st->st_gid = stx->stx_gid;
+	st->st_rdev = makedev(stx->stx_rdev_major, stx->stx_rdev_minor);
+	st->st_size = stx->stx_size;
+	st->st_blksize = stx->stx_blksize;
+	st->st_blocks = stx->stx_blocks;
+	st->st_atim.tv_sec = stx->stx_atime.tv_sec;
+	st->st_atim.tv_nsec = stx->stx_atime.tv_nsec;
+	st->st_mtim.tv_sec = stx->stx_mtime.tv_sec;
+	st->st_mtim.tv_nsec = stx->stx_mtime.tv_nsec;
+	st->st_ctim.tv_sec = stx->stx_ctime.tv_sec;
+	st->st_ctim.tv_nsec = stx->stx_ctime.tv_nsec;
+}
+
+static void queue_statx(struct lstat_batch *batch, unsigned int i,
+			const char *path)
+{
+	unsigned int tail = *batch->sq_tail;
+	unsigned int index = tail & *batch->sq_mask;
+	struct io_uring_sqe *sqe = &batch->sqes[index];
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_STATX;
+	sqe->fd = AT_FDCWD;
+	sqe->addr = (uintptr_t)path;
+	sqe->len = STATX_BASIC_STATS;
+	sqe->off = (uintptr_t)&batch->stx[i];
+	sqe->statx_flags = AT_SYMLINK_NOFOLLOW | AT_STATX_SYNC_AS_STAT;
+	sqe->user_data = i;
+	batch->sq_array[index] = index;
+
+	/* The kernel must see the request before the new tail. */
+	__atomic_store_n(batch->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+int lstat_batch(struct lstat_batch *batch, const char **paths, unsigned int nr,
+		struct stat *st, int *err)
+{
+	unsigned int submitted = 0, completed = 0;
+
+	if (batch->broken || nr > batch->depth)
+		return -1;
+
+	for (unsigned int i = 0; i < nr; i++)
+		queue_statx(batch, i, paths[i]);
+
+	while (completed < nr) {
+		unsigned int head, tail;
+		int ret;
+
+		ret = io_uring_enter(batch->fd, nr - submitted,
+				     1, IORING_ENTER_GETEVENTS);
+		if (ret < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			/* Requests may be in flight; do not reuse the ring. */
+			batch->broken = 1;
+			return -1;
+		}
+		submitted += ret;
+
+		head = *batch->cq_head;
+		tail = __atomic_load_n(batch->cq_tail, __ATOMIC_ACQUIRE);
+		for (; head != tail; head++) {
+			struct io_uring_cqe *cqe = &batch->cqes[head & *batch->cq_mask];
+			unsigned int i = cqe->user_data;
+
+			if (cqe->res == -EINVAL) {
+				/* A kernel without statx requests; ask again. */
+				batch->broken = 1;
+				err[i] = lstat(paths[i], &st[i]) ? errno : 0;
+			} else if (cqe->res < 0) {
+				err[i] = -cqe->res;
+			} else {
+				statx_to_stat(&batch->stx[i], &st[i]);
+				err[i] = 0;
+			}
+			completed++;
+		}
+		__atomic_store_n(batch->cq_head, head, __ATOMIC_RELEASE);
+	}
+	return 0;
+}
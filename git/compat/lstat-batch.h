@@ -0,0 +1,31 @@
+#ifndef COMPAT_LSTAT_BATCH_H
+#define COMPAT_LSTAT_BATCH_H
+
+/*
+ * lstat() many paths with one system call, so that the latency of each
+ * lstat() overlaps with the others, on platforms that can.  This pays
+ * off on network file systems and overlays where every call has to
+ * wait.
+ */
+struct lstat_batch;
+
+/*
+ * Prepare to lstat() up to "depth" paths at a time.  Returns NULL if the
+ * platform cannot, in which case the caller should lstat() the paths
+ * one by one.
+ */
+struct lstat_batch *lstat_batch_init(unsigned int depth);
+
+/*
+ * lstat() the "nr" paths, at most the depth given to lstat_batch_init(),
+ * into "st".  "err[i]" is set to 0 if "paths[i]" could be lstat()'ed and
+ * to the errno lstat() would have set otherwise.  Returns -1 if the
+ * batch could not be run at all, in which case the caller should lstat()
+ * the paths itself, and 0 otherwise.
+ */
+int lstat_batch(struct lstat_batch *batch, const char **paths, unsigned int nr,
+		struct stat *st, int *err);
+
+void lstat_batch_release(struct lstat_batch *batch);
+
+#endif /* COMPAT_LSTAT_BATCH_H */
@@ -12,6 +12,8 @@
 #include "setup.h"
 #include "strbuf.h"
 #include "string-list.h"
+#include "strvec.h"
+#include "upload-pack-worker.h"
 
 #ifdef NO_INITGROUPS
 #define initgroups(x, y) (0) /* nothing */
@@ -35,7 +37,7 @@ static const char daemon_usage[] =
 "           [--interpolated-path=<path>]\n"
 "           [--reuseaddr] [--pid-file=<file>]\n"
 "           [--(enable|disable|allow-override|forbid-override)=<service>]\n"
-"           [--access-hook=<path>]\n"
+"           [--access-hook=<path>] [--upload-pack-workers=<path>]\n"
 "           [--inetd | [--listen=<host_or_ipaddr>] [--port=<n>]\n"
 "                      [--detach] [--user=<user> [--group=<group>]]\n"
 "           [--log-destination=(stderr|syslog|none)]\n"
@@ -59,6 +61,9 @@ static int base_path_relaxed;
  */
 static const char *user_path;
 
+/* If defined, upload-pack requests are handed to warm workers */
+static const char *upload_pack_workers;
+
 /* Timeout, and initial timeout */
 static unsigned int timeout;
 static unsigned int init_timeout;
@@ -468,6 +473,25 @@ static int run_service_command(struct child_process *cld)
 static int upload_pack(const struct strvec *env)
 {
 	struct child_process cld = CHILD_PROCESS_INIT;
+
+#ifndef NO_UNIX_SOCKETS
+	if (upload_pack_workers) {
+		struct strvec args = STRVEC_INIT;
+		int conn;
+
+		strvec_pushf(&args, "--timeout=%u", timeout);
+		conn = upload_pack_worker_start(upload_pack_workers,
+						&args, env, 0, 1);
+		strvec_clear(&args);
+		if (conn >= 0) {
+			close(0);
+			close(1);
+			return upload_pack_worker_finish(conn);
+		}
+		loginfo("No upload-pack worker available, spawning one-off");
+	}
+#endif
+
 	strvec_pushl(&cld.args, "upload-pack", "--strict", NULL);
 	strvec_pushf(&cld.args, "--timeout=%u", timeout);
 
@@ -1304,6 +1328,13 @@ int cmd_main(int argc, const char **argv)
 			access_hook = v;
 			continue;
 		}
+		if (skip_prefix(arg, "--upload-pack-workers=", &v)) {
+#ifdef NO_UNIX_SOCKETS
+			die("--upload-pack-workers requires Unix domain sockets");
+#endif
+			upload_pack_workers = absolute_pathdup(v);
+			continue;
+		}
 		if (skip_prefix(arg, "--timeout=", &v)) {
 			if (strtoul_ui(v, 10, &timeout))
 				die(_("invalid timeout '%s', expecting a non-negative integer"), v);
@@ -0,0 +1,360 @@
+#include "git-compat-util.h"
+#include "dir-prefetch.h"
+#include "dir.h"
+#include "gettext.h"
+#include "hashmap.h"
+#include "list.h"
+#include "read-cache-ll.h"
+#include "repository.h"
+#include "strbuf.h"
+#include "thread-utils.h"
+#include "trace2.h"
+
+enum dir_job_state {
+	DIR_JOB_QUEUED,
+	DIR_JOB_RUNNING,
+	DIR_JOB_DONE,
+};
+
+struct dir_job {
+	struct hashmap_entry ent;
+	struct list_head queue; /* while DIR_JOB_QUEUED */
+	enum dir_job_state state;
+	struct dir_listing *listing;
+	size_t len;
+	char path[FLEX_ARRAY];
+};
+
+struct dir_prefetch {
+	struct index_state *istate;
+	int expand;
+
+	pthread_t *threads;
+	int nr_threads;
+
+	/*
+	 * Everything below is protected by "mutex".  Jobs are in "jobs"
+	 * until the caller picks up their listing, and on "queue" until
+	 * a thread starts reading them.
+	 */
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+	struct hashmap jobs;
+	struct list_head queue;
+	int stopping;
+
+	unsigned int nr_prefetched, nr_waited, nr_read;
+};
+
+/* Bounds the memory held by listings that are read but not asked for. */
+#define DIR_PREFETCH_MAX_JOBS 4096
+
+static int dir_job_cmp(const void *cmp_data UNUSED,
+		       const struct hashmap_entry *eptr,
+		       const struct hashmap_entry *entry_or_key,
+		       const void *keydata UNUSED)
+{
+	const struct dir_job *a, *b;
+
+	a = container_of(eptr, const struct dir_job, ent);
+	b = container_of(entry_or_key, const struct dir_job, ent);
+
+	return a->len != b->len || memcmp(a->path, b->path, a->len);
+}
+
+static struct dir_job *find_job(struct dir_prefetch *p,
+				const char *path, size_t len)
+{
+	struct dir_job *key;
+	struct dir_job *job;
+
+	FLEX_ALLOC_MEM(key, path, path, len);
+	key->len = len;
+	hashmap_entry_init(&key->ent, memhash(path, len));
+	job = hashmap_get_entry(&p->jobs, key, ent, NULL);
+	free(key);
+	return job;
+}
+
+void dir_listing_free(struct dir_listing *l)
+{
+	if (!l)
+		return;
+	free(l->entries);
+	strbuf_release(&l->names);
+	free(l);
+}
+
+/*
+ * Is `path` (with a trailing slash) the leading directory of an index
+ * entry?  The index is sorted, so the first entry at or after `path`
+ * tells.
+ */
+static int index_has_dir(struct index_state *istate,
+			 const char *path, size_t len)
+{
+	int pos = index_name_pos_sparse(istate, path, len);
+
+	if (pos >= 0)
+		return 1;
+	pos = -pos - 1;
+	return pos < istate->cache_nr &&
+	       !strncmp(istate->cache[pos]->name, path, len);
+}
+
+/*
+ * Read the directory `path` (relative to the current directory, with a
+ * trailing slash unless it is empty), and mark which of its entries
+ * are tracked directories.
+ */
+static struct dir_listing *read_listing(struct dir_prefetch *p,
+					const char *path, size_t len)
+{
+	const char *c_path = len ? path : ".";
+	struct strbuf sub = STRBUF_INIT;
+	struct dir_listing *l;
+	struct dirent *de;
+	DIR *fdir;
+
+	CALLOC_ARRAY(l, 1);
+	strbuf_init(&l->names, 0);
+
+	/* lstat() first, so that the listing is at least as new as "st" */
+	if (lstat(c_path, &l->st) || !(fdir = opendir(c_path))) {
+		l->err = errno;
+		return l;
+	}
+
+	strbuf_add(&sub, path, len);
+	while ((de = readdir_skip_dot_and_dotdot(fdir))) {
+		struct dir_listing_entry *e;
+
+		ALLOC_GROW(l->entries, l->nr + 1, l->alloc);
+		e = &l->entries[l->nr++];
+		e->name = l->names.len;
+		e->d_type = DTYPE(de);
+		e->tracked_dir = 0;
+		strbuf_add(&l->names, de->d_name, strlen(de->d_name) + 1);
+
+		if (e->d_type != DT_DIR)
+			continue;
+		strbuf_setlen(&sub, len);
+		strbuf_addstr(&sub, de->d_name);
+		strbuf_addch(&sub, '/');
+		e->tracked_dir = index_has_dir(p->istate, sub.buf, sub.len);
+	}
+	closedir(fdir);
+
+	strbuf_release(&sub);
+	return l;
+}
+
+/*
+ * Queue the tracked subdirectories of `path`.  Directories the caller
+ * is about to descend into go to the front of the queue, those found
+ * by the threads themselves to the back.
+ */
+static void queue_subdirs(struct dir_prefetch *p, const char *path, size_t len,
+			  const struct dir_listing *l, int urgent)
+{
+	struct strbuf sub = STRBUF_INIT;
+	int queued = 0;
+
+	strbuf_add(&sub, path, len);
+
+	pthread_mutex_lock(&p->mutex);
+	for (size_t n = 0; n < l->nr; n++) {
+		/* walk backwards when adding to the front to keep the order */
+		size_t i = urgent ? l->nr - 1 - n : n;
+		struct dir_job *job;
+
+		if (!l->entries[i].tracked_dir)
+			continue;
+
+		strbuf_setlen(&sub, len);
+		strbuf_addstr(&sub, dir_listing_name(l, i));
+		strbuf_addch(&sub, '/');
+
+		job = find_job(p, sub.buf, sub.len);
+		if (job) {
+			if (urgent && job->state == DIR_JOB_QUEUED)
+				list_move(&job->queue, &p->queue);
+			continue;
+		}
+		if (hashmap_get_size(&p->jobs) >= DIR_PREFETCH_MAX_JOBS)
+			break;
+
+		FLEX_ALLOC_MEM(job, path, sub.buf, sub.len);
+		job->len = sub.len;
+		job->state = DIR_JOB_QUEUED;
+		hashmap_entry_init(&job->ent, memhash(sub.buf, sub.len));
+		hashmap_add(&p->jobs, &job->ent);
+		if (urgent)
+			list_add(&job->queue, &p->queue);
+		else
+			list_add_tail(&job->queue, &p->queue);
+		queued++;
+	}
+	if (queued)
+		pthread_cond_broadcast(&p->work_cond);
+	pthread_mutex_unlock(&p->mutex);
+
+	strbuf_release(&sub);
+}
+
+static void *dir_prefetch_worker(void *data)
+{
+	struct dir_prefetch *p = data;
+
+	pthread_mutex_lock(&p->mutex);
+	for (;;) {
+		struct dir_job *job;
+		struct dir_listing *l;
+
+		while (list_empty(&p->queue) && !p->stopping)
+			pthread_cond_wait(&p->work_cond, &p->mutex);
+		if (p->stopping)
+			break;
+
+		job = list_first_entry(&p->queue, struct dir_job, queue);
+		list_del_init(&job->queue);
+		job->state = DIR_JOB_RUNNING;
+		pthread_mutex_unlock(&p->mutex);
+
+		l = read_listing(p, job->path, job->len);
+		if (p->expand && !l->err)
+			queue_subdirs(p, job->path, job->len, l, 0);
+
+		pthread_mutex_lock(&p->mutex);
+		job->listing = l;
+		job->state = DIR_JOB_DONE;
+		pthread_cond_broadcast(&p->done_cond);
+	}
+	pthread_mutex_unlock(&p->mutex);
+
+	return NULL;
+}
+
+struct dir_prefetch *dir_prefetch_start(struct index_state *istate,
+					int nr_threads, int expand)
+{
+	struct dir_prefetch *p;
+
+	if (!HAVE_THREADS || nr_threads < 1)
+		return NULL;
+
+	CALLOC_ARRAY(p, 1);
+	p->istate = istate;
+	p->expand = expand;
+	INIT_LIST_HEAD(&p->queue);
+	hashmap_init(&p->jobs, dir_job_cmp, NULL, 0);
+	pthread_mutex_init(&p->mutex, NULL);
+	pthread_cond_init(&p->work_cond, NULL);
+	pthread_cond_init(&p->done_cond, NULL);
+
+	CALLOC_ARRAY(p->threads, nr_threads);
+	for (int i = 0; i < nr_threads; i++) {
+		int err = pthread_create(&p->threads[i], NULL,
+					 dir_prefetch_worker, p);
+		if (err) {
+			warning(_("unable to create thread: %s"), strerror(err));
+			break;
+		}
+		p->nr_threads++;
+	}
+
+	if (!p->nr_threads) {
+		dir_prefetch_stop(p);
+		return NULL;
+	}
+	return p;
+}
+
+struct dir_listing *dir_prefetch_take(struct dir_prefetch *p,
+				      const char *path, size_t len)
+{
+	struct dir_listing *l = NULL;
+	struct dir_job *job;
+
+	pthread_mutex_lock(&p->mutex);
+	job = find_job(p, path, len);
+	if (!job)
+		goto out;
+
+	hashmap_remove(&p->jobs, &job->ent, NULL);
+	if (job->state == DIR_JOB_QUEUED) {
+		/* The caller will get there first. */
+		list_del(&job->queue);
+		free(job);
+		goto out;
+	}
+
+	if (job->state == DIR_JOB_RUNNING)
+		p->nr_waited++;
+	while (job->state != DIR_JOB_DONE)
+		pthread_cond_wait(&p->done_cond, &p->mutex);
+
+	l = job->listing;
+	p->nr_prefetched++;
+	free(job);
+
+out:
+	pthread_mutex_unlock(&p->mutex);
+	return l;
+}
+
+struct dir_listing *dir_prefetch_read(struct dir_prefetch *p,
+				      const char *path, size_t len)
+{
+	p->nr_read++;
+	return read_listing(p, path, len);
+}
+
+void dir_prefetch_want_subdirs(struct dir_prefetch *p,
+			       const char *path, size_t len,
+			       const struct dir_listing *l)
+{
+	if (!l->err)
+		queue_subdirs(p, path, len, l, 1);
+}
+
+void dir_prefetch_stop(struct dir_prefetch *p)
+{
+	struct hashmap_iter iter;
+	struct dir_job *job;
+	unsigned int nr_unused = 0;
+
+	if (!p)
+		return;
+
+	pthread_mutex_lock(&p->mutex);
+	p->stopping = 1;
+	pthread_cond_broadcast(&p->work_cond);
+	pthread_mutex_unlock(&p->mutex);
+
+	for (int i = 0; i < p->nr_threads; i++)
+		pthread_join(p->threads[i], NULL);
+
+	hashmap_for_each_entry(&p->jobs, &iter, job, ent) {
+		if (job->listing)
+			nr_unused++;
+		dir_listing_free(job->listing);
+	}
+	hashmap_clear_and_free(&p->jobs, struct dir_job, ent);
+
+	trace2_data_intmax("dir", p->istate->repo, "prefetch/prefetched",
+			   p->nr_prefetched);
+	trace2_data_intmax("dir", p->istate->repo, "prefetch/waited",
+			   p->nr_waited);
+	trace2_data_intmax("dir", p->istate->repo, "prefetch/read",
+			   p->nr_read);
+	trace2_data_intmax("dir", p->istate->repo, "prefetch/unused",
+			   nr_unused);
+
+	pthread_cond_destroy(&p->work_cond);
+	pthread_cond_destroy(&p->done_cond);
+	pthread_mutex_destroy(&p->mutex);
+	free(p->threads);
+	free(p);
+}
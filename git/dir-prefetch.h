@@ -0,0 +1,90 @@
+#ifndef DIR_PREFETCH_H
+#define DIR_PREFETCH_H
+
+#include "strbuf.h"
+
+struct index_state;
+
+/*
+ * A pool of threads that reads the directories of the worktree ahead
+ * of read_directory(), so that the walk itself, which has to decide
+ * about every path in order because of the stack of .gitignore files,
+ * finds the listings in memory instead of waiting on opendir() and
+ * readdir() one directory at a time.
+ *
+ * The threads only read directories that are tracked in the index, as
+ * those are the ones the walk is sure to descend into; untracked and
+ * ignored directories (think build output) are left to the walk.
+ */
+struct dir_prefetch;
+
+/*
+ * The entries of a directory, as returned by readdir() without "." and
+ * "..", in the order readdir() returned them.
+ */
+struct dir_listing {
+	/* the directory as lstat() saw it just before it was read */
+	struct stat st;
+	/* errno of the failed lstat() or opendir(), or 0 */
+	int err;
+
+	size_t nr, alloc;
+	struct dir_listing_entry {
+		size_t name; /* offset into "names" */
+		unsigned char d_type;
+		unsigned tracked_dir:1; /* a directory in the index */
+	} *entries;
+	struct strbuf names;
+};
+
+static inline const char *dir_listing_name(const struct dir_listing *l,
+					   size_t i)
+{
+	return l->names.buf + l->entries[i].name;
+}
+
+void dir_listing_free(struct dir_listing *l);
+
+/*
+ * Start `nr_threads` threads reading the tracked directories of
+ * `istate`, which must not change until dir_prefetch_stop().  With
+ * `expand`, the threads also go on to the tracked subdirectories of
+ * what they read; otherwise they only read the directories the caller
+ * asks for with dir_prefetch_want_subdirs().
+ *
+ * Returns NULL if no threads could be started.
+ */
+struct dir_prefetch *dir_prefetch_start(struct index_state *istate,
+					int nr_threads, int expand);
+
+/*
+ * Return the listing of `path` (relative to the current directory,
+ * with a trailing slash unless it is empty) if a thread read it,
+ * waiting for it to finish if it is reading it right now, and NULL
+ * otherwise.  A read that has not started yet is cancelled.
+ */
+struct dir_listing *dir_prefetch_take(struct dir_prefetch *p,
+				      const char *path, size_t len);
+
+/*
+ * Read the directory `path` on the calling thread.
+ */
+struct dir_listing *dir_prefetch_read(struct dir_prefetch *p,
+				      const char *path, size_t len);
+
+/*
+ * Tell the threads that the caller is about to descend into the
+ * directory `path` with listing `l`, so that its tracked
+ * subdirectories are read next.
+ */
+void dir_prefetch_want_subdirs(struct dir_prefetch *p,
+			       const char *path, size_t len,
+			       const struct dir_listing *l);
+
+/*
+ * Stop the threads and free the pool, including listings nobody asked
+ * for.
+ */
+void dir_prefetch_stop(struct dir_prefetch *p);
+
+#endif /* DIR_PREFETCH_H */
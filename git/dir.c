@@ -14,6 +14,7 @@
 #include "config.h"
 #include "convert.h"
 #include "dir.h"
+#include "dir-prefetch.h"
 #include "environment.h"
 #include "gettext.h"
 #include "name-hash.h"
@@ -61,6 +62,8 @@ enum path_treatment {
  */
 struct cached_dir {
 	DIR *fdir;
+	struct dir_listing *listing; /* instead of "fdir" when prefetching */
+	size_t listing_pos;
 	struct untracked_cache_dir *untracked;
 	int nr_files;
 	int nr_dirs;
@@ -928,6 +931,203 @@ int hashmap_contains_parent(struct hashmap *map,
 	return 0;
 }
 
+/*
+ * Patterns that can only ever match a single basename ("Makefile"), a
+ * single extension ("*.o") or a single path ("/build") are bucketed by
+ * that string.  Globs are bucketed by their literal part: the start of
+ * the basename for "tmp*", the leading directories for "doc/html*".
+ * Together this works like a trie, and matching a path only has to look
+ * at the few buckets its basename, extension and leading directories
+ * select, plus the globs that have no literal part.
+ *
+ * The keys are folded to lowercase so that the buckets do not depend on
+ * core.ignoreCase; the patterns found in them are matched as usual.
+ */
+struct pattern_bucket {
+	struct hashmap_entry ent;
+	int *pos; /* into pl->patterns, in increasing order */
+	size_t nr, alloc;
+	size_t keylen;
+	char key[FLEX_ARRAY];
+};
+
+struct pattern_buckets {
+	struct hashmap basenames;
+	struct hashmap extensions;
+	struct hashmap paths;
+	struct hashmap basename_prefixes;
+	uint64_t basename_prefix_lens; /* bit n: a prefix of length n */
+	struct hashmap leading_dirs;
+	int *globs; /* everything else, in increasing order */
+	size_t globs_nr, globs_alloc;
+};
+
+/* Below this many patterns, the list is cheap enough to scan. */
+#define PATTERN_BUCKETS_MIN 16
+
+struct pattern_bucket_key {
+	const char *key;
+	size_t keylen;
+};
+
+static int pattern_bucket_cmp(const void *cmp_data UNUSED,
+			      const struct hashmap_entry *eptr,
+			      const struct hashmap_entry *entry_or_key UNUSED,
+			      const void *keydata)
+{
+	const struct pattern_bucket *e =
+		container_of(eptr, const struct pattern_bucket, ent);
+	const struct pattern_bucket_key *k = keydata;
+
+	return e->keylen != k->keylen || strncasecmp(e->key, k->key, k->keylen);
+}
+
+static struct pattern_bucket *find_pattern_bucket(struct hashmap *map,
+						  const char *key,
+						  size_t keylen)
+{
+	struct pattern_bucket_key k = { key, keylen };
+
+	if (!hashmap_get_size(map))
+		return NULL;
+	return hashmap_get_entry_from_hash(map, memihash(key, keylen), &k,
+					   struct pattern_bucket, ent);
+}
+
+static void add_to_pattern_bucket(struct hashmap *map,
+				  const char *key, size_t keylen, int pos)
+{
+	struct pattern_bucket *b = find_pattern_bucket(map, key, keylen);
+
+	if (!b) {
+		FLEX_ALLOC_MEM(b, key, key, keylen);
+		b->keylen = keylen;
+		hashmap_entry_init(&b->ent, memihash(key, keylen));
+		hashmap_add(map, &b->ent);
+	}
+	ALLOC_GROW(b->pos, b->nr + 1, b->alloc);
+	b->pos[b->nr++] = pos;
+}
+
+static const char *extension_of(const char *name, size_t len)
+{
+	while (len--)
+		if (name[len] == '.')
+			return name + len + 1;
+	return NULL;
+}
+
+static void add_pattern_to_buckets(struct pattern_list *pl, int pos)
+{
+	struct pattern_buckets *b = pl->buckets;
+	struct path_pattern *pattern = pl->patterns[pos];
+	const char *p = pattern->pattern;
+	size_t len = pattern->patternlen;
+	int literal = pattern->nowildcardlen == pattern->patternlen;
+
+	if ((pattern->flags & PATTERN_FLAG_NODIR) && literal) {
+		add_to_pattern_bucket(&b->basenames, p, len, pos);
+		return;
+	}
+
+	if ((pattern->flags & PATTERN_FLAG_NODIR) &&
+	    (pattern->flags & PATTERN_FLAG_ENDSWITH)) {
+		/*
+		 * A name ending in "literal" has the same extension as
+		 * "literal" when the latter has one.
+		 */
+		const char *ext = extension_of(p + 1, len - 1);
+
+		if (ext) {
+			add_to_pattern_bucket(&b->extensions,
+					      ext, p + len - ext, pos);
+			return;
+		}
+	}
+
+	if ((pattern->flags & PATTERN_FLAG_NODIR) &&
+	    pattern->nowildcardlen > 0 && pattern->nowildcardlen < 64) {
+		add_to_pattern_bucket(&b->basename_prefixes,
+				      p, pattern->nowildcardlen, pos);
+		b->basename_prefix_lens |= (uint64_t)1 << pattern->nowildcardlen;
+		return;
+	}
+
+	if (!(pattern->flags & PATTERN_FLAG_NODIR)) {
+		/* see match_pathname() */
+		struct strbuf key = STRBUF_INIT;
+		const char *slash;
+
+		strbuf_add(&key, pattern->base, pattern->baselen);
+		if (*p == '/')
+			strbuf_add(&key, p + 1, pattern->nowildcardlen - 1);
+		else
+			strbuf_add(&key, p, pattern->nowildcardlen);
+
+		if (literal) {
+			add_to_pattern_bucket(&b->paths, key.buf, key.len, pos);
+			strbuf_release(&key);
+			return;
+		}
+
+		/* the path has to start with the directories in the key */
+		slash = strrchr(key.buf, '/');
+		if (slash && slash != key.buf) {
+			add_to_pattern_bucket(&b->leading_dirs, key.buf,
+					      slash - key.buf, pos);
+			strbuf_release(&key);
+			return;
+		}
+		strbuf_release(&key);
+	}
+
+	ALLOC_GROW(b->globs, b->globs_nr + 1, b->globs_alloc);
+	b->globs[b->globs_nr++] = pos;
+}
+
+static void update_pattern_buckets(struct pattern_list *pl)
+{
+	if (!pl->buckets) {
+		if (pl->nr < PATTERN_BUCKETS_MIN)
+			return;
+
+		CALLOC_ARRAY(pl->buckets, 1);
+		hashmap_init(&pl->buckets->basenames, pattern_bucket_cmp, NULL, 0);
+		hashmap_init(&pl->buckets->extensions, pattern_bucket_cmp, NULL, 0);
+		hashmap_init(&pl->buckets->paths, pattern_bucket_cmp, NULL, 0);
+		hashmap_init(&pl->buckets->basename_prefixes,
+			     pattern_bucket_cmp, NULL, 0);
+		hashmap_init(&pl->buckets->leading_dirs,
+			     pattern_bucket_cmp, NULL, 0);
+		for (int i = 0; i < pl->nr - 1; i++)
+			add_pattern_to_buckets(pl, i);
+	}
+	add_pattern_to_buckets(pl, pl->nr - 1);
+}
+
+static void clear_pattern_bucket_hashmap(struct hashmap *map)
+{
+	struct hashmap_iter iter;
+	struct pattern_bucket *b;
+
+	hashmap_for_each_entry(map, &iter, b, ent)
+		free(b->pos);
+	hashmap_clear_and_free(map, struct pattern_bucket, ent);
+}
+
+static void clear_pattern_buckets(struct pattern_list *pl)
+{
+	if (!pl->buckets)
+		return;
+	clear_pattern_bucket_hashmap(&pl->buckets->basenames);
+	clear_pattern_bucket_hashmap(&pl->buckets->extensions);
+	clear_pattern_bucket_hashmap(&pl->buckets->paths);
+	clear_pattern_bucket_hashmap(&pl->buckets->basename_prefixes);
+	clear_pattern_bucket_hashmap(&pl->buckets->leading_dirs);
+	free(pl->buckets->globs);
+	FREE_AND_NULL(pl->buckets);
+}
+
 void add_pattern(const char *string, const char *base,
 		 int baselen, struct pattern_list *pl, int srcpos)
 {
@@ -949,6 +1149,7 @@ void add_pattern(const char *string, const char *base,
 	pattern->pl = pl;
 
 	add_pattern_to_hashsets(pl, pattern);
+	update_pattern_buckets(pl);
 }
 
 static int read_skip_worktree_file_from_index(struct index_state *istate,
@@ -981,6 +1182,7 @@ void clear_pattern_list(struct pattern_list *pl)
 	free(pl->patterns);
 	clear_pattern_entry_hashmap(&pl->recursive_hashmap);
 	clear_pattern_entry_hashmap(&pl->parent_hashmap);
+	clear_pattern_buckets(pl);
 
 	memset(pl, 0, sizeof(*pl));
 }
@@ -1409,6 +1611,111 @@ int match_pathname(const char *pathname, int pathlen,
 				 WM_PATHNAME) == 0;
 }
 
+static int pattern_matches(struct path_pattern *pattern,
+			   const char *pathname, int pathlen,
+			   const char *basename, int *dtype,
+			   struct index_state *istate)
+{
+	const char *exclude = pattern->pattern;
+	int prefix = pattern->nowildcardlen;
+
+	if (pattern->flags & PATTERN_FLAG_MUSTBEDIR) {
+		*dtype = resolve_dtype(*dtype, istate, pathname, pathlen);
+		if (*dtype != DT_DIR)
+			return 0;
+	}
+
+	if (pattern->flags & PATTERN_FLAG_NODIR)
+		return match_basename(basename,
+				      pathlen - (basename - pathname),
+				      exclude, prefix, pattern->patternlen,
+				      pattern->flags);
+
+	assert(pattern->baselen == 0 ||
+	       pattern->base[pattern->baselen - 1] == '/');
+	return match_pathname(pathname, pathlen,
+			      pattern->base,
+			      pattern->baselen ? pattern->baselen - 1 : 0,
+			      exclude, prefix, pattern->patternlen);
+}
+
+/*
+ * Return the position of the last pattern in bucket "b" that matches
+ * and comes after "best", or "best" if there is none.
+ */
+static int last_match_in_bucket(struct pattern_bucket *b, int best,
+				const char *pathname, int pathlen,
+				const char *basename, int *dtype,
+				struct pattern_list *pl,
+				struct index_state *istate)
+{
+	if (!b)
+		return best;
+	for (size_t i = b->nr; i-- && b->pos[i] > best; )
+		if (pattern_matches(pl->patterns[b->pos[i]], pathname, pathlen,
+				    basename, dtype, istate))
+			return b->pos[i];
+	return best;
+}
+
+static struct path_pattern *last_matching_pattern_from_buckets(const char *pathname,
+							       int pathlen,
+							       const char *basename,
+							       int *dtype,
+							       struct pattern_list *pl,
+							       struct index_state *istate)
+{
+	struct pattern_buckets *b = pl->buckets;
+	int basenamelen = pathlen - (basename - pathname);
+	const char *ext = extension_of(basename, basenamelen);
+	int best = -1;
+
+	best = last_match_in_bucket(find_pattern_bucket(&b->basenames,
+							basename, basenamelen),
+				    best, pathname, pathlen, basename, dtype,
+				    pl, istate);
+	if (ext)
+		best = last_match_in_bucket(find_pattern_bucket(&b->extensions, ext,
+								pathname + pathlen - ext),
+					    best, pathname, pathlen, basename,
+					    dtype, pl, istate);
+	best = last_match_in_bucket(find_pattern_bucket(&b->paths,
+							pathname, pathlen),
+				    best, pathname, pathlen, basename, dtype,
+				    pl, istate);
+
+	for (int len = 1; len < 64 && len <= basenamelen; len++) {
+		if (!(b->basename_prefix_lens & ((uint64_t)1 << len)))
+			continue;
+		best = last_match_in_bucket(find_pattern_bucket(&b->basename_prefixes,
+								basename, len),
+					    best, pathname, pathlen, basename,
+					    dtype, pl, istate);
+	}
+
+	if (hashmap_get_size(&b->leading_dirs)) {
+		for (int len = 1; len < pathlen; len++) {
+			if (pathname[len] != '/')
+				continue;
+			best = last_match_in_bucket(find_pattern_bucket(&b->leading_dirs,
+									pathname, len),
+						    best, pathname, pathlen,
+						    basename, dtype, pl, istate);
+		}
+	}
+
+	/* Only a glob that comes later can override what we found. */
+	for (size_t i = b->globs_nr; i-- && b->globs[i] > best; ) {
+		if (pattern_matches(pl->patterns[b->globs[i]], pathname, pathlen,
+				    basename, dtype, istate)) {
+			best = b->globs[i];
+			break;
+		}
+	}
+
+	return best < 0 ? NULL : pl->patterns[best];
+}
+
 /*
  * Scan the given exclude list in reverse to see whether pathname
  * should be ignored.  The first match (i.e. the last on the list), if
@@ -1422,45 +1729,21 @@ static struct path_pattern *last_matching_pattern_from_list(const char *pathname
 						       struct pattern_list *pl,
 						       struct index_state *istate)
 {
-	struct path_pattern *res = NULL; /* undecided */
 	int i;
 
 	if (!pl->nr)
 		return NULL;	/* undefined */
 
-	for (i = pl->nr - 1; 0 <= i; i--) {
-		struct path_pattern *pattern = pl->patterns[i];
-		const char *exclude = pattern->pattern;
-		int prefix = pattern->nowildcardlen;
+	if (pl->buckets)
+		return last_matching_pattern_from_buckets(pathname, pathlen,
+							  basename, dtype,
+							  pl, istate);
 
-		if (pattern->flags & PATTERN_FLAG_MUSTBEDIR) {
-			*dtype = resolve_dtype(*dtype, istate, pathname, pathlen);
-			if (*dtype != DT_DIR)
-				continue;
-		}
-
-		if (pattern->flags & PATTERN_FLAG_NODIR) {
-			if (match_basename(basename,
-					   pathlen - (basename - pathname),
-					   exclude, prefix, pattern->patternlen,
-					   pattern->flags)) {
-				res = pattern;
-				break;
-			}
-			continue;
-		}
-
-		assert(pattern->baselen == 0 ||
-		       pattern->base[pattern->baselen - 1] == '/');
-		if (match_pathname(pathname, pathlen,
-				   pattern->base,
-				   pattern->baselen ? pattern->baselen - 1 : 0,
-				   exclude, prefix, pattern->patternlen)) {
-			res = pattern;
-			break;
-		}
-	}
-	return res;
+	for (i = pl->nr - 1; 0 <= i; i--)
+		if (pattern_matches(pl->patterns[i], pathname, pathlen,
+				    basename, dtype, istate))
+			return pl->patterns[i];
+	return NULL;
 }
 
 /*
@@ -2517,7 +2800,8 @@ static int valid_cached_dir(struct dir_struct *dir,
 			    struct untracked_cache_dir *untracked,
 			    struct index_state *istate,
 			    struct strbuf *path,
-			    int check_only)
+			    int check_only,
+			    const struct dir_listing *listing)
 {
 	struct stat st;
 
@@ -2529,7 +2813,20 @@ static int valid_cached_dir(struct dir_struct *dir,
 	 */
 	refresh_fsmonitor(istate);
 	if (!(dir->untracked->use_fsmonitor && untracked->valid)) {
-		if (lstat(path->len ? path->buf : ".", &st)) {
+		int err;
+
+		/*
+		 * A prefetched listing comes with the stat data from just
+		 * before it was read, which is what we have to remember
+		 * for it to be trusted later.
+		 */
+		if (listing) {
+			err = listing->err;
+			st = listing->st;
+		} else {
+			err = lstat(path->len ? path->buf : ".", &st);
+		}
+		if (err) {
 			memset(&untracked->stat_data, 0, sizeof(untracked->stat_data));
 			return 0;
 		}
@@ -2572,17 +2869,40 @@ static int open_cached_dir(struct cached_dir *cdir,
 
 	memset(cdir, 0, sizeof(*cdir));
 	cdir->untracked = untracked;
-	if (valid_cached_dir(dir, untracked, istate, path, check_only))
+	if (dir->internal.prefetch)
+		cdir->listing = dir_prefetch_take(dir->internal.prefetch,
+						  path->buf, path->len);
+	if (valid_cached_dir(dir, untracked, istate, path, check_only,
+			     cdir->listing)) {
+		dir_listing_free(cdir->listing);
+		cdir->listing = NULL;
 		return 0;
+	}
 	c_path = path->len ? path->buf : ".";
-	cdir->fdir = opendir(c_path);
-	if (!cdir->fdir)
-		warning_errno(_("could not open directory '%s'"), c_path);
+	if (dir->internal.prefetch) {
+		if (!cdir->listing)
+			cdir->listing = dir_prefetch_read(dir->internal.prefetch,
+							  path->buf, path->len);
+		if (cdir->listing->err) {
+			errno = cdir->listing->err;
+			warning_errno(_("could not open directory '%s'"), c_path);
+			dir_listing_free(cdir->listing);
+			cdir->listing = NULL;
+		} else {
+			dir_prefetch_want_subdirs(dir->internal.prefetch,
+						  path->buf, path->len,
+						  cdir->listing);
+		}
+	} else {
+		cdir->fdir = opendir(c_path);
+		if (!cdir->fdir)
+			warning_errno(_("could not open directory '%s'"), c_path);
+	}
 	if (dir->untracked) {
 		invalidate_directory(dir->untracked, untracked);
 		dir->untracked->dir_opened++;
 	}
-	if (!cdir->fdir)
+	if (!cdir->fdir && !cdir->listing)
 		return -1;
 	return 0;
 }
@@ -2602,6 +2922,17 @@ static int read_cached_dir(struct cached_dir *cdir)
 		cdir->d_type = DTYPE(de);
 		return 0;
 	}
+	if (cdir->listing) {
+		if (cdir->listing_pos >= cdir->listing->nr) {
+			cdir->d_name = NULL;
+			cdir->d_type = DT_UNKNOWN;
+			return -1;
+		}
+		cdir->d_name = dir_listing_name(cdir->listing,
+						cdir->listing_pos);
+		cdir->d_type = cdir->listing->entries[cdir->listing_pos++].d_type;
+		return 0;
+	}
 	while (cdir->nr_dirs < cdir->untracked->dirs_nr) {
 		struct untracked_cache_dir *d = cdir->untracked->dirs[cdir->nr_dirs];
 		if (!d->recurse) {
@@ -2625,6 +2956,7 @@ static void close_cached_dir(struct cached_dir *cdir)
 {
 	if (cdir->fdir)
 		closedir(cdir->fdir);
+	dir_listing_free(cdir->listing);
 	/*
 	 * We have gone through this directory and found no untracked
 	 * entries. Mark it valid.
@@ -2660,7 +2992,7 @@ static void add_path_to_appropriate_result_list(struct dir_struct *dir,
 		if (dir->flags & DIR_SHOW_IGNORED)
 			break;
 		dir_add_name(dir, istate, path->buf, path->len);
-		if (cdir->fdir)
+		if (cdir->fdir || cdir->listing)
 			add_untracked(untracked, path->buf + baselen);
 		break;
 
@@ -2766,7 +3098,7 @@ static enum path_treatment read_directory_recursive(struct dir_struct *dir,
 
 			/* abort early if maximum state has been reached */
 			if (dir_state == path_untracked) {
-				if (cdir.fdir)
+				if (cdir.fdir || cdir.listing)
 					add_untracked(untracked, path.buf + baselen);
 				break;
 			}
@@ -3125,6 +3457,42 @@ static void emit_traversal_statistics(struct dir_struct *dir,
 			   "opendir", dir->untracked->dir_opened);
 }
 
+/* Tracked paths per thread reading directories ahead of the walk. */
+#define DIR_PREFETCH_COST 5000
+
+static struct dir_prefetch *start_dir_prefetch(struct index_state *istate,
+					       const struct pathspec *pathspec,
+					       struct untracked_cache_dir *untracked)
+{
+	int nr_threads = 0;
+
+	/*
+	 * The threads look up directories in the index, so it must not
+	 * be expanded underneath them, and they read everything that is
+	 * tracked, which would be wasted on a walk limited to a pathspec.
+	 */
+	if (!HAVE_THREADS || !istate->repo || istate->sparse_index ||
+	    (pathspec && pathspec->nr))
+		return NULL;
+	/* Most of the directories will come from the untracked cache. */
+	if (untracked && untracked->valid)
+		return NULL;
+
+	repo_config_get_int(istate->repo, "core.untrackedscanthreads",
+			    &nr_threads);
+	if (nr_threads < 1) {
+		nr_threads = istate->cache_nr / DIR_PREFETCH_COST;
+		if (nr_threads > online_cpus())
+			nr_threads = online_cpus();
+	}
+
+	/*
+	 * With the untracked cache, many directories will not need to be
+	 * read at all, so only read those the walk has to descend into.
+	 */
+	return dir_prefetch_start(istate, nr_threads - 1, !untracked);
+}
+
 int read_directory(struct dir_struct *dir, struct index_state *istate,
 		   const char *path, int len, const struct pathspec *pathspec)
 {
@@ -3146,8 +3514,13 @@ int read_directory(struct dir_struct *dir, struct index_state *istate,
 		 * e.g. prep_exclude()
 		 */
 		dir->untracked = NULL;
-	if (!len || treat_leading_path(dir, istate, path, len, pathspec))
+	if (!len || treat_leading_path(dir, istate, path, len, pathspec)) {
+		dir->internal.prefetch = start_dir_prefetch(istate, pathspec,
+							    untracked);
 		read_directory_recursive(dir, istate, path, len, untracked, 0, 0, pathspec);
+		dir_prefetch_stop(dir->internal.prefetch);
+		dir->internal.prefetch = NULL;
+	}
 	QSORT(dir->entries, dir->nr, cmp_dir_entry);
 	QSORT(dir->ignored, dir->ignored_nr, cmp_dir_entry);
 
@@ -44,6 +44,8 @@ struct repository;
  */
 
 struct repository;
+struct dir_prefetch;
+struct pattern_buckets;
 
 struct dir_entry {
 	unsigned int len;
@@ -119,6 +121,14 @@ struct pattern_list {
 	 * Used to check single-level parents of blobs.
 	 */
 	struct hashmap parent_hashmap;
+
+	/*
+	 * Once the list is long enough, the patterns that can only match
+	 * one basename, one extension or one path are also kept in
+	 * hashmaps, so that a path is only checked against those and the
+	 * remaining globs instead of the whole list.
+	 */
+	struct pattern_buckets *buckets;
 };
 
 /*
@@ -354,6 +364,9 @@ struct dir_struct {
 		/* Stats about the traversal */
 		unsigned visited_paths;
 		unsigned visited_directories;
+
+		/* Threads reading directories ahead of the traversal */
+		struct dir_prefetch *prefetch;
 	} internal;
 };
 
@@ -159,6 +159,7 @@ extern unsigned long pack_size_limit_cfg;
 extern int max_allowed_tree_depth;
 
 extern int core_preload_index;
+extern int core_batch_stat;
 extern int precomposed_unicode;
 extern int protect_hfs;
 extern int protect_ntfs;
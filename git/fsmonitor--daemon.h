@@ -4,6 +4,7 @@
 #ifdef HAVE_FSMONITOR_DAEMON_BACKEND
 
 #include "hashmap.h"
+#include "strmap.h"
 #include "thread-utils.h"
 #include "fsmonitor-path-utils.h"
 
@@ -59,6 +60,11 @@ struct fsmonitor_daemon_state {
 	struct ipc_server_data *ipc_server_data;
 	struct strbuf path_ipc;
 
+	/*
+	 * The output of recent `git status` commands, keyed by a hash
+	 * of everything but the working directory that it depends on.
+	 */
+	struct strmap status_cache;
 };
 
 /*
@@ -43,6 +43,13 @@ int fsmonitor_ipc__send_command(const char *command UNUSED,
 	return -1;
 }
 
+int fsmonitor_ipc__send_request(const char *request UNUSED,
+				size_t len UNUSED,
+				struct strbuf *answer UNUSED)
+{
+	return -1;
+}
+
 #else
 
 int fsmonitor_ipc__is_supported(void)
@@ -173,4 +180,28 @@ int fsmonitor_ipc__send_command(const char *command,
 	return 0;
 }
 
+int fsmonitor_ipc__send_request(const char *request, size_t len,
+				struct strbuf *answer)
+{
+	struct ipc_client_connection *connection = NULL;
+	struct ipc_client_connect_options options
+		= IPC_CLIENT_CONNECT_OPTIONS_INIT;
+	int ret;
+
+	strbuf_reset(answer);
+
+	options.wait_if_busy = 1;
+	options.wait_if_not_found = 0;
+
+	if (ipc_client_try_connect(fsmonitor_ipc__get_path(the_repository),
+				   &options, &connection) != IPC_STATE__LISTENING)
+		return -1;
+
+	ret = ipc_client_send_command_to_connection(connection, request, len,
+						    answer);
+	ipc_client_close_connection(connection);
+
+	return ret < 0 ? -1 : 0;
+}
+
 #endif
@@ -47,4 +47,15 @@ int fsmonitor_ipc__send_query(const char *since_token,
 int fsmonitor_ipc__send_command(const char *command,
 				struct strbuf *answer);
 
+/*
+ * Connect to a `git-fsmonitor--daemon` process via simple-ipc and
+ * send a request of `len` bytes, which need not be text.  Unlike
+ * `fsmonitor_ipc__send_command()`, this neither starts a daemon nor
+ * dies if none is available, for callers that can do without.
+ *
+ * Returns -1 on error; 0 on success.
+ */
+int fsmonitor_ipc__send_request(const char *request, size_t len,
+				struct strbuf *answer);
+
 #endif /* FSMONITOR_IPC_H */
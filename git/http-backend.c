@@ -22,6 +22,7 @@
 #include "protocol.h"
 #include "date.h"
 #include "write-or-die.h"
+#include "upload-pack-worker.h"
 
 static const char content_type[] = "Content-Type";
 static const char content_length[] = "Content-Length";
@@ -467,6 +468,49 @@ static void pipe_fixed_length(const char *prog_name, int out, size_t req_len)
 	close(out);
 }
 
+/*
+ * Hand an upload-pack request over to a warm worker instead of spawning
+ * "cld", if GIT_HTTP_UPLOAD_PACK_WORKERS names a worker directory.  On
+ * success "cld->in" is set up the way start_command() would, and the
+ * worker connection is returned; otherwise -1.
+ */
+static int start_upload_pack_worker(struct child_process *cld)
+{
+	int conn = -1;
+#ifndef NO_UNIX_SOCKETS
+	const char *dir = getenv("GIT_HTTP_UPLOAD_PACK_WORKERS");
+	const char *protocol = getenv(GIT_PROTOCOL_ENVIRONMENT);
+	struct strvec args = STRVEC_INIT;
+	struct strvec env = STRVEC_INIT;
+	int fds[2] = { 0, -1 };
+
+	if (!dir || !*dir || strcmp(cld->args.v[0], "upload-pack"))
+		return -1;
+	if (cld->in < 0 && pipe(fds) < 0)
+		return -1;
+
+	/* drop the service name and the trailing "." */
+	for (size_t i = 1; i + 1 < cld->args.nr; i++)
+		strvec_push(&args, cld->args.v[i]);
+	strvec_pushv(&env, cld->env.v);
+	if (protocol)
+		strvec_pushf(&env, GIT_PROTOCOL_ENVIRONMENT "=%s", protocol);
+
+	conn = upload_pack_worker_start(dir, &args, &env, fds[0], 1);
+	if (fds[1] >= 0) {
+		close(fds[0]);
+		if (conn < 0)
+			close(fds[1]);
+		else
+			cld->in = fds[1];
+	}
+
+	strvec_clear(&args);
+	strvec_clear(&env);
+#endif
+	return conn;
+}
+
 static void run_service(const char **argv, int buffer_input)
 {
 	const char *encoding = getenv("HTTP_CONTENT_ENCODING");
@@ -475,6 +519,7 @@ static void run_service(const char **argv, int buffer_input)
 	int gzipped_request = 0;
 	struct child_process cld = CHILD_PROCESS_INIT;
 	ssize_t req_len = get_content_length();
+	int worker;
 
 	if (encoding && (!strcmp(encoding, "gzip") || !strcmp(encoding, "x-gzip")))
 		gzipped_request = 1;
@@ -496,7 +541,8 @@ static void run_service(const char **argv, int buffer_input)
 	cld.git_cmd = 1;
 	cld.clean_on_exit = 1;
 	cld.wait_after_clean = 1;
-	if (start_command(&cld))
+	worker = start_upload_pack_worker(&cld);
+	if (worker < 0 && start_command(&cld))
 		exit(1);
 
 	close(1);
@@ -509,7 +555,10 @@ static void run_service(const char **argv, int buffer_input)
 	else
 		close(0);
 
-	if (finish_command(&cld))
+	if (worker >= 0) {
+		if (upload_pack_worker_finish(worker))
+			exit(1);
+	} else if (finish_command(&cld))
 		exit(1);
 }
 
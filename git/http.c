@@ -732,6 +732,13 @@ static int has_proxy_cert_password(void)
 static void set_curl_keepalive(CURL *c)
 {
 	curl_easy_setopt(c, CURLOPT_TCP_KEEPALIVE, 1);
+
+	/*
+	 * Rather than opening a new connection, wait for one that can be
+	 * multiplexed, so that the rounds of a stateless-rpc exchange all
+	 * run over the same warm HTTP/2 connection.
+	 */
+	curl_easy_setopt(c, CURLOPT_PIPEWAIT, 1L);
 }
 
 /* Return 1 if redactions have been made, 0 otherwise. */
@@ -1361,6 +1368,7 @@ void http_init(struct remote *remote, const char *url, int proactive_auth)
 	curlm = curl_multi_init();
 	if (!curlm)
 		die("curl_multi_init failed");
+	curl_multi_setopt(curlm, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
 
 	if (getenv("GIT_SSL_NO_VERIFY"))
 		curl_ssl_verify = 0;
@@ -12,6 +12,11 @@
 #include "pkt-line.h"
 #include "config.h"
 #include "string-list.h"
+#include "path.h"
+#include "lockfile.h"
+#include "trace2.h"
+#include "object-file.h"
+#include "trace.h"
 
 static enum {
 	UNBORN_IGNORE = 0,
@@ -73,6 +78,52 @@ struct ls_refs_data {
 	struct strbuf buf;
 	struct strvec hidden_refs;
 	unsigned unborn : 1;
+	unsigned use_cache : 1;
+
+	/*
+	 * When building the advertisement cache, send_ref() appends
+	 * pkt-lines here instead of writing them to stdout.
+	 */
+	struct ls_refs_cache *cache;
+};
+
+/*
+ * The advertisement cache holds, per namespace, the complete response
+ * to an ls-refs request with "peel" and "symrefs", minus HEAD, as
+ * ready-made pkt-lines sorted by refname:
+ *
+ *   - 4-byte signature "LSRC" and 4-byte version
+ *   - hash of the namespace, hidden refs and refs change stamp the
+ *     cache was built for
+ *   - 8-byte number of refs N
+ *   - N + 1 8-byte offsets of each pkt-line into the data, the last one
+ *     being the length of the data
+ *   - the data
+ *
+ * All integers are in network byte order.  Ref prefixes are resolved by
+ * binary search on the offsets, so that each prefix is served with a
+ * single write.  Any ref update replaces the change stamp of the refs,
+ * after which the cache no longer matches and is rebuilt by the next
+ * ls-refs request.  As the stamp is read before the refs are, a cache
+ * built while refs change is keyed on the stamp from before the change.
+ */
+#define LS_REFS_CACHE_DIR "ls-refs-cache"
+#define LS_REFS_CACHE_SIGNATURE 0x4c535243 /* "LSRC" */
+#define LS_REFS_CACHE_VERSION 2
+
+struct ls_refs_cache {
+	const unsigned char *offsets;
+	const char *data;
+	uint64_t nr;
+
+	/* where the cache lives when it has been read from disk */
+	void *map;
+	size_t map_size;
+
+	/* where the cache lives while it is being built */
+	struct strbuf built_offsets;
+	struct strbuf built_data;
+	unsigned too_large : 1;
 };
 
 static int send_ref(const char *refname, const char *referent UNUSED, const struct object_id *oid,
@@ -86,7 +137,7 @@ static int send_ref(const char *refname, const char *referent UNUSED, const stru
 	if (ref_is_hidden(refname_nons, refname, &data->hidden_refs))
 		return 0;
 
-	if (!ref_match(&data->prefixes, refname_nons))
+	if (!data->cache && !ref_match(&data->prefixes, refname_nons))
 		return 0;
 
 	if (oid)
@@ -115,6 +166,22 @@ static int send_ref(const char *refname, const char *referent UNUSED, const stru
 	}
 
 	strbuf_addch(&data->buf, '\n');
+	if (data->cache) {
+		struct ls_refs_cache *cache = data->cache;
+		size_t len = cache->built_data.len;
+
+		if (data->buf.len > LARGE_PACKET_DATA_MAX) {
+			cache->too_large = 1;
+			return 0;
+		}
+		strbuf_add(&cache->built_offsets, "\0\0\0\0\0\0\0\0", 8);
+		put_be64(cache->built_offsets.buf + cache->built_offsets.len - 8,
+			 len);
+		strbuf_addstr(&cache->built_data, "0000");
+		set_packet_header(cache->built_data.buf + len, data->buf.len + 4);
+		strbuf_addbuf(&cache->built_data, &data->buf);
+		return 0;
+	}
 	packet_fwrite(stdout, data->buf.buf, data->buf.len);
 
 	return 0;
@@ -142,6 +209,12 @@ static int ls_refs_config(const char *var, const char *value,
 			  void *cb_data)
 {
 	struct ls_refs_data *data = cb_data;
+
+	if (!strcmp(var, "lsrefs.advertisementcache")) {
+		data->use_cache = git_config_bool(var, value);
+		return 0;
+	}
+
 	/*
 	 * We only serve fetches over v2 for now, so respect only "uploadpack"
 	 * config. This may need to eventually be expanded to "receive", but we
@@ -150,6 +223,253 @@ static int ls_refs_config(const char *var, const char *value,
 	return parse_hide_refs_config(var, value, "uploadpack", &data->hidden_refs);
 }
 
+static void ls_refs_cache_key(struct ls_refs_data *data,
+			      const struct strbuf *stamp, unsigned char *key)
+{
+	struct git_hash_ctx ctx;
+	const char *namespace = get_git_namespace();
+
+	the_hash_algo->init_fn(&ctx);
+	the_hash_algo->update_fn(&ctx, namespace, strlen(namespace) + 1);
+	for (size_t i = 0; i < data->hidden_refs.nr; i++)
+		the_hash_algo->update_fn(&ctx, data->hidden_refs.v[i],
+					 strlen(data->hidden_refs.v[i]) + 1);
+	the_hash_algo->update_fn(&ctx, stamp->buf, stamp->len);
+	the_hash_algo->final_fn(key, &ctx);
+}
+
+static void ls_refs_cache_file(struct repository *r, struct strbuf *path)
+{
+	struct strbuf name = STRBUF_INIT;
+
+	strbuf_addstr(&name, *get_git_namespace() ? get_git_namespace() : "default");
+	strbuf_addstr(&name, ".lsrc");
+	/* namespaces contain slashes; flatten them */
+	for (size_t i = 0; i < name.len; i++)
+		if (name.buf[i] == '/')
+			name.buf[i] = '%';
+	strbuf_reset(path);
+	repo_common_path_append(r, path, "%s/%s", LS_REFS_CACHE_DIR, name.buf);
+	strbuf_release(&name);
+}
+
+static uint64_t cache_offset(const struct ls_refs_cache *cache, uint64_t i)
+{
+	return get_be64(cache->offsets + i * 8);
+}
+
+static int ls_refs_cache_read(struct repository *r, struct ls_refs_data *data,
+			      const struct strbuf *stamp,
+			      struct ls_refs_cache *cache)
+{
+	struct strbuf path = STRBUF_INIT;
+	unsigned char key[GIT_MAX_RAWSZ];
+	const unsigned char *p;
+	size_t header = 8 + the_hash_algo->rawsz + 8;
+	size_t min_entry = 4 + the_hash_algo->hexsz + 1;
+	uint64_t data_size, prev = 0;
+	struct stat st;
+	int fd;
+
+	ls_refs_cache_file(r, &path);
+	fd = git_open(path.buf);
+	strbuf_release(&path);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) || st.st_size < header) {
+		close(fd);
+		return -1;
+	}
+	cache->map_size = xsize_t(st.st_size);
+	cache->map = xmmap(NULL, cache->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	p = cache->map;
+	ls_refs_cache_key(data, stamp, key);
+	if (get_be32(p) != LS_REFS_CACHE_SIGNATURE ||
+	    get_be32(p + 4) != LS_REFS_CACHE_VERSION ||
+	    memcmp(p + 8, key, the_hash_algo->rawsz))
+		goto invalid;
+	cache->nr = get_be64(p + 8 + the_hash_algo->rawsz);
+	if (cache->nr >= (cache->map_size - header) / 8)
+		goto invalid;
+	cache->offsets = p + header;
+	cache->data = (const char *)cache->offsets + (cache->nr + 1) * 8;
+	data_size = cache->map_size - (cache->data - (const char *)cache->map);
+	if (cache_offset(cache, 0) || cache_offset(cache, cache->nr) != data_size)
+		goto invalid;
+	/*
+	 * Lookups trust the offsets, so make sure that every entry lies
+	 * within the data and is long enough for an object ID and a space.
+	 */
+	for (uint64_t i = 1; i <= cache->nr; i++) {
+		uint64_t offset = cache_offset(cache, i);
+
+		if (offset < prev || offset - prev < min_entry ||
+		    offset > data_size)
+			goto invalid;
+		prev = offset;
+	}
+	return 0;
+
+invalid:
+	munmap(cache->map, cache->map_size);
+	cache->map = NULL;
+	return -1;
+}
+
+static void ls_refs_cache_write(struct repository *r, struct ls_refs_data *data,
+				struct ls_refs_cache *cache,
+				const struct strbuf *stamp)
+{
+	struct lock_file lk = LOCK_INIT;
+	struct strbuf path = STRBUF_INIT;
+	unsigned char header[8 + GIT_MAX_RAWSZ + 8];
+	size_t rawsz = the_hash_algo->rawsz;
+	int fd;
+
+	ls_refs_cache_file(r, &path);
+	if (safe_create_leading_directories(path.buf))
+		goto out;
+	fd = hold_lock_file_for_update(&lk, path.buf, 0);
+	if (fd < 0)
+		goto out; /* somebody else is writing it already */
+
+	put_be32(header, LS_REFS_CACHE_SIGNATURE);
+	put_be32(header + 4, LS_REFS_CACHE_VERSION);
+	ls_refs_cache_key(data, stamp, header + 8);
+	put_be64(header + 8 + rawsz, cache->nr);
+	if (write_in_full(fd, header, 8 + rawsz + 8) < 0 ||
+	    write_in_full(fd, cache->built_offsets.buf,
+			  cache->built_offsets.len) < 0 ||
+	    write_in_full(fd, cache->built_data.buf,
+			  cache->built_data.len) < 0 ||
+	    commit_lock_file(&lk) < 0)
+		rollback_lock_file(&lk);
+
+out:
+	strbuf_release(&path);
+}
+
+static void ls_refs_cache_build(struct repository *r, struct ls_refs_data *data,
+				const struct strbuf *stamp,
+				struct ls_refs_cache *cache)
+{
+	const char *prefixes[] = { "", NULL };
+
+	trace2_region_enter("ls-refs", "build-cache", r);
+	data->cache = cache;
+	refs_for_each_fullref_in_prefixes(get_main_ref_store(r),
+					  get_git_namespace(), prefixes,
+					  hidden_refs_to_excludes(&data->hidden_refs),
+					  send_ref, data);
+	data->cache = NULL;
+
+	cache->nr = cache->built_offsets.len / 8;
+	strbuf_add(&cache->built_offsets, "\0\0\0\0\0\0\0\0", 8);
+	put_be64(cache->built_offsets.buf + cache->built_offsets.len - 8,
+		 cache->built_data.len);
+	cache->offsets = (const unsigned char *)cache->built_offsets.buf;
+	cache->data = cache->built_data.buf;
+
+	if (stamp && !cache->too_large)
+		ls_refs_cache_write(r, data, cache, stamp);
+	trace2_data_intmax("ls-refs", r, "cache/refs", cache->nr);
+	trace2_region_leave("ls-refs", "build-cache", r);
+}
+
+static void ls_refs_cache_release(struct ls_refs_cache *cache)
+{
+	if (cache->map)
+		munmap(cache->map, cache->map_size);
+	strbuf_release(&cache->built_offsets);
+	strbuf_release(&cache->built_data);
+}
+
+/*
+ * Return the refname of the i-th ref, which is terminated by a space or
+ * newline in the pkt-line, and its length.
+ */
+static const char *cache_refname(const struct ls_refs_cache *cache, uint64_t i,
+				 size_t *len)
+{
+	const char *line = cache->data + cache_offset(cache, i) + 4;
+	const char *end = cache->data + cache_offset(cache, i + 1);
+	const char *refname = line + the_hash_algo->hexsz + 1;
+	const char *eol = memchr(refname, '\n', end - refname);
+	const char *sp;
+
+	if (!eol)
+		eol = end;
+	sp = memchr(refname, ' ', eol - refname);
+	*len = (sp ? sp : eol) - refname;
+	return refname;
+}
+
+/* Return the index of the first ref not sorting before prefix. */
+static uint64_t cache_lower_bound(const struct ls_refs_cache *cache,
+				  const char *prefix)
+{
+	uint64_t lo = 0, hi = cache->nr;
+	size_t prefix_len = strlen(prefix);
+
+	while (lo < hi) {
+		uint64_t mi = lo + (hi - lo) / 2;
+		size_t len;
+		const char *refname = cache_refname(cache, mi, &len);
+		int cmp = memcmp(refname, prefix, len < prefix_len ? len : prefix_len);
+
+		if (!cmp && len < prefix_len)
+			cmp = -1;
+		if (cmp < 0)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	return lo;
+}
+
+static int cmp_prefix(const void *a, const void *b)
+{
+	return strcmp(*(const char **)a, *(const char **)b);
+}
+
+static void send_cached_refs(struct ls_refs_data *data,
+			     const struct ls_refs_cache *cache)
+{
+	const char *last = NULL;
+
+	/*
+	 * Sort the prefixes and skip those covered by a shorter one, so
+	 * that the matching ranges come out in order and without
+	 * duplicates, just like refs_for_each_fullref_in_prefixes().
+	 */
+	QSORT(data->prefixes.v, data->prefixes.nr, cmp_prefix);
+	for (size_t i = 0; i < data->prefixes.nr; i++) {
+		const char *prefix = data->prefixes.v[i];
+		uint64_t begin, end;
+
+		if (last && starts_with(prefix, last))
+			continue;
+		last = prefix;
+
+		begin = end = cache_lower_bound(cache, prefix);
+		while (end < cache->nr) {
+			size_t len;
+			const char *refname = cache_refname(cache, end, &len);
+
+			if (len < strlen(prefix) ||
+			    memcmp(refname, prefix, strlen(prefix)))
+				break;
+			end++;
+		}
+		if (begin < end)
+			fwrite(cache->data + cache_offset(cache, begin), 1,
+			       cache_offset(cache, end) - cache_offset(cache, begin),
+			       stdout);
+	}
+}
+
 int ls_refs(struct repository *r, struct packet_reader *request)
 {
 	struct ls_refs_data data;
@@ -193,10 +513,27 @@ int ls_refs(struct repository *r, struct packet_reader *request)
 	send_possibly_unborn_head(&data);
 	if (!data.prefixes.nr)
 		strvec_push(&data.prefixes, "");
-	refs_for_each_fullref_in_prefixes(get_main_ref_store(r),
-					  get_git_namespace(), data.prefixes.v,
-					  hidden_refs_to_excludes(&data.hidden_refs),
-					  send_ref, &data);
+	if (data.use_cache && data.peel && data.symrefs) {
+		struct ls_refs_cache cache = {
+			.built_offsets = STRBUF_INIT,
+			.built_data = STRBUF_INIT,
+		};
+		struct strbuf stamp = STRBUF_INIT;
+
+		/* Without a stamp, build the advertisement but do not keep it. */
+		if (refs_read_change_stamp(get_main_ref_store(r), &stamp))
+			ls_refs_cache_build(r, &data, NULL, &cache);
+		else if (ls_refs_cache_read(r, &data, &stamp, &cache))
+			ls_refs_cache_build(r, &data, &stamp, &cache);
+		send_cached_refs(&data, &cache);
+		ls_refs_cache_release(&cache);
+		strbuf_release(&stamp);
+	} else {
+		refs_for_each_fullref_in_prefixes(get_main_ref_store(r),
+						  get_git_namespace(), data.prefixes.v,
+						  hidden_refs_to_excludes(&data.hidden_refs),
+						  send_ref, &data);
+	}
 	packet_fflush(stdout);
 	strvec_clear(&data.prefixes);
 	strbuf_release(&data.buf);
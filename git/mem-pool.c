@@ -76,11 +76,13 @@ void mem_pool_init(struct mem_pool *pool, size_t initial_size)
 void mem_pool_discard(struct mem_pool *pool, int invalidate_memory)
 {
 	struct mp_block *block, *block_to_free;
+	struct mp_mapping *mapping, *mapping_to_free;
 
 	trace_printf_key(&trace_mem_pool,
 		"mem_pool (%p): discard (%"PRIuMAX") unused\n",
 		(void *)pool,
-		(uintmax_t)(pool->mp_block->end - pool->mp_block->next_free));
+		(uintmax_t)(pool->mp_block ?
+			    pool->mp_block->end - pool->mp_block->next_free : 0));
 	block = pool->mp_block;
 	while (block)
 	{
@@ -93,10 +95,35 @@ void mem_pool_discard(struct mem_pool *pool, int invalidate_memory)
 		free(block_to_free);
 	}
 
+	/* unmapped memory cannot be used by accident anyway */
+	mapping = pool->mp_mapping;
+	while (mapping) {
+		mapping_to_free = mapping;
+		mapping = mapping->next_mapping;
+
+		munmap(mapping_to_free->map, mapping_to_free->len);
+		free(mapping_to_free);
+	}
+
 	pool->mp_block = NULL;
+	pool->mp_mapping = NULL;
 	pool->pool_alloc = 0;
 }
 
+void mem_pool_add_mapping(struct mem_pool *pool, void *map, size_t len)
+{
+	struct mp_mapping *mapping = xmalloc(sizeof(*mapping));
+
+	mapping->map = map;
+	mapping->len = len;
+	mapping->next_mapping = pool->mp_mapping;
+	pool->mp_mapping = mapping;
+
+	trace_printf_key(&trace_mem_pool,
+		"mem_pool (%p): add mapping (%"PRIuMAX")\n",
+		(void *)pool, (uintmax_t)len);
+}
+
 void *mem_pool_alloc(struct mem_pool *pool, size_t len)
 {
 	struct mp_block *p = NULL;
@@ -190,6 +217,7 @@ char *mem_pool_strndup(struct mem_pool *pool, const char *str, size_t len)
 int mem_pool_contains(struct mem_pool *pool, void *mem)
 {
 	struct mp_block *p;
+	struct mp_mapping *m;
 
 	/* Check if memory is allocated in a block */
 	for (p = pool->mp_block; p; p = p->next_block)
@@ -197,6 +225,12 @@ int mem_pool_contains(struct mem_pool *pool, void *mem)
 		    (mem < ((void *)p->end)))
 			return 1;
 
+	/* ... or mapped */
+	for (m = pool->mp_mapping; m; m = m->next_mapping)
+		if ((char *)mem >= (char *)m->map &&
+		    (char *)mem < (char *)m->map + m->len)
+			return 1;
+
 	return 0;
 }
 
@@ -224,7 +258,17 @@ void mem_pool_combine(struct mem_pool *dst, struct mem_pool *src)
 		/* src is empty, nothing to do. */
 	}
 
+	if (src->mp_mapping) {
+		struct mp_mapping *m = src->mp_mapping;
+
+		while (m->next_mapping)
+			m = m->next_mapping;
+		m->next_mapping = dst->mp_mapping;
+		dst->mp_mapping = src->mp_mapping;
+	}
+
 	dst->pool_alloc += src->pool_alloc;
 	src->pool_alloc = 0;
 	src->mp_block = NULL;
+	src->mp_mapping = NULL;
 }
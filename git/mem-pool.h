@@ -8,9 +8,18 @@ struct mp_block {
 	uintmax_t space[FLEX_ARRAY]; /* more */
 };
 
+struct mp_mapping {
+	struct mp_mapping *next_mapping;
+	void *map;
+	size_t len;
+};
+
 struct mem_pool {
 	struct mp_block *mp_block;
 
+	/* Memory mapped with xmmap() the pool is responsible for. */
+	struct mp_mapping *mp_mapping;
+
 	/*
 	 * The amount of available memory to grow the pool by.
 	 * This size does not include the overhead for the mp_block.
@@ -53,6 +62,12 @@ char *mem_pool_strndup(struct mem_pool *pool, const char *str, size_t len);
 __attribute__((format (printf, 2, 3)))
 char *mem_pool_strfmt(struct mem_pool *pool, const char *fmt, ...);
 
+/*
+ * Make the pool responsible for 'len' bytes at 'map' that were mapped
+ * with xmmap(), so that they are unmapped when the pool is discarded.
+ */
+void mem_pool_add_mapping(struct mem_pool *pool, void *map, size_t len);
+
 /*
  * Move the memory associated with the 'src' pool to the 'dst' pool. The 'src'
  * pool will be empty and not contain any memory. It still needs to be free'd
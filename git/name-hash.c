@@ -586,15 +586,283 @@ static void threaded_lazy_init_name_hash(
 	free(lazy_entries);
 }
 
+/*
+ * Until a command has looked up enough names for it to pay off, the
+ * hash tables are not built for the whole index, but only hold the
+ * entries a lookup could match: those named like the name looked up,
+ * in any case, and those under the directories leading to it.
+ *
+ * These are found without going over the whole index with a tree of
+ * "struct partial_dir", each with the ranges of the index holding the
+ * entries named like it or under it, in any case (so that "a/b" and
+ * "A/B/c" are both in "a/b").  The children of a directory are found
+ * the first time a lookup goes through it, by skipping over the entries
+ * of each child with a binary search.  The tree only describes the
+ * index it was built from, and is built again once entries are added
+ * or removed.
+ */
+struct partial_range {
+	unsigned int start, end;
+};
+
+struct partial_dir {
+	struct hashmap_entry ent;
+	struct partial_range *range;
+	unsigned int range_nr, range_alloc;
+	unsigned expanded : 1,
+		 hashed : 1;
+	unsigned int namelen;
+	char name[FLEX_ARRAY];
+};
+
+struct partial_name_hash {
+	struct hashmap dirs;
+	unsigned root_expanded : 1,
+		 stale : 1;
+	struct cache_entry **cache;
+	unsigned int cache_nr;
+
+	/* children found and entries hashed so far */
+	unsigned int cost;
+	unsigned int nr_hashed;
+};
+
+static int partial_dir_cmp(const void *cmp_data UNUSED,
+			   const struct hashmap_entry *eptr,
+			   const struct hashmap_entry *entry_or_key,
+			   const void *keydata)
+{
+	const struct partial_dir *e1, *e2;
+	const char *name = keydata;
+
+	e1 = container_of(eptr, const struct partial_dir, ent);
+	e2 = container_of(entry_or_key, const struct partial_dir, ent);
+
+	return e1->namelen != e2->namelen || strncasecmp(e1->name,
+			name ? name : e2->name, e1->namelen);
+}
+
+static struct partial_dir *get_partial_dir(struct partial_name_hash *p,
+					   const char *name,
+					   unsigned int namelen, int create)
+{
+	struct partial_dir key, *dir;
+	unsigned int hash = memihash(name, namelen);
+
+	hashmap_entry_init(&key.ent, hash);
+	key.namelen = namelen;
+	dir = hashmap_get_entry(&p->dirs, &key, ent, name);
+	if (!dir && create) {
+		FLEX_ALLOC_MEM(dir, name, name, namelen);
+		hashmap_entry_init(&dir->ent, hash);
+		dir->namelen = namelen;
+		hashmap_add(&p->dirs, &dir->ent);
+	}
+	return dir;
+}
+
+static void clear_partial_dirs(struct partial_name_hash *p)
+{
+	struct hashmap_iter iter;
+	struct partial_dir *dir;
+
+	hashmap_for_each_entry(&p->dirs, &iter, dir, ent)
+		free(dir->range);
+	hashmap_clear_and_free(&p->dirs, struct partial_dir, ent);
+}
+
+/*
+ * Return the first entry in (k, end) whose name does not start with
+ * the first `len` bytes of `prefix`, which the entry at k does.
+ */
+static unsigned int skip_prefix_entries(struct index_state *istate,
+					unsigned int k, unsigned int end,
+					const char *prefix, unsigned int len)
+{
+	unsigned int begin = k + 1;
+
+	while (begin < end) {
+		unsigned int mid = begin + ((end - begin) >> 1);
+
+		if (strncmp(istate->cache[mid]->name, prefix, len))
+			end = mid;
+		else
+			begin = mid + 1;
+	}
+	return begin;
+}
+
+/*
+ * Add the children of the directory made of the first `len` bytes of
+ * the names of the entries in [start, end), or of the root if `len` is
+ * zero, to the tree.
+ */
+static void add_partial_children(struct index_state *istate,
+				 struct partial_name_hash *p,
+				 unsigned int start, unsigned int end,
+				 unsigned int len)
+{
+	unsigned int skip = len ? len + 1 : 0;
+	unsigned int k = start;
+
+	while (k < end) {
+		const struct cache_entry *ce = istate->cache[k];
+		unsigned int namelen = ce_namelen(ce);
+		unsigned int childlen, next;
+		struct partial_dir *child;
+		const char *slash;
+
+		/* the directory itself, or its sparse-directory entry */
+		if (namelen <= skip) {
+			k++;
+			continue;
+		}
+
+		slash = memchr(ce->name + skip, '/', namelen - skip);
+		if (slash) {
+			childlen = slash - ce->name;
+			next = skip_prefix_entries(istate, k, end, ce->name,
+						   childlen + 1);
+		} else {
+			/* a file, with all of its stages */
+			childlen = namelen;
+			next = k + 1;
+			while (next < end &&
+			       !strcmp(istate->cache[next]->name, ce->name))
+				next++;
+		}
+
+		child = get_partial_dir(p, ce->name, childlen, 1);
+		ALLOC_GROW(child->range, child->range_nr + 1, child->range_alloc);
+		child->range[child->range_nr].start = k;
+		child->range[child->range_nr].end = next;
+		child->range_nr++;
+
+		p->cost++;
+		k = next;
+	}
+}
+
+/*
+ * Find the entries named `name`, or with `deepest`, the deepest of the
+ * directories leading to it there are entries under.  Returns NULL if
+ * there are none.
+ */
+static struct partial_dir *find_partial_dir(struct index_state *istate,
+					    struct partial_name_hash *p,
+					    const char *name,
+					    unsigned int namelen, int deepest)
+{
+	struct partial_dir *dir = NULL;
+	unsigned int len = 0;
+
+	if (!p->root_expanded) {
+		add_partial_children(istate, p, 0, istate->cache_nr, 0);
+		p->root_expanded = 1;
+	}
+
+	while (len < namelen) {
+		const char *slash = memchr(name + len, '/', namelen - len);
+		unsigned int end = slash ? slash - name : namelen;
+		struct partial_dir *child;
+
+		/* as in "dir/", or "dir//file" */
+		if (end == len)
+			break;
+
+		child = get_partial_dir(p, name, end, 0);
+		if (!child)
+			return deepest ? dir : NULL;
+		dir = child;
+
+		/* once a directory is hashed, so is everything under it */
+		if (dir->hashed || !slash || end + 1 == namelen)
+			break;
+
+		if (!dir->expanded) {
+			for (unsigned int i = 0; i < dir->range_nr; i++)
+				add_partial_children(istate, p,
+						     dir->range[i].start,
+						     dir->range[i].end,
+						     dir->namelen);
+			dir->expanded = 1;
+		}
+		len = end + 1;
+	}
+	return dir;
+}
+
+/*
+ * Hash the entries in `dir`.  Returns -1 if they are not where the
+ * tree says they are.
+ */
+static int hash_partial_dir(struct index_state *istate,
+			    struct partial_name_hash *p,
+			    struct partial_dir *dir)
+{
+	for (unsigned int i = 0; i < dir->range_nr; i++) {
+		if (dir->range[i].end > istate->cache_nr)
+			return -1;
+
+		for (unsigned int k = dir->range[i].start; k < dir->range[i].end; k++) {
+			struct cache_entry *ce = istate->cache[k];
+
+			if (ce_namelen(ce) < dir->namelen ||
+			    strncasecmp(ce->name, dir->name, dir->namelen) ||
+			    (ce->name[dir->namelen] && ce->name[dir->namelen] != '/'))
+				return -1;
+
+			if (!(ce->ce_flags & CE_HASHED)) {
+				hash_index_entry(istate, ce);
+				p->nr_hashed++;
+			}
+			p->cost++;
+		}
+	}
+	dir->hashed = 1;
+	return 0;
+}
+
+static void free_partial_name_hash(struct index_state *istate)
+{
+	struct partial_name_hash *p = istate->name_hash_partial;
+
+	trace2_data_intmax("index", istate->repo, "name-hash/partial",
+			   p->nr_hashed);
+	clear_partial_dirs(p);
+	free(p);
+	istate->name_hash_partial = NULL;
+}
+
+/*
+ * Build the hash tables for the whole index, or finish them if only
+ * some of the entries are hashed so far.
+ */
 static void lazy_init_name_hash(struct index_state *istate)
 {
 
-	if (istate->name_hash_initialized)
+	if (istate->name_hash_initialized && !istate->name_hash_partial)
 		return;
 	trace_performance_enter();
 	trace2_region_enter("index", "name-hash-init", istate->repo);
-	hashmap_init(&istate->name_hash, cache_entry_cmp, NULL, istate->cache_nr);
-	hashmap_init(&istate->dir_hash, dir_entry_cmp, NULL, istate->cache_nr);
+
+	/*
+	 * Start over from empty tables, which can be sized for the whole
+	 * index and filled by the threads.
+	 */
+	if (istate->name_hash_partial) {
+		free_partial_name_hash(istate);
+		for (unsigned int nr = 0; nr < istate->cache_nr; nr++)
+			istate->cache[nr]->ce_flags &= ~CE_HASHED;
+		hashmap_clear(&istate->name_hash);
+		hashmap_clear_and_free(&istate->dir_hash, struct dir_entry, ent);
+		istate->name_hash_initialized = 0;
+	}
+
+	if (!istate->name_hash_initialized) {
+		hashmap_init(&istate->name_hash, cache_entry_cmp, NULL, istate->cache_nr);
+		hashmap_init(&istate->dir_hash, dir_entry_cmp, NULL, istate->cache_nr);
+	}
 
 	if (lookup_lazy_params(istate)) {
 		/*
@@ -617,6 +885,55 @@ static void lazy_init_name_hash(struct index_state *istate)
 	trace_performance_leave("initialize name hash");
 }
 
+/*
+ * Make sure the hash tables hold every entry a lookup of `name` could
+ * match or, with `deepest`, every entry under the deepest directory
+ * leading to it that is in the index.
+ *
+ * Once hashing only those would take a quarter as long as building
+ * the tables for the whole index, the command is likely to look up many
+ * more names, and we build them in full, on threads if it pays off.
+ */
+static void hash_entries_for(struct index_state *istate, const char *name,
+			     unsigned int namelen, int deepest)
+{
+	struct partial_name_hash *p;
+	struct partial_dir *dir;
+	unsigned int size = 0;
+
+	if (!istate->name_hash_initialized) {
+		hashmap_init(&istate->name_hash, cache_entry_cmp, NULL, 0);
+		hashmap_init(&istate->dir_hash, dir_entry_cmp, NULL, 0);
+		CALLOC_ARRAY(istate->name_hash_partial, 1);
+		hashmap_init(&istate->name_hash_partial->dirs, partial_dir_cmp, NULL, 0);
+		istate->name_hash_partial->stale = 1;
+		istate->name_hash_initialized = 1;
+	}
+
+	p = istate->name_hash_partial;
+	if (!p)
+		return;
+
+	if (p->stale || p->cache != istate->cache ||
+	    p->cache_nr != istate->cache_nr) {
+		clear_partial_dirs(p);
+		hashmap_init(&p->dirs, partial_dir_cmp, NULL, 0);
+		p->root_expanded = 0;
+		p->stale = 0;
+		p->cache = istate->cache;
+		p->cache_nr = istate->cache_nr;
+	}
+
+	dir = find_partial_dir(istate, p, name, namelen, deepest);
+	if (dir && !dir->hashed)
+		for (unsigned int i = 0; i < dir->range_nr; i++)
+			size += dir->range[i].end - dir->range[i].start;
+
+	if (p->cost + size > istate->cache_nr / 4 ||
+	    (dir && hash_partial_dir(istate, p, dir) < 0))
+		lazy_init_name_hash(istate);
+}
+
 /*
  * A test routine for t/helper/ sources.
  *
@@ -638,13 +955,20 @@ int test_lazy_init_name_hash(struct index_state *istate, int try_threaded)
 
 void add_name_hash(struct index_state *istate, struct cache_entry *ce)
 {
-	if (istate->name_hash_initialized)
-		hash_index_entry(istate, ce);
+	if (!istate->name_hash_initialized)
+		return;
+	hash_index_entry(istate, ce);
+	if (istate->name_hash_partial)
+		istate->name_hash_partial->stale = 1;
 }
 
 void remove_name_hash(struct index_state *istate, struct cache_entry *ce)
 {
-	if (!istate->name_hash_initialized || !(ce->ce_flags & CE_HASHED))
+	if (!istate->name_hash_initialized)
+		return;
+	if (istate->name_hash_partial)
+		istate->name_hash_partial->stale = 1;
+	if (!(ce->ce_flags & CE_HASHED))
 		return;
 	ce->ce_flags &= ~CE_HASHED;
 	hashmap_remove(&istate->name_hash, &ce->ent, ce);
@@ -694,7 +1018,7 @@ int index_dir_find(struct index_state *istate, const char *name, int namelen,
 {
 	struct dir_entry *dir;
 
-	lazy_init_name_hash(istate);
+	hash_entries_for(istate, name, namelen, 0);
 	expand_to_path(istate, name, namelen, 0);
 	dir = find_dir_entry(istate, name, namelen);
 
@@ -710,8 +1034,9 @@ void adjust_dirname_case(struct index_state *istate, char *name)
 {
 	const char *startPtr = name;
 	const char *ptr = startPtr;
+	const char *slash = strrchr(name, '/');
 
-	lazy_init_name_hash(istate);
+	hash_entries_for(istate, name, slash ? slash - name : 0, 1);
 	expand_to_path(istate, name, strlen(name), 0);
 	while (*ptr) {
 		while (*ptr && *ptr != '/')
@@ -735,7 +1060,7 @@ struct cache_entry *index_file_exists(struct index_state *istate, const char *na
 	struct cache_entry *ce;
 	unsigned int hash = memihash(name, namelen);
 
-	lazy_init_name_hash(istate);
+	hash_entries_for(istate, name, namelen, 0);
 	expand_to_path(istate, name, namelen, icase);
 
 	ce = hashmap_get_entry_from_hash(&istate->name_hash, hash, NULL,
@@ -753,6 +1078,8 @@ void free_name_hash(struct index_state *istate)
 		return;
 	istate->name_hash_initialized = 0;
 
+	if (istate->name_hash_partial)
+		free_partial_name_hash(istate);
 	hashmap_clear(&istate->name_hash);
 	hashmap_clear_and_free(&istate->dir_hash, struct dir_entry, ent);
 }
@@ -70,8 +70,9 @@ static void mark_common(struct negotiation_state *ns, struct commit *commit,
 		if ((commit->object.flags & SEEN) && !(commit->object.flags & POPPED))
 			ns->non_common_revs--;
 	}
-	while ((commit = prio_queue_get(&queue))) {
+	while ((commit = prio_queue_peek(&queue))) {
 		struct object *o = (struct object *)commit;
+		int popped = 0;
 
 		if (!(o->flags & SEEN))
 			rev_list_push(ns, commit, SEEN);
@@ -79,8 +80,10 @@ static void mark_common(struct negotiation_state *ns, struct commit *commit,
 			struct commit_list *parents;
 
 			if (!o->parsed && !dont_parse)
-				if (repo_parse_commit(the_repository, commit))
+				if (repo_parse_commit(the_repository, commit)) {
+					prio_queue_get(&queue);
 					continue;
+				}
 
 			for (parents = commit->parents;
 					parents;
@@ -95,9 +98,15 @@ static void mark_common(struct negotiation_state *ns, struct commit *commit,
 				if ((p->object.flags & SEEN) && !(p->object.flags & POPPED))
 					ns->non_common_revs--;
 
-				prio_queue_put(&queue, parents->item);
+				if (popped)
+					prio_queue_put(&queue, parents->item);
+				else
+					prio_queue_replace(&queue, parents->item);
+				popped = 1;
 			}
 		}
+		if (!popped)
+			prio_queue_get(&queue);
 	}
 
 	clear_prio_queue(&queue);
@@ -192,6 +201,7 @@ void default_negotiator_init(struct fetch_negotiator *negotiator)
 	negotiator->release = release;
 	negotiator->data = CALLOC_ARRAY(ns, 1);
 	ns->rev_list.compare = compare_commits_by_commit_date;
+	ns->rev_list.get_key = commit_date_queue_key;
 
 	if (marked)
 		refs_for_each_ref(get_main_ref_store(the_repository),
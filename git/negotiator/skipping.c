@@ -100,22 +100,29 @@ static void mark_common(struct data *data, struct commit *seen_commit)
 
 	prio_queue_put(&queue, seen_commit);
 	seen_commit->object.flags |= COMMON;
-	while ((c = prio_queue_get(&queue))) {
+	while ((c = prio_queue_peek(&queue))) {
 		struct commit_list *p;
+		int popped = 0;
 
 		if (!(c->object.flags & POPPED))
 			data->non_common_revs--;
 
-		if (!c->object.parsed)
-			continue;
-		for (p = c->parents; p; p = p->next) {
-			if (!(p->item->object.flags & SEEN) ||
-			    (p->item->object.flags & COMMON))
-				continue;
-
-			p->item->object.flags |= COMMON;
-			prio_queue_put(&queue, p->item);
+		if (c->object.parsed) {
+			for (p = c->parents; p; p = p->next) {
+				if (!(p->item->object.flags & SEEN) ||
+				    (p->item->object.flags & COMMON))
+					continue;
+
+				p->item->object.flags |= COMMON;
+				if (popped)
+					prio_queue_put(&queue, p->item);
+				else
+					prio_queue_replace(&queue, p->item);
+				popped = 1;
+			}
 		}
+		if (!popped)
+			prio_queue_get(&queue);
 	}
 
 	clear_prio_queue(&queue);
@@ -2,6 +2,7 @@
 
 #include "git-compat-util.h"
 #include "commit.h"
+#include "commit-reach.h"
 #include "gettext.h"
 #include "hex.h"
 #include "strbuf.h"
@@ -23,6 +24,8 @@
 #include "midx.h"
 #include "config.h"
 #include "pseudo-merge.h"
+#include "replace-object.h"
+#include "shallow.h"
 
 /*
  * An entry on the bitmap index, representing the bitmap for a given
@@ -2445,6 +2448,151 @@ void count_bitmap_commit_list(struct bitmap_index *bitmap_git,
 		*tags = count_object_type(bitmap_git, OBJ_TAG);
 }
 
+/*
+ * Return the objects reachable from "commit", or NULL if we would have to
+ * walk over a commit outside of the bitmapped packs.
+ */
+static struct bitmap *find_commit_reachable(struct bitmap_index *bitmap_git,
+					    struct commit *commit)
+{
+	struct repository *r = bitmap_repo(bitmap_git);
+	struct bitmap *result = bitmap_new();
+	struct commit_list *stack = NULL;
+
+	commit_list_insert(commit, &stack);
+	while (stack) {
+		struct commit *c = pop_commit(&stack);
+		struct ewah_bitmap *stored;
+		struct commit_list *p;
+		int pos = bitmap_position(bitmap_git, &c->object.oid);
+
+		if (pos < 0 || repo_parse_commit(r, c))
+			goto fail;
+		if (bitmap_get(result, pos))
+			continue;
+
+		stored = bitmap_for_commit(bitmap_git, c);
+		if (stored) {
+			existing_bitmaps_hits_nr++;
+			bitmap_or_ewah(result, stored);
+			continue;
+		}
+		existing_bitmaps_misses_nr++;
+
+		bitmap_set(result, pos);
+		for (p = c->parents; p; p = p->next)
+			commit_list_insert(p->item, &stack);
+	}
+	return result;
+
+fail:
+	free_commit_list(stack);
+	bitmap_free(result);
+	return NULL;
+}
+
+/* Count the commits in "a" that are not in "b". */
+static uint32_t count_commits_not_in(struct bitmap_index *bitmap_git,
+				     struct bitmap *a, struct bitmap *b)
+{
+	uint32_t count = 0;
+	size_t i = 0;
+	struct ewah_iterator it;
+	eword_t filter;
+
+	init_type_iterator(&it, bitmap_git, OBJ_COMMIT);
+
+	while (i < a->word_alloc && ewah_iterator_next(&filter, &it)) {
+		eword_t word = a->words[i] & filter;
+		if (i < b->word_alloc)
+			word &= ~b->words[i];
+		count += ewah_bit_popcount64(word);
+		i++;
+	}
+
+	return count;
+}
+
+/*
+ * Bitmaps record the history found in the packs, which is not what we
+ * see with grafts, replaced commits or a shallow clone.
+ */
+static int bitmap_history_matches(struct repository *r)
+{
+	if (replace_refs_enabled(r)) {
+		prepare_replace_object(r);
+		if (hashmap_get_size(&r->objects->replace_map->map))
+			return 0;
+	}
+
+	prepare_commit_graft(r);
+	if (r->parsed_objects &&
+	    (r->parsed_objects->grafts_nr || r->parsed_objects->substituted_parent))
+		return 0;
+
+	return !is_repository_shallow(r);
+}
+
+int bitmap_ahead_behind(struct repository *r,
+			struct commit **commits, size_t commits_nr,
+			struct ahead_behind_count *counts, size_t counts_nr)
+{
+	struct bitmap_index *bitmap_git;
+	struct bitmap **bases;
+	struct bitmap *tip = NULL;
+	size_t tip_index = 0;
+	int ret = 0;
+
+	if (!bitmap_history_matches(r) || !(bitmap_git = prepare_bitmap_git(r)))
+		return -1;
+
+	/*
+	 * Many counts usually share few bases, so keep what we found for
+	 * each of those. Counts for the same tip come together, so we
+	 * only keep the latest tip.
+	 */
+	CALLOC_ARRAY(bases, commits_nr);
+
+	for (size_t i = 0; i < counts_nr; i++) {
+		size_t b = counts[i].base_index, t = counts[i].tip_index;
+		struct bitmap *tip_bitmap;
+
+		if (!bases[b] &&
+		    !(bases[b] = find_commit_reachable(bitmap_git, commits[b]))) {
+			ret = -1;
+			break;
+		}
+
+		if (bases[t])
+			tip_bitmap = bases[t];
+		else {
+			if (!tip || tip_index != t) {
+				bitmap_free(tip);
+				tip = find_commit_reachable(bitmap_git, commits[t]);
+				tip_index = t;
+				if (!tip) {
+					ret = -1;
+					break;
+				}
+			}
+			tip_bitmap = tip;
+		}
+
+		counts[i].ahead = count_commits_not_in(bitmap_git, tip_bitmap, bases[b]);
+		counts[i].behind = count_commits_not_in(bitmap_git, bases[b], tip_bitmap);
+	}
+
+	if (!ret)
+		trace2_data_intmax("bitmap", r, "ahead-behind/counts", counts_nr);
+
+	bitmap_free(tip);
+	for (size_t i = 0; i < commits_nr; i++)
+		bitmap_free(bases[i]);
+	free(bases);
+	free_bitmap_index(bitmap_git);
+	return ret;
+}
+
 struct bitmap_test_data {
 	struct bitmap_index *bitmap_git;
 	struct bitmap *base;
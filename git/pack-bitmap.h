@@ -7,6 +7,7 @@
 #include "pack-objects.h"
 #include "string-list.h"
 
+struct ahead_behind_count;
 struct commit;
 struct repository;
 struct rev_info;
@@ -103,6 +104,16 @@ int bitmap_has_oid_in_uninteresting(struct bitmap_index *, const struct object_i
 
 off_t get_disk_usage_from_bitmap(struct bitmap_index *, struct rev_info *);
 
+/*
+ * Fill in "counts" like ahead_behind() from commit-reach.h, using the
+ * reachability bitmaps instead of walking history. Return 0 on success,
+ * and -1 if the bitmaps cannot answer for all of "commits", in which
+ * case "counts" may have been partially filled in.
+ */
+int bitmap_ahead_behind(struct repository *r,
+			struct commit **commits, size_t commits_nr,
+			struct ahead_behind_count *counts, size_t counts_nr);
+
 struct bitmap_writer {
 	struct ewah_bitmap *commits;
 	struct ewah_bitmap *trees;
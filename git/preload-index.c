@@ -6,6 +6,7 @@
 #define DISABLE_SIGN_COMPARE_WARNINGS
 
 #include "git-compat-util.h"
+#include "compat/lstat-batch.h"
 #include "pathspec.h"
 #include "dir.h"
 #include "environment.h"
@@ -31,6 +32,12 @@ static struct fscache *fscache;
 #define MAX_PARALLEL (20)
 #define THREAD_COST (500)
 
+/*
+ * The number of lstat's each thread keeps in flight at once where they
+ * can be batched.
+ */
+#define LSTAT_BATCH (64)
+
 struct progress_data {
 	unsigned long n;
 	struct progress *progress;
@@ -44,8 +51,40 @@ struct thread_data {
 	struct progress_data *progress;
 	int offset, nr;
 	int t2_nr_lstat;
+	int t2_nr_batched;
 };
 
+static void preload_entry(struct index_state *index, struct cache_entry *ce,
+			  struct stat *st)
+{
+	if (ie_match_stat(index, ce, st, CE_MATCH_RACY_IS_DIRTY|CE_MATCH_IGNORE_FSMONITOR))
+		return;
+	ce_mark_uptodate(ce);
+	mark_fsmonitor_valid(index, ce);
+}
+
+static void preload_batch(struct thread_data *p, struct lstat_batch *batch,
+			  struct cache_entry **ces, int nr)
+{
+	const char *paths[LSTAT_BATCH];
+	struct stat st[LSTAT_BATCH];
+	int err[LSTAT_BATCH];
+	int i;
+
+	for (i = 0; i < nr; i++)
+		paths[i] = ces[i]->name;
+	if (lstat_batch(batch, paths, nr, st, err)) {
+		for (i = 0; i < nr; i++)
+			err[i] = lstat(paths[i], &st[i]) ? errno : 0;
+	} else {
+		p->t2_nr_batched += nr;
+	}
+
+	for (i = 0; i < nr; i++)
+		if (!err[i])
+			preload_entry(p->index, ces[i], &st[i]);
+}
+
 static void *preload_thread(void *_data)
 {
 	int nr, last_nr;
@@ -53,6 +92,10 @@ static void *preload_thread(void *_data)
 	struct index_state *index = p->index;
 	struct cache_entry **cep = index->cache + p->offset;
 	struct cache_def cache = CACHE_DEF_INIT;
+	struct lstat_batch *batch = core_batch_stat ?
+		lstat_batch_init(LSTAT_BATCH) : NULL;
+	struct cache_entry *batched[LSTAT_BATCH];
+	int batched_nr = 0;
 
 	nr = p->nr;
 	if (nr + p->offset > index->cache_nr)
@@ -88,13 +131,21 @@ static void *preload_thread(void *_data)
 		if (threaded_has_symlink_leading_path(&cache, ce->name, ce_namelen(ce)))
 			continue;
 		p->t2_nr_lstat++;
-		if (lstat(ce->name, &st))
+		if (batch) {
+			batched[batched_nr++] = ce;
+			if (batched_nr == LSTAT_BATCH) {
+				preload_batch(p, batch, batched, batched_nr);
+				batched_nr = 0;
+			}
 			continue;
-		if (ie_match_stat(index, ce, &st, CE_MATCH_RACY_IS_DIRTY|CE_MATCH_IGNORE_FSMONITOR))
+		}
+		if (lstat(ce->name, &st))
 			continue;
-		ce_mark_uptodate(ce);
-		mark_fsmonitor_valid(index, ce);
+		preload_entry(index, ce, &st);
 	} while (--nr > 0);
+	if (batched_nr)
+		preload_batch(p, batch, batched, batched_nr);
+	lstat_batch_release(batch);
 	if (p->progress) {
 		struct progress_data *pd = p->progress;
 
@@ -115,6 +166,7 @@ void preload_index(struct index_state *index,
 	struct thread_data data[MAX_PARALLEL];
 	struct progress_data pd;
 	int t2_sum_lstat = 0;
+	int t2_sum_batched = 0;
 
 	if (!HAVE_THREADS || !core_preload_index)
 		return;
@@ -165,6 +217,7 @@ void preload_index(struct index_state *index,
 		if (pthread_join(p->pthread, NULL))
 			die("unable to join threaded lstat");
 		t2_sum_lstat += p->t2_nr_lstat;
+		t2_sum_batched += p->t2_nr_batched;
 	}
 	stop_progress(&pd.progress);
 
@@ -177,6 +230,7 @@ void preload_index(struct index_state *index,
 	trace_performance_leave("preload index");
 
 	trace2_data_intmax("index", NULL, "preload/sum_lstat", t2_sum_lstat);
+	trace2_data_intmax("index", NULL, "preload/sum_batched", t2_sum_batched);
 	trace2_region_leave("index", "preload", NULL);
 }
 
@@ -4,6 +4,7 @@
 #include "git-compat-util.h"
 #include "config.h"
 #include "commit.h"
+#include "commit-graph.h"
 #include "environment.h"
 #include "gettext.h"
 #include "hash.h"
@@ -893,6 +894,7 @@ struct format_commit_context {
 	const struct pretty_print_context *pretty_ctx;
 	unsigned commit_header_parsed:1;
 	unsigned commit_message_parsed:1;
+	unsigned subject_is_enough:1;
 	struct signature_check signature_check;
 	enum flush_type flush_type;
 	enum trunc_type truncate;
@@ -1715,9 +1717,15 @@ static size_t format_commit_one(struct strbuf *sb, /* in UTF-8 */
 
 	/* For the rest we have to parse the commit header. */
 	if (!c->commit_header_parsed) {
-		msg = c->message =
-			repo_logmsg_reencode(c->repository, commit,
-					     &c->commit_encoding, "UTF-8");
+		struct strbuf summary = STRBUF_INIT;
+
+		if (c->subject_is_enough &&
+		    get_commit_summary_in_graph(c->repository, commit, &summary))
+			msg = c->message = strbuf_detach(&summary, NULL);
+		else
+			msg = c->message =
+				repo_logmsg_reencode(c->repository, commit,
+						     &c->commit_encoding, "UTF-8");
 		parse_commit_header(c);
 	}
 
@@ -1983,6 +1991,26 @@ void userformat_find_requirements(const char *fmt, struct userformat_want *w)
 	}
 }
 
+/*
+ * Return 1 if `fmt` has a placeholder that needs more of the commit
+ * message than its subject.
+ */
+static int userformat_needs_body(const char *fmt)
+{
+	while ((fmt = strchr(fmt, '%'))) {
+		fmt++;
+		if (skip_prefix(fmt, "%", &fmt))
+			continue;
+
+		if (*fmt == '+' || *fmt == '-' || *fmt == ' ')
+			fmt++;
+
+		if (*fmt == 'b' || *fmt == 'B' || starts_with(fmt, "(trailers"))
+			return 1;
+	}
+	return 0;
+}
+
 void repo_format_commit_message(struct repository *r,
 				const struct commit *commit,
 				const char *format, struct strbuf *sb,
@@ -1992,6 +2020,7 @@ void repo_format_commit_message(struct repository *r,
 		.repository = r,
 		.commit = commit,
 		.pretty_ctx = pretty_ctx,
+		.subject_is_enough = !userformat_needs_body(format),
 		.wrap_start = sb->len
 	};
 	const char *output_enc = pretty_ctx->output_encoding;
@@ -2291,6 +2320,7 @@ void pretty_print_commit(struct pretty_print_context *pp,
 	const char *reencoded;
 	const char *encoding;
 	int need_8bit_cte = pp->need_8bit_cte;
+	struct strbuf summary = STRBUF_INIT;
 
 	if (pp->fmt == CMIT_FMT_USERFORMAT) {
 		repo_format_commit_message(the_repository, commit,
@@ -2299,8 +2329,12 @@ void pretty_print_commit(struct pretty_print_context *pp,
 	}
 
 	encoding = get_log_output_encoding();
-	msg = reencoded = repo_logmsg_reencode(the_repository, commit, NULL,
-					       encoding);
+	if (pp->fmt == CMIT_FMT_ONELINE && same_encoding(encoding, "UTF-8") &&
+	    get_commit_summary_in_graph(the_repository, commit, &summary))
+		msg = reencoded = strbuf_detach(&summary, NULL);
+	else
+		msg = reencoded = repo_logmsg_reencode(the_repository, commit,
+						       NULL, encoding);
 
 	if (pp->fmt == CMIT_FMT_ONELINE || cmit_fmt_is_mail(pp->fmt))
 		indent = 0;
@@ -1,13 +1,30 @@
 #include "git-compat-util.h"
 #include "prio-queue.h"
 
-static inline int compare(struct prio_queue *queue, size_t i, size_t j)
+/*
+ * The queue is a 4-ary heap: the children of the entry at "ix" are at
+ * 4 * ix + 1 to 4 * ix + 4.  Compared to a binary heap this halves the
+ * depth, and the children of an entry share one or two cache lines.
+ */
+#define PRIO_QUEUE_ARITY 4
+
+static inline int compare(struct prio_queue *queue,
+			  const struct prio_queue_entry *a,
+			  const struct prio_queue_entry *b)
 {
-	int cmp = queue->compare(queue->array[i].data, queue->array[j].data,
-				 queue->cb_data);
+	int cmp;
+
+	if (queue->get_key) {
+		if (a->key[0] != b->key[0])
+			return a->key[0] < b->key[0] ? 1 : -1;
+		if (a->key[1] != b->key[1])
+			return a->key[1] < b->key[1] ? 1 : -1;
+		cmp = 0;
+	} else {
+		cmp = queue->compare(a->data, b->data, queue->cb_data);
+	}
 	if (!cmp)
-		cmp = (queue->array[i].ctr > queue->array[j].ctr) -
-		      (queue->array[i].ctr < queue->array[j].ctr);
+		cmp = (a->ctr > b->ctr) - (a->ctr < b->ctr);
 	return cmp;
 }
 
@@ -16,6 +33,55 @@ static inline void swap(struct prio_queue *queue, size_t i, size_t j)
 	SWAP(queue->array[i], queue->array[j]);
 }
 
+static void init_entry(struct prio_queue *queue,
+		       struct prio_queue_entry *entry, void *thing)
+{
+	entry->ctr = queue->insertion_ctr++;
+	entry->data = thing;
+	if (queue->get_key)
+		queue->get_key(thing, entry->key, queue->cb_data);
+}
+
+/* Move "entry" up from the hole at "ix" to where it belongs. */
+static void sift_up(struct prio_queue *queue, size_t ix,
+		    struct prio_queue_entry *entry)
+{
+	while (ix) {
+		size_t parent = (ix - 1) / PRIO_QUEUE_ARITY;
+
+		if (compare(queue, &queue->array[parent], entry) <= 0)
+			break;
+		queue->array[ix] = queue->array[parent];
+		ix = parent;
+	}
+	queue->array[ix] = *entry;
+}
+
+/* Move "entry" down from the hole at the root to where it belongs. */
+static void sift_down(struct prio_queue *queue,
+		      struct prio_queue_entry *entry)
+{
+	size_t ix = 0, child;
+
+	while ((child = ix * PRIO_QUEUE_ARITY + 1) < queue->nr) {
+		size_t end = child + PRIO_QUEUE_ARITY;
+		size_t best = child;
+
+		if (end > queue->nr)
+			end = queue->nr;
+		for (child++; child < end; child++)
+			if (compare(queue, &queue->array[child],
+				    &queue->array[best]) < 0)
+				best = child;
+
+		if (compare(queue, entry, &queue->array[best]) <= 0)
+			break;
+		queue->array[ix] = queue->array[best];
+		ix = best;
+	}
+	queue->array[ix] = *entry;
+}
+
 void prio_queue_reverse(struct prio_queue *queue)
 {
 	size_t i, j;
@@ -38,30 +104,26 @@ void clear_prio_queue(struct prio_queue *queue)
 
 void prio_queue_put(struct prio_queue *queue, void *thing)
 {
-	size_t ix, parent;
+	struct prio_queue_entry entry;
+
+	init_entry(queue, &entry, thing);
 
 	/* Append at the end */
 	ALLOC_GROW(queue->array, queue->nr + 1, queue->alloc);
-	queue->array[queue->nr].ctr = queue->insertion_ctr++;
-	queue->array[queue->nr].data = thing;
 	queue->nr++;
-	if (!queue->compare)
+	if (!queue->compare) {
+		queue->array[queue->nr - 1] = entry;
 		return; /* LIFO */
+	}
 
 	/* Bubble up the new one */
-	for (ix = queue->nr - 1; ix; ix = parent) {
-		parent = (ix - 1) / 2;
-		if (compare(queue, parent, ix) <= 0)
-			break;
-
-		swap(queue, parent, ix);
-	}
+	sift_up(queue, queue->nr - 1, &entry);
 }
 
 void *prio_queue_get(struct prio_queue *queue)
 {
+	struct prio_queue_entry last;
 	void *result;
-	size_t ix, child;
 
 	if (!queue->nr)
 		return NULL;
@@ -72,20 +134,9 @@ void *prio_queue_get(struct prio_queue *queue)
 	if (!--queue->nr)
 		return result;
 
-	queue->array[0] = queue->array[queue->nr];
-
-	/* Push down the one at the root */
-	for (ix = 0; ix * 2 + 1 < queue->nr; ix = child) {
-		child = ix * 2 + 1; /* left */
-		if (child + 1 < queue->nr &&
-		    compare(queue, child, child + 1) >= 0)
-			child++; /* use right child */
-
-		if (compare(queue, ix, child) <= 0)
-			break;
-
-		swap(queue, child, ix);
-	}
+	/* Push down the last one from the root */
+	last = queue->array[queue->nr];
+	sift_down(queue, &last);
 	return result;
 }
 
@@ -97,3 +148,22 @@ void *prio_queue_peek(struct prio_queue *queue)
 		return queue->array[queue->nr - 1].data;
 	return queue->array[0].data;
 }
+
+void prio_queue_replace(struct prio_queue *queue, void *thing)
+{
+	struct prio_queue_entry entry;
+
+	if (!queue->nr) {
+		prio_queue_put(queue, thing);
+		return;
+	}
+
+	init_entry(queue, &entry, thing);
+	if (!queue->compare) {
+		queue->array[queue->nr - 1] = entry;
+		return; /* LIFO */
+	}
+
+	/* Push down the new one from the root */
+	sift_down(queue, &entry);
+}
@@ -21,9 +21,22 @@
  */
 typedef int (*prio_queue_compare_fn)(const void *one, const void *two, void *cb_data);
 
+/*
+ * Describe a "thing" by two numbers when it is added to the queue, so
+ * that the queue can order things without calling back into "compare".
+ * Things with a larger first number are taken out first, then those
+ * with a larger second number.  The third parameter is cb_data in the
+ * prio_queue structure.
+ *
+ * The numbers must order things exactly like "compare" does, and must
+ * not change while the thing is in the queue.
+ */
+typedef void (*prio_queue_key_fn)(const void *thing, uint64_t key[2], void *cb_data);
+
 struct prio_queue_entry {
 	size_t ctr;
 	void *data;
+	uint64_t key[2];
 };
 
 struct prio_queue {
@@ -32,6 +45,7 @@ struct prio_queue {
 	void *cb_data;
 	size_t alloc, nr;
 	struct prio_queue_entry *array;
+	prio_queue_key_fn get_key;
 };
 
 /*
@@ -52,6 +66,14 @@ void *prio_queue_get(struct prio_queue *);
  */
 void *prio_queue_peek(struct prio_queue *);
 
+/*
+ * Replace the "thing" that compares the smallest with another one; this
+ * is the same as prio_queue_get() followed by prio_queue_put(), but
+ * cheaper.  Walks that take out a commit and add its parents can add
+ * the first parent this way.
+ */
+void prio_queue_replace(struct prio_queue *, void *thing);
+
 void clear_prio_queue(struct prio_queue *);
 
 /* Reverse the LIFO elements */
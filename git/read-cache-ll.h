@@ -139,6 +139,8 @@ struct split_index;
 struct untracked_cache;
 struct progress;
 struct pattern_list;
+struct index_journal;
+struct partial_name_hash;
 
 enum sparse_index_mode {
 	/*
@@ -170,6 +172,7 @@ struct index_state {
 	struct string_list *resolve_undo;
 	struct cache_tree *cache_tree;
 	struct split_index *split_index;
+	struct index_journal *journal;
 	struct cache_time timestamp;
 	unsigned name_hash_initialized : 1,
 		 initialized : 1,
@@ -180,6 +183,7 @@ struct index_state {
 	enum sparse_index_mode sparse_index;
 	struct hashmap name_hash;
 	struct hashmap dir_hash;
+	struct partial_name_hash *name_hash_partial;
 	struct object_id oid;
 	struct untracked_cache *untracked;
 	char *fsmonitor_last_update;
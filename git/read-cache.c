@@ -8,6 +8,7 @@
 #define DISABLE_SIGN_COMPARE_WARNINGS
 
 #include "git-compat-util.h"
+#include "abspath.h"
 #include "bulk-checkin.h"
 #include "config.h"
 #include "date.h"
@@ -48,6 +49,9 @@
 #include "csum-file.h"
 #include "promisor-remote.h"
 #include "hook.h"
+#include "ewah/ewok.h"
+#include "write-or-die.h"
+#include "version.h"
 
 /* Mask for the name length in ce_flags in the on-disk index */
 
@@ -71,6 +75,7 @@
 #define CACHE_EXT_ENDOFINDEXENTRIES 0x454F4945	/* "EOIE" */
 #define CACHE_EXT_INDEXENTRYOFFSETTABLE 0x49454F54 /* "IEOT" */
 #define CACHE_EXT_SPARSE_DIRECTORIES 0x73646972 /* "sdir" */
+#define CACHE_EXT_JOURNAL 0x6a726e6c	  /* "jrnl" */
 
 /* changes that can be kept in $GIT_DIR/index (basically all extensions) */
 #define EXTMASK (RESOLVE_UNDO_CHANGED | CACHE_TREE_CHANGED | \
@@ -88,6 +93,101 @@
  */
 #define CACHE_ENTRY_PATH_LENGTH 80
 
+/*
+ * An index written with the "jrnl" extension can be followed by a
+ * journal, "<index>.journal", to which small updates are appended
+ * instead of writing the whole index again.  The journal starts with
+ * the random id from the extension of the index it applies to, so that
+ * a journal left behind by an older index is ignored.  Each record
+ * lists the positions of the entries it removes, the entries it adds
+ * in the v2/v3 on-disk format, and ends with a hash of the record, so
+ * that a reader can tell a record that is still being written.
+ */
+#define INDEX_JOURNAL_SIGNATURE 0x4a524e4c /* "JRNL" */
+#define INDEX_JOURNAL_VERSION 1
+#define INDEX_JOURNAL_ID_SZ 16
+#define INDEX_JOURNAL_HEADER_SZ (8 + INDEX_JOURNAL_ID_SZ)
+#define INDEX_JOURNAL_RECORD_HEADER_SZ 12
+
+/*
+ * The journal is written as a whole new index once it is 1/8 of the
+ * size of the index, unless it is still smaller than this; it never
+ * grows larger than the index itself.
+ */
+#define INDEX_JOURNAL_MIN_LIMIT (64 * 1024)
+
+struct index_journal {
+	unsigned char id[INDEX_JOURNAL_ID_SZ];
+	char *index_path;
+	char *path;
+
+	/* the files as they were read, to notice when they were written since */
+	struct stat_data index_sd;
+	struct stat_data journal_sd;
+	unsigned journal_exists : 1;
+	off_t index_size;
+
+	/* the end of the last record replayed, or -1 for no usable journal */
+	off_t size;
+	unsigned int nr_records;
+
+	/*
+	 * The entries as the files on disk have them, in order.  Entries
+	 * still in the index point back here with "index", just like the
+	 * entries of a split index do into its shared index.
+	 */
+	struct cache_entry **base;
+	unsigned int base_nr;
+};
+
+/*
+ * With index.mappedEntries, writing the index also writes its entries
+ * to "<index>.entries" exactly as create_from_disk() would return them,
+ * so that reading the index can map that file instead of creating the
+ * entries one by one.  The file is only meant for this build of Git on
+ * this machine, so it is in host byte order and records the build that
+ * wrote it, the layout of "struct cache_entry" and the values of the
+ * flags it keeps, and it records the stat data and checksum of the
+ * index it was written with, so that it is ignored once the index is
+ * written without it.
+ *
+ * The header is followed by the offsets of the entries in units of
+ * INDEX_IMAGE_ALIGN, counted from the start of the file, and then the
+ * entries themselves.
+ */
+#define INDEX_IMAGE_SIGNATURE 0x47494d45 /* "GIME" */
+#define INDEX_IMAGE_VERSION 2
+#define INDEX_IMAGE_ALIGN sizeof(uintmax_t)
+
+/* the flags of the entries as they are read from the index */
+#define INDEX_IMAGE_CE_FLAGS (CE_STAGEMASK | CE_VALID | \
+			      CE_EXTENDED | CE_EXTENDED_FLAGS)
+
+struct index_image_header {
+	uint32_t signature;
+	uint32_t version;
+	unsigned char build_id[GIT_MAX_RAWSZ];
+	uint32_t entry_size;
+	uint32_t name_offset;
+	uint32_t hash_algo;
+	uint32_t ce_stagemask;
+	uint32_t ce_valid;
+	uint32_t ce_extended;
+	uint32_t ce_intent_to_add;
+	uint32_t ce_skip_worktree;
+	uint32_t cache_nr;
+
+	/* the index file, as it was written */
+	uint64_t index_size;
+	uint64_t index_ino;
+	uint64_t index_mtime_sec;
+	uint64_t index_mtime_nsec;
+	unsigned char index_hash[GIT_MAX_RAWSZ];
+
+	/* where the extensions of the index start */
+	uint64_t extension_offset;
+};
+
 enum index_search_mode {
 	NO_EXPAND_SPARSE = 0,
 	EXPAND_SPARSE = 1
@@ -1787,6 +1887,12 @@ static int read_index_extension(struct index_state *istate,
 		/* no content, only an indicator */
 		istate->sparse_index = INDEX_COLLAPSED;
 		break;
+	case CACHE_EXT_JOURNAL:
+		if (sz != INDEX_JOURNAL_ID_SZ)
+			return error(_("corrupt index journal extension"));
+		CALLOC_ARRAY(istate->journal, 1);
+		memcpy(istate->journal->id, data, sz);
+		break;
 	default:
 		if (*ext < 'A' || 'Z' < *ext)
 			return error(_("index uses %.4s extension, which we do not understand"),
@@ -2225,6 +2331,387 @@ static void set_new_index_sparsity(struct index_state *istate)
 }
 
 /* remember to discard_cache() before reading a different cache! */
+static void free_index_journal(struct index_state *istate)
+{
+	struct index_journal *j = istate->journal;
+
+	if (!j)
+		return;
+	free(j->index_path);
+	free(j->path);
+	free(j->base);
+	FREE_AND_NULL(istate->journal);
+}
+
+/*
+ * Remember the entries of the index as the files on disk have them.
+ */
+static void reset_index_journal_base(struct index_state *istate)
+{
+	struct index_journal *j = istate->journal;
+
+	REALLOC_ARRAY(j->base, istate->cache_nr);
+	j->base_nr = 0;
+	for (unsigned int i = 0; i < istate->cache_nr; i++) {
+		struct cache_entry *ce = istate->cache[i];
+
+		ce->ce_flags &= ~CE_UPDATE_IN_BASE;
+		if (ce->ce_flags & CE_REMOVE) {
+			ce->index = 0;
+			continue;
+		}
+		j->base[j->base_nr++] = ce;
+		ce->index = j->base_nr;
+	}
+}
+
+/*
+ * Have the index and its journal been left alone since we read them?
+ */
+static int index_journal_unchanged(const struct index_journal *j)
+{
+	struct stat st;
+
+	if (lstat(j->index_path, &st) || match_stat_data(&j->index_sd, &st))
+		return 0;
+	if (lstat(j->path, &st))
+		return errno == ENOENT && !j->journal_exists;
+	return j->journal_exists && !match_stat_data(&j->journal_sd, &st);
+}
+
+/*
+ * Forget what is cached about "ce" as add_index_entry() and
+ * remove_index_entry_at() would: the cache tree does not know about its
+ * new contents, and the untracked cache that it is (no longer) tracked.
+ */
+static void invalidate_journal_path(struct index_state *istate,
+				    const struct cache_entry *ce)
+{
+	cache_tree_invalidate_path(istate, ce->name);
+	untracked_cache_invalidate_path(istate, ce->name, 1);
+}
+
+/*
+ * Remove the entries at "positions" from the index and merge in the
+ * entries of the record, which are sorted like the index is.
+ */
+static void apply_index_journal_record(struct index_state *istate,
+				       const char *positions, uint32_t nr_removed,
+				       const char *entries, size_t entries_size,
+				       uint32_t nr_added)
+{
+	const char *path = istate->journal->path;
+	struct cache_entry **cache, *prev = NULL;
+	unsigned int nr = 0, i = 0, alloc;
+	uint32_t removed = 0;
+	size_t off = 0;
+
+	if (nr_removed > istate->cache_nr)
+		die(_("index journal '%s' is corrupt"), path);
+	alloc = alloc_nr(istate->cache_nr - nr_removed + nr_added);
+	ALLOC_ARRAY(cache, alloc);
+
+	for (uint32_t added = 0; added <= nr_added; added++) {
+		struct cache_entry *ce = NULL, *replaced = NULL;
+
+		if (added < nr_added) {
+			unsigned long consumed;
+
+			if (entries_size - off < offsetof(struct ondisk_cache_entry, data) +
+						 the_hash_algo->rawsz + sizeof(uint16_t))
+				die(_("index journal '%s' is corrupt"), path);
+			ce = create_from_disk(istate->ce_mem_pool, 2,
+					      entries + off, &consumed, NULL);
+			off += consumed;
+			if (off > entries_size ||
+			    (prev && cmp_cache_name_compare(&prev, &ce) >= 0))
+				die(_("index journal '%s' is corrupt"), path);
+			prev = ce;
+		}
+
+		/* keep the entries that sort before it */
+		while (i < istate->cache_nr) {
+			struct cache_entry *old = istate->cache[i];
+			int cmp = ce ? cmp_cache_name_compare(&old, &ce) : -1;
+
+			if (cmp > 0)
+				break;
+			if (removed < nr_removed &&
+			    get_be32(positions + removed * sizeof(uint32_t)) == i) {
+				if (!cmp)
+					replaced = old;
+				else
+					invalidate_journal_path(istate, old);
+				removed++;
+				i++;
+				continue;
+			}
+			if (!cmp)
+				die(_("index journal '%s' is corrupt"), path);
+			cache[nr++] = old;
+			i++;
+		}
+		if (!ce)
+			continue;
+
+		/* only the stat data of most entries is refreshed */
+		if (!replaced)
+			invalidate_journal_path(istate, ce);
+		else if (replaced->ce_mode != ce->ce_mode ||
+			 !oideq(&replaced->oid, &ce->oid) ||
+			 (replaced->ce_flags ^ ce->ce_flags) & CE_INTENT_TO_ADD)
+			cache_tree_invalidate_path(istate, ce->name);
+		if (replaced)
+			discard_cache_entry(replaced);
+		cache[nr++] = ce;
+	}
+	if (removed != nr_removed || off != entries_size)
+		die(_("index journal '%s' is corrupt"), path);
+
+	free(istate->cache);
+	istate->cache = cache;
+	istate->cache_nr = nr;
+	istate->cache_alloc = alloc;
+}
+
+/*
+ * Replay the records of the journal of the index that was just read
+ * from "path", and remember what is on disk so that later changes can
+ * be appended to the journal.
+ *
+ * Returns -1 if the index was replaced while we read it, in which case
+ * the journal we found may belong to the new one, or have been removed
+ * with the old one; the caller has to read the index again.
+ */
+static int read_index_journal(struct index_state *istate, const char *path,
+			      struct stat *index_st)
+{
+	struct index_journal *j = istate->journal;
+	const unsigned hashsz = the_hash_algo->rawsz;
+	unsigned int cache_changed = istate->cache_changed;
+	char *buf = NULL;
+	size_t len = 0, off;
+	struct stat st;
+	int fd;
+
+	j->index_path = absolute_pathdup(path);
+	j->path = xstrfmt("%s.journal", j->index_path);
+	fill_stat_data(&j->index_sd, index_st);
+	j->index_size = index_st->st_size;
+	j->size = -1;
+
+	fd = open(j->path, O_RDONLY);
+	if (fd < 0) {
+		if (errno != ENOENT)
+			die_errno(_("could not open '%s'"), j->path);
+		goto track;
+	}
+	if (fstat(fd, &st))
+		die_errno(_("could not stat '%s'"), j->path);
+	fill_stat_data(&j->journal_sd, &st);
+	j->journal_exists = 1;
+
+	len = xsize_t(st.st_size);
+	buf = xmallocz(len);
+	if (read_in_full(fd, buf, len) != len)
+		die_errno(_("could not read '%s'"), j->path);
+	close(fd);
+
+	/* a journal left behind by an older index has a different id */
+	if (len < INDEX_JOURNAL_HEADER_SZ ||
+	    get_be32(buf) != INDEX_JOURNAL_SIGNATURE ||
+	    get_be32(buf + 4) != INDEX_JOURNAL_VERSION ||
+	    memcmp(buf + 8, j->id, INDEX_JOURNAL_ID_SZ))
+		goto track;
+
+	for (off = j->size = INDEX_JOURNAL_HEADER_SZ;
+	     len - off >= INDEX_JOURNAL_RECORD_HEADER_SZ;
+	     j->size = off) {
+		const char *rec = buf + off;
+		uint32_t nr_removed = get_be32(rec);
+		uint32_t nr_added = get_be32(rec + 4);
+		uint32_t entries_size = get_be32(rec + 8);
+		size_t rec_len = INDEX_JOURNAL_RECORD_HEADER_SZ;
+		unsigned char hash[GIT_MAX_RAWSZ];
+		struct git_hash_ctx c;
+
+		/* a torn record at the end is one that is still being written */
+		if ((len - off - rec_len) / sizeof(uint32_t) < nr_removed)
+			break;
+		rec_len += nr_removed * sizeof(uint32_t);
+		if (len - off - rec_len < (size_t)entries_size + hashsz)
+			break;
+		rec_len += entries_size;
+
+		the_hash_algo->init_fn(&c);
+		git_hash_update(&c, rec, rec_len);
+		git_hash_final(hash, &c);
+		if (!hasheq(hash, (const unsigned char *)rec + rec_len,
+			    the_repository->hash_algo))
+			break;
+
+		apply_index_journal_record(istate,
+					   rec + INDEX_JOURNAL_RECORD_HEADER_SZ,
+					   nr_removed,
+					   rec + rec_len - entries_size,
+					   entries_size, nr_added);
+		j->nr_records++;
+		off += rec_len + hashsz;
+	}
+
+	if (j->nr_records) {
+		istate->timestamp.sec = st.st_mtime;
+		istate->timestamp.nsec = ST_MTIME_NSEC(st);
+
+		/*
+		 * Changes are not appended while fsmonitor is in use, but
+		 * if it was, its bitmap no longer matches the positions of
+		 * the entries; start over as if it was just enabled.
+		 */
+		if (istate->fsmonitor_last_update) {
+			FREE_AND_NULL(istate->fsmonitor_last_update);
+			ewah_free(istate->fsmonitor_dirty);
+			istate->fsmonitor_dirty = NULL;
+		}
+	}
+
+	/* what was replayed is already on disk */
+	istate->cache_changed = cache_changed;
+
+	trace2_data_intmax("index", the_repository, "read/journal_records",
+			   j->nr_records);
+
+track:
+	free(buf);
+	if (lstat(j->index_path, &st) || match_stat_data(&j->index_sd, &st))
+		return -1;
+	reset_index_journal_base(istate);
+	return 0;
+}
+
+/*
+ * Fill in what tells an image written by this build from one written
+ * by another.
+ */
+static void index_image_build_header(struct index_image_header *hdr)
+{
+	struct git_hash_ctx c;
+
+	hdr->signature = INDEX_IMAGE_SIGNATURE;
+	hdr->version = INDEX_IMAGE_VERSION;
+
+	the_hash_algo->init_fn(&c);
+	git_hash_update(&c, git_version_string, strlen(git_version_string) + 1);
+	git_hash_update(&c, git_built_from_commit_string,
+			strlen(git_built_from_commit_string) + 1);
+	git_hash_final(hdr->build_id, &c);
+
+	hdr->entry_size = sizeof(struct cache_entry);
+	hdr->name_offset = offsetof(struct cache_entry, name);
+	hdr->hash_algo = hash_algo_by_ptr(the_hash_algo);
+	hdr->ce_stagemask = CE_STAGEMASK;
+	hdr->ce_valid = CE_VALID;
+	hdr->ce_extended = CE_EXTENDED;
+	hdr->ce_intent_to_add = CE_INTENT_TO_ADD;
+	hdr->ce_skip_worktree = CE_SKIP_WORKTREE;
+}
+
+/*
+ * Map the entries of the index that was just read from "path" from
+ * "<path>.entries" if it was written along with it.  Returns 1 and
+ * where the extensions start in "extension_offset" if it was.
+ */
+static int read_index_image(struct index_state *istate, const char *path,
+			    const struct stat *st,
+			    const char *mmap, size_t mmap_size,
+			    unsigned long *extension_offset)
+{
+	const unsigned hashsz = the_hash_algo->rawsz;
+	struct index_image_header hdr, build = { 0 };
+	const uint32_t *offsets;
+	struct stat image_st;
+	size_t len, entries_start;
+	char *image_path, *map;
+	int fd;
+
+	prepare_repo_settings(istate->repo);
+	if (!istate->repo->settings.index_mapped_entries)
+		return 0;
+
+	image_path = xstrfmt("%s.entries", path);
+	fd = open(image_path, O_RDONLY);
+	free(image_path);
+	if (fd < 0)
+		return 0;
+	if (fstat(fd, &image_st) ||
+	    read_in_full(fd, &hdr, sizeof(hdr)) != sizeof(hdr))
+		goto ignore;
+
+	/* an image written by another build, or with another index */
+	index_image_build_header(&build);
+	if (hdr.signature != build.signature ||
+	    hdr.version != build.version ||
+	    memcmp(hdr.build_id, build.build_id, hashsz) ||
+	    hdr.entry_size != build.entry_size ||
+	    hdr.name_offset != build.name_offset ||
+	    hdr.hash_algo != build.hash_algo ||
+	    hdr.ce_stagemask != build.ce_stagemask ||
+	    hdr.ce_valid != build.ce_valid ||
+	    hdr.ce_extended != build.ce_extended ||
+	    hdr.ce_intent_to_add != build.ce_intent_to_add ||
+	    hdr.ce_skip_worktree != build.ce_skip_worktree ||
+	    hdr.cache_nr != istate->cache_nr ||
+	    hdr.index_size != (uint64_t)st->st_size ||
+	    hdr.index_ino != (uint64_t)st->st_ino ||
+	    hdr.index_mtime_sec != (uint64_t)st->st_mtime ||
+	    hdr.index_mtime_nsec != (uint64_t)ST_MTIME_NSEC(*st) ||
+	    memcmp(hdr.index_hash, mmap + mmap_size - hashsz, hashsz) ||
+	    hdr.extension_offset < sizeof(struct cache_header) ||
+	    hdr.extension_offset > mmap_size - hashsz)
+		goto ignore;
+
+	len = xsize_t(image_st.st_size);
+	entries_start = st_add(sizeof(hdr), st_mult(hdr.cache_nr, sizeof(uint32_t)));
+	entries_start = DIV_ROUND_UP(entries_start, INDEX_IMAGE_ALIGN) * INDEX_IMAGE_ALIGN;
+	if (len < entries_start)
+		goto ignore;
+
+	/* entries that are modified get a private copy of their page */
+	map = xmmap_gently(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED)
+		goto ignore;
+	close(fd);
+
+	offsets = (const uint32_t *)(map + sizeof(hdr));
+	for (unsigned int i = 0; i < hdr.cache_nr; i++) {
+		size_t off = (size_t)offsets[i] * INDEX_IMAGE_ALIGN;
+		struct cache_entry *ce = (struct cache_entry *)(map + off);
+
+		if (off < entries_start || off > len ||
+		    len - off < sizeof(struct cache_entry) ||
+		    cache_entry_size(ce->ce_namelen) > len - off ||
+		    ce->name[ce->ce_namelen] ||
+		    ce->ce_flags & ~INDEX_IMAGE_CE_FLAGS) {
+			munmap(map, len);
+			return 0;
+		}
+		istate->cache[i] = ce;
+	}
+
+	istate->ce_mem_pool = xmalloc(sizeof(*istate->ce_mem_pool));
+	mem_pool_init(istate->ce_mem_pool, 0);
+	mem_pool_add_mapping(istate->ce_mem_pool, map, len);
+
+	*extension_offset = hdr.extension_offset;
+	trace2_data_intmax("index", the_repository, "read/mapped_entries",
+			   hdr.cache_nr);
+	return 1;
+
+ignore:
+	close(fd);
+	return 0;
+}
+
 int do_read_index(struct index_state *istate, const char *path, int must_exist)
 {
 	int fd;
@@ -2235,7 +2722,7 @@ int do_read_index(struct index_state *istate, const char *path, int must_exist)
 	size_t mmap_size;
 	struct load_index_extensions p;
 	size_t extension_offset = 0;
-	int nr_threads, cpus;
+	int nr_threads, cpus, mapped;
 	struct index_entry_offset_table *ieot = NULL;
 
 	if (istate->initialized)
@@ -2298,6 +2785,11 @@ int do_read_index(struct index_state *istate, const char *path, int must_exist)
 	if (!HAVE_THREADS)
 		nr_threads = 1;
 
+	/* mapped entries leave nothing to do for threads */
+	mapped = read_index_image(istate, path, &st, mmap, mmap_size, &src_offset);
+	if (mapped)
+		nr_threads = 1;
+
 	if (nr_threads > 1) {
 		extension_offset = read_eoie_extension(mmap, mmap_size);
 		if (extension_offset) {
@@ -2322,7 +2814,7 @@ int do_read_index(struct index_state *istate, const char *path, int must_exist)
 	if (ieot) {
 		src_offset += load_cache_entries_threaded(istate, mmap, mmap_size, nr_threads, ieot);
 		free(ieot);
-	} else {
+	} else if (!mapped) {
 		src_offset += load_all_cache_entries(istate, mmap, mmap_size, src_offset);
 	}
 
@@ -2340,6 +2832,17 @@ int do_read_index(struct index_state *istate, const char *path, int must_exist)
 	}
 	munmap((void *)mmap, mmap_size);
 
+	if (istate->journal) {
+		if (istate->split_index) {
+			free_index_journal(istate);
+		} else if (read_index_journal(istate, path, &st) < 0) {
+			trace2_data_string("index", the_repository,
+					   "read/journal", "retry");
+			discard_index(istate);
+			return do_read_index(istate, path, must_exist);
+		}
+	}
+
 	/*
 	 * TODO trace2: replace "the_repository" with the actual repo instance
 	 * that is associated with the given "istate".
@@ -2478,6 +2981,7 @@ void release_index(struct index_state *istate)
 	free(istate->fsmonitor_last_update);
 	free(istate->cache);
 	discard_split_index(istate);
+	free_index_journal(istate);
 	free_untracked_cache(istate->untracked);
 
 	if (istate->sparse_checkout_patterns) {
@@ -2673,7 +3177,7 @@ static void copy_cache_entry_to_ondisk(struct ondisk_cache_entry *ondisk,
 	}
 }
 
-static int ce_write_entry(struct hashfile *f, struct cache_entry *ce,
+static int ce_write_entry(struct strbuf *out, struct cache_entry *ce,
 			  struct strbuf *previous_name, struct ondisk_cache_entry *ondisk)
 {
 	int size;
@@ -2692,9 +3196,9 @@ static int ce_write_entry(struct hashfile *f, struct cache_entry *ce,
 	if (!previous_name) {
 		int len = ce_namelen(ce);
 		copy_cache_entry_to_ondisk(ondisk, ce);
-		hashwrite(f, ondisk, size);
-		hashwrite(f, ce->name, len);
-		hashwrite(f, padding, align_padding_size(size, len));
+		strbuf_add(out, ondisk, size);
+		strbuf_add(out, ce->name, len);
+		strbuf_add(out, padding, align_padding_size(size, len));
 	} else {
 		int common, to_remove, prefix_size;
 		unsigned char to_remove_vi[16];
@@ -2708,10 +3212,10 @@ static int ce_write_entry(struct hashfile *f, struct cache_entry *ce,
 		prefix_size = encode_varint(to_remove, to_remove_vi);
 
 		copy_cache_entry_to_ondisk(ondisk, ce);
-		hashwrite(f, ondisk, size);
-		hashwrite(f, to_remove_vi, prefix_size);
-		hashwrite(f, ce->name + common, ce_namelen(ce) - common);
-		hashwrite(f, padding, 1);
+		strbuf_add(out, ondisk, size);
+		strbuf_add(out, to_remove_vi, prefix_size);
+		strbuf_add(out, ce->name + common, ce_namelen(ce) - common);
+		strbuf_add(out, padding, 1);
 
 		strbuf_splice(previous_name, common, to_remove,
 			      ce->name + common, ce_namelen(ce) - common);
@@ -2724,6 +3228,134 @@ static int ce_write_entry(struct hashfile *f, struct cache_entry *ce,
 	return 0;
 }
 
+struct write_cache_entries_thread_data
+{
+	pthread_t pthread;
+	struct cache_entry **cache;
+	int nr;			/* cache entries in the block, removed ones included */
+	int v4;
+	struct strbuf previous_name;
+	struct strbuf out;	/* the block as it goes to the index file */
+	int written;		/* # of entries in "out" */
+};
+
+/*
+ * A thread proc to turn a block of cache entries into their on-disk
+ * form, so that the main thread only has to hash and write it.
+ */
+static void *write_cache_entries_thread(void *_data)
+{
+	struct write_cache_entries_thread_data *p = _data;
+	struct ondisk_cache_entry ondisk;
+	int i;
+
+	for (i = 0; i < p->nr; i++) {
+		struct cache_entry *ce = p->cache[i];
+
+		if (ce->ce_flags & CE_REMOVE)
+			continue;
+		ce_write_entry(&p->out, ce, p->v4 ? &p->previous_name : NULL,
+			       &ondisk);
+		p->written++;
+	}
+	return NULL;
+}
+
+/*
+ * Write the entries of the index with one thread per block, producing
+ * the same bytes as writing them one by one.  With an offset table,
+ * the blocks are those recorded in it, and a v4 name is not compressed
+ * against the last one of the previous block; otherwise the index is
+ * cut into "nr_threads" blocks.
+ *
+ * The entries must already have been checked and smudged.
+ */
+static void write_cache_entries_threaded(struct index_state *istate,
+					 struct hashfile *f, int v4,
+					 int nr_threads,
+					 struct index_entry_offset_table *ieot,
+					 int ieot_entries)
+{
+	struct cache_entry **cache = istate->cache;
+	int entries = istate->cache_nr;
+	struct write_cache_entries_thread_data *data;
+	const struct cache_entry *last_written = NULL;
+	int i, nr_blocks = 0, block_entries, err;
+
+	block_entries = ieot ? ieot_entries : DIV_ROUND_UP(entries, nr_threads);
+	CALLOC_ARRAY(data, DIV_ROUND_UP(entries, block_entries));
+
+	/*
+	 * Cut the blocks where the serial loop in do_write_index() would:
+	 * before an entry at a multiple of "block_entries", unless it is
+	 * removed.
+	 */
+	for (i = 0; i < entries; i++) {
+		struct write_cache_entries_thread_data *p;
+		int removed = cache[i]->ce_flags & CE_REMOVE;
+
+		if (i && (removed || i % block_entries))
+			goto next;
+
+		p = &data[nr_blocks++];
+		p->cache = cache + i;
+		p->v4 = v4;
+		strbuf_init(&p->previous_name, 0);
+		strbuf_init(&p->out, 0);
+		if (i)
+			p[-1].nr = i - (p[-1].cache - cache);
+
+		/*
+		 * The first name of the block is compressed against the
+		 * last one written before it.  Look at that one now, as
+		 * writing it clears CE_STRIP_NAME.
+		 */
+		if (v4 && last_written) {
+			size_t len = (last_written->ce_flags & CE_STRIP_NAME) ?
+				0 : ce_namelen(last_written);
+
+			if (ieot)
+				/* nothing in common, as in do_write_index() */
+				strbuf_addchars(&p->previous_name, 0, len);
+			else
+				strbuf_add(&p->previous_name,
+					   last_written->name, len);
+		}
+	next:
+		if (!removed)
+			last_written = cache[i];
+	}
+	data[nr_blocks - 1].nr = entries - (data[nr_blocks - 1].cache - cache);
+
+	for (i = 0; i < nr_blocks; i++) {
+		err = pthread_create(&data[i].pthread, NULL,
+				     write_cache_entries_thread, &data[i]);
+		if (err)
+			die(_("unable to create write_cache_entries thread: %s"),
+			    strerror(err));
+	}
+
+	for (i = 0; i < nr_blocks; i++) {
+		struct write_cache_entries_thread_data *p = &data[i];
+
+		err = pthread_join(p->pthread, NULL);
+		if (err)
+			die(_("unable to join write_cache_entries thread: %s"),
+			    strerror(err));
+
+		if (ieot && (p->written || i < nr_blocks - 1)) {
+			ieot->entries[ieot->nr].nr = p->written;
+			ieot->entries[ieot->nr].offset = hashfile_total(f);
+			ieot->nr++;
+		}
+		hashwrite(f, p->out.buf, p->out.len);
+		strbuf_release(&p->out);
+		strbuf_release(&p->previous_name);
+	}
+
+	free(data);
+}
+
 /*
  * This function verifies if index_state has the correct sha1 of the
  * index file.  Don't die if we have any other failure, just return 0.
@@ -2755,6 +3387,9 @@ static int verify_index_from(const struct index_state *istate, const char *path)
 	if (!hasheq(istate->oid.hash, hash, the_repository->hash_algo))
 		goto out;
 
+	if (istate->journal && !index_journal_unchanged(istate->journal))
+		goto out;
+
 	close(fd);
 	return 1;
 
@@ -2792,6 +3427,43 @@ void repo_update_index_if_able(struct repository *repo,
 		rollback_lock_file(lockfile);
 }
 
+int repo_compact_index_journal(struct repository *repo)
+{
+	char *path = xstrfmt("%s.journal", repo_get_index_file(repo));
+	int ret = 0;
+
+	/* a full write of the index removes the journal along the way */
+	if (file_exists(path)) {
+		struct lock_file lock = LOCK_INIT;
+		struct index_journal *j;
+
+		/* whoever holds the lock is about to write the index anyway */
+		if (repo_hold_locked_index(repo, &lock, 0) < 0)
+			goto out;
+
+		if (repo->index)
+			discard_index(repo->index);
+		if (repo_read_index(repo) < 0) {
+			rollback_lock_file(&lock);
+			ret = error(_("index file corrupt"));
+			goto out;
+		}
+
+		j = repo->index->journal;
+		if (j && j->nr_records) {
+			repo->index->cache_changed |= SOMETHING_CHANGED;
+			ret = write_locked_index(repo->index, &lock, COMMIT_LOCK);
+		} else {
+			unlink_or_warn(path);
+			rollback_lock_file(&lock);
+		}
+	}
+
+out:
+	free(path);
+	return ret;
+}
+
 static int record_eoie(void)
 {
 	int val;
@@ -2829,6 +3501,7 @@ enum write_extensions {
 	WRITE_RESOLVE_UNDO_EXTENSION =    1<<2,
 	WRITE_UNTRACKED_CACHE_EXTENSION = 1<<3,
 	WRITE_FSMONITOR_EXTENSION =       1<<4,
+	WRITE_JOURNAL_EXTENSION =         1<<5,
 };
 #define WRITE_ALL_EXTENSIONS ((enum write_extensions)-1)
 
@@ -2839,6 +3512,117 @@ enum write_extensions {
  * detail of lockfiles, callers of `do_write_index()` should not
  * rely on it.
  */
+/*
+ * Is "tempfile" the lock of the index file of "r", as opposed to a
+ * temporary index of some command?
+ */
+static int is_repo_index_lock(struct repository *r, struct tempfile *tempfile)
+{
+	const char *lock_path = get_tempfile_path(tempfile);
+	char *target, *index_file;
+	size_t len;
+	int ret;
+
+	if (!r || !r->index_file || !strip_suffix(lock_path, LOCK_SUFFIX, &len))
+		return 0;
+	target = xmemdupz(lock_path, len);
+	index_file = absolute_pathdup(r->index_file);
+	ret = !fspathcmp(absolute_path(target), index_file);
+	free(index_file);
+	free(target);
+	return ret;
+}
+
+/*
+ * Write the entries of the index just written to "<index>.entries" for
+ * read_index_image(), to be committed before the index itself.  This is
+ * only a cache, so failing to write it is not an error.
+ */
+static void write_index_image(struct index_state *istate,
+			      struct tempfile *tempfile, const struct stat *st,
+			      size_t extension_offset)
+{
+	const char *lock_path = get_tempfile_path(tempfile);
+	struct lock_file lock = LOCK_INIT;
+	struct index_image_header hdr = { 0 };
+	struct strbuf sb = STRBUF_INIT;
+	size_t off, len;
+	char *path;
+	int fd;
+
+	if (!strip_suffix(lock_path, LOCK_SUFFIX, &len))
+		return;
+	path = xstrfmt("%.*s.entries", (int)len, lock_path);
+	fd = hold_lock_file_for_update(&lock, path, 0);
+	free(path);
+	if (fd < 0)
+		return;
+
+	index_image_build_header(&hdr);
+	for (unsigned int i = 0; i < istate->cache_nr; i++)
+		if (!(istate->cache[i]->ce_flags & CE_REMOVE))
+			hdr.cache_nr++;
+	hdr.index_size = st->st_size;
+	hdr.index_ino = st->st_ino;
+	hdr.index_mtime_sec = st->st_mtime;
+	hdr.index_mtime_nsec = ST_MTIME_NSEC(*st);
+	memcpy(hdr.index_hash, istate->oid.hash, the_hash_algo->rawsz);
+	hdr.extension_offset = extension_offset;
+	strbuf_add(&sb, &hdr, sizeof(hdr));
+
+	off = st_add(sizeof(hdr), st_mult(hdr.cache_nr, sizeof(uint32_t)));
+	off = DIV_ROUND_UP(off, INDEX_IMAGE_ALIGN) * INDEX_IMAGE_ALIGN;
+	for (unsigned int i = 0; i < istate->cache_nr; i++) {
+		struct cache_entry *ce = istate->cache[i];
+		uint32_t pos;
+
+		if (ce->ce_flags & CE_REMOVE)
+			continue;
+		if (off / INDEX_IMAGE_ALIGN > UINT32_MAX)
+			goto rollback;
+		pos = off / INDEX_IMAGE_ALIGN;
+		strbuf_add(&sb, &pos, sizeof(pos));
+		off += DIV_ROUND_UP(cache_entry_size(ce->ce_namelen),
+				    INDEX_IMAGE_ALIGN) * INDEX_IMAGE_ALIGN;
+	}
+	strbuf_addchars(&sb, 0, DIV_ROUND_UP(sb.len, INDEX_IMAGE_ALIGN) *
+				INDEX_IMAGE_ALIGN - sb.len);
+
+	/* what create_from_disk() makes of the entries just written */
+	for (unsigned int i = 0; i < istate->cache_nr; i++) {
+		struct cache_entry *ce = istate->cache[i], *copy;
+		size_t size = DIV_ROUND_UP(cache_entry_size(ce->ce_namelen),
+					   INDEX_IMAGE_ALIGN) * INDEX_IMAGE_ALIGN;
+
+		if (ce->ce_flags & CE_REMOVE)
+			continue;
+		if (sb.len >= 64 * 1024) {
+			if (write_in_full(fd, sb.buf, sb.len) < 0)
+				goto rollback;
+			strbuf_reset(&sb);
+		}
+		strbuf_addchars(&sb, 0, size);
+		copy = (struct cache_entry *)(sb.buf + sb.len - size);
+		copy->ce_stat_data = ce->ce_stat_data;
+		copy->ce_mode = ce->ce_mode;
+		copy->ce_flags = ce->ce_flags & INDEX_IMAGE_CE_FLAGS;
+		copy->mem_pool_allocated = 1;
+		copy->ce_namelen = ce->ce_namelen;
+		oidcpy(&copy->oid, &ce->oid);
+		memcpy(copy->name, ce->name, ce->ce_namelen);
+	}
+	if (write_in_full(fd, sb.buf, sb.len) < 0)
+		goto rollback;
+
+	strbuf_release(&sb);
+	commit_lock_file(&lock);
+	return;
+
+rollback:
+	strbuf_release(&sb);
+	rollback_lock_file(&lock);
+}
+
 static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 			  enum write_extensions write_extensions, unsigned flags)
 {
@@ -2853,13 +3637,13 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 	struct ondisk_cache_entry ondisk;
 	struct strbuf previous_name_buf = STRBUF_INIT, *previous_name;
 	int drop_cache_tree = istate->drop_cache_tree;
-	off_t offset;
+	off_t offset, entries_end;
 	int csum_fsync_flag;
 	int ieot_entries = 1;
 	struct index_entry_offset_table *ieot = NULL;
 	struct repository *r = istate->repo;
 	struct strbuf sb = STRBUF_INIT;
-	int nr, nr_threads, ret;
+	int nr, nr_threads, nr_write_threads, ret;
 
 	f = hashfd(tempfile->fd, tempfile->filename.buf);
 
@@ -2926,10 +3710,18 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 		}
 	}
 
-	offset = hashfile_total(f);
-
-	nr = 0;
-	previous_name = (hdr_version == 4) ? &previous_name_buf : NULL;
+	/*
+	 * Entries can be turned into their on-disk form on threads,
+	 * one for each block of the offset table if there is one.
+	 */
+	nr_write_threads = nr_threads;
+	if (!nr_write_threads) {
+		nr_write_threads = istate->cache_nr / THREAD_COST;
+		if (nr_write_threads > online_cpus())
+			nr_write_threads = online_cpus();
+	}
+	if (nr_write_threads > istate->cache_nr)
+		nr_write_threads = istate->cache_nr;
 
 	for (i = 0; i < entries; i++) {
 		struct cache_entry *ce = cache[i];
@@ -2950,32 +3742,56 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 
 			drop_cache_tree = 1;
 		}
-		if (ieot && i && (i % ieot_entries == 0)) {
+		if (err)
+			break;
+	}
+	if (err) {
+		ret = err;
+		goto out;
+	}
+
+	offset = hashfile_total(f);
+
+	nr = 0;
+	previous_name = (hdr_version == 4) ? &previous_name_buf : NULL;
+
+	if (nr_write_threads > 1) {
+		write_cache_entries_threaded(istate, f, !!previous_name,
+					     nr_write_threads, ieot, ieot_entries);
+	} else {
+		for (i = 0; i < entries; i++) {
+			struct cache_entry *ce = cache[i];
+			if (ce->ce_flags & CE_REMOVE)
+				continue;
+			if (ieot && i && (i % ieot_entries == 0)) {
+				ieot->entries[ieot->nr].nr = nr;
+				ieot->entries[ieot->nr].offset = offset;
+				ieot->nr++;
+				/*
+				 * If we have a V4 index, set the first byte to an invalid
+				 * character to ensure there is nothing common with the previous
+				 * entry
+				 */
+				if (previous_name)
+					previous_name->buf[0] = 0;
+				nr = 0;
+
+				offset = hashfile_total(f);
+			}
+			strbuf_reset(&sb);
+			if (ce_write_entry(&sb, ce, previous_name, (struct ondisk_cache_entry *)&ondisk) < 0)
+				err = -1;
+
+			if (err)
+				break;
+			hashwrite(f, sb.buf, sb.len);
+			nr++;
+		}
+		if (ieot && nr) {
 			ieot->entries[ieot->nr].nr = nr;
 			ieot->entries[ieot->nr].offset = offset;
 			ieot->nr++;
-			/*
-			 * If we have a V4 index, set the first byte to an invalid
-			 * character to ensure there is nothing common with the previous
-			 * entry
-			 */
-			if (previous_name)
-				previous_name->buf[0] = 0;
-			nr = 0;
-
-			offset = hashfile_total(f);
 		}
-		if (ce_write_entry(f, ce, previous_name, (struct ondisk_cache_entry *)&ondisk) < 0)
-			err = -1;
-
-		if (err)
-			break;
-		nr++;
-	}
-	if (ieot && nr) {
-		ieot->entries[ieot->nr].nr = nr;
-		ieot->entries[ieot->nr].offset = offset;
-		ieot->nr++;
 	}
 	strbuf_release(&previous_name_buf);
 
@@ -2984,7 +3800,7 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 		goto out;
 	}
 
-	offset = hashfile_total(f);
+	offset = entries_end = hashfile_total(f);
 
 	/*
 	 * The extension headers must be hashed on their own for the
@@ -3080,6 +3896,24 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 			goto out;
 		}
 	}
+	if (write_extensions & WRITE_JOURNAL_EXTENSION &&
+	    r->settings.index_journal &&
+	    !istate->split_index && !istate->sparse_index &&
+	    is_repo_index_lock(r, tempfile)) {
+		unsigned char id[INDEX_JOURNAL_ID_SZ];
+
+		if (csprng_bytes(id, sizeof(id), 0) < 0) {
+			ret = error_errno(_("unable to get random bytes for index journal"));
+			goto out;
+		}
+		err = write_index_ext_header(f, eoie_c, CACHE_EXT_JOURNAL,
+					     sizeof(id)) < 0;
+		hashwrite(f, id, sizeof(id));
+		if (err) {
+			ret = -1;
+			goto out;
+		}
+	}
 	if (istate->sparse_index) {
 		if (write_index_ext_header(f, eoie_c, CACHE_EXT_SPARSE_DIRECTORIES, 0) < 0) {
 			ret = -1;
@@ -3125,6 +3959,10 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 	istate->timestamp.nsec = ST_MTIME_NSEC(st);
 	trace_performance_since(start, "write index, changed mask = %x", istate->cache_changed);
 
+	if (r->settings.index_mapped_entries && !istate->split_index &&
+	    is_repo_index_lock(r, tempfile))
+		write_index_image(istate, tempfile, &st, entries_end);
+
 	/*
 	 * TODO trace2: replace "the_repository" with the actual repo instance
 	 * that is associated with the given "istate".
@@ -3158,6 +3996,26 @@ static int commit_locked_index(struct lock_file *lk)
 		return commit_lock_file(lk);
 }
 
+/*
+ * The journal of the index we are about to replace does not apply to
+ * the new one.  Remove it while we still hold the lock, so that nobody
+ * appends to it in the meantime; readers notice that the index changed
+ * under them and read it again.
+ */
+static void remove_index_journal(struct index_state *istate,
+				 struct lock_file *lock)
+{
+	char *path;
+
+	if (alternate_index_output ||
+	    !is_repo_index_lock(istate->repo, lock->tempfile))
+		return;
+	path = xstrfmt("%s.journal", istate->repo->index_file);
+	if (unlink(path) && errno != ENOENT)
+		warning_errno(_("unable to unlink '%s'"), path);
+	free(path);
+}
+
 static int do_write_locked_index(struct index_state *istate,
 				 struct lock_file *lock,
 				 unsigned flags,
@@ -3188,10 +4046,12 @@ static int do_write_locked_index(struct index_state *istate,
 
 	if (ret)
 		return ret;
-	if (flags & COMMIT_LOCK)
+	if (flags & COMMIT_LOCK) {
+		remove_index_journal(istate, lock);
 		ret = commit_locked_index(lock);
-	else
+	} else {
 		ret = close_lock_file_gently(lock);
+	}
 
 	run_hooks_l(the_repository, "post-index-change",
 		    istate->updated_workdir ? "1" : "0",
@@ -3350,6 +4210,220 @@ static int too_many_not_shared_entries(struct index_state *istate)
 	return (int64_t)istate->cache_nr * max_split < (int64_t)not_shared * 100;
 }
 
+/*
+ * Forget about the journal before the index is written as a whole; the
+ * journal on disk no longer applies to the new index.
+ */
+static void stop_index_journal(struct index_state *istate)
+{
+	if (!istate->journal)
+		return;
+	for (unsigned int i = 0; i < istate->cache_nr; i++)
+		istate->cache[i]->index = 0;
+	free_index_journal(istate);
+}
+
+static void add_journal_be32(struct strbuf *sb, uint32_t v)
+{
+	unsigned char buf[sizeof(uint32_t)];
+
+	put_be32(buf, v);
+	strbuf_add(sb, buf, sizeof(buf));
+}
+
+/*
+ * Append what changed since the index and its journal were read to the
+ * journal.  Returns 1 if the index has to be written as a whole instead,
+ * and otherwise 0 or -1 for success or failure.
+ */
+static int append_index_journal(struct index_state *istate,
+				struct lock_file *lock, unsigned flags)
+{
+	struct index_journal *j = istate->journal;
+	struct repository *r = istate->repo;
+	const unsigned int journal_changes = CE_ENTRY_CHANGED | CE_ENTRY_REMOVED |
+					     CE_ENTRY_ADDED | CACHE_TREE_CHANGED;
+	const char *lock_path = get_lock_file_path(lock);
+	struct ondisk_cache_entry ondisk;
+	struct strbuf rec = STRBUF_INIT;
+	struct cache_entry **added = NULL;
+	size_t added_nr = 0, added_alloc = 0, extended = 0, entries_start, len;
+	uint32_t nr_removed = 0;
+	unsigned char *kept = NULL, hash[GIT_MAX_RAWSZ];
+	struct git_hash_ctx c;
+	off_t limit;
+	struct stat st;
+	char *target;
+	int same_file, fd, ret = 1;
+
+	prepare_repo_settings(r);
+	if (!r->settings.index_journal || !(flags & COMMIT_LOCK) ||
+	    alternate_index_output || istate->split_index ||
+	    git_env_bool("GIT_TEST_SPLIT_INDEX", 0) ||
+	    istate->sparse_index || r->settings.sparse_index ||
+	    istate->drop_cache_tree || istate->fsmonitor_last_update ||
+	    !istate->cache_changed ||
+	    (istate->cache_changed & ~journal_changes))
+		return 1;
+
+	/* resolve-undo information is changed without telling anybody */
+	if (istate->resolve_undo)
+		return 1;
+
+	/* a cache tree that was brought up to date is only kept by a full write */
+	if ((istate->cache_changed & CACHE_TREE_CHANGED) &&
+	    istate->cache_tree && istate->cache_tree->entry_count >= 0)
+		return 1;
+
+	if (!strip_suffix(lock_path, LOCK_SUFFIX, &len))
+		return 1;
+	target = xmemdupz(lock_path, len);
+	same_file = !strcmp(absolute_path(target), j->index_path);
+	free(target);
+	if (!same_file || !index_journal_unchanged(j))
+		return 1;
+
+	/*
+	 * Entries that are still the ones read from disk are kept, all
+	 * others are added, and the positions no entry is kept at are
+	 * removed.
+	 */
+	CALLOC_ARRAY(kept, j->base_nr);
+	for (unsigned int i = 0; i < istate->cache_nr; i++) {
+		struct cache_entry *ce = istate->cache[i];
+
+		if (ce->ce_flags & CE_REMOVE)
+			continue;
+		if (ce->ce_flags & CE_EXTENDED_FLAGS)
+			extended++;
+		if (ce->index && ce->index <= j->base_nr &&
+		    j->base[ce->index - 1] == ce &&
+		    !(ce->ce_flags & CE_UPDATE_IN_BASE) &&
+		    (ce_uptodate(ce) || !is_racy_timestamp(istate, ce))) {
+			kept[ce->index - 1] = 1;
+			continue;
+		}
+		/* leave it to do_write_index() to complain */
+		if (is_null_oid(&ce->oid))
+			goto out;
+		ALLOC_GROW(added, added_nr + 1, added_alloc);
+		added[added_nr++] = ce;
+	}
+
+	/* ... and to pick between version 2 and 3 */
+	if ((istate->version == 2 && extended) ||
+	    (istate->version == 3 && !extended))
+		goto out;
+	for (unsigned int i = 0; i < j->base_nr; i++)
+		if (!kept[i])
+			nr_removed++;
+
+	if (!nr_removed && !added_nr) {
+		rollback_lock_file(lock);
+		ret = 0;
+		goto out;
+	}
+
+	add_journal_be32(&rec, nr_removed);
+	add_journal_be32(&rec, added_nr);
+	add_journal_be32(&rec, 0); /* size of the entries, filled in below */
+	for (unsigned int i = 0; i < j->base_nr; i++)
+		if (!kept[i])
+			add_journal_be32(&rec, i);
+	entries_start = rec.len;
+	for (size_t i = 0; i < added_nr; i++) {
+		struct cache_entry *ce = added[i];
+
+		if (!ce_uptodate(ce) && is_racy_timestamp(istate, ce))
+			ce_smudge_racily_clean_entry(istate, ce);
+		ce->ce_flags &= ~CE_EXTENDED;
+		if (ce->ce_flags & CE_EXTENDED_FLAGS)
+			ce->ce_flags |= CE_EXTENDED;
+		ce_write_entry(&rec, ce, NULL, &ondisk);
+	}
+	put_be32(rec.buf + 8, rec.len - entries_start);
+
+	the_hash_algo->init_fn(&c);
+	git_hash_update(&c, rec.buf, rec.len);
+	git_hash_final(hash, &c);
+	strbuf_add(&rec, hash, the_hash_algo->rawsz);
+
+	/* a journal that grew too large is compacted into a new index */
+	limit = j->index_size / 8;
+	if (limit < INDEX_JOURNAL_MIN_LIMIT)
+		limit = INDEX_JOURNAL_MIN_LIMIT;
+	if (limit > j->index_size)
+		limit = j->index_size;
+	if ((j->size < 0 ? INDEX_JOURNAL_HEADER_SZ : j->size) + rec.len > limit)
+		goto out;
+
+	if (j->size >= 0) {
+		/* drop a torn record left by a writer that died */
+		fd = open(j->path, O_WRONLY);
+		if (fd < 0 || ftruncate(fd, j->size) ||
+		    lseek(fd, j->size, SEEK_SET) < 0 ||
+		    write_in_full(fd, rec.buf, rec.len) < 0) {
+			ret = error_errno(_("unable to append to '%s'"), j->path);
+			if (fd >= 0)
+				close(fd);
+			goto out;
+		}
+		fsync_component_or_die(FSYNC_COMPONENT_INDEX, fd, j->path);
+		close(fd);
+	} else {
+		struct lock_file journal_lock = LOCK_INIT;
+		unsigned char hdr[INDEX_JOURNAL_HEADER_SZ];
+
+		put_be32(hdr, INDEX_JOURNAL_SIGNATURE);
+		put_be32(hdr + 4, INDEX_JOURNAL_VERSION);
+		memcpy(hdr + 8, j->id, INDEX_JOURNAL_ID_SZ);
+
+		fd = hold_lock_file_for_update(&journal_lock, j->path, 0);
+		if (fd < 0 ||
+		    write_in_full(fd, hdr, sizeof(hdr)) < 0 ||
+		    write_in_full(fd, rec.buf, rec.len) < 0) {
+			ret = error_errno(_("unable to write '%s'"), j->path);
+			rollback_lock_file(&journal_lock);
+			goto out;
+		}
+		fsync_component_or_die(FSYNC_COMPONENT_INDEX, fd, j->path);
+		if (commit_lock_file(&journal_lock)) {
+			ret = error_errno(_("unable to write '%s'"), j->path);
+			goto out;
+		}
+		j->size = sizeof(hdr);
+	}
+
+	if (lstat(j->path, &st)) {
+		ret = error_errno(_("could not stat '%s'"), j->path);
+		goto out;
+	}
+	fill_stat_data(&j->journal_sd, &st);
+	j->journal_exists = 1;
+	j->size += rec.len;
+	j->nr_records++;
+	istate->timestamp.sec = (unsigned int)st.st_mtime;
+	istate->timestamp.nsec = ST_MTIME_NSEC(st);
+	reset_index_journal_base(istate);
+	rollback_lock_file(lock);
+
+	trace2_data_intmax("index", r, "write/journal_removed", nr_removed);
+	trace2_data_intmax("index", r, "write/journal_added", added_nr);
+
+	run_hooks_l(the_repository, "post-index-change",
+		    istate->updated_workdir ? "1" : "0",
+		    istate->updated_skipworktree ? "1" : "0", NULL);
+	istate->updated_workdir = 0;
+	istate->updated_skipworktree = 0;
+	ret = 0;
+
+out:
+	strbuf_release(&rec);
+	free(added);
+	free(kept);
+	return ret;
+}
+
 int write_locked_index(struct index_state *istate, struct lock_file *lock,
 		       unsigned flags)
 {
@@ -3366,6 +4440,13 @@ int write_locked_index(struct index_state *istate, struct lock_file *lock,
 		return 0;
 	}
 
+	if (istate->journal) {
+		ret = append_index_journal(istate, lock, flags);
+		if (ret <= 0)
+			goto out;
+		stop_index_journal(istate);
+	}
+
 	if (istate->fsmonitor_last_update)
 		fill_fsmonitor_bitmap(istate);
 
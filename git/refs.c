@@ -9,6 +9,7 @@
 #include "advice.h"
 #include "config.h"
 #include "environment.h"
+#include "dir.h"
 #include "strmap.h"
 #include "gettext.h"
 #include "hex.h"
@@ -32,6 +33,8 @@
 #include "commit.h"
 #include "wildmatch.h"
 #include "ident.h"
+#include "tempfile.h"
+#include "trace.h"
 
 /*
  * List of all available backends
@@ -2378,6 +2381,66 @@ static int run_transaction_hook(struct ref_transaction *transaction,
 	return ret;
 }
 
+#define REFS_CHANGE_STAMP "refs-stamp"
+
+/*
+ * Write a new change stamp to `path`.  The stamp is replaced by a rename,
+ * so that readers never see a partial one.
+ */
+static int write_change_stamp(const char *path)
+{
+	static unsigned int counter;
+	struct strbuf tmp_path = STRBUF_INIT;
+	struct strbuf stamp = STRBUF_INIT;
+	struct tempfile *tmp;
+	int ret = 0;
+
+	strbuf_addf(&stamp, "%"PRIuMAX" %"PRIuMAX" %u\n",
+		    (uintmax_t)getnanotime(), (uintmax_t)getpid(), counter++);
+	strbuf_addf(&tmp_path, "%s-XXXXXX", path);
+	tmp = mks_tempfile(tmp_path.buf);
+	if (!tmp ||
+	    write_in_full(get_tempfile_fd(tmp), stamp.buf, stamp.len) < 0 ||
+	    rename_tempfile(&tmp, path) < 0) {
+		warning_errno(_("could not update '%s'"), path);
+		delete_tempfile(&tmp);
+		ret = -1;
+	}
+	strbuf_release(&tmp_path);
+	strbuf_release(&stamp);
+	return ret;
+}
+
+/*
+ * Replace the change stamp after refs have changed, so that caches keyed
+ * on the previous stamp see that they are out of date.  This is done
+ * whenever a stamp exists, whatever the configuration, as a cache may
+ * be enabled again later.
+ */
+static void refs_update_change_stamp(struct ref_store *refs)
+{
+	struct strbuf path = STRBUF_INIT;
+
+	repo_common_path_append(refs->repo, &path, "%s", REFS_CHANGE_STAMP);
+	if (file_exists(path.buf))
+		write_change_stamp(path.buf);
+	strbuf_release(&path);
+}
+
+int refs_read_change_stamp(struct ref_store *refs, struct strbuf *stamp)
+{
+	struct strbuf path = STRBUF_INIT;
+	int ret;
+
+	repo_common_path_append(refs->repo, &path, "%s", REFS_CHANGE_STAMP);
+	strbuf_reset(stamp);
+	ret = strbuf_read_file(stamp, path.buf, 0);
+	if (ret < 0 && errno == ENOENT && !write_change_stamp(path.buf))
+		ret = strbuf_read_file(stamp, path.buf, 0);
+	strbuf_release(&path);
+	return ret < 0 ? -1 : 0;
+}
+
 int ref_transaction_prepare(struct ref_transaction *transaction,
 			    struct strbuf *err)
 {
@@ -2470,6 +2533,8 @@ int ref_transaction_commit(struct ref_transaction *transaction,
 	}
 
 	ret = refs->be->transaction_finish(refs, transaction, err);
+	if (!ret && transaction->nr)
+		refs_update_change_stamp(refs);
 	if (!ret && !(transaction->flags & REF_TRANSACTION_FLAG_INITIAL))
 		run_transaction_hook(transaction, "committed");
 	return ret;
@@ -2724,6 +2789,7 @@ int refs_rename_ref(struct ref_store *refs, const char *oldref,
 
 	msg = normalize_reflog_message(logmsg);
 	retval = refs->be->rename_ref(refs, oldref, newref, msg);
+	refs_update_change_stamp(refs);
 	free(msg);
 	return retval;
 }
@@ -2736,6 +2802,7 @@ int refs_copy_existing_ref(struct ref_store *refs, const char *oldref,
 
 	msg = normalize_reflog_message(logmsg);
 	retval = refs->be->copy_ref(refs, oldref, newref, msg);
+	refs_update_change_stamp(refs);
 	free(msg);
 	return retval;
 }
@@ -861,6 +861,16 @@ int ref_transaction_commit(struct ref_transaction *transaction,
 int ref_transaction_abort(struct ref_transaction *transaction,
 			  struct strbuf *err);
 
+/*
+ * Read the change stamp of the refs into `stamp`, an opaque string that
+ * is replaced after every ref transaction, rename or copy that changes
+ * refs, so that caches derived from the refs can tell when to rebuild.
+ * The stamp is created by the first call, and ref updates replace it
+ * from then on.  Returns 0 on success, or -1 if the stamp cannot be
+ * read or created.
+ */
+int refs_read_change_stamp(struct ref_store *refs, struct strbuf *stamp);
+
 /*
  * Execute the given callback function for each of the reference updates which
  * have been queued in the given transaction. `old_oid` and `new_oid` may be
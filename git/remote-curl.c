@@ -614,6 +614,14 @@ struct rpc_state {
 	unsigned gzip_request : 1;
 	unsigned initial_buffer : 1;
 
+	/*
+	 * Set once a request has gone through without any authentication.
+	 * Later large requests can then be streamed right away, without
+	 * first probing the server, which would cost a round trip each.
+	 * Once the server asks for authentication, we probe again.
+	 */
+	unsigned skip_probe : 1;
+
 	/*
 	 * Whenever a pkt-line is read into buf, append the 4 characters
 	 * denoting its length before appending the payload.
@@ -894,6 +902,29 @@ static int probe_rpc(struct rpc_state *rpc, struct slot_results *results)
 	return err;
 }
 
+/*
+ * Probe the server until it accepts our credentials, asking for them as
+ * needed, and tell whether the request should then wait for "100
+ * Continue" before sending its body.
+ */
+static int probe_rpc_auth(struct rpc_state *rpc, int *needs_100_continue)
+{
+	struct slot_results results;
+	int err;
+
+	do {
+		err = probe_rpc(rpc, &results);
+		if (err == HTTP_REAUTH)
+			credential_fill(the_repository, &http_auth, 0);
+	} while (err == HTTP_REAUTH);
+	if (err != HTTP_OK)
+		return -1;
+
+	if (results.auth_avail & CURLAUTH_GSSNEGOTIATE || http_auth.authtype)
+		*needs_100_continue = 1;
+	return 0;
+}
+
 static curl_off_t xcurl_off_t(size_t len)
 {
 	uintmax_t size = len;
@@ -914,7 +945,7 @@ static int post_rpc(struct rpc_state *rpc, int stateless_connect, int flush_rece
 	char *gzip_body = NULL;
 	size_t gzip_size = 0;
 	int err, large_request = 0;
-	int needs_100_continue = 0;
+	int needs_100_continue = 0, probe_skipped = 0;
 	struct rpc_in_data rpc_in_data;
 
 	/* Try to load the entire request, if we can fit it into the
@@ -936,19 +967,12 @@ static int post_rpc(struct rpc_state *rpc, int stateless_connect, int flush_rece
 		}
 	}
 
-	if (large_request) {
-		struct slot_results results;
-
-		do {
-			err = probe_rpc(rpc, &results);
-			if (err == HTTP_REAUTH)
-				credential_fill(the_repository, &http_auth, 0);
-		} while (err == HTTP_REAUTH);
-		if (err != HTTP_OK)
+	if (large_request && rpc->skip_probe) {
+		trace2_data_intmax("remote-curl", the_repository, "rpc/probe-skipped", 1);
+		probe_skipped = 1;
+	} else if (large_request) {
+		if (probe_rpc_auth(rpc, &needs_100_continue))
 			return -1;
-
-		if (results.auth_avail & CURLAUTH_GSSNEGOTIATE || http_auth.authtype)
-			needs_100_continue = 1;
 	}
 
 retry:
@@ -1062,7 +1086,29 @@ static int post_rpc(struct rpc_state *rpc, int stateless_connect, int flush_rece
 
 
 	rpc->any_written = 0;
+	trace2_region_enter("remote-curl", "post-rpc", the_repository);
 	err = run_slot(slot, NULL);
+	trace2_region_leave("remote-curl", "post-rpc", the_repository);
+	if (err == HTTP_OK && !needs_100_continue &&
+	    !http_auth.username && !http_auth.credential)
+		rpc->skip_probe = 1;
+	if (err == HTTP_REAUTH && probe_skipped) {
+		/*
+		 * The server wants authentication after all, so probe before
+		 * every large request from now on.  We can only send this one
+		 * again if curl has not read past the first buffer yet.
+		 */
+		rpc->skip_probe = 0;
+		probe_skipped = 0;
+		if (rpc->initial_buffer) {
+			curl_slist_free_all(headers);
+			if (probe_rpc_auth(rpc, &needs_100_continue))
+				return -1;
+			rpc->pos = 0;
+			goto retry;
+		}
+		error(_("authentication required after the request was sent"));
+	}
 	if (err == HTTP_REAUTH && !large_request) {
 		credential_fill(the_repository, &http_auth, 0);
 		curl_slist_free_all(headers);
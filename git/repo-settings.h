@@ -53,6 +53,8 @@ struct repo_settings {
 
 	int index_version;
 	int index_skip_hash;
+	int index_journal;
+	int index_mapped_entries;
 	enum untracked_cache_setting core_untracked_cache;
 
 	int pack_use_sparse;
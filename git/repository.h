@@ -227,6 +227,13 @@ int repo_read_index_unmerged(struct repository *);
  */
 void repo_update_index_if_able(struct repository *, struct lock_file *);
 
+/*
+ * Write the index as a whole if changes to it were appended to its
+ * journal, and remove the journal.  Gives up quietly if somebody else
+ * holds the lock of the index.
+ */
+int repo_compact_index_journal(struct repository *);
+
 /*
  * Return 1 if upgrade repository format to target_version succeeded,
  * 0 if no upgrade is necessary, and -1 when upgrade is not possible.
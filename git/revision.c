@@ -44,6 +44,10 @@
 #include "hashmap.h"
 #include "utf8.h"
 #include "bloom.h"
+#include "treesame-prefetch.h"
+#include "promisor-remote.h"
+#include "replace-object.h"
+#include "thread-utils.h"
 #include "json-writer.h"
 #include "list-objects-filter-options.h"
 #include "resolve-undo.h"
@@ -696,25 +700,44 @@ static void trace2_bloom_filter_statistics_atexit(void)
 
 static int forbid_bloom_filters(struct pathspec *spec)
 {
-	if (spec->has_wildcard)
-		return 1;
-	if (spec->nr > 1)
-		return 1;
-	if (spec->magic & ~PATHSPEC_LITERAL)
-		return 1;
-	if (spec->nr && (spec->items[0].magic & ~PATHSPEC_LITERAL))
+	unsigned int allowed_magic = PATHSPEC_LITERAL | PATHSPEC_GLOB;
+
+	if (spec->magic & ~allowed_magic)
 		return 1;
+	for (int i = 0; i < spec->nr; i++)
+		if (spec->items[i].magic & ~allowed_magic)
+			return 1;
 
 	return 0;
 }
 
+/*
+ * Return the length of the path whose Bloom keys tell whether a commit
+ * may have changed anything matching "pi": the path itself without a
+ * trailing slash if it is literal, or the leading directories before the
+ * first wildcard if not.  Zero means that the pathspec item may match
+ * anywhere.
+ */
+static size_t bloom_pathspec_len(const struct pathspec_item *pi)
+{
+	size_t len = pi->len;
+
+	if (pi->nowildcard_len < pi->len) {
+		len = pi->nowildcard_len;
+		while (len && pi->match[len - 1] != '/')
+			len--;
+	}
+
+	/* remove single trailing slash from path, if needed */
+	if (len && pi->match[len - 1] == '/')
+		len--;
+
+	return len;
+}
+
 static void prepare_to_use_bloom_filter(struct rev_info *revs)
 {
-	struct pathspec_item *pi;
-	char *path_alloc = NULL;
-	const char *path, *p;
-	size_t len;
-	int path_component_nr = 1;
+	size_t i;
 
 	if (!revs->commits)
 		return;
@@ -731,89 +754,262 @@ static void prepare_to_use_bloom_filter(struct rev_info *revs)
 	if (!revs->pruning.pathspec.nr)
 		return;
 
-	pi = &revs->pruning.pathspec.items[0];
-
-	/* remove single trailing slash from path, if needed */
-	if (pi->len > 0 && pi->match[pi->len - 1] == '/') {
-		path_alloc = xmemdupz(pi->match, pi->len - 1);
-		path = path_alloc;
-	} else
-		path = pi->match;
-
-	len = strlen(path);
-	if (!len) {
-		revs->bloom_filter_settings = NULL;
-		free(path_alloc);
-		return;
-	}
-
-	p = path;
-	while (*p) {
-		/*
-		 * At this point, the path is normalized to use Unix-style
-		 * path separators. This is required due to how the
-		 * changed-path Bloom filters store the paths.
-		 */
-		if (*p == '/')
-			path_component_nr++;
-		p++;
+	for (i = 0; i < revs->pruning.pathspec.nr; i++) {
+		if (!bloom_pathspec_len(&revs->pruning.pathspec.items[i])) {
+			revs->bloom_filter_settings = NULL;
+			return;
+		}
 	}
 
-	revs->bloom_keys_nr = path_component_nr;
-	ALLOC_ARRAY(revs->bloom_keys, revs->bloom_keys_nr);
-
-	fill_bloom_key(path, len, &revs->bloom_keys[0],
-		       revs->bloom_filter_settings);
-	path_component_nr = 1;
+	/*
+	 * At this point, the paths are normalized to use Unix-style path
+	 * separators. This is required due to how the changed-path Bloom
+	 * filters store the paths.
+	 *
+	 * A commit may have changed the paths we are interested in if the
+	 * keys of any of the pathspec items are all in its filter.
+	 */
+	revs->bloom_keyvecs_nr = revs->pruning.pathspec.nr;
+	CALLOC_ARRAY(revs->bloom_keyvecs, revs->bloom_keyvecs_nr);
+	for (i = 0; i < revs->bloom_keyvecs_nr; i++) {
+		const struct pathspec_item *pi = &revs->pruning.pathspec.items[i];
 
-	p = path + len - 1;
-	while (p > path) {
-		if (*p == '/')
-			fill_bloom_key(path, p - path,
-				       &revs->bloom_keys[path_component_nr++],
-				       revs->bloom_filter_settings);
-		p--;
+		revs->bloom_keyvecs[i] =
+			bloom_keyvec_new(pi->match, bloom_pathspec_len(pi),
+					 revs->bloom_filter_settings);
 	}
 
 	if (trace2_is_enabled() && !bloom_filter_atexit_registered) {
 		atexit(trace2_bloom_filter_statistics_atexit);
 		bloom_filter_atexit_registered = 1;
 	}
-
-	free(path_alloc);
 }
 
-static int check_maybe_different_in_bloom_filter(struct rev_info *revs,
-						 struct commit *commit)
+enum bloom_check {
+	BLOOM_CHECK_NONE = 0,
+	BLOOM_CHECK_UNUSABLE,
+	BLOOM_CHECK_NOT_PRESENT,
+	BLOOM_CHECK_MAYBE,
+	BLOOM_CHECK_DEFINITELY_NOT,
+};
+
+static enum bloom_check check_bloom_filter(struct rev_info *revs,
+					   struct commit *commit)
 {
 	struct bloom_filter *filter;
-	int result = 1, j;
+	int result = 0;
 
 	if (!revs->repo->objects->commit_graph)
-		return -1;
+		return BLOOM_CHECK_UNUSABLE;
 
 	if (commit_graph_generation(commit) == GENERATION_NUMBER_INFINITY)
-		return -1;
+		return BLOOM_CHECK_UNUSABLE;
 
 	filter = get_bloom_filter(revs->repo, commit);
 
-	if (!filter) {
-		count_bloom_filter_not_present++;
-		return -1;
+	if (!filter)
+		return BLOOM_CHECK_NOT_PRESENT;
+
+	for (size_t i = 0; !result && i < revs->bloom_keyvecs_nr; i++)
+		result = bloom_filter_contains_vec(filter, revs->bloom_keyvecs[i],
+						   revs->bloom_filter_settings);
+
+	return result ? BLOOM_CHECK_MAYBE : BLOOM_CHECK_DEFINITELY_NOT;
+}
+
+/*
+ * While a path-limited walk that can use Bloom filters is busy showing a
+ * commit, threads compare the trees of the commits it is about to reach
+ * to those of their first parents.  For those that turn out to be
+ * TREESAME, which is what a false positive of the Bloom filter is, the
+ * walk then does not have to diff the trees itself.
+ *
+ * The commits to hand to the threads are found by following the first
+ * parents of each commit that is added to the walk.  Each commit we have
+ * looked at points further down its first-parent chain, to where we
+ * stopped looking, so that we do not follow the same chain again every
+ * time the walk takes a step along it.
+ */
+struct treesame_ahead {
+	struct commit *next;
+	enum bloom_check bloom;
+	unsigned examined:1,
+		 reached:1;
+};
+
+define_commit_slab(treesame_ahead_slab, struct treesame_ahead);
+
+struct treesame_lookahead {
+	struct treesame_prefetch *prefetch;
+	struct treesame_ahead_slab ahead;
+	unsigned int unreached;
+	unsigned int reached;
+};
+
+/* How many commits we look at before the walk gets to them. */
+#define TREESAME_LOOKAHEAD 1024
+
+/*
+ * A walk that is only to show a few commits may well stop after a few
+ * more; look no further ahead than it has walked, or than it has commits
+ * left to show, so that "git log -n 1 -- <path>" does not do a thousand
+ * commits worth of work for one.
+ */
+static unsigned int treesame_lookahead_limit(struct rev_info *revs)
+{
+	struct treesame_lookahead *la = revs->treesame_lookahead;
+	unsigned int wanted;
+
+	if (revs->max_count < 0)
+		return TREESAME_LOOKAHEAD;
+	wanted = revs->max_count + (revs->skip_count > 0 ? revs->skip_count : 0);
+	if (wanted < la->reached)
+		wanted = la->reached;
+	return wanted < TREESAME_LOOKAHEAD ? wanted : TREESAME_LOOKAHEAD;
+}
+
+static void prepare_treesame_lookahead(struct rev_info *revs)
+{
+	struct treesame_prefetch *prefetch;
+	struct strvec paths = STRVEC_INIT;
+	int nr_threads;
+
+	if (!revs->bloom_keyvecs_nr || !revs->prune ||
+	    revs->diffopt.flags.follow_renames ||
+	    repo_has_promisor_remote(revs->repo))
+		return;
+
+	if (repo_config_get_int(revs->repo, "log.threads", &nr_threads) ||
+	    nr_threads < 1)
+		nr_threads = online_cpus();
+	/* The walk itself runs on the main thread. */
+	if (--nr_threads < 1)
+		return;
+
+	/* Threads must not be the first to look up replace refs. */
+	if (replace_refs_enabled(revs->repo))
+		prepare_replace_object(revs->repo);
+
+	/*
+	 * Trees that agree at the paths we looked up in the Bloom filters
+	 * agree on everything the pathspec can match.
+	 */
+	for (int i = 0; i < revs->pruning.pathspec.nr; i++) {
+		const struct pathspec_item *pi = &revs->pruning.pathspec.items[i];
+
+		strvec_push_nodup(&paths, xmemdupz(pi->match,
+						   bloom_pathspec_len(pi)));
+	}
+	prefetch = treesame_prefetch_start(revs->repo, paths.v, paths.nr,
+					   nr_threads);
+	strvec_clear(&paths);
+	if (!prefetch)
+		return;
+
+	CALLOC_ARRAY(revs->treesame_lookahead, 1);
+	revs->treesame_lookahead->prefetch = prefetch;
+	init_treesame_ahead_slab(&revs->treesame_lookahead->ahead);
+}
+
+static void release_treesame_lookahead(struct treesame_lookahead *la)
+{
+	if (!la)
+		return;
+	treesame_prefetch_stop(la->prefetch);
+	clear_treesame_ahead_slab(&la->ahead);
+	free(la);
+}
+
+/*
+ * "commit" has just been added to the walk; queue the comparisons of the
+ * commits down its first-parent chain that the walk has not got to yet.
+ */
+static void look_ahead_for_treesame(struct rev_info *revs,
+				    struct commit *commit)
+{
+	struct treesame_lookahead *la = revs->treesame_lookahead;
+	struct treesame_ahead *ahead;
+	struct commit *c, *next;
+	unsigned int limit;
+
+	ahead = treesame_ahead_slab_at(&la->ahead, commit);
+	if (ahead->reached)
+		return;
+	if (ahead->examined)
+		la->unreached--;
+	ahead->reached = 1;
+	la->reached++;
+	limit = treesame_lookahead_limit(revs);
+
+	c = commit;
+	while (c && (ahead = treesame_ahead_slab_at(&la->ahead, c))->examined)
+		c = ahead->next;
+
+	while (c && la->unreached < limit) {
+		struct commit *parent;
+		enum bloom_check bloom;
+
+		if (c->object.flags & UNINTERESTING ||
+		    repo_parse_commit_gently(revs->repo, c, 1) < 0 ||
+		    !c->parents ||
+		    repo_parse_commit_gently(revs->repo, c->parents->item, 1) < 0)
+			break;
+		parent = c->parents->item;
+
+		bloom = check_bloom_filter(revs, c);
+		if (bloom != BLOOM_CHECK_DEFINITELY_NOT &&
+		    treesame_prefetch_add(la->prefetch,
+					  get_commit_tree_oid(parent),
+					  get_commit_tree_oid(c), c->date) < 0)
+			break;
+
+		/* Remember the answer for when the walk gets here. */
+		ahead = treesame_ahead_slab_at(&la->ahead, c);
+		ahead->bloom = bloom;
+		ahead->examined = 1;
+		ahead->next = parent;
+		if (!ahead->reached)
+			la->unreached++;
+		c = parent;
 	}
 
-	for (j = 0; result && j < revs->bloom_keys_nr; j++) {
-		result = bloom_filter_contains(filter,
-					       &revs->bloom_keys[j],
-					       revs->bloom_filter_settings);
+	/* Let everything we went past point to where we stopped. */
+	while (commit != c) {
+		ahead = treesame_ahead_slab_at(&la->ahead, commit);
+		next = ahead->next;
+		ahead->next = c;
+		commit = next;
 	}
+}
+
+static int check_maybe_different_in_bloom_filter(struct rev_info *revs,
+						 struct commit *commit)
+{
+	enum bloom_check check = BLOOM_CHECK_NONE;
 
-	if (result)
+	if (revs->treesame_lookahead) {
+		struct treesame_ahead *ahead =
+			treesame_ahead_slab_peek(&revs->treesame_lookahead->ahead,
+						 commit);
+		if (ahead)
+			check = ahead->bloom;
+	}
+	if (check == BLOOM_CHECK_NONE)
+		check = check_bloom_filter(revs, commit);
+
+	switch (check) {
+	case BLOOM_CHECK_NOT_PRESENT:
+		count_bloom_filter_not_present++;
+		return -1;
+	case BLOOM_CHECK_MAYBE:
 		count_bloom_filter_maybe++;
-	else
+		return 1;
+	case BLOOM_CHECK_DEFINITELY_NOT:
 		count_bloom_filter_definitely_not++;
-
-	return result;
+		return 0;
+	default:
+		return -1;
+	}
 }
 
 static int rev_compare_tree(struct rev_info *revs,
@@ -846,7 +1042,7 @@ static int rev_compare_tree(struct rev_info *revs,
 			return REV_TREE_SAME;
 	}
 
-	if (revs->bloom_keys_nr && !nth_parent) {
+	if (revs->bloom_keyvecs_nr && !nth_parent) {
 		bloom_ret = check_maybe_different_in_bloom_filter(revs, commit);
 
 		if (bloom_ret == 0)
@@ -855,7 +1051,13 @@ static int rev_compare_tree(struct rev_info *revs,
 
 	tree_difference = REV_TREE_SAME;
 	revs->pruning.flags.has_changes = 0;
-	diff_tree_oid(&t1->object.oid, &t2->object.oid, "", &revs->pruning);
+	if (!nth_parent && revs->treesame_lookahead &&
+	    treesame_prefetch_lookup(revs->treesame_lookahead->prefetch,
+				     &t1->object.oid, &t2->object.oid))
+		; /* the threads found them to be TREESAME */
+	else
+		diff_tree_oid(&t1->object.oid, &t2->object.oid, "",
+			      &revs->pruning);
 
 	if (!nth_parent)
 		if (bloom_ret == 1 && tree_difference == REV_TREE_SAME)
@@ -873,7 +1075,7 @@ static int rev_same_tree_as_empty(struct rev_info *revs, struct commit *commit,
 	if (!t1)
 		return 0;
 
-	if (!nth_parent && revs->bloom_keys_nr) {
+	if (!nth_parent && revs->bloom_keyvecs_nr) {
 		bloom_ret = check_maybe_different_in_bloom_filter(revs, commit);
 		if (!bloom_ret)
 			return 1;
@@ -1252,6 +1454,8 @@ static int process_parents(struct rev_info *revs, struct commit *commit,
 				commit_list_insert_by_date(p, list);
 			if (queue)
 				prio_queue_put(queue, p);
+			if (revs->treesame_lookahead)
+				look_ahead_for_treesame(revs, p);
 		}
 		if (revs->first_parent_only)
 			break;
@@ -3250,10 +3454,12 @@ void release_revisions(struct rev_info *revs)
 	line_log_free(revs);
 	oidset_clear(&revs->missing_commits);
 
-	for (int i = 0; i < revs->bloom_keys_nr; i++)
-		clear_bloom_key(&revs->bloom_keys[i]);
-	FREE_AND_NULL(revs->bloom_keys);
-	revs->bloom_keys_nr = 0;
+	for (size_t i = 0; i < revs->bloom_keyvecs_nr; i++)
+		bloom_keyvec_free(revs->bloom_keyvecs[i]);
+	FREE_AND_NULL(revs->bloom_keyvecs);
+	revs->bloom_keyvecs_nr = 0;
+	release_treesame_lookahead(revs->treesame_lookahead);
+	revs->treesame_lookahead = NULL;
 }
 
 static void add_child(struct rev_info *revs, struct commit *parent, struct commit *child)
@@ -3807,6 +4013,7 @@ static void init_topo_walk(struct rev_info *revs)
 		break;
 	case REV_SORT_BY_COMMIT_DATE:
 		info->topo_queue.compare = compare_commits_by_commit_date;
+		info->topo_queue.get_key = commit_date_queue_key;
 		break;
 	case REV_SORT_BY_AUTHOR_DATE:
 		init_author_date_slab(&info->author_date);
@@ -3816,7 +4023,9 @@ static void init_topo_walk(struct rev_info *revs)
 	}
 
 	info->explore_queue.compare = compare_commits_by_gen_then_commit_date;
+	info->explore_queue.get_key = commit_gen_then_date_queue_key;
 	info->indegree_queue.compare = compare_commits_by_gen_then_commit_date;
+	info->indegree_queue.get_key = commit_gen_then_date_queue_key;
 
 	info->min_generation = GENERATION_NUMBER_INFINITY;
 	for (list = revs->commits; list; list = list->next) {
@@ -3948,6 +4157,8 @@ int prepare_revision_walk(struct rev_info *revs)
 
 	if (!revs->reflog_info)
 		prepare_to_use_bloom_filter(revs);
+	if (!revs->treesame_lookahead)
+		prepare_treesame_lookahead(revs);
 	if (!revs->unsorted_input)
 		commit_list_sort_by_date(&revs->commits);
 	if (revs->no_walk)
@@ -4015,7 +4226,10 @@ static void merge_queue_into_list(struct prio_queue *q, struct commit_list **lis
 
 static enum rewrite_result rewrite_one(struct rev_info *revs, struct commit **pp)
 {
-	struct prio_queue queue = { compare_commits_by_commit_date };
+	struct prio_queue queue = {
+		.compare = compare_commits_by_commit_date,
+		.get_key = commit_date_queue_key,
+	};
 	enum rewrite_result ret = rewrite_one_1(revs, pp, &queue);
 	merge_queue_into_list(&queue, &revs->commits);
 	clear_prio_queue(&queue);
@@ -62,8 +62,9 @@ struct repository;
 struct rev_info;
 struct string_list;
 struct saved_parents;
-struct bloom_key;
+struct bloom_keyvec;
 struct bloom_filter_settings;
+struct treesame_lookahead;
 struct option;
 struct parse_opt_ctx_t;
 define_shared_commit_slab(revision_sources, char *);
@@ -360,9 +361,9 @@ struct rev_info {
 	struct topo_walk_info *topo_walk_info;
 
 	/* Commit graph bloom filter fields */
-	/* The bloom filter key(s) for the pathspec */
-	struct bloom_key *bloom_keys;
-	int bloom_keys_nr;
+	/* The bloom filter keys for each pathspec item */
+	struct bloom_keyvec **bloom_keyvecs;
+	size_t bloom_keyvecs_nr;
 
 	/*
 	 * The bloom filter settings used to generate the key.
@@ -370,6 +371,12 @@ struct rev_info {
 	 */
 	struct bloom_filter_settings *bloom_filter_settings;
 
+	/*
+	 * Trees of commits further down the walk that are compared on
+	 * other threads while we are busy with the current one.
+	 */
+	struct treesame_lookahead *treesame_lookahead;
+
 	/* misc. flags related to '--no-kept-objects' */
 	unsigned keep_pack_cache_flags;
 
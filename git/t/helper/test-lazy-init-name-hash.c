@@ -16,6 +16,7 @@ static int dump;
 static int perf;
 static int analyze;
 static int analyze_step;
+static int lookup;
 
 /*
  * Dump the contents of the "dir" and "name" hash tables to stdout.
@@ -188,6 +189,44 @@ static void analyze_run(void)
 	}
 }
 
+/*
+ * Look up "lookup" of the entries, spread over the index, and their
+ * parent directories in upper case, "count" times, and report on the
+ * time taken and on how much of the index got hashed for them.
+ */
+static void lookup_run(void)
+{
+	uint64_t t1, t2;
+	int i, j;
+
+	for (i = 0; i < count; i++) {
+		struct index_state *istate = the_repository->index;
+
+		repo_read_index(the_repository);
+		t1 = getnanotime();
+		for (j = 0; j < lookup && istate->cache_nr; j++) {
+			const struct cache_entry *ce =
+				istate->cache[(uint64_t)j * istate->cache_nr / lookup];
+			char *name = xstrdup_toupper(ce->name);
+			char *slash = strrchr(name, '/');
+
+			if (!index_file_exists(istate, name, ce_namelen(ce), 1))
+				die("'%s' not found", name);
+			if (slash && !index_dir_exists(istate, name, slash - name))
+				die("directory of '%s' not found", name);
+			free(name);
+		}
+		t2 = getnanotime();
+
+		printf("%f %d lookups, %d of %d hashed\n",
+		       ((double)(t2 - t1))/1000000000, lookup,
+		       hashmap_get_size(&istate->name_hash), istate->cache_nr);
+		fflush(stdout);
+
+		discard_index(istate);
+	}
+}
+
 int cmd__lazy_init_name_hash(int argc, const char **argv)
 {
 	const char *usage[] = {
@@ -196,6 +235,7 @@ int cmd__lazy_init_name_hash(int argc, const char **argv)
 		"test-tool lazy-init-name-hash -a a [--step s] [-c c]",
 		"test-tool lazy-init-name-hash (-s | -m) [-c c]",
 		"test-tool lazy-init-name-hash -s -m [-c c]",
+		"test-tool lazy-init-name-hash -l l [-c c]",
 		NULL
 	};
 	struct option options[] = {
@@ -206,6 +246,7 @@ int cmd__lazy_init_name_hash(int argc, const char **argv)
 		OPT_BOOL('p', "perf", &perf, "compare single vs multi"),
 		OPT_INTEGER('a', "analyze", &analyze, "analyze different multi sizes"),
 		OPT_INTEGER(0, "step", &analyze_step, "analyze step factor"),
+		OPT_INTEGER('l', "lookup", &lookup, "look up some of the names"),
 		OPT_END(),
 	};
 	const char *prefix;
@@ -256,6 +297,13 @@ int cmd__lazy_init_name_hash(int argc, const char **argv)
 		return 0;
 	}
 
+	if (lookup > 0) {
+		if (single || multi)
+			die("cannot use single or multi with lookup");
+		lookup_run();
+		return 0;
+	}
+
 	if (!single && !multi)
 		die("require either -s or -m or both");
 
@@ -2,6 +2,7 @@
 
 #include "test-tool.h"
 #include "commit.h"
+#include "commit-graph.h"
 #include "commit-reach.h"
 #include "gettext.h"
 #include "hex.h"
@@ -179,6 +180,33 @@ int cmd__reach(int ac, const char **av)
 
 		print_sorted_commit_ids(list);
 		free_commit_list(list);
+	} else if (!strcmp(av[1], "reach_index")) {
+		const int reachable_flag = 1;
+		int counts[3] = { 0 };
+
+		for (size_t i = 0; i < X_nr; i++) {
+			struct commit_list *list = get_reachable_subset(&X_array[i], 1,
+									Y_array, Y_nr,
+									reachable_flag);
+
+			for (size_t j = 0; j < Y_nr; j++) {
+				int reach = commit_graph_can_reach(r, X_array[i], Y_array[j]);
+				int walk = !!(Y_array[j]->object.flags & reachable_flag);
+
+				if (reach >= 0 && reach != walk)
+					die("reach index says %d for %s reaching %s",
+					    reach, oid_to_hex(&X_array[i]->object.oid),
+					    oid_to_hex(&Y_array[j]->object.oid));
+				counts[reach + 1]++;
+			}
+
+			for (size_t j = 0; j < Y_nr; j++)
+				Y_array[j]->object.flags &= ~reachable_flag;
+			free_commit_list(list);
+		}
+
+		printf("%s(X,Y):yes=%d,no=%d,unknown=%d\n", av[1],
+		       counts[2], counts[1], counts[0]);
 	}
 
 	object_array_clear(&X_obj);
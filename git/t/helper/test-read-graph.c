@@ -34,6 +34,16 @@ static void dump_graph_info(struct commit_graph *graph)
 		printf(" bloom_indexes");
 	if (graph->chunk_bloom_data)
 		printf(" bloom_data");
+	if (graph->chunk_identity_index)
+		printf(" identity_index");
+	if (graph->chunk_identity_data)
+		printf(" identity_data");
+	if (graph->chunk_subject_index)
+		printf(" subject_index");
+	if (graph->chunk_subject_data)
+		printf(" subject_data");
+	if (graph->chunk_reach_index)
+		printf(" reach_index");
 	printf("\n");
 
 	printf("options:");
@@ -30,6 +30,8 @@ graph_git_behavior() {
 		graph_git_two_modes "${DIR:+-C $DIR} log --oneline $BRANCH" &&
 		graph_git_two_modes "${DIR:+-C $DIR} log --topo-order $BRANCH" &&
 		graph_git_two_modes "${DIR:+-C $DIR} log --graph $COMPARE..$BRANCH" &&
+		graph_git_two_modes "${DIR:+-C $DIR} rev-list --count $COMPARE..$BRANCH" &&
+		graph_git_two_modes "${DIR:+-C $DIR} rev-list --count $BRANCH...$COMPARE" &&
 		graph_git_two_modes "${DIR:+-C $DIR} branch -vv" &&
 		graph_git_two_modes "${DIR:+-C $DIR} merge-base -a $BRANCH $COMPARE"
 	'
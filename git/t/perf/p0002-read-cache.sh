@@ -11,4 +11,13 @@ test_perf "read_cache/discard_cache $count times" "
 	test-tool read-cache $count
 "
 
+test_expect_success 'write mapped entries' '
+	git config index.mappedEntries true &&
+	git update-index --force-write-index
+'
+
+test_perf "read_cache/discard_cache $count times (mapped entries)" "
+	test-tool read-cache $count
+"
+
 test_done
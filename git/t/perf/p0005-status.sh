@@ -46,4 +46,14 @@ test_perf "read-tree status br_ballast ($nr_files)" '
 	git status
 '
 
+# With the index fresh, status is mostly the lstat() of every file,
+# which preload_index() batches where it can.
+test_expect_success "refresh the index" '
+	git status >/dev/null
+'
+
+test_perf "status with a fresh index br_ballast ($nr_files)" '
+	git status
+'
+
 test_done
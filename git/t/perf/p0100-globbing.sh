@@ -40,4 +40,33 @@ do
 	'
 done
 
+test_expect_success 'setup many ignore patterns' '
+	mkdir ignores &&
+	for i in $(test_seq 1 500)
+	do
+		echo "name$i" &&
+		echo "*.ext$i" &&
+		echo "/dir$i/out" &&
+		echo "!keep$i.ext$i" &&
+		echo "dir$i/**/*.log" &&
+		echo "tmp$i*" || return 1
+	done >ignores/.gitignore &&
+	for i in $(test_seq 1 100)
+	do
+		for j in $(test_seq 1 20)
+		do
+			echo "dir$i/sub/file$j.ext$j" &&
+			echo "dir$i/out" &&
+			echo "dir$i/sub/keep$j.ext$j" &&
+			echo "dir$i/sub/file$j.log" &&
+			echo "dir$i/tmp$j.c" &&
+			echo "dir$i/plain$j.c" || return 1
+		done
+	done >ignores/paths
+'
+
+test_perf 'check-ignore with 3000 patterns' '
+	git -C ignores check-ignore --no-index --stdin <ignores/paths >/dev/null
+'
+
 test_done
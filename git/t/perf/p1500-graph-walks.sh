@@ -32,10 +32,16 @@ test_expect_success 'setup' '
 		echo "X:$line" >>test-tool-tags || return 1
 	done &&
 
+	grep "^X:" test-tool-refs >test-tool-reach &&
+	sed -n "s/^X:/Y:/p" test-tool-refs >>test-tool-reach &&
+
 	commit=$(git commit-tree $(git rev-parse HEAD^{tree})) &&
 	git update-ref refs/heads/disjoint-base $commit &&
 
-	git commit-graph write --reachable
+	git commit-graph write --reachable &&
+	cp .git/objects/info/commit-graph commit-graph-plain &&
+	git commit-graph write --reachable --reach-index &&
+	cp .git/objects/info/commit-graph commit-graph-reach
 '
 
 test_perf 'ahead-behind counts: git for-each-ref' '
@@ -78,4 +84,54 @@ test_perf 'is-base check: git for-each-ref (disjoint-base)' '
 	git for-each-ref --format="%(is-base:refs/heads/disjoint-base)" --stdin <refs
 '
 
+test_expect_success 'setup: write reachability bitmaps' '
+	git repack -adb
+'
+
+test_perf 'ahead-behind counts: git for-each-ref (bitmaps)' '
+	git for-each-ref --format="%(ahead-behind:HEAD)" --stdin <refs
+'
+
+test_perf 'ahead-behind counts: git branch (bitmaps)' '
+	xargs git branch -l --format="%(ahead-behind:HEAD)" <branches
+'
+
+test_expect_success 'setup: drop the reachability index' '
+	cp commit-graph-plain .git/objects/info/commit-graph
+'
+
+test_perf 'contains: git tag --contains (no reachability index)' '
+	xargs git tag --contains=HEAD~100 <tags
+'
+
+test_perf 'merge-base --is-ancestor (no reachability index)' '
+	for ref in $(cat refs)
+	do
+		git merge-base --is-ancestor $ref HEAD ||
+		test $? = 1 ||
+		return 1
+	done
+'
+
+test_expect_success 'setup: use the reachability index' '
+	cp commit-graph-reach .git/objects/info/commit-graph
+'
+
+test_perf 'contains: git tag --contains (reachability index)' '
+	xargs git tag --contains=HEAD~100 <tags
+'
+
+test_perf 'merge-base --is-ancestor (reachability index)' '
+	for ref in $(cat refs)
+	do
+		git merge-base --is-ancestor $ref HEAD ||
+		test $? = 1 ||
+		return 1
+	done
+'
+
+test_perf 'reach_index: test-tool reach' '
+	test-tool reach reach_index <test-tool-reach
+'
+
 test_done
@@ -13,4 +13,19 @@ do
 	"
 done
 
+test_expect_success 'write commit-graph with identities' '
+	git commit-graph write --reachable --identities
+'
+
+for format in %an-%ae-%s %ad-%cd-%s
+do
+	test_perf "log with $format (commit-graph identities)" "
+		git log --format=\"$format\" >/dev/null
+	"
+done
+
+test_perf 'shortlog (commit-graph identities)' '
+	git shortlog -sn HEAD >/dev/null
+'
+
 test_done
@@ -847,6 +847,52 @@ test_expect_success 'directories and ** matches' '
 	test_cmp expect actual
 '
 
+test_expect_success 'long pattern lists keep the last match' '
+	cat >.gitignore <<-\EOF &&
+	*.o
+	build
+	/out
+	doc/html
+	!keep.o
+	*.log
+	!*.log
+	!/out
+	debug.lo?
+	*.tar.gz
+	!x.tar.gz
+	junk
+	*~
+	tmp*
+	!tmp.o
+	sub/*.c
+	!sub/keep.c
+	!junk/
+	EOF
+	git check-ignore -v -n a.o keep.o dir/build out dir/out doc/html \
+		x.log debug.lox x.tar.gz y.tar.gz file~ tmp.o tmpfile \
+		sub/a.c sub/keep.c junk other >actual &&
+	cat >expect <<-\EOF &&
+	.gitignore:1:*.o	a.o
+	.gitignore:5:!keep.o	keep.o
+	.gitignore:2:build	dir/build
+	.gitignore:8:!/out	out
+	::	dir/out
+	.gitignore:4:doc/html	doc/html
+	.gitignore:7:!*.log	x.log
+	.gitignore:9:debug.lo?	debug.lox
+	.gitignore:11:!x.tar.gz	x.tar.gz
+	.gitignore:10:*.tar.gz	y.tar.gz
+	.gitignore:13:*~	file~
+	.gitignore:15:!tmp.o	tmp.o
+	.gitignore:14:tmp*	tmpfile
+	.gitignore:16:sub/*.c	sub/a.c
+	.gitignore:17:!sub/keep.c	sub/keep.c
+	.gitignore:12:junk	junk
+	::	other
+	EOF
+	test_cmp expect actual
+'
+
 ############################################################################
 #
 # test whitespace handling
@@ -344,4 +344,31 @@ test_expect_success 'DF vs DF/DF case test.' '
 	check_cache_at DF/DF clean
 '
 
+test_expect_success 'checkout.treeThreads does not change the result' '
+	git init tree-threads &&
+	(
+		cd tree-threads &&
+		mkdir -p a/b/c a/d e/f &&
+		touch a/b/c/file a/d/file e/f/file top &&
+		git add . &&
+		git commit -m one &&
+		echo changed >a/b/c/file &&
+		git rm -q e/f/file &&
+		mkdir -p g/h &&
+		touch g/h/file &&
+		git add . &&
+		git commit -m two &&
+		git tag two &&
+		git ls-files --stage >expect &&
+		git checkout -q HEAD^ &&
+
+		GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+			git -c checkout.treeThreads=4 read-tree -m -u HEAD two &&
+		git ls-files --stage >actual &&
+		test_cmp expect actual &&
+		git diff --exit-code two &&
+		grep "\"key\":\"prefetch/queued\"" trace.event
+	)
+'
+
 test_done
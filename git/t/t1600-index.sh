@@ -5,6 +5,8 @@ test_description='index file specific tests'
 . ./test-lib.sh
 
 sane_unset GIT_TEST_SPLIT_INDEX
+# the index is compared byte for byte, which a journal id would upset
+sane_unset GIT_TEST_INDEX_JOURNAL
 
 test_expect_success 'setup' '
 	echo 1 >a
@@ -133,4 +135,175 @@ test_expect_success 'index version config precedence' '
 	test_index_version 0 true 2 2
 '
 
+test_expect_success 'index written on threads is the same' '
+	git init threaded-write &&
+	(
+		cd threaded-write &&
+		for d in a b/c b/d e
+		do
+			mkdir -p $d &&
+			for f in $(test_seq 1 20)
+			do
+				echo "$d/$f" >$d/file-$f || return 1
+			done || return 1
+		done &&
+		git add . &&
+		tree=$(git write-tree) &&
+		git ls-files -s >expect.stage &&
+
+		for version in 2 4
+		do
+			rm -f .git/index &&
+			git -c index.version=$version -c index.threads=1 \
+				read-tree $tree &&
+			git update-index --skip-worktree b/c/file-3 e/file-20 &&
+			mv .git/index expect.index &&
+			git -c index.version=$version -c index.threads=4 \
+				-c index.recordOffsetTable=false \
+				-c index.recordEndOfIndexEntries=false \
+				read-tree $tree &&
+			git -c index.threads=4 \
+				-c index.recordOffsetTable=false \
+				-c index.recordEndOfIndexEntries=false \
+				update-index --skip-worktree b/c/file-3 e/file-20 &&
+			test_cmp_bin expect.index .git/index &&
+
+			rm -f .git/index &&
+			git -c index.version=$version -c index.threads=3 \
+				-c index.recordOffsetTable=true \
+				-c index.recordEndOfIndexEntries=true \
+				read-tree $tree &&
+			git -c index.threads=3 ls-files -s >actual.stage &&
+			test_cmp expect.stage actual.stage || return 1
+		done
+	)
+'
+
+test_expect_success 'index.journal appends changes and gc compacts them' '
+	git init journal &&
+	(
+		cd journal &&
+		git config index.journal true &&
+		for f in $(test_seq 1 20)
+		do
+			echo $f >file-$f || return 1
+		done &&
+		# entries as new as the index would all go into the journal
+		test-tool chmtime =-60 file-* &&
+		git add . &&
+		git commit -m initial &&
+		test_path_is_missing .git/index.journal &&
+		cp .git/index base.index &&
+
+		echo changed >file-3 &&
+		git add file-3 &&
+		git rm -q file-7 &&
+		echo new >new &&
+		git add new &&
+		test_path_is_file .git/index.journal &&
+		test_cmp_bin base.index .git/index &&
+		git -c index.journal=false ls-files -s >actual &&
+		git ls-files -s >expect &&
+		test_cmp expect actual &&
+
+		# a torn record at the end is ignored
+		cp .git/index.journal journal.good &&
+		echo torn >>.git/index.journal &&
+		git ls-files -s >actual &&
+		test_cmp expect actual &&
+		cp journal.good .git/index.journal &&
+
+		git gc &&
+		test_path_is_missing .git/index.journal &&
+		! test_cmp_bin base.index .git/index &&
+		git ls-files -s >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'a full write of the index removes its journal' '
+	(
+		cd journal &&
+		echo more >file-1 &&
+		git add file-1 &&
+		test_path_is_file .git/index.journal &&
+		git ls-files -s >expect &&
+		git commit -m second &&
+		test_path_is_missing .git/index.journal &&
+		git ls-files -s >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'the journal does not grow larger than the index' '
+	git init small-journal &&
+	(
+		cd small-journal &&
+		git config index.journal true &&
+		echo 0 >file &&
+		git add file &&
+		git commit -m initial &&
+		for i in $(test_seq 1 30)
+		do
+			echo $i >file &&
+			git add file &&
+			if test -f .git/index.journal
+			then
+				test $(test_file_size .git/index.journal) -le \
+				     $(test_file_size .git/index) || return 1
+			fi || return 1
+		done &&
+		echo 30 >expect &&
+		git show :file >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'index.mappedEntries maps the entries of the index' '
+	git init mapped &&
+	(
+		cd mapped &&
+		git config index.mappedEntries true &&
+		for f in $(test_seq 1 20)
+		do
+			echo $f >file-$f || return 1
+		done &&
+		git add . &&
+		git update-index --chmod=+x file-2 &&
+		git update-index --skip-worktree file-5 &&
+		test_path_is_file .git/index.entries &&
+
+		git -c index.mappedEntries=false ls-files -s -t >expect &&
+		GIT_TRACE2_EVENT="$(pwd)/trace" git ls-files -s -t >actual &&
+		test_cmp expect actual &&
+		test_trace2_data index read/mapped_entries 20 <trace &&
+
+		echo changed >file-3 &&
+		git add file-3 &&
+		git -c index.mappedEntries=false ls-files -s -t >expect &&
+		git ls-files -s -t >actual &&
+		test_cmp expect actual &&
+
+		# left behind by an older index
+		git -c index.mappedEntries=false update-index --force-write-index &&
+		GIT_TRACE2_EVENT="$(pwd)/trace.stale" git ls-files -s -t >actual &&
+		test_cmp expect actual &&
+		! grep read/mapped_entries trace.stale
+	)
+'
+
+test_expect_success 'index.mappedEntries ignores a truncated image' '
+	(
+		cd mapped &&
+		git update-index --force-write-index &&
+		git -c index.mappedEntries=false ls-files -s -t >expect &&
+		size=$(test_file_size .git/index.entries) &&
+		head -c $(($size - 16)) .git/index.entries >truncated &&
+		mv truncated .git/index.entries &&
+		GIT_TRACE2_EVENT="$(pwd)/trace.truncated" git ls-files -s -t >actual &&
+		test_cmp expect actual &&
+		! grep read/mapped_entries trace.truncated
+	)
+'
+
 test_done
@@ -15,6 +15,7 @@ sane_unset GIT_TEST_SPLIT_INDEX
 # those extensions.
 sane_unset GIT_TEST_FSMONITOR
 sane_unset GIT_TEST_INDEX_THREADS
+sane_unset GIT_TEST_INDEX_JOURNAL
 
 # Create a file named as $1 with content read from stdin.
 # Set the file's mtime to a few seconds in the past to avoid racy situations.
@@ -4,15 +4,13 @@ test_description='Test the lazy init name hash with various folder structures'
 
 . ./test-lib.sh
 
-if test 1 -eq $(test-tool online-cpus)
-then
-	skip_all='skipping lazy-init tests, single cpu'
-	test_done
-fi
+test_lazy_prereq MULTI_CPU '
+	test 1 -lt $(test-tool online-cpus)
+'
 
 LAZY_THREAD_COST=2000
 
-test_expect_success 'no buffer overflow in lazy_init_name_hash' '
+test_expect_success MULTI_CPU 'no buffer overflow in lazy_init_name_hash' '
 	(
 	    test_seq $LAZY_THREAD_COST | sed "s/^/a_/" &&
 	    echo b/b/b &&
@@ -24,4 +22,25 @@ test_expect_success 'no buffer overflow in lazy_init_name_hash' '
 	test-tool lazy-init-name-hash -m
 '
 
+test_expect_success 'looking up a few names only hashes their directories' '
+	git init lookup &&
+	for i in $(test_seq 10)
+	do
+		for j in $(test_seq 10)
+		do
+			test_seq 5 | sed "s|^|dir$i/sub$j/file|" || return 1
+		done || return 1
+	done |
+	sed "s/^/100644 $EMPTY_BLOB	/" |
+	git -C lookup update-index --index-info &&
+
+	test-tool -C lookup lazy-init-name-hash --lookup=3 >out &&
+	read secs nr lookups hashed of total rest <out &&
+	test $hashed -lt $total &&
+
+	test-tool -C lookup lazy-init-name-hash --lookup=500 >out &&
+	read secs nr lookups hashed of total rest <out &&
+	test $hashed -eq $total
+'
+
 test_done
@@ -138,8 +138,16 @@ test_expect_success 'git log with --walk-reflogs does not use Bloom filters' '
 	test_bloom_filters_not_used "--walk-reflogs -- A"
 '
 
-test_expect_success 'git log -- multiple path specs does not use Bloom filters' '
-	test_bloom_filters_not_used "-- file4 A/file1"
+test_expect_success 'git log -- multiple path specs uses Bloom filters' '
+	test_bloom_filters_used "-- file4 A/file1" &&
+	test_bloom_filters_used "-- A/B/C A/file1" &&
+	test_bloom_filters_used "-- A/B A/B/file2" &&
+	test_bloom_filters_used "-- file4 path_does_not_exist"
+'
+
+test_expect_success 'git log -- multiple path specs with magic does not use Bloom filters' '
+	test_bloom_filters_not_used "-- file4 :(icase)A/file1" &&
+	test_bloom_filters_not_used "-- A :(exclude)A/B"
 '
 
 test_expect_success 'git log -- "." pathspec at root does not use Bloom filters' '
@@ -151,9 +159,42 @@ test_expect_success 'git log with wildcard that resolves to a single path uses B
 	test_bloom_filters_used "-- *renamed"
 '
 
-test_expect_success 'git log with wildcard that resolves to a multiple paths does not uses Bloom filters' '
-	test_bloom_filters_not_used "-- *" &&
-	test_bloom_filters_not_used "-- file*"
+# The shell expands these wildcards into several literal paths, which
+# are all looked up in the Bloom filters together.  "*" also matches
+# files that are not tracked, like the trace itself.
+test_expect_success 'git log with wildcard that resolves to multiple paths uses Bloom filters' '
+	test_bloom_filters_used "-- *" &&
+	test_bloom_filters_used "-- file*" &&
+	grep -q "statistics:{\"filter_not_present\":0,\"maybe\":4,\"definitely_not\":8,\"false_positive\":1}" \
+		"$TRASH_DIRECTORY/trace.perf"
+'
+
+test_bloom_filters_used_with_pathspec () {
+	rm -f "$TRASH_DIRECTORY/trace.perf" &&
+	git -c core.commitGraph=false log --pretty="format:%s" -- "$@" >log_wo_bloom &&
+	GIT_TRACE2_PERF="$TRASH_DIRECTORY/trace.perf" \
+		git -c core.commitGraph=true log --pretty="format:%s" -- "$@" >log_w_bloom &&
+	grep -q "statistics:{\"filter_not_present\":0,\"maybe\"" "$TRASH_DIRECTORY/trace.perf" &&
+	test_cmp log_wo_bloom log_w_bloom
+}
+
+test_expect_success 'git log with wildcard pathspec in a directory uses Bloom filters' '
+	test_bloom_filters_used_with_pathspec "A/*1" &&
+	test_bloom_filters_used_with_pathspec "A/B/*" &&
+	test_bloom_filters_used_with_pathspec "A/B/C/file?" file4 &&
+	test_bloom_filters_used_with_pathspec ":(glob)A/**/file2"
+'
+
+test_expect_success 'git log with wildcard pathspec at the root does not use Bloom filters' '
+	for spec in "*" "file*" "*4"
+	do
+		rm -f trace.perf &&
+		git -c core.commitGraph=false log --format=%s -- A "$spec" >expect &&
+		GIT_TRACE2_PERF="$(pwd)/trace.perf" \
+			git -c core.commitGraph=true log --format=%s -- A "$spec" >actual &&
+		! grep "statistics:{" trace.perf &&
+		test_cmp expect actual || return 1
+	done
 '
 
 test_expect_success 'setup - add commit-graph to the chain without Bloom filters' '
@@ -425,6 +466,99 @@ test_expect_success 'Bloom generation backfills empty commits' '
 	)
 '
 
+test_expect_success 'Bloom filters do not depend on commitGraph.threads' '
+	git init threads &&
+	test_when_finished "rm -fr threads" &&
+	(
+		cd threads &&
+		git commit --allow-empty -m empty &&
+		test_commit file &&
+		mkdir -p a/b/c &&
+		for i in $(test_seq 1 12)
+		do
+			echo $i >a/b/c/$i || return 1
+		done &&
+		git add a &&
+		git commit -m large &&
+		test_commit a/b/file &&
+		git rm -r a/b/c &&
+		git commit -m removed &&
+		rm a/b/file.t &&
+		mkdir a/b/file.t &&
+		test_commit a/b/file.t/now-a-dir &&
+		chmod +x file.t &&
+		git update-index --chmod=+x file.t &&
+		git commit -m mode &&
+		git update-index --add --cacheinfo \
+			160000,$(git rev-parse HEAD),sub &&
+		git commit -m submodule &&
+		test_commit last &&
+
+		for threads in 1 4
+		do
+			rm -f .git/objects/info/commit-graph trace.event &&
+			GIT_TEST_BLOOM_SETTINGS_MAX_CHANGED_PATHS=10 \
+				GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+				git -c commitGraph.threads=$threads commit-graph write \
+					--reachable --changed-paths &&
+			test_filter_computed 9 trace.event &&
+			test_filter_trunc_empty 1 trace.event &&
+			test_filter_trunc_large 2 trace.event &&
+			mv .git/objects/info/commit-graph graph.$threads &&
+
+			rm -f trace.event &&
+			GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+				git -c commitGraph.threads=$threads commit-graph write \
+					--reachable --changed-paths --max-new-filters=3 &&
+			test_filter_computed 3 trace.event &&
+			test_filter_not_computed 6 trace.event &&
+			mv .git/objects/info/commit-graph limited.$threads ||
+			return 1
+		done &&
+		test_cmp_bin graph.1 graph.4 &&
+		test_cmp_bin limited.1 limited.4
+	)
+'
+
+test_expect_success 'log -- <path> does not depend on log.threads' '
+	test_commit --no-tag not-in-graph-1 A/file1 &&
+	test_commit --no-tag not-in-graph-2 file4 &&
+	test_when_finished "git reset --hard HEAD~2" &&
+	for path in A A/B A/B/file2 A/B/C/file3 file4 file5 path_does_not_exist
+	do
+		for option in "" "--full-history" "--simplify-merges" "--first-parent"
+		do
+			rm -f trace.perf &&
+			git -c log.threads=1 log --format=%s $option -- $path >expect &&
+			GIT_TRACE2_PERF="$(pwd)/trace.perf" \
+				git -c log.threads=4 log --format=%s $option -- $path >actual &&
+			grep "prefetch/queued" trace.perf &&
+			test_cmp expect actual || return 1
+		done
+	done
+'
+
+test_expect_success 'log -n <count> -- <path> does not look far ahead' '
+	git init lookahead &&
+	(
+		cd lookahead &&
+		for i in $(test_seq 1 40)
+		do
+			echo $i >file &&
+			git add file &&
+			git commit -q -m $i || return 1
+		done &&
+		git commit-graph write --reachable --changed-paths &&
+		GIT_TRACE2_PERF="$(pwd)/trace.perf" \
+			git -c log.threads=4 log --format=%s -n 1 -- file >actual &&
+		echo 40 >expect &&
+		test_cmp expect actual &&
+		grep "prefetch/queued" trace.perf >queued &&
+		queued=$(sed -n "s/.*prefetch\/queued:\([0-9]*\).*/\1/p" queued) &&
+		test "$queued" -le 2
+	)
+'
+
 graph=.git/objects/info/commit-graph
 graphdir=.git/objects/info/commit-graphs
 chain=$graphdir/commit-graph-chain
@@ -221,6 +221,63 @@ test_expect_success 'write graph with new commit' '
 graph_git_behavior 'full graph, commit 8 vs merge 1' full commits/8 merge/1
 graph_git_behavior 'full graph, commit 8 vs merge 2' full commits/8 merge/2
 
+test_expect_success 'rev-list --count walks the commit-graph' '
+	for range in "merge/3" "merge/3 ^commits/4" "merge/1...merge/2" \
+		     "merge/3 ^merge/3" "--all ^commits/2"
+	do
+		git -C full -c core.commitGraph=false rev-list --count $range >expect &&
+		rm -f trace.event &&
+		GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+			git -C full rev-list --count $range >actual &&
+		test_cmp expect actual &&
+		grep "count-reachable/visited" trace.event || return 1
+	done &&
+
+	rm -f trace.event &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		git -C full rev-list --count --no-merges merge/3 >actual &&
+	git -C full -c core.commitGraph=false rev-list --count --no-merges merge/3 >expect &&
+	test_cmp expect actual &&
+	! grep "count-reachable/visited" trace.event
+'
+
+test_expect_success 'rev-list --count takes commits out by generation' '
+	git init count-order &&
+	(
+		cd count-order &&
+		test_commit X &&
+		test_commit T1 &&
+		test_commit B &&
+		git checkout -b side X &&
+		test_commit T2 &&
+		git commit-graph write --reachable &&
+		for range in "T1 T2 ^B" "^B T1 T2" "T2 T1 ^B"
+		do
+			git -c core.commitGraph=false rev-list --count $range >expect &&
+			rm -f trace.event &&
+			GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+				git rev-list --count $range >actual &&
+			test_cmp expect actual &&
+			grep "count-reachable/visited" trace.event || return 1
+		done
+	)
+'
+
+test_expect_success 'rev-list --count walks a graph with topological levels' '
+	test_when_finished "git -C full commit-graph write" &&
+	git -C full -c commitGraph.generationVersion=1 commit-graph write --reachable &&
+	graph_read_expect -C full 11 extra_edges 1 &&
+	for range in "merge/3" "merge/3 ^commits/4" "merge/1...merge/2"
+	do
+		git -C full -c core.commitGraph=false rev-list --count $range >expect &&
+		rm -f trace.event &&
+		GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+			git -C full rev-list --count $range >actual &&
+		test_cmp expect actual &&
+		grep "count-reachable/visited" trace.event || return 1
+	done
+'
+
 test_expect_success 'write graph with nothing new' '
 	git -C full commit-graph write &&
 	test_path_is_file full/$objdir/info/commit-graph &&
@@ -898,6 +955,82 @@ test_expect_success 'reader notices too-small generations chunk' '
 	test_cmp expect.err err
 '
 
+test_expect_success 'commit-graph stores identities and subjects' '
+	test_when_finished "rm -rf identities" &&
+	git init identities &&
+	(
+		cd identities &&
+
+		test_commit A &&
+		test_commit --author "Other Author <other@example.com>" B &&
+		git commit --allow-empty -F - <<-\EOF &&
+		a subject
+		spanning two lines
+
+		and a body
+		EOF
+		git commit-graph write --reachable --identities &&
+		graph_read_expect 3 "generation_data identity_index identity_data subject_index subject_data" &&
+		git commit-graph verify &&
+
+		for format in "%an <%ae> %ad %s" "%aN %cE %cr %ct %f %e" "%h %aI%n%cD %s"
+		do
+			git -c core.commitGraph=false log --format="$format" >expect &&
+			git log --format="$format" >actual &&
+			test_cmp expect actual || return 1
+		done &&
+		git -c core.commitGraph=false log --oneline >expect &&
+		git log --oneline >actual &&
+		test_cmp expect actual &&
+		git -c core.commitGraph=false shortlog HEAD >expect &&
+		git shortlog HEAD >actual &&
+		test_cmp expect actual &&
+
+		# Subjects and identities come from the commit-graph, but
+		# the body still needs the commit object.
+		oid=$(git rev-parse B) &&
+		rm .git/objects/"$(test_oid_to_path "$oid")" &&
+		git log --format="%an %s" >actual &&
+		test_line_count = 3 actual &&
+		git log --oneline >actual &&
+		test_line_count = 3 actual &&
+		test_must_fail git log --format=%b
+	)
+'
+
+test_expect_success 'commit-graph identities fall back for non-UTF-8 commits' '
+	test_when_finished "rm -rf identities" &&
+	git init identities &&
+	(
+		cd identities &&
+
+		test_commit A &&
+		git -c i18n.commitEncoding=ISO8859-1 \
+			commit --allow-empty -m "$(printf "caf\351")" &&
+		git commit-graph write --reachable --identities &&
+		git commit-graph verify &&
+		git -c core.commitGraph=false log --format="%s %e" >expect &&
+		git log --format="%s %e" >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'commit-graph identities are kept until --no-identities' '
+	test_when_finished "rm -rf identities" &&
+	git init identities &&
+	(
+		cd identities &&
+
+		test_commit A &&
+		git commit-graph write --reachable --identities &&
+		test_commit B &&
+		git commit-graph write --reachable &&
+		graph_read_expect 2 "generation_data identity_index identity_data subject_index subject_data" &&
+		git commit-graph write --reachable --no-identities &&
+		graph_read_expect 2 "generation_data"
+	)
+'
+
 test_expect_success 'stale commit cannot be parsed when given directly' '
 	test_when_finished "rm -rf repo" &&
 	git init repo &&
@@ -376,4 +376,59 @@ test_expect_success 'badFilemode is not a strict error' '
 	grep "$tree: badFilemode" err
 '
 
+test_expect_success 'push with receive.connectivityViaIndexPack' '
+	rm -rf dst.git &&
+	git init --bare dst.git &&
+	git -C dst.git config receive.connectivityViaIndexPack true &&
+	git -C dst.git config receive.unpackLimit 1 &&
+	rm -rf src &&
+	git init src &&
+	test_commit -C src base &&
+	git -C src push ../dst.git HEAD:refs/heads/main &&
+	test_commit -C src next &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git -C src push ../dst.git HEAD:refs/heads/main &&
+	test_region receive-pack check-connectivity trace &&
+	test_trace2_data receive-pack connectivity/boundary 2 <trace &&
+	git -C src rev-parse HEAD >expect &&
+	git -C dst.git rev-parse refs/heads/main >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'receive.connectivityViaIndexPack checks objects outside the pack' '
+	rm -rf dst.git &&
+	git init --bare dst.git &&
+	git -C dst.git config receive.connectivityViaIndexPack true &&
+	git -C dst.git config receive.unpackLimit 1 &&
+	(
+		cd dst.git &&
+
+		# an unreachable commit whose tree is missing
+		blob=$(echo one | git hash-object -w --stdin) &&
+		tree=$(printf "100644 blob $blob\tfile\n" | git mktree) &&
+		base=$(git commit-tree -m base $tree) &&
+		rm objects/$(test_oid_to_path $tree) &&
+
+		# a commit on top of it, sent in a pack of its own
+		blob=$(echo two | git hash-object -w --stdin) &&
+		tree=$(printf "100644 blob $blob\tfile\n" | git mktree) &&
+		tip=$(git commit-tree -p $base -m tip $tree) &&
+		printf "%s\n" $tip $tree $blob |
+		git pack-objects --stdout >../tip.pack &&
+		for oid in $tip $tree $blob
+		do
+			rm objects/$(test_oid_to_path $oid) || return 1
+		done &&
+
+		{
+			echo "$ZERO_OID $tip refs/heads/tip" |
+			test-tool pkt-line pack &&
+			printf 0000 &&
+			cat ../tip.pack
+		} >../push.in &&
+		git receive-pack . <../push.in >/dev/null &&
+		test_must_fail git rev-parse --verify refs/heads/tip
+	)
+'
+
 test_done
@@ -383,4 +383,57 @@ test_expect_success 'git fetch --no-all --all (fetch all remotes)' '
 	)
 '
 
+test_expect_success 'fetch.batchRefUpdates updates refs of all remotes' '
+	setup_test_clone test16 &&
+	(
+		cd test16 &&
+		git -c fetch.batchRefUpdates=true fetch --all &&
+		create_fetch_all_expect &&
+		git branch -r >actual &&
+		test_cmp expect actual &&
+		test_line_count = 10 .git/FETCH_HEAD
+	)
+'
+
+test_expect_success 'fetch.batchRefUpdates uses one connectivity check and transaction' '
+	git init batch &&
+	for r in one two three
+	do
+		git clone $r batch-$r &&
+		test_commit -C batch-$r batch-$r &&
+		git -C batch remote add $r ../batch-$r || return 1
+	done &&
+	(
+		cd batch &&
+		GIT_TRACE2_EVENT="$PWD/trace.json" \
+			git -c fetch.batchRefUpdates=true fetch --multiple one two three &&
+		test_region fetch deferred-connectivity trace.json &&
+		test_region fetch deferred-ref-updates trace.json &&
+		grep "\"event\":\"child_start\",\"sid\":\"[^/\"]*\".*\"argv\":\[\"git\",\"rev-list\"" \
+			trace.json >rev-list &&
+		test_line_count = 1 rev-list &&
+		git rev-parse one/main two/main three/main
+	)
+'
+
+test_expect_success 'fetch.batchRefUpdates with --atomic and a failing remote' '
+	setup_test_clone test18 &&
+	(
+		cd test18 &&
+		git remote add bogus ../bogus &&
+		test_must_fail git -c fetch.batchRefUpdates=true \
+			fetch --atomic --multiple one bogus &&
+		test_must_fail git rev-parse --verify refs/remotes/one/main &&
+		git -c fetch.batchRefUpdates=true fetch --atomic --multiple one two &&
+		git rev-parse --verify refs/remotes/one/main &&
+		git rev-parse --verify refs/remotes/two/another
+	)
+'
+
+test_expect_success '--atomic with multiple remotes requires fetch.batchRefUpdates' '
+	setup_test_clone test19 &&
+	test_must_fail git -C test19 fetch --atomic --multiple one two 2>err &&
+	test_grep "can only be used when fetching from one remote" err
+'
+
 test_done
@@ -109,6 +109,39 @@ test_expect_success GZIP 'fetch gzipped empty' '
 	! verify_http_result "200 OK"
 '
 
+test_expect_success POSIXPERM 'upload-pack workers refuse a shared directory' '
+	test_when_finished "rm -rf shared-workers" &&
+	mkdir -m 755 shared-workers &&
+	test_env GIT_HTTP_UPLOAD_PACK_WORKERS="$PWD/shared-workers" \
+		test_http_env upload fetch_body &&
+	verify_http_result "200 OK" &&
+	test_grep "must be a directory owned by us" act.err.$test_count &&
+	test_dir_is_empty shared-workers
+'
+
+test_expect_success 'fetch plain via upload-pack worker' '
+	rm -rf workers &&
+	git config uploadpack.workerIdleTimeout 2 &&
+	test_env GIT_HTTP_UPLOAD_PACK_WORKERS="$PWD/workers" \
+		test_http_env upload fetch_body &&
+	verify_http_result "200 OK" &&
+	ls workers/upload-pack-* >sockets &&
+	test_line_count = 1 sockets
+'
+
+test_expect_success 'fetch plain truncated via upload-pack worker' '
+	test_env GIT_HTTP_UPLOAD_PACK_WORKERS="$PWD/workers" \
+		test_http_env upload fetch_body.trunc &&
+	! verify_http_result "200 OK"
+'
+
+test_expect_success GZIP 'fetch gzipped via upload-pack worker' '
+	test_env HTTP_CONTENT_ENCODING="gzip" \
+		GIT_HTTP_UPLOAD_PACK_WORKERS="$PWD/workers" \
+		test_http_env upload fetch_body.gz &&
+	verify_http_result "200 OK"
+'
+
 test_expect_success GZIP 'push plain' '
 	test_when_finished "git branch -D newbranch" &&
 	test_http_env receive push_body &&
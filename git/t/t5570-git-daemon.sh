@@ -232,4 +232,40 @@ test_expect_success FAKENC 'hostname interpolation works after LF-stripping' '
 	test_cmp expect actual
 '
 
+stop_git_daemon
+mkdir -m 700 workers
+start_git_daemon --upload-pack-workers="$(pwd)/workers"
+
+test_expect_success 'upload-pack workers serve clones' '
+	repo="$GIT_DAEMON_DOCUMENT_ROOT_PATH/worker.git" &&
+	git init --bare "$repo" &&
+	>"$repo"/git-daemon-export-ok &&
+	git -C "$repo" config uploadpack.workerIdleTimeout 2 &&
+	git push "$repo" main &&
+	git clone "$GIT_DAEMON_URL/worker.git" worker-clone &&
+	git -C "$repo" rev-parse main >expect &&
+	git -C worker-clone rev-parse origin/main >actual &&
+	test_cmp expect actual &&
+	ls workers/upload-pack-* >sockets &&
+	test_line_count = 1 sockets
+'
+
+test_expect_success 'upload-pack workers see new refs and objects' '
+	test_commit -C worker-clone worker-one &&
+	git -C worker-clone push "$GIT_DAEMON_DOCUMENT_ROOT_PATH/worker.git" HEAD:main &&
+	git -C worker-clone rev-parse HEAD >expect &&
+	git ls-remote "$GIT_DAEMON_URL/worker.git" refs/heads/main >out &&
+	cut -f1 out >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'upload-pack workers pick up repacks' '
+	git -C "$GIT_DAEMON_DOCUMENT_ROOT_PATH/worker.git" repack -a -d &&
+	git clone "$GIT_DAEMON_URL/worker.git" worker-clone-2 &&
+	git -C worker-clone-2 fsck &&
+	git -C worker-clone rev-parse HEAD >expect &&
+	git -C worker-clone-2 rev-parse HEAD >actual &&
+	test_cmp expect actual
+'
+
 test_done
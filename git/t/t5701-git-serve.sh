@@ -295,6 +295,152 @@ test_expect_success 'symrefs parameter' '
 	test_cmp expect actual
 '
 
+test_expect_success 'ls-refs with advertisement cache' '
+	test_when_finished "rm -rf .git/ls-refs-cache" &&
+	test_config lsrefs.advertisementCache true &&
+	for prefixes in "" "refs/tags/one refs/heads/" "refs/heads/m refs/heads/ refs/t"
+	do
+		{
+			echo command=ls-refs &&
+			echo object-format=$(test_oid algo) &&
+			echo 0001 &&
+			echo peel &&
+			echo symrefs &&
+			for p in $prefixes
+			do
+				echo "ref-prefix $p" || return 1
+			done &&
+			echo 0000
+		} | test-tool pkt-line pack >in &&
+
+		GIT_CONFIG_COUNT=1 \
+		GIT_CONFIG_KEY_0=lsrefs.advertisementCache \
+		GIT_CONFIG_VALUE_0=false \
+			test-tool serve-v2 --stateless-rpc <in >expect &&
+		test-tool serve-v2 --stateless-rpc <in >actual &&
+		test_path_is_file .git/ls-refs-cache/default.lsrc &&
+		test_cmp expect actual &&
+		GIT_TRACE2_EVENT="$PWD/trace" \
+			test-tool serve-v2 --stateless-rpc <in >actual &&
+		test_cmp expect actual &&
+		test_region ! ls-refs build-cache trace || return 1
+	done
+'
+
+test_expect_success 'ref updates invalidate the advertisement cache' '
+	test_when_finished "rm -rf .git/ls-refs-cache .git/refs-stamp" &&
+	test_when_finished "git branch -D cached" &&
+	test_config lsrefs.advertisementCache true &&
+	test-tool pkt-line pack >in <<-EOF &&
+	command=ls-refs
+	object-format=$(test_oid algo)
+	0001
+	peel
+	symrefs
+	ref-prefix refs/heads/cached
+	0000
+	EOF
+
+	test-tool serve-v2 --stateless-rpc <in >out &&
+	test-tool pkt-line unpack <out >actual &&
+	echo 0000 >expect &&
+	test_cmp expect actual &&
+	test_path_is_file .git/ls-refs-cache/default.lsrc &&
+	cp .git/refs-stamp stamp.old &&
+
+	git branch cached main &&
+	! test_cmp stamp.old .git/refs-stamp &&
+	test-tool serve-v2 --stateless-rpc <in >out &&
+	test-tool pkt-line unpack <out >actual &&
+	cat >expect <<-EOF &&
+	$(git rev-parse main) refs/heads/cached
+	0000
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'ref updates with the cache disabled replace the stamp' '
+	test_when_finished "rm -rf .git/ls-refs-cache .git/refs-stamp" &&
+	git branch uncached main &&
+	test_path_is_missing .git/refs-stamp &&
+	test-tool pkt-line pack >in <<-EOF &&
+	command=ls-refs
+	object-format=$(test_oid algo)
+	0001
+	peel
+	symrefs
+	ref-prefix refs/heads/uncached
+	0000
+	EOF
+
+	GIT_CONFIG_COUNT=1 \
+	GIT_CONFIG_KEY_0=lsrefs.advertisementCache \
+	GIT_CONFIG_VALUE_0=true \
+		test-tool serve-v2 --stateless-rpc <in >out &&
+	test_path_is_file .git/ls-refs-cache/default.lsrc &&
+	cp .git/refs-stamp stamp.old &&
+
+	git branch -D uncached &&
+	! test_cmp stamp.old .git/refs-stamp &&
+	GIT_CONFIG_COUNT=1 \
+	GIT_CONFIG_KEY_0=lsrefs.advertisementCache \
+	GIT_CONFIG_VALUE_0=true \
+		test-tool serve-v2 --stateless-rpc <in >out &&
+	test-tool pkt-line unpack <out >actual &&
+	echo 0000 >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'advertisement cache with bogus offsets is rebuilt' '
+	test_when_finished "rm -rf .git/ls-refs-cache .git/refs-stamp" &&
+	test_config lsrefs.advertisementCache true &&
+	test-tool pkt-line pack >in <<-EOF &&
+	command=ls-refs
+	object-format=$(test_oid algo)
+	0001
+	peel
+	symrefs
+	ref-prefix refs/heads/
+	0000
+	EOF
+
+	test-tool serve-v2 --stateless-rpc <in >expect &&
+	# make the offset of the second entry point before the first
+	printf "\001" |
+	dd of=.git/ls-refs-cache/default.lsrc bs=1 conv=notrunc \
+		seek=$((8 + $(test_oid rawsz) + 8 + 8 + 7)) &&
+	GIT_TRACE2_EVENT="$PWD/trace" \
+		test-tool serve-v2 --stateless-rpc <in >actual &&
+	test_cmp expect actual &&
+	test_region ls-refs build-cache trace
+'
+
+test_expect_success 'advertisement cache honors hidden refs' '
+	test_when_finished "rm -rf .git/ls-refs-cache" &&
+	test_config lsrefs.advertisementCache true &&
+	test-tool pkt-line pack >in <<-EOF &&
+	command=ls-refs
+	object-format=$(test_oid algo)
+	0001
+	peel
+	symrefs
+	ref-prefix refs/
+	0000
+	EOF
+
+	test-tool serve-v2 --stateless-rpc <in >out &&
+	test_config uploadpack.hideRefs refs/tags &&
+	test-tool serve-v2 --stateless-rpc <in >out &&
+	test-tool pkt-line unpack <out >actual &&
+	cat >expect <<-EOF &&
+	$(git rev-parse refs/heads/dev) refs/heads/dev
+	$(git rev-parse refs/heads/main) refs/heads/main
+	$(git rev-parse refs/heads/release) refs/heads/release symref-target:refs/heads/main
+	0000
+	EOF
+	test_cmp expect actual
+'
+
 test_expect_success 'sending server-options' '
 	test-tool pkt-line pack >in <<-EOF &&
 	command=ls-refs
@@ -1035,6 +1035,19 @@ test_expect_success 'clone big repository with http:// using protocol v2' '
 	grep "Send header: Transfer-Encoding: chunked" log
 '
 
+test_expect_success 'large requests after the first are sent without probing' '
+	test_when_finished "rm -rf big_child_noprobe trace" &&
+
+	GIT_TRACE2_EVENT="$(pwd)/trace" git \
+		-c protocol.version=2 -c http.postbuffer=65536 \
+		clone "$HTTPD_URL/smart/big" big_child_noprobe &&
+
+	# ls-refs went through without authentication, so the large
+	# fetch request can be streamed without an extra round trip
+	test_trace2_data remote-curl rpc/probe-skipped 1 <trace &&
+	test_region remote-curl post-rpc trace
+'
+
 test_expect_success 'fetch with http:// using protocol v2' '
 	test_when_finished "rm -f log" &&
 
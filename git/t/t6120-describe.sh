@@ -717,6 +717,31 @@ test_expect_success 'describe --broken --dirty with a file with changed stat' '
 	)
 '
 
+test_expect_success 'describe with commitGraph skips unreachable tags' '
+	git init graph-describe &&
+	(
+		cd graph-describe &&
+		test_commit --annotate A &&
+		test_commit B &&
+		test_commit C &&
+		git checkout -b side &&
+		test_commit --annotate D &&
+		test_commit --annotate E &&
+		git checkout - &&
+		git commit-graph write --reachable &&
+
+		echo A-2-g$(git rev-parse --short C) >expect &&
+		git -c core.commitGraph=false describe C >actual &&
+		test_cmp expect actual &&
+		git -c core.commitGraph=true describe C >actual &&
+		test_cmp expect actual &&
+
+		echo D-1-g$(git rev-parse --short E^0) >expect &&
+		git -c core.commitGraph=true describe --exclude=E E^0 >actual &&
+		test_cmp expect actual
+	)
+'
+
 test_expect_success '--always with no refs falls back to commit hash' '
 	git rev-parse HEAD >expect &&
 	git describe --no-abbrev --always --match=no-such-tag >actual &&
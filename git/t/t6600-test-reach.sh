@@ -58,6 +58,9 @@ test_expect_success 'setup' '
 	git -c commitGraph.generationVersion=1 commit-graph write --reachable &&
 	mv .git/objects/info/commit-graph commit-graph-no-gdat &&
 	chmod u+w commit-graph-no-gdat &&
+	git commit-graph write --reachable --reach-index &&
+	mv .git/objects/info/commit-graph commit-graph-reach &&
+	chmod u+w commit-graph-reach &&
 	git config core.commitGraph true
 '
 
@@ -73,6 +76,9 @@ run_all_modes () {
 	test_cmp expect actual &&
 	cp commit-graph-no-gdat .git/objects/info/commit-graph &&
 	"$@" <input >actual &&
+	test_cmp expect actual &&
+	cp commit-graph-reach .git/objects/info/commit-graph &&
+	"$@" <input >actual &&
 	test_cmp expect actual
 }
 
@@ -529,6 +535,20 @@ test_expect_success 'for-each-ref ahead-behind:none' '
 		--format="%(refname) %(ahead-behind:commit-8-4)" --stdin
 '
 
+test_expect_success 'for-each-ref ahead-behind with reachability bitmaps' '
+	git for-each-ref --format="%(refname)" "refs/heads/commit-*" >input &&
+	git for-each-ref --stdin \
+		--format="%(refname) %(ahead-behind:commit-5-5) %(ahead-behind:commit-9-6)" \
+		<input >expect &&
+	test_when_finished "rm -f .git/objects/pack/*.bitmap" &&
+	git repack -adb &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.txt" git for-each-ref --stdin \
+		--format="%(refname) %(ahead-behind:commit-5-5) %(ahead-behind:commit-9-6)" \
+		<input >actual &&
+	test_cmp expect actual &&
+	grep "\"key\":\"ahead-behind/counts\",\"value\":\"200\"" trace.txt
+'
+
 test_expect_success 'for-each-ref merged:linear' '
 	cat >input <<-\EOF &&
 	refs/heads/commit-1-1
@@ -762,4 +782,32 @@ test_expect_success 'for-each-ref is-base: --sort' '
 		--sort=refname --sort=-is-base:commit-2-3
 '
 
+test_expect_success 'reach_index agrees with a walk' '
+	for i in $(test_seq 1 10)
+	do
+		for j in $(test_seq 1 10)
+		do
+			echo "X:commit-$i-$j" &&
+			echo "Y:commit-$i-$j" || return 1
+		done || return 1
+	done >input &&
+	test_when_finished rm -rf .git/objects/info/commit-graph &&
+	cp commit-graph-reach .git/objects/info/commit-graph &&
+	test-tool reach reach_index <input >actual &&
+	grep "^reach_index(X,Y):yes=[1-9][0-9]*,no=[1-9][0-9]*,unknown=[0-9]*$" actual
+'
+
+test_expect_success 'reach_index over split layers' '
+	test_when_finished rm -rf .git/objects/info/commit-graphs &&
+	git show-ref -s commit-5-5 |
+		git commit-graph write --stdin-commits --split --no-reach-index &&
+	git show-ref -s commit-8-8 |
+		git commit-graph write --stdin-commits --split=no-merge --reach-index &&
+	git commit-graph write --reachable --split=no-merge &&
+	test_line_count = 3 .git/objects/info/commit-graphs/commit-graph-chain &&
+	git commit-graph verify &&
+	test-tool reach reach_index <input >actual &&
+	grep "^reach_index(X,Y):yes=[1-9][0-9]*,no=[1-9][0-9]*,unknown=[0-9]*$" actual
+'
+
 test_done
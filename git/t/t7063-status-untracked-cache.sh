@@ -7,6 +7,10 @@ export GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME
 
 . ./test-lib.sh
 
+# Replaying an index journal invalidates the directories of the paths
+# it touches once more, which the counts below do not expect.
+sane_unset GIT_TEST_INDEX_JOURNAL
+
 # On some filesystems (e.g. FreeBSD's ext2 and ufs) directory mtime
 # is updated lazily after contents in the directory changes, which
 # forces the untracked cache code to take the slow path.  A test
@@ -986,6 +990,38 @@ test_expect_success '"status" after file replacement should be clean with UC=fal
 	status_is_clean
 '
 
+test_expect_success 'core.untrackedScanThreads does not change the result' '
+	git init scan-threads &&
+	(
+		cd scan-threads &&
+		mkdir -p a/b/c d/e untracked-dir &&
+		echo "*.o" >.gitignore &&
+		echo ignored-dir >d/.gitignore &&
+		touch a/file a/b/file a/b/c/file d/e/file &&
+		git add . &&
+		git commit -m tracked &&
+		touch a/new a/b/c/new.o d/e/new untracked-dir/file &&
+		mkdir d/ignored-dir &&
+		touch d/ignored-dir/file &&
+
+		git -c core.untrackedCache=false -c core.untrackedScanThreads=1 \
+			status --porcelain -uall --ignored >../expect.status &&
+		git -c core.untrackedCache=false -c core.untrackedScanThreads=4 \
+			status --porcelain -uall --ignored >../actual.status &&
+		test_cmp ../expect.status ../actual.status &&
+
+		git -c core.untrackedCache=true -c core.untrackedScanThreads=4 \
+			status --porcelain -uall >../actual.status &&
+		test-tool dump-untracked-cache >../actual.uc &&
+		git update-index --no-untracked-cache &&
+		git -c core.untrackedCache=true -c core.untrackedScanThreads=1 \
+			status --porcelain -uall >../expect.status &&
+		test-tool dump-untracked-cache >../expect.uc &&
+		test_cmp ../expect.status ../actual.status &&
+		test_cmp ../expect.uc ../actual.uc
+	)
+'
+
 test_expect_success 'empty repo (no index) and core.untrackedCache' '
 	git init emptyrepo &&
 	git -C emptyrepo -c core.untrackedCache=true write-tree
@@ -1774,4 +1774,29 @@ test_expect_success EXPENSIVE 'status does not re-read unchanged 4 or 8 GiB file
 	)
 '
 
+test_expect_success 'core.batchStat does not change the result' '
+	git init batch-stat &&
+	(
+		cd batch-stat &&
+		mkdir -p dir/sub &&
+		for i in 1 2 3 4 5 6 7 8 9
+		do
+			echo $i >file$i &&
+			echo $i >dir/sub/file$i || return 1
+		done &&
+		test_ln_s_add file1 link &&
+		git add . &&
+		git commit -m files &&
+		echo changed >file2 &&
+		rm dir/sub/file3 &&
+		test-tool chmtime =+60 file4 &&
+
+		GIT_TEST_PRELOAD_INDEX=1 git -c core.batchStat=false \
+			status --porcelain -uno >expect &&
+		GIT_TEST_PRELOAD_INDEX=1 git -c core.batchStat=true \
+			status --porcelain -uno >actual &&
+		test_cmp expect actual
+	)
+'
+
 test_done
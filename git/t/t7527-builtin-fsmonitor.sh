@@ -571,6 +571,55 @@ test_expect_success 'flush cached data' '
 	grep "file_3" actual_q3
 '
 
+test_expect_success 'status.fsmonitorCache reuses unchanged output' '
+	test_when_finished "stop_daemon_delete_repo test_status_cache" &&
+
+	git init test_status_cache &&
+	test_commit -C test_status_cache initial &&
+	git -C test_status_cache config core.fsmonitor true &&
+	git -C test_status_cache config status.fsmonitorCache true &&
+
+	start_daemon -C test_status_cache &&
+
+	git -C test_status_cache status >expect &&
+	GIT_TRACE2_EVENT="$PWD/.git/trace_hit" \
+		git -C test_status_cache status >actual &&
+	test_cmp expect actual &&
+	grep "\"fsmonitor-cache\",\"value\":\"hit\"" .git/trace_hit &&
+
+	echo change >test_status_cache/initial.t &&
+	>test_status_cache/untracked &&
+	GIT_TRACE2_EVENT="$PWD/.git/trace_miss" \
+		git -C test_status_cache status >actual &&
+	grep "\"fsmonitor-cache\",\"value\":\"miss\"" .git/trace_miss &&
+	git -C test_status_cache -c status.fsmonitorCache=false status >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'status.fsmonitorCache keeps working once it is full' '
+	test_when_finished "stop_daemon_delete_repo test_status_cache_full" &&
+
+	git init test_status_cache_full &&
+	test_commit -C test_status_cache_full initial &&
+	git -C test_status_cache_full config core.fsmonitor true &&
+	git -C test_status_cache_full config status.fsmonitorCache true &&
+
+	start_daemon -C test_status_cache_full &&
+
+	# more outputs than the daemon keeps, each under its own key
+	for i in $(test_seq 1 20)
+	do
+		git -C test_status_cache_full status -- path-$i >expect.$i ||
+		return 1
+	done &&
+	git -C test_status_cache_full fsmonitor--daemon status &&
+
+	GIT_TRACE2_EVENT="$PWD/.git/trace_full" \
+		git -C test_status_cache_full status -- path-20 >actual &&
+	test_cmp expect.20 actual &&
+	grep "\"fsmonitor-cache\",\"value\":\"hit\"" .git/trace_full
+'
+
 # The next few test cases create repos where the .git directory is NOT
 # inside the one of the working directory.  That is, where .git is a file
 # that points to a directory elsewhere.  This happens for submodules and
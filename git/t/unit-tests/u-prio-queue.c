@@ -7,12 +7,21 @@ static int intcmp(const void *va, const void *vb, void *data UNUSED)
 	return *a - *b;
 }
 
+static void intkey(const void *va, uint64_t key[2], void *data UNUSED)
+{
+	const int *a = va;
+	key[0] = INT_MAX - *a;
+	key[1] = 0;
+}
+
 
 #define MISSING  -1
 #define DUMP	 -2
 #define STACK	 -3
 #define GET	 -4
 #define REVERSE  -5
+#define REPLACE  -6
+#define KEYED    -7
 
 static int show(int *v)
 {
@@ -51,6 +60,17 @@ static void test_prio_queue(int *input, size_t input_size,
 		case REVERSE:
 			prio_queue_reverse(&pq);
 			break;
+		case REPLACE:
+			peek = prio_queue_peek(&pq);
+			cl_assert(i + 1 < input_size);
+			prio_queue_replace(&pq, &input[++i]);
+			cl_assert(j < result_size);
+			cl_assert_equal_i(result[j], show(peek));
+			j++;
+			break;
+		case KEYED:
+			pq.get_key = intkey;
+			break;
 		default:
 			prio_queue_put(&pq, &input[i]);
 			break;
@@ -92,3 +112,32 @@ void test_prio_queue__reverse_stack(void)
 	TEST_INPUT(((int []){ STACK, 1, 2, 3, 4, 5, 6, REVERSE, DUMP }),
 		   ((int []){ 1, 2, 3, 4, 5, 6 }));
 }
+
+void test_prio_queue__replace(void)
+{
+	TEST_INPUT(((int []){ REPLACE, 6, 2, 4, REPLACE, 5, 7, 3, REPLACE, 1, DUMP }),
+		   ((int []){ MISSING, 2, 3, 1, 4, 5, 6, 7 }));
+}
+
+void test_prio_queue__replace_stack(void)
+{
+	TEST_INPUT(((int []){ STACK, 8, 1, 5, REPLACE, 4, 6, REPLACE, 2, 3, DUMP }),
+		   ((int []){ 5, 6, 3, 2, 4, 1, 8 }));
+}
+
+void test_prio_queue__keyed(void)
+{
+	TEST_INPUT(((int []){ KEYED, 2, 6, 3, 10, 9, 5, 7, 4, 5, 8, 1, GET, REPLACE, 11, DUMP }),
+		   ((int []){ 1, 2, 3, 4, 5, 5, 6, 7, 8, 9, 10, 11 }));
+}
+
+void test_prio_queue__many(void)
+{
+	int input[] = { 17, 3, 25, 9, 12, 31, 0, 8, 8, 21, 14, 6, 27, 19, 2, 11,
+			5, 30, 1, 23, 16, 4, 29, 13, 7, 22, 10, 26, 15, 18, 24, 20,
+			28, 3, DUMP };
+	int result[] = { 0, 1, 2, 3, 3, 4, 5, 6, 7, 8, 8, 9, 10, 11, 12, 13, 14,
+			 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28,
+			 29, 30, 31 };
+	TEST_INPUT(input, result);
+}
@@ -0,0 +1,433 @@
+#include "git-compat-util.h"
+#include "tree-prefetch.h"
+#include "gettext.h"
+#include "hash.h"
+#include "hashmap.h"
+#include "object-store-ll.h"
+#include "oid-array.h"
+#include "repository.h"
+#include "thread-utils.h"
+#include "trace2.h"
+#include "tree.h"
+#include "tree-walk.h"
+
+enum tree_job_state {
+	TREE_JOB_QUEUED,
+	TREE_JOB_RUNNING,
+	TREE_JOB_DONE,
+	TREE_JOB_CANCELLED,
+};
+
+/* The read of one tree, until the main thread takes it. */
+struct tree_job {
+	struct hashmap_entry ent;
+	struct object_id oid;
+	enum tree_job_state state;
+	void *buf;
+	unsigned long size;
+};
+
+/*
+ * The trees found at the same path in each of the root trees, which a
+ * thread reads together so that it can find where they differ below.
+ * "jobs[i]" is NULL if there is no tree at "oids[i]", or if another
+ * tuple reads that tree already, and is the same as "jobs[j]" if the
+ * trees at "i" and "j" are the same.
+ */
+struct tree_tuple {
+	struct tree_tuple *next;
+	struct object_id oids[TREE_PREFETCH_MAX_TREES];
+	struct tree_job *jobs[TREE_PREFETCH_MAX_TREES];
+};
+
+struct tree_prefetch {
+	struct repository *r;
+	int n;
+	int all;
+
+	pthread_t *threads;
+	int nr_threads;
+
+	/*
+	 * Everything below is protected by "mutex".  Jobs are in "jobs"
+	 * until the main thread takes them, and their tuple is on the
+	 * LIFO "stack" until a thread picks it up.
+	 */
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+	struct hashmap jobs;
+	struct tree_tuple *stack;
+	int stopping;
+
+	unsigned int nr_queued, nr_taken, nr_waited;
+};
+
+/* Bounds the trees read but not taken yet, and their memory. */
+#define TREE_PREFETCH_MAX_JOBS 4096
+
+static int tree_job_cmp(const void *cmp_data UNUSED,
+			const struct hashmap_entry *eptr,
+			const struct hashmap_entry *entry_or_key,
+			const void *keydata)
+{
+	const struct tree_job *a, *b;
+
+	a = container_of(eptr, const struct tree_job, ent);
+	b = container_of(entry_or_key, const struct tree_job, ent);
+
+	return !oideq(&a->oid, keydata ? keydata : &b->oid);
+}
+
+static struct tree_job *find_job(struct tree_prefetch *p,
+				 const struct object_id *oid)
+{
+	return hashmap_get_entry_from_hash(&p->jobs, oidhash(oid), oid,
+					   struct tree_job, ent);
+}
+
+/*
+ * Append to "children" the trees found at each directory of the trees
+ * "descs" that the traversal will descend into, "p->n" object names at
+ * a time, with the null oid where a tree has no such directory.
+ */
+static int find_subtrees(struct tree_prefetch *p, struct tree_desc *descs,
+			 struct oid_array *children)
+{
+	struct name_entry entries[TREE_PREFETCH_MAX_TREES];
+	int have[TREE_PREFETCH_MAX_TREES] = { 0 };
+
+	for (;;) {
+		const struct name_entry *first = NULL;
+		int matched[TREE_PREFETCH_MAX_TREES];
+		int differ = 0;
+
+		for (int i = 0; i < p->n; i++) {
+			/* Only directories are descended into. */
+			while (!have[i] && descs[i].size) {
+				if (!tree_entry_gently(&descs[i], &entries[i]))
+					return -1;
+				have[i] = S_ISDIR(entries[i].mode);
+			}
+			if (!have[i])
+				continue;
+			if (!first ||
+			    base_name_compare(entries[i].path,
+					      tree_entry_len(&entries[i]), S_IFDIR,
+					      first->path, tree_entry_len(first),
+					      S_IFDIR) < 0)
+				first = &entries[i];
+		}
+		if (!first)
+			return 0;
+
+		for (int i = 0; i < p->n; i++) {
+			matched[i] = have[i] &&
+				tree_entry_len(&entries[i]) == tree_entry_len(first) &&
+				!memcmp(entries[i].path, first->path,
+					tree_entry_len(first));
+			if (!matched[i] || !oideq(&entries[i].oid, &first->oid))
+				differ = 1;
+		}
+
+		for (int i = 0; i < p->n; i++) {
+			if (differ || p->all)
+				oid_array_append(children, matched[i] ?
+						 &entries[i].oid : null_oid());
+			if (matched[i])
+				have[i] = 0;
+		}
+	}
+}
+
+/*
+ * Queue the reads of the trees in "children" so that the first of them
+ * is picked up first.  Called with the mutex held.
+ */
+static void queue_subtrees(struct tree_prefetch *p,
+			   const struct oid_array *children)
+{
+	for (size_t c = children->nr; c; c -= p->n) {
+		const struct object_id *oids = children->oid + c - p->n;
+		struct tree_tuple *tuple;
+		int have_jobs = 0;
+
+		if (hashmap_get_size(&p->jobs) >= TREE_PREFETCH_MAX_JOBS)
+			break;
+
+		CALLOC_ARRAY(tuple, 1);
+		for (int i = 0; i < p->n; i++) {
+			struct tree_job *job = NULL;
+
+			oidcpy(&tuple->oids[i], &oids[i]);
+			if (is_null_oid(&oids[i]))
+				continue;
+			for (int j = 0; j < i && !job; j++)
+				if (oideq(&oids[j], &oids[i]))
+					job = tuple->jobs[j];
+			if (!job && !find_job(p, &oids[i])) {
+				CALLOC_ARRAY(job, 1);
+				hashmap_entry_init(&job->ent, oidhash(&oids[i]));
+				oidcpy(&job->oid, &oids[i]);
+				hashmap_add(&p->jobs, &job->ent);
+				p->nr_queued++;
+				have_jobs = 1;
+			}
+			tuple->jobs[i] = job;
+		}
+
+		if (!have_jobs) {
+			free(tuple);
+			continue;
+		}
+		tuple->next = p->stack;
+		p->stack = tuple;
+	}
+	pthread_cond_broadcast(&p->work_cond);
+}
+
+/* Whether "tuple->jobs[i]" is the first mention of its job. */
+static int first_mention(struct tree_tuple *tuple, int i)
+{
+	for (int j = 0; j < i; j++)
+		if (tuple->jobs[j] == tuple->jobs[i])
+			return 0;
+	return 1;
+}
+
+static void read_tuple(struct tree_prefetch *p, struct tree_tuple *tuple)
+{
+	struct tree_desc descs[TREE_PREFETCH_MAX_TREES];
+	struct oid_array children = OID_ARRAY_INIT;
+	int complete = 1;
+
+	for (int i = 0; i < p->n; i++) {
+		struct tree_job *job = tuple->jobs[i];
+		enum object_type type;
+
+		if (!job || !first_mention(tuple, i))
+			continue;
+		job->buf = repo_read_object_file(p->r, &job->oid, &type,
+						 &job->size);
+		if (job->buf && type != OBJ_TREE)
+			FREE_AND_NULL(job->buf);
+	}
+
+	for (int i = 0; i < p->n; i++) {
+		struct tree_job *job = tuple->jobs[i];
+
+		if (is_null_oid(&tuple->oids[i])) {
+			init_tree_desc(&descs[i], NULL, NULL, 0);
+		} else if (!job || !job->buf ||
+			   init_tree_desc_gently(&descs[i], &job->oid,
+						 job->buf, job->size, 0)) {
+			complete = 0;
+			break;
+		}
+	}
+
+	/*
+	 * The buffers are only handed out once the jobs are done, so
+	 * they can be walked without the mutex.
+	 */
+	if (complete && find_subtrees(p, descs, &children))
+		oid_array_clear(&children);
+
+	pthread_mutex_lock(&p->mutex);
+	for (int i = 0; i < p->n; i++)
+		if (tuple->jobs[i])
+			tuple->jobs[i]->state = TREE_JOB_DONE;
+	queue_subtrees(p, &children);
+	pthread_cond_broadcast(&p->done_cond);
+	pthread_mutex_unlock(&p->mutex);
+
+	oid_array_clear(&children);
+}
+
+/*
+ * Drop the jobs of "tuple" the main thread cancelled, and the tuple if
+ * it has no jobs left.  Called with the mutex held.
+ */
+static int drop_cancelled(struct tree_tuple *tuple)
+{
+	int have_jobs = 0;
+
+	for (int i = 0; i < TREE_PREFETCH_MAX_TREES; i++) {
+		struct tree_job *job = tuple->jobs[i];
+
+		if (!job || job->state != TREE_JOB_CANCELLED)
+			continue;
+		for (int j = i + 1; j < TREE_PREFETCH_MAX_TREES; j++)
+			if (tuple->jobs[j] == job)
+				tuple->jobs[j] = NULL;
+		tuple->jobs[i] = NULL;
+		free(job);
+	}
+
+	for (int i = 0; i < TREE_PREFETCH_MAX_TREES; i++)
+		if (tuple->jobs[i])
+			have_jobs = 1;
+	if (!have_jobs)
+		free(tuple);
+	return have_jobs;
+}
+
+static void *tree_prefetch_worker(void *data)
+{
+	struct tree_prefetch *p = data;
+
+	pthread_mutex_lock(&p->mutex);
+	for (;;) {
+		struct tree_tuple *tuple;
+
+		while (!p->stack && !p->stopping)
+			pthread_cond_wait(&p->work_cond, &p->mutex);
+		if (p->stopping)
+			break;
+
+		tuple = p->stack;
+		p->stack = tuple->next;
+		if (!drop_cancelled(tuple))
+			continue;
+
+		for (int i = 0; i < p->n; i++)
+			if (tuple->jobs[i])
+				tuple->jobs[i]->state = TREE_JOB_RUNNING;
+		pthread_mutex_unlock(&p->mutex);
+
+		read_tuple(p, tuple);
+		free(tuple);
+
+		pthread_mutex_lock(&p->mutex);
+	}
+	pthread_mutex_unlock(&p->mutex);
+
+	return NULL;
+}
+
+struct tree_prefetch *tree_prefetch_start(struct repository *r,
+					  int n, const struct tree_desc *roots,
+					  int all, int nr_threads)
+{
+	struct tree_desc descs[TREE_PREFETCH_MAX_TREES];
+	struct oid_array children = OID_ARRAY_INIT;
+	struct tree_prefetch *p;
+
+	if (!HAVE_THREADS || nr_threads < 1 ||
+	    n < 1 || n > TREE_PREFETCH_MAX_TREES)
+		return NULL;
+
+	CALLOC_ARRAY(p, 1);
+	p->r = r;
+	p->n = n;
+	p->all = all;
+	hashmap_init(&p->jobs, tree_job_cmp, NULL, 0);
+	pthread_mutex_init(&p->mutex, NULL);
+	pthread_cond_init(&p->work_cond, NULL);
+	pthread_cond_init(&p->done_cond, NULL);
+
+	/* The threads are not running yet; no need for the mutex. */
+	COPY_ARRAY(descs, roots, n);
+	if (!find_subtrees(p, descs, &children))
+		queue_subtrees(p, &children);
+	oid_array_clear(&children);
+	if (!p->stack) {
+		tree_prefetch_stop(p);
+		return NULL;
+	}
+
+	enable_obj_read_lock();
+
+	CALLOC_ARRAY(p->threads, nr_threads);
+	for (int i = 0; i < nr_threads; i++) {
+		int err = pthread_create(&p->threads[i], NULL,
+					 tree_prefetch_worker, p);
+		if (err) {
+			warning(_("unable to create thread: %s"), strerror(err));
+			break;
+		}
+		p->nr_threads++;
+	}
+
+	if (!p->nr_threads) {
+		tree_prefetch_stop(p);
+		return NULL;
+	}
+	return p;
+}
+
+void *tree_prefetch_take(struct tree_prefetch *p, const struct object_id *oid,
+			 unsigned long *size)
+{
+	struct tree_job *job;
+	void *buf = NULL;
+
+	pthread_mutex_lock(&p->mutex);
+	job = find_job(p, oid);
+	if (!job)
+		goto out;
+
+	hashmap_remove(&p->jobs, &job->ent, NULL);
+	if (job->state == TREE_JOB_QUEUED) {
+		/* The caller will get there first; let the thread drop it. */
+		job->state = TREE_JOB_CANCELLED;
+		goto out;
+	}
+
+	if (job->state == TREE_JOB_RUNNING)
+		p->nr_waited++;
+	while (job->state == TREE_JOB_RUNNING)
+		pthread_cond_wait(&p->done_cond, &p->mutex);
+
+	buf = job->buf;
+	*size = job->size;
+	if (buf)
+		p->nr_taken++;
+	free(job);
+
+out:
+	pthread_mutex_unlock(&p->mutex);
+	return buf;
+}
+
+void tree_prefetch_stop(struct tree_prefetch *p)
+{
+	struct hashmap_iter iter;
+	struct tree_job *job;
+
+	if (!p)
+		return;
+
+	if (p->threads) {
+		pthread_mutex_lock(&p->mutex);
+		p->stopping = 1;
+		pthread_cond_broadcast(&p->work_cond);
+		pthread_mutex_unlock(&p->mutex);
+
+		for (int i = 0; i < p->nr_threads; i++)
+			pthread_join(p->threads[i], NULL);
+		disable_obj_read_lock();
+	}
+
+	/* Cancelled jobs are only on the stack, the others still in "jobs". */
+	while (p->stack) {
+		struct tree_tuple *tuple = p->stack;
+
+		p->stack = tuple->next;
+		if (drop_cancelled(tuple))
+			free(tuple);
+	}
+	hashmap_for_each_entry(&p->jobs, &iter, job, ent)
+		free(job->buf);
+	hashmap_clear_and_free(&p->jobs, struct tree_job, ent);
+
+	trace2_data_intmax("unpack_trees", p->r, "prefetch/queued", p->nr_queued);
+	trace2_data_intmax("unpack_trees", p->r, "prefetch/taken", p->nr_taken);
+	trace2_data_intmax("unpack_trees", p->r, "prefetch/waited", p->nr_waited);
+
+	pthread_cond_destroy(&p->work_cond);
+	pthread_cond_destroy(&p->done_cond);
+	pthread_mutex_destroy(&p->mutex);
+	free(p->threads);
+	free(p);
+}
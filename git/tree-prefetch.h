@@ -0,0 +1,49 @@
+#ifndef TREE_PREFETCH_H
+#define TREE_PREFETCH_H
+
+struct object_id;
+struct repository;
+struct tree_desc;
+
+/*
+ * A pool of threads that reads the trees unpack_trees() is going to
+ * descend into ahead of its traversal, which has to merge the trees
+ * and the index one directory at a time, in order, on the main thread.
+ *
+ * Starting from the directories of the root trees, the threads read the
+ * subtrees of every directory at which the trees differ, as those are
+ * the ones the traversal cannot skip; with a single tree, they read all
+ * of it.  They go depth first, like the traversal does.
+ */
+struct tree_prefetch;
+
+/* The most trees the threads can read side by side. */
+#define TREE_PREFETCH_MAX_TREES 8
+
+/*
+ * Start `nr_threads` threads reading the subtrees of the `n` root trees
+ * `roots`, which are not modified.  With `all`, the threads read every
+ * subtree, and not only those at which the trees differ.
+ *
+ * Returns NULL if no threads could be started.
+ */
+struct tree_prefetch *tree_prefetch_start(struct repository *r,
+					  int n, const struct tree_desc *roots,
+					  int all, int nr_threads);
+
+/*
+ * Return the contents of the tree `oid` and its size if a thread read
+ * it, waiting for it to finish if it is reading it right now, and NULL
+ * otherwise.  A read that has not started yet is cancelled.  The caller
+ * owns the returned buffer.
+ */
+void *tree_prefetch_take(struct tree_prefetch *p, const struct object_id *oid,
+			 unsigned long *size);
+
+/*
+ * Stop the threads and free the pool, including trees nobody asked
+ * for.
+ */
+void tree_prefetch_stop(struct tree_prefetch *p);
+
+#endif /* TREE_PREFETCH_H */
@@ -0,0 +1,436 @@
+#include "git-compat-util.h"
+#include "treesame-prefetch.h"
+#include "gettext.h"
+#include "hash.h"
+#include "hashmap.h"
+#include "object-store-ll.h"
+#include "repository.h"
+#include "thread-utils.h"
+#include "trace2.h"
+#include "tree-walk.h"
+
+enum treesame_job_state {
+	TREESAME_JOB_QUEUED,
+	TREESAME_JOB_RUNNING,
+	TREESAME_JOB_DONE,
+	TREESAME_JOB_CANCELLED,
+};
+
+struct treesame_job {
+	struct hashmap_entry ent;
+	struct object_id old_tree;
+	struct object_id new_tree;
+	struct treesame_job *next;
+	enum treesame_job_state state;
+	int same;
+	timestamp_t date;
+};
+
+struct treesame_prefetch {
+	struct repository *r;
+	char **paths;
+	size_t paths_nr;
+
+	pthread_t *threads;
+	int nr_threads;
+
+	/*
+	 * Everything below is protected by "mutex".  Jobs are in "jobs"
+	 * until the main thread looks them up, and in the FIFO
+	 * "queue_head" until a thread picks them up.
+	 */
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+	struct hashmap jobs;
+	struct treesame_job *queue_head, **queue_tail;
+	size_t pending;
+	int stopping;
+
+	/*
+	 * "lookup_date" is the commit date of the latest job the walk
+	 * looked up, and "evicted_date" the value it had when we last
+	 * evicted jobs.
+	 */
+	timestamp_t lookup_date, evicted_date;
+
+	unsigned int nr_queued, nr_same, nr_waited, nr_evicted;
+};
+
+/* Enough to keep the threads busy while the main thread catches up. */
+#define TREESAME_PENDING_PER_THREAD 8
+#define TREESAME_MAX_JOBS 4096
+
+static unsigned int treesame_job_hash(const struct object_id *old_tree,
+				      const struct object_id *new_tree)
+{
+	return oidhash(old_tree) ^ (oidhash(new_tree) * 31);
+}
+
+/*
+ * Drop the jobs for commits newer than the latest one the walk looked
+ * up.  The walk goes by commit date across all of its branches, so it
+ * went past them without asking, and they only take room from jobs it
+ * will ask about.  Jobs further down the other branches are kept, and
+ * so are jobs that a thread is working on.
+ */
+static void evict_passed_jobs(struct treesame_prefetch *p)
+{
+	struct treesame_job **passed;
+	struct hashmap_iter iter;
+	struct treesame_job *job;
+	size_t nr = 0;
+
+	if (p->evicted_date == p->lookup_date)
+		return;
+	p->evicted_date = p->lookup_date;
+
+	/* Removing entries can resize the map, so do not iterate over it. */
+	ALLOC_ARRAY(passed, hashmap_get_size(&p->jobs));
+	hashmap_for_each_entry(&p->jobs, &iter, job, ent)
+		if (job->date > p->lookup_date &&
+		    job->state != TREESAME_JOB_RUNNING)
+			passed[nr++] = job;
+
+	for (size_t i = 0; i < nr; i++) {
+		job = passed[i];
+		hashmap_remove(&p->jobs, &job->ent, NULL);
+		if (job->state == TREESAME_JOB_QUEUED) {
+			/* Still on the queue; let the thread drop it. */
+			job->state = TREESAME_JOB_CANCELLED;
+			p->pending--;
+		} else {
+			free(job);
+		}
+	}
+	p->nr_evicted += nr;
+	free(passed);
+}
+
+static int treesame_job_cmp(const void *cmp_data UNUSED,
+			    const struct hashmap_entry *eptr,
+			    const struct hashmap_entry *entry_or_key,
+			    const void *keydata UNUSED)
+{
+	const struct treesame_job *a, *b;
+
+	a = container_of(eptr, const struct treesame_job, ent);
+	b = container_of(entry_or_key, const struct treesame_job, ent);
+
+	return !oideq(&a->old_tree, &b->old_tree) ||
+	       !oideq(&a->new_tree, &b->new_tree);
+}
+
+static struct treesame_job *find_job(struct treesame_prefetch *p,
+				     const struct object_id *old_tree,
+				     const struct object_id *new_tree)
+{
+	struct treesame_job key;
+
+	hashmap_entry_init(&key.ent, treesame_job_hash(old_tree, new_tree));
+	oidcpy(&key.old_tree, old_tree);
+	oidcpy(&key.new_tree, new_tree);
+	return hashmap_get_entry(&p->jobs, &key, ent, NULL);
+}
+
+/*
+ * Find the entry called "name" in the tree "oid".  Returns 1 and fills
+ * "entry_oid" and "mode" if there is one, 0 if there is none and -1 if
+ * the tree cannot be read.
+ */
+static int find_entry(struct repository *r, const struct object_id *oid,
+		      const char *name, size_t len,
+		      struct object_id *entry_oid, unsigned short *mode)
+{
+	struct tree_desc desc;
+	struct name_entry entry;
+	enum object_type type;
+	unsigned long size;
+	void *buf;
+	int ret = 0;
+
+	buf = repo_read_object_file(r, oid, &type, &size);
+	if (!buf || type != OBJ_TREE ||
+	    init_tree_desc_gently(&desc, oid, buf, size, 0)) {
+		free(buf);
+		return -1;
+	}
+
+	while (desc.size) {
+		if (!tree_entry_gently(&desc, &entry)) {
+			ret = -1;
+			break;
+		}
+		if (tree_entry_len(&entry) == len &&
+		    !memcmp(entry.path, name, len)) {
+			oidcpy(entry_oid, &entry.oid);
+			*mode = entry.mode;
+			ret = 1;
+			break;
+		}
+	}
+
+	free(buf);
+	return ret;
+}
+
+/*
+ * Return 1 if the trees agree at "path", 0 if they may not, and -1 if
+ * one of them cannot be read.  Leading directories are compared on the
+ * way down, so that a subtree that did not change settles the question
+ * without reading further.
+ */
+static int same_at_path(struct repository *r,
+			const struct object_id *old_tree,
+			const struct object_id *new_tree,
+			const char *path)
+{
+	struct object_id old_oid, new_oid;
+	unsigned short old_mode = S_IFDIR, new_mode = S_IFDIR;
+	int old_found = 1, new_found = 1;
+
+	oidcpy(&old_oid, old_tree);
+	oidcpy(&new_oid, new_tree);
+
+	for (;;) {
+		const char *slash = strchrnul(path, '/');
+		size_t len = slash - path;
+
+		if (old_found && new_found && old_mode == new_mode &&
+		    oideq(&old_oid, &new_oid))
+			return 1;
+
+		/* Nothing below a non-tree can match the path. */
+		old_found = old_found && S_ISDIR(old_mode);
+		new_found = new_found && S_ISDIR(new_mode);
+		if (!old_found && !new_found)
+			return 1;
+		if (!old_found || !new_found)
+			return 0;
+
+		old_found = find_entry(r, &old_oid, path, len, &old_oid, &old_mode);
+		new_found = find_entry(r, &new_oid, path, len, &new_oid, &new_mode);
+		if (old_found < 0 || new_found < 0)
+			return -1;
+
+		if (!*slash)
+			break;
+		path = slash + 1;
+	}
+
+	if (!old_found && !new_found)
+		return 1;
+	return old_found && new_found && old_mode == new_mode &&
+	       oideq(&old_oid, &new_oid);
+}
+
+static int trees_same(struct treesame_prefetch *p,
+		      const struct object_id *old_tree,
+		      const struct object_id *new_tree)
+{
+	for (size_t i = 0; i < p->paths_nr; i++)
+		if (same_at_path(p->r, old_tree, new_tree, p->paths[i]) != 1)
+			return 0;
+	return 1;
+}
+
+static void *treesame_worker(void *data)
+{
+	struct treesame_prefetch *p = data;
+
+	pthread_mutex_lock(&p->mutex);
+	for (;;) {
+		struct treesame_job *job;
+		int same;
+
+		while (!p->queue_head && !p->stopping)
+			pthread_cond_wait(&p->work_cond, &p->mutex);
+		if (p->stopping)
+			break;
+
+		job = p->queue_head;
+		p->queue_head = job->next;
+		if (!p->queue_head)
+			p->queue_tail = &p->queue_head;
+
+		if (job->state == TREESAME_JOB_CANCELLED) {
+			free(job);
+			continue;
+		}
+
+		job->state = TREESAME_JOB_RUNNING;
+		pthread_mutex_unlock(&p->mutex);
+
+		same = trees_same(p, &job->old_tree, &job->new_tree);
+
+		pthread_mutex_lock(&p->mutex);
+		job->same = same;
+		job->state = TREESAME_JOB_DONE;
+		p->pending--;
+		pthread_cond_broadcast(&p->done_cond);
+	}
+	pthread_mutex_unlock(&p->mutex);
+
+	return NULL;
+}
+
+struct treesame_prefetch *treesame_prefetch_start(struct repository *r,
+						  const char **paths,
+						  size_t paths_nr,
+						  int nr_threads)
+{
+	struct treesame_prefetch *p;
+
+	if (!HAVE_THREADS || nr_threads < 1 || !paths_nr)
+		return NULL;
+
+	CALLOC_ARRAY(p, 1);
+	p->r = r;
+	ALLOC_ARRAY(p->paths, paths_nr);
+	for (size_t i = 0; i < paths_nr; i++)
+		p->paths[i] = xstrdup(paths[i]);
+	p->paths_nr = paths_nr;
+	p->queue_tail = &p->queue_head;
+	p->lookup_date = p->evicted_date = TIME_MAX;
+	hashmap_init(&p->jobs, treesame_job_cmp, NULL, 0);
+	pthread_mutex_init(&p->mutex, NULL);
+	pthread_cond_init(&p->work_cond, NULL);
+	pthread_cond_init(&p->done_cond, NULL);
+
+	enable_obj_read_lock();
+
+	CALLOC_ARRAY(p->threads, nr_threads);
+	for (int i = 0; i < nr_threads; i++) {
+		int err = pthread_create(&p->threads[i], NULL,
+					 treesame_worker, p);
+		if (err) {
+			warning(_("unable to create thread: %s"), strerror(err));
+			break;
+		}
+		p->nr_threads++;
+	}
+
+	if (!p->nr_threads) {
+		treesame_prefetch_stop(p);
+		return NULL;
+	}
+	return p;
+}
+
+int treesame_prefetch_add(struct treesame_prefetch *p,
+			  const struct object_id *old_tree,
+			  const struct object_id *new_tree,
+			  timestamp_t date)
+{
+	struct treesame_job *job;
+	int ret = 0;
+
+	if (oideq(old_tree, new_tree))
+		return 0;
+
+	pthread_mutex_lock(&p->mutex);
+	if (find_job(p, old_tree, new_tree))
+		goto out;
+	if (hashmap_get_size(&p->jobs) >= TREESAME_MAX_JOBS)
+		evict_passed_jobs(p);
+	if (p->pending >= (size_t)p->nr_threads * TREESAME_PENDING_PER_THREAD ||
+	    hashmap_get_size(&p->jobs) >= TREESAME_MAX_JOBS) {
+		ret = -1;
+		goto out;
+	}
+
+	CALLOC_ARRAY(job, 1);
+	hashmap_entry_init(&job->ent, treesame_job_hash(old_tree, new_tree));
+	oidcpy(&job->old_tree, old_tree);
+	oidcpy(&job->new_tree, new_tree);
+	job->date = date;
+	hashmap_add(&p->jobs, &job->ent);
+
+	*p->queue_tail = job;
+	p->queue_tail = &job->next;
+	p->pending++;
+	p->nr_queued++;
+	pthread_cond_signal(&p->work_cond);
+
+out:
+	pthread_mutex_unlock(&p->mutex);
+	return ret;
+}
+
+int treesame_prefetch_lookup(struct treesame_prefetch *p,
+			     const struct object_id *old_tree,
+			     const struct object_id *new_tree)
+{
+	struct treesame_job *job;
+	int same = 0;
+
+	if (oideq(old_tree, new_tree))
+		return 1;
+
+	pthread_mutex_lock(&p->mutex);
+	job = find_job(p, old_tree, new_tree);
+	if (!job)
+		goto out;
+
+	hashmap_remove(&p->jobs, &job->ent, NULL);
+	p->lookup_date = job->date;
+	if (job->state == TREESAME_JOB_QUEUED) {
+		/* The caller will get there first; let the thread drop it. */
+		job->state = TREESAME_JOB_CANCELLED;
+		p->pending--;
+		goto out;
+	}
+
+	if (job->state == TREESAME_JOB_RUNNING)
+		p->nr_waited++;
+	while (job->state == TREESAME_JOB_RUNNING)
+		pthread_cond_wait(&p->done_cond, &p->mutex);
+
+	same = job->same;
+	if (same)
+		p->nr_same++;
+	free(job);
+
+out:
+	pthread_mutex_unlock(&p->mutex);
+	return same;
+}
+
+void treesame_prefetch_stop(struct treesame_prefetch *p)
+{
+	struct treesame_job *job, *next;
+
+	if (!p)
+		return;
+
+	pthread_mutex_lock(&p->mutex);
+	p->stopping = 1;
+	pthread_cond_broadcast(&p->work_cond);
+	pthread_mutex_unlock(&p->mutex);
+
+	for (int i = 0; i < p->nr_threads; i++)
+		pthread_join(p->threads[i], NULL);
+	disable_obj_read_lock();
+
+	/* Cancelled jobs are only on the queue, the others still in "jobs". */
+	for (job = p->queue_head; job; job = next) {
+		next = job->next;
+		if (job->state == TREESAME_JOB_CANCELLED)
+			free(job);
+	}
+	hashmap_clear_and_free(&p->jobs, struct treesame_job, ent);
+
+	trace2_data_intmax("treesame", p->r, "prefetch/queued", p->nr_queued);
+	trace2_data_intmax("treesame", p->r, "prefetch/same", p->nr_same);
+	trace2_data_intmax("treesame", p->r, "prefetch/waited", p->nr_waited);
+	trace2_data_intmax("treesame", p->r, "prefetch/evicted", p->nr_evicted);
+
+	pthread_cond_destroy(&p->work_cond);
+	pthread_cond_destroy(&p->done_cond);
+	pthread_mutex_destroy(&p->mutex);
+	for (size_t i = 0; i < p->paths_nr; i++)
+		free(p->paths[i]);
+	free(p->paths);
+	free(p->threads);
+	free(p);
+}
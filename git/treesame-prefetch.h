@@ -0,0 +1,59 @@
+#ifndef TREESAME_PREFETCH_H
+#define TREESAME_PREFETCH_H
+
+struct object_id;
+struct repository;
+
+/*
+ * A pool of threads that speculatively compares pairs of trees at a
+ * fixed set of literal paths, so that a path-limited revision walk can
+ * learn that a commit is TREESAME to its parent without running the tree
+ * diff itself.
+ *
+ * The threads can only prove that two trees agree at every path; when
+ * they do not, the caller still has to run the real diff to find out how
+ * they differ.  This is what makes false positives of the changed-path
+ * Bloom filters cheap, as they are exactly the pairs the threads settle.
+ */
+struct treesame_prefetch;
+
+/*
+ * Start `nr_threads` threads comparing trees at `paths`, which are
+ * literal paths relative to the root of the trees, without a trailing
+ * slash.  Returns NULL if the pool could not be set up, in which case
+ * all comparisons have to be done by the caller.
+ */
+struct treesame_prefetch *treesame_prefetch_start(struct repository *r,
+						  const char **paths,
+						  size_t paths_nr,
+						  int nr_threads);
+
+/*
+ * Queue the comparison of `old_tree` and `new_tree`, the trees of a
+ * commit made at `date` and of its parent.  Returns -1 if the pool has
+ * enough work queued already, and 0 otherwise.  When the pool needs
+ * room, comparisons for commits newer than the latest one that was
+ * looked up are dropped.
+ */
+int treesame_prefetch_add(struct treesame_prefetch *p,
+			  const struct object_id *old_tree,
+			  const struct object_id *new_tree,
+			  timestamp_t date);
+
+/*
+ * Return 1 if the comparison of `old_tree` and `new_tree` was queued and
+ * showed that they agree at every path, waiting for it to finish if a
+ * thread is working on it.  Returns 0 otherwise, including when the pair
+ * was queued but no thread has picked it up yet; it is then dropped from
+ * the queue.
+ */
+int treesame_prefetch_lookup(struct treesame_prefetch *p,
+			     const struct object_id *old_tree,
+			     const struct object_id *new_tree);
+
+/*
+ * Stop the threads and free the pool.
+ */
+void treesame_prefetch_stop(struct treesame_prefetch *p);
+
+#endif /* TREESAME_PREFETCH_H */
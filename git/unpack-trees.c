@@ -25,12 +25,16 @@
 #include "submodule-config.h"
 #include "symlinks.h"
 #include "trace2.h"
+#include "tree-prefetch.h"
 #include "fsmonitor.h"
 #include "object-store-ll.h"
 #include "promisor-remote.h"
 #include "entry.h"
 #include "parallel-checkout.h"
 #include "setup.h"
+#include "config.h"
+#include "replace-object.h"
+#include "thread-utils.h"
 
 /*
  * Error messages expected by scripts out of plumbing commands such as
@@ -863,6 +867,27 @@ static int traverse_by_cache_tree(int pos, int nr_entries, int nr_names,
 	return 0;
 }
 
+/*
+ * Like fill_tree_descriptor(), but take the tree from the threads reading
+ * ahead of the traversal if one of them read it.
+ */
+static void *fill_tree_descriptor_ahead(struct unpack_trees_options *o,
+					struct tree_desc *desc,
+					const struct object_id *oid)
+{
+	unsigned long size;
+	void *buf;
+
+	if (oid && o->internal.tree_prefetch) {
+		buf = tree_prefetch_take(o->internal.tree_prefetch, oid, &size);
+		if (buf) {
+			init_tree_desc(desc, oid, buf, size);
+			return buf;
+		}
+	}
+	return fill_tree_descriptor(the_repository, desc, oid);
+}
+
 static int traverse_trees_recursive(int n, unsigned long dirmask,
 				    unsigned long df_conflicts,
 				    struct name_entry *names,
@@ -937,7 +962,7 @@ static int traverse_trees_recursive(int n, unsigned long dirmask,
 			const struct object_id *oid = NULL;
 			if (dirmask & 1)
 				oid = &names[i].oid;
-			buf[nr_buf++] = fill_tree_descriptor(the_repository, t + i, oid);
+			buf[nr_buf++] = fill_tree_descriptor_ahead(o, t + i, oid);
 		}
 	}
 
@@ -1882,6 +1907,41 @@ static int verify_absent(const struct cache_entry *,
  *
  * CE_ADDED, CE_UNPACKED and CE_NEW_SKIP_WORKTREE are used internally
  */
+/*
+ * Start threads reading the trees the traversal is going to descend
+ * into, if that is worth it.
+ */
+static struct tree_prefetch *start_tree_prefetch(struct unpack_trees_options *o,
+						 unsigned len, struct tree_desc *t)
+{
+	struct repository *r = the_repository;
+	struct cache_tree *cache_tree = o->src_index->cache_tree;
+	int nr_threads;
+
+	if (!HAVE_THREADS ||
+	    (o->pathspec && o->pathspec->nr) || o->prefix ||
+	    o->src_index->sparse_index ||
+	    repo_has_promisor_remote(r))
+		return NULL;
+
+	/* A single tree the index matches is not traversed at all. */
+	if (len == 1 && o->merge && cache_tree && cache_tree->entry_count >= 0)
+		return NULL;
+
+	if (repo_config_get_int(r, "checkout.treethreads", &nr_threads) ||
+	    nr_threads < 1)
+		nr_threads = online_cpus();
+	/* The traversal itself runs on the main thread. */
+	if (--nr_threads < 1)
+		return NULL;
+
+	/* Threads must not be the first to look up replace refs. */
+	if (replace_refs_enabled(r))
+		prepare_replace_object(r);
+
+	return tree_prefetch_start(r, len, t, len == 1, nr_threads);
+}
+
 int unpack_trees(unsigned len, struct tree_desc *t, struct unpack_trees_options *o)
 {
 	struct repository *repo = the_repository;
@@ -2009,7 +2069,10 @@ int unpack_trees(unsigned len, struct tree_desc *t, struct unpack_trees_options
 
 		trace_performance_enter();
 		trace2_region_enter("unpack_trees", "traverse_trees", the_repository);
+		o->internal.tree_prefetch = start_tree_prefetch(o, len, t);
 		ret = traverse_trees(o->src_index, len, t, &info);
+		tree_prefetch_stop(o->internal.tree_prefetch);
+		o->internal.tree_prefetch = NULL;
 		trace2_region_leave("unpack_trees", "traverse_trees", the_repository);
 		trace_performance_leave("traverse_trees");
 		if (ret < 0)
@@ -12,6 +12,7 @@
 struct cache_entry;
 struct unpack_trees_options;
 struct pattern_list;
+struct tree_prefetch;
 
 typedef int (*merge_fn_t)(const struct cache_entry * const *src,
 		struct unpack_trees_options *options);
@@ -107,6 +108,7 @@ struct unpack_trees_options {
 
 		struct pattern_list *pl;
 		struct dir_struct *dir;
+		struct tree_prefetch *tree_prefetch;
 	} internal;
 };
 
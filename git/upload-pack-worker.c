@@ -0,0 +1,548 @@
+#define USE_THE_REPOSITORY_VARIABLE
+
+#include "git-compat-util.h"
+#include "abspath.h"
+#include "commit-graph.h"
+#include "environment.h"
+#include "gettext.h"
+#include "hash.h"
+#include "hex.h"
+#include "object-store-ll.h"
+#include "packfile.h"
+#include "protocol.h"
+#include "repo-settings.h"
+#include "repository.h"
+#include "run-command.h"
+#include "statinfo.h"
+#include "strbuf.h"
+#include "strvec.h"
+#include "trace2.h"
+#include "unix-socket.h"
+#include "unix-stream-server.h"
+#include "upload-pack-worker.h"
+
+/*
+ * How long a front-end waits for a freshly spawned worker to start
+ * listening before it gives up and runs upload-pack itself.
+ */
+#define WORKER_SPAWN_TIMEOUT_MS (2000)
+#define WORKER_SPAWN_POLL_MS (10)
+
+/* Upper bound on the size of a request header, to catch garbage early. */
+#define WORKER_MAX_REQUEST (64 * 1024)
+
+/*
+ * The variables a front-end may set for a single request.  Anything
+ * else in a request is refused, so that whoever can reach the socket
+ * cannot point the worker's children at other config, hooks or object
+ * directories.
+ */
+static const char *forwarded_env[] = {
+	GIT_PROTOCOL_ENVIRONMENT,
+	"GIT_COMMITTER_NAME",
+	"GIT_COMMITTER_EMAIL",
+	"REMOTE_ADDR",
+	"REMOTE_PORT",
+};
+
+static int is_forwarded_env(const char *entry)
+{
+	const char *eq = strchr(entry, '=');
+
+	if (!eq)
+		return 0;
+	for (size_t i = 0; i < ARRAY_SIZE(forwarded_env); i++)
+		if (strlen(forwarded_env[i]) == eq - entry &&
+		    !strncmp(entry, forwarded_env[i], eq - entry))
+			return 1;
+	return 0;
+}
+
+/*
+ * Make sure `dir` is a directory only we can get into, creating it if
+ * needed.  Anybody who can reach a worker socket gets repository data
+ * served with our permissions, so a directory that is a symlink, owned
+ * by somebody else or accessible to group or others is refused.
+ */
+static int check_socket_dir(const char *dir)
+{
+	struct stat st;
+
+	if (mkdir(dir, 0700) < 0 && errno != EEXIST)
+		return error_errno(_("unable to create upload-pack worker directory '%s'"),
+				   dir);
+	if (lstat(dir, &st) < 0)
+		return error_errno(_("unable to stat '%s'"), dir);
+	if (!S_ISDIR(st.st_mode) || st.st_uid != geteuid() ||
+	    (st.st_mode & 077))
+		return error(_("upload-pack worker directory '%s' must be a "
+			       "directory owned by us with mode 0700"), dir);
+	return 0;
+}
+
+void upload_pack_worker_socket_path(struct strbuf *out, const char *socket_dir)
+{
+	struct strbuf gitdir = STRBUF_INIT;
+	git_SHA_CTX ctx;
+	unsigned char hash[GIT_SHA1_RAWSZ];
+
+	strbuf_realpath(&gitdir, ".", 1);
+	git_SHA1_Init(&ctx);
+	git_SHA1_Update(&ctx, gitdir.buf, gitdir.len);
+	git_SHA1_Final(hash, &ctx);
+
+	strbuf_reset(out);
+	strbuf_addstr(out, socket_dir);
+	strbuf_complete(out, '/');
+	strbuf_addf(out, "upload-pack-%s",
+		    hash_to_hex_algop(hash, &hash_algos[GIT_HASH_SHA1]));
+	strbuf_release(&gitdir);
+}
+
+/*
+ * Send the descriptors `in`, `out` and our stderr along with the 4-byte
+ * length of the request header that follows them on the stream.
+ */
+static int send_fds(int sock, int in, int out, uint32_t len)
+{
+	struct msghdr msg = { 0 };
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	union {
+		char buf[CMSG_SPACE(3 * sizeof(int))];
+		struct cmsghdr align;
+	} u;
+	int fds[3] = { in, out, 2 };
+	uint32_t nlen = htonl(len);
+
+	memset(&u, 0, sizeof(u));
+	iov.iov_base = &nlen;
+	iov.iov_len = sizeof(nlen);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = u.buf;
+	msg.msg_controllen = sizeof(u.buf);
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+	return sendmsg(sock, &msg, 0) == sizeof(nlen) ? 0 : -1;
+}
+
+/*
+ * The counterpart of send_fds().  Returns 0 on success, 1 on EOF (e.g.
+ * a liveness probe from unix_ss_create()), and -1 on error.
+ */
+static int recv_fds(int sock, int fds[3], uint32_t *len)
+{
+	struct msghdr msg = { 0 };
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	union {
+		char buf[CMSG_SPACE(3 * sizeof(int))];
+		struct cmsghdr align;
+	} u;
+	uint32_t nlen;
+	ssize_t got;
+
+	iov.iov_base = &nlen;
+	iov.iov_len = sizeof(nlen);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = u.buf;
+	msg.msg_controllen = sizeof(u.buf);
+
+	do {
+		got = recvmsg(sock, &msg, 0);
+	} while (got < 0 && errno == EINTR);
+	if (!got)
+		return 1;
+	if (got != sizeof(nlen))
+		return -1;
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if (!cmsg || cmsg->cmsg_level != SOL_SOCKET ||
+	    cmsg->cmsg_type != SCM_RIGHTS ||
+	    cmsg->cmsg_len != CMSG_LEN(3 * sizeof(int)))
+		return -1;
+
+	memcpy(fds, CMSG_DATA(cmsg), 3 * sizeof(int));
+	*len = ntohl(nlen);
+	return 0;
+}
+
+/*
+ * The request header is a sequence of NUL-terminated strings: the
+ * upload-pack arguments, an empty string, and the environment.
+ */
+static void encode_request(struct strbuf *buf, const struct strvec *args,
+			   const struct strvec *env)
+{
+	for (size_t i = 0; i < args->nr; i++)
+		strbuf_add(buf, args->v[i], strlen(args->v[i]) + 1);
+	strbuf_addch(buf, '\0');
+	for (size_t i = 0; i < env->nr; i++)
+		strbuf_add(buf, env->v[i], strlen(env->v[i]) + 1);
+}
+
+static int decode_request(const char *buf, size_t len,
+			  struct strvec *args, struct strvec *env)
+{
+	const char *end = buf + len;
+	struct strvec *dst = args;
+
+	if (len && end[-1])
+		return -1;
+	while (buf < end) {
+		size_t n = strlen(buf);
+
+		if (!n && dst == args)
+			dst = env;
+		else if (!n || (dst == env && !is_forwarded_env(buf)))
+			return -1;
+		else
+			strvec_push(dst, buf);
+		buf += n + 1;
+	}
+	return dst == env ? 0 : -1;
+}
+
+static int spawn_worker(const char *socket_path)
+{
+	struct child_process cp = CHILD_PROCESS_INIT;
+
+	cp.git_cmd = 1;
+	cp.no_stdin = 1;
+	cp.no_stdout = 1;
+	cp.no_stderr = 1;
+	/* these are per-request and must not stick to the worker */
+	strvec_pushl(&cp.env, GIT_PROTOCOL_ENVIRONMENT,
+		     GIT_NAMESPACE_ENVIRONMENT, NULL);
+	strvec_pushl(&cp.args, "upload-pack", "--strict", NULL);
+	strvec_pushf(&cp.args, "--worker=%s", socket_path);
+	strvec_push(&cp.args, ".");
+
+	/*
+	 * The worker outlives us by design; it is reparented when we
+	 * exit and never waited for.
+	 */
+	return start_command(&cp);
+}
+
+static int connect_worker(const char *socket_path)
+{
+	int fd = unix_stream_connect(socket_path, 0);
+
+	if (fd < 0 && (errno == ENOENT || errno == ECONNREFUSED) &&
+	    !spawn_worker(socket_path)) {
+		int waited = 0;
+
+		while (fd < 0 && waited < WORKER_SPAWN_TIMEOUT_MS) {
+			sleep_millisec(WORKER_SPAWN_POLL_MS);
+			waited += WORKER_SPAWN_POLL_MS;
+			fd = unix_stream_connect(socket_path, 0);
+		}
+	}
+	return fd;
+}
+
+int upload_pack_worker_start(const char *socket_dir,
+			     const struct strvec *args,
+			     const struct strvec *env,
+			     int in, int out)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct strbuf req = STRBUF_INIT;
+	char ack;
+	int fd = -1;
+
+	/*
+	 * The namespace is resolved once per process, so a worker could
+	 * not serve requests for different namespaces.
+	 */
+	if (getenv(GIT_NAMESPACE_ENVIRONMENT))
+		goto out;
+
+	if (check_socket_dir(socket_dir) < 0)
+		goto out;
+	upload_pack_worker_socket_path(&path, socket_dir);
+	fd = connect_worker(path.buf);
+	if (fd < 0)
+		goto out;
+
+	/*
+	 * The worker acknowledges the request once it has taken it on.
+	 * Without that, e.g. because the worker retired while we were
+	 * queued, the descriptors are still ours to serve.
+	 */
+	encode_request(&req, args, env);
+	if (send_fds(fd, in, out, req.len) < 0 ||
+	    write_in_full(fd, req.buf, req.len) < 0 ||
+	    read_in_full(fd, &ack, 1) != 1) {
+		close(fd);
+		fd = -1;
+	}
+
+out:
+	trace2_data_intmax("upload-pack-worker", NULL, "handoff", fd >= 0);
+	strbuf_release(&req);
+	strbuf_release(&path);
+	return fd;
+}
+
+int upload_pack_worker_finish(int conn)
+{
+	uint32_t code;
+
+	/*
+	 * The worker reports the exit code of the child serving us once
+	 * it is done; if the worker itself went away, we only see EOF.
+	 */
+	if (read_in_full(conn, &code, sizeof(code)) != sizeof(code))
+		code = htonl(128);
+	close(conn);
+	return ntohl(code);
+}
+
+/*
+ * The on-disk state a worker has warmed up.  When any of these paths
+ * changes the worker retires, so that repacks, commit-graph rewrites and
+ * config edits are picked up by its successor.
+ */
+static const char *stamp_paths[] = {
+	"config",
+	"objects/pack",
+	"objects/info/alternates",
+	"objects/info/commit-graph",
+	"objects/info/commit-graphs",
+};
+
+struct worker_stamp {
+	struct stat_data sd[ARRAY_SIZE(stamp_paths)];
+	unsigned missing[ARRAY_SIZE(stamp_paths)];
+};
+
+static void stamp_fill(struct worker_stamp *stamp)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(stamp_paths); i++) {
+		struct stat st;
+
+		stamp->missing[i] = !!stat(stamp_paths[i], &st);
+		if (!stamp->missing[i])
+			fill_stat_data(&stamp->sd[i], &st);
+	}
+}
+
+static int stamp_changed(const struct worker_stamp *stamp)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(stamp_paths); i++) {
+		struct stat st;
+		int missing = !!stat(stamp_paths[i], &st);
+
+		if (missing != stamp->missing[i] ||
+		    (!missing && match_stat_data(&stamp->sd[i], &st)))
+			return 1;
+	}
+	return 0;
+}
+
+static void warm_repository(struct repository *r)
+{
+	prepare_repo_settings(r);
+	get_all_packs(r);
+	generation_numbers_enabled(r);
+}
+
+static NORETURN void serve_child(int conn, const int fds[3],
+				 const struct strvec *args,
+				 const struct strvec *env,
+				 upload_pack_worker_fn fn)
+{
+	close(conn);
+	signal(SIGCHLD, SIG_DFL);
+	for (int i = 0; i < 3; i++)
+		if (dup2(fds[i], i) < 0)
+			exit(128);
+	for (int i = 0; i < 3; i++)
+		if (fds[i] > 2)
+			close(fds[i]);
+
+	unsetenv(GIT_PROTOCOL_ENVIRONMENT);
+	for (size_t i = 0; i < env->nr; i++) {
+		const char *eq = strchr(env->v[i], '=');
+		char *name;
+
+		/* decode_request() only lets through "NAME=value" */
+		if (!eq)
+			BUG("malformed worker environment '%s'", env->v[i]);
+		name = xstrndup(env->v[i], eq - env->v[i]);
+		setenv(name, eq + 1, 1);
+		free(name);
+	}
+
+	exit(fn(args));
+}
+
+/*
+ * A request being served by a child.  The worker holds on to the
+ * connection so that it can report the child's exit code, which also
+ * covers children that exit() from deep within upload-pack.
+ */
+struct worker_child {
+	pid_t pid;
+	int conn;
+};
+
+struct worker_children {
+	struct worker_child *items;
+	size_t nr, alloc;
+};
+
+/*
+ * Read a request from `conn` and fork a child to serve it.
+ */
+static void handle_connection(int conn, upload_pack_worker_fn fn, int stale,
+			      struct worker_children *children)
+{
+	struct strvec args = STRVEC_INIT, env = STRVEC_INIT;
+	struct strbuf req = STRBUF_INIT;
+	int fds[3] = { -1, -1, -1 };
+	uint32_t len;
+	pid_t pid = -1;
+
+	if (recv_fds(conn, fds, &len) ||
+	    len > WORKER_MAX_REQUEST)
+		goto done;
+	strbuf_grow(&req, len);
+	if (read_in_full(conn, req.buf, len) != len)
+		goto done;
+	strbuf_setlen(&req, len);
+	if (decode_request(req.buf, req.len, &args, &env) ||
+	    write_in_full(conn, "", 1) < 0)
+		goto done;
+
+	pid = fork();
+	if (pid < 0) {
+		error_errno("fork");
+	} else if (!pid) {
+		if (stale)
+			reprepare_packed_git(the_repository);
+		serve_child(conn, fds, &args, &env, fn);
+	} else {
+		ALLOC_GROW(children->items, children->nr + 1, children->alloc);
+		children->items[children->nr].pid = pid;
+		children->items[children->nr].conn = conn;
+		children->nr++;
+	}
+
+done:
+	for (int i = 0; i < 3; i++)
+		if (fds[i] >= 0)
+			close(fds[i]);
+	if (pid <= 0)
+		close(conn);
+	strbuf_release(&req);
+	strvec_clear(&args);
+	strvec_clear(&env);
+}
+
+static void reap_children(struct worker_children *children, int block)
+{
+	int status;
+	pid_t pid;
+
+	while (children->nr &&
+	       (pid = waitpid(-1, &status, block ? 0 : WNOHANG)) > 0) {
+		for (size_t i = 0; i < children->nr; i++) {
+			uint32_t code;
+
+			if (children->items[i].pid != pid)
+				continue;
+
+			if (WIFEXITED(status))
+				code = htonl(WEXITSTATUS(status));
+			else
+				code = htonl(128 + WTERMSIG(status));
+			write_in_full(children->items[i].conn,
+				      &code, sizeof(code));
+			close(children->items[i].conn);
+			children->items[i] = children->items[--children->nr];
+			break;
+		}
+	}
+}
+
+static void child_handler(int signo UNUSED)
+{
+	/* only here to interrupt poll() */
+	signal(SIGCHLD, child_handler);
+}
+
+int upload_pack_worker_run(const char *socket_path, unsigned int idle_timeout,
+			   upload_pack_worker_fn fn)
+{
+	struct unix_stream_listen_opts opts = UNIX_STREAM_LISTEN_OPTS_INIT;
+	struct unix_ss_socket *server;
+	struct worker_children children = { 0 };
+	struct worker_stamp stamp;
+	uint64_t idle_ms = 0;
+	int stale = 0;
+	char *socket_dir = xstrdup(socket_path);
+
+	if (check_socket_dir(dirname(socket_dir)) < 0) {
+		free(socket_dir);
+		return -1;
+	}
+	free(socket_dir);
+
+	warm_repository(the_repository);
+	stamp_fill(&stamp);
+
+	if (unix_ss_create(socket_path, &opts, -1, &server) < 0)
+		return -1;
+	signal(SIGCHLD, child_handler);
+	trace2_region_enter("upload-pack-worker", "serve", the_repository);
+
+	while (!stale && (!idle_timeout || idle_ms < idle_timeout * 1000ull)) {
+		struct pollfd pfd;
+		int wait_ms = children.nr ? 100 : 1000;
+		int conn;
+
+		reap_children(&children, 0);
+		if (unix_ss_was_stolen(server))
+			break;
+
+		pfd.fd = server->fd_socket;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, wait_ms) <= 0) {
+			if (!children.nr)
+				idle_ms += wait_ms;
+			continue;
+		}
+
+		conn = accept(server->fd_socket, NULL, NULL);
+		if (conn < 0)
+			continue;
+		idle_ms = 0;
+
+		/*
+		 * Stop accepting once our view of the repository is out of
+		 * date; the current request is still served after picking
+		 * up new packs.
+		 */
+		stale = stamp_changed(&stamp);
+		if (stale)
+			trace2_data_string("upload-pack-worker", the_repository,
+					   "retire", "stale");
+		handle_connection(conn, fn, stale, &children);
+	}
+
+	unix_ss_free(server);
+	reap_children(&children, 1);
+	free(children.items);
+	trace2_region_leave("upload-pack-worker", "serve", the_repository);
+	return 0;
+}
@@ -0,0 +1,72 @@
+#ifndef UPLOAD_PACK_WORKER_H
+#define UPLOAD_PACK_WORKER_H
+
+struct strbuf;
+struct strvec;
+
+/*
+ * Upload-pack workers are long-lived `git upload-pack --worker=<socket>`
+ * processes, one per repository, that keep the repository's config,
+ * packfile list, multi-pack-index, commit-graph and packed-refs loaded
+ * between requests.  Front-ends like git-daemon and git-http-backend
+ * hand a client connection to the worker by passing its file descriptors
+ * over a Unix domain socket; the worker forks a child that inherits the
+ * warm state and serves the request on those descriptors.
+ *
+ * Workers live below a socket directory chosen by the front-end.  It is
+ * created with mode 0700 if missing, and both sides refuse to use it
+ * unless it is a directory owned by the current user that nobody else
+ * can enter.  Requests may only set the few environment variables that
+ * git-daemon and git-http-backend forward, like GIT_PROTOCOL.  A worker
+ * exits after it has been idle for a while, or once it notices that the
+ * packs, commit-graph or config of its repository have changed; the next
+ * request then starts a fresh one.
+ */
+
+/*
+ * Compute the path of the worker socket in `socket_dir` serving the
+ * repository in the current working directory.
+ */
+void upload_pack_worker_socket_path(struct strbuf *out, const char *socket_dir);
+
+/*
+ * Hand `in`, `out` and our stderr over to the upload-pack worker of the
+ * repository in the current working directory, starting one if none is
+ * listening yet.  `args` holds `git upload-pack` options (e.g.
+ * "--stateless-rpc") and `env` "NAME=value" pairs to apply for this
+ * request only.
+ *
+ * Returns a connection to be passed to upload_pack_worker_finish(), or
+ * -1 if no worker could be reached, in which case the caller should run
+ * upload-pack itself.  The caller may close `in` and `out` on success.
+ */
+int upload_pack_worker_start(const char *socket_dir,
+			     const struct strvec *args,
+			     const struct strvec *env,
+			     int in, int out);
+
+/*
+ * Wait for the request handed to a worker to complete and return its
+ * exit code.
+ */
+int upload_pack_worker_finish(int conn);
+
+/*
+ * Serve one request forwarded by upload_pack_worker_start().  Called in a
+ * child process of the worker with stdin, stdout and stderr already
+ * connected to the front-end, and returns the exit code to report back.
+ */
+typedef int (*upload_pack_worker_fn)(const struct strvec *args);
+
+/*
+ * Listen on `socket_path` and serve requests for the repository in the
+ * current working directory with `fn` until the worker has been idle for
+ * `idle_timeout` seconds or its repository has changed underneath it.
+ *
+ * Returns 0 on a clean exit, and -1 if the socket could not be created
+ * (for example because another worker already owns it).
+ */
+int upload_pack_worker_run(const char *socket_path, unsigned int idle_timeout,
+			   upload_pack_worker_fn fn);
+
+#endif /* UPLOAD_PACK_WORKER_H */